@@ -0,0 +1,289 @@
+/*  =========================================================================
+    asset_info - Cached asset attributes used for rule matching
+
+    Copyright (C) 2016 - 2017 Tomas Halman
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+/*
+@header
+    asset_info - Cached asset attributes used for rule matching
+@discuss
+    Agent keeps one asset_info for every active asset it has seen, so new
+    or changed rules can be matched against known assets without asking
+    asset-agent to republish them. All strings live in one buffer.
+@end
+*/
+
+#include "fty_alert_flexible_classes.h"
+
+//  Structure of our class
+
+struct _asset_info_t {
+    const char *name;
+    const char *ename;          //  NULL if asset has no friendly name
+    const char *type;
+    const char *subtype;
+    const char *model;
+    const char *device_part;
+    const char *groups;         //  group names, each one zero terminated
+    size_t groups_count;
+    const char *cursor;         //  group iterator
+    size_t cursor_index;
+    char *buffer;               //  storage for all strings above
+};
+
+//  --------------------------------------------------------------------------
+//  Copy string to buffer, return pointer to the copy
+
+static const char *
+s_store (char **p, const char *string)
+{
+    char *copy = *p;
+    size_t len = strlen (string);
+    memcpy (copy, string, len + 1);
+    *p += len + 1;
+    return copy;
+}
+
+//  --------------------------------------------------------------------------
+//  Create a new asset_info from fty_proto ASSET message. Only attributes
+//  needed for rule matching are kept.
+
+asset_info_t *
+asset_info_new (fty_proto_t *ftymsg)
+{
+    assert (ftymsg);
+
+    const char *name = fty_proto_name (ftymsg);
+    const char *ename = fty_proto_ext_string (ftymsg, "name", NULL);
+    const char *type = fty_proto_aux_string (ftymsg, FTY_PROTO_ASSET_AUX_TYPE, "");
+    const char *subtype = fty_proto_aux_string (ftymsg, FTY_PROTO_ASSET_AUX_SUBTYPE, "");
+    const char *model = fty_proto_ext_string (ftymsg, FTY_PROTO_ASSET_EXT_MODEL, "");
+    const char *device_part = fty_proto_ext_string (ftymsg, FTY_PROTO_ASSET_EXT_DEVICE_PART, "");
+
+    //  first pass: compute buffer size
+    size_t size = strlen (name) + 1
+        + (ename ? strlen (ename) + 1 : 0)
+        + strlen (type) + 1
+        + strlen (subtype) + 1
+        + strlen (model) + 1
+        + strlen (device_part) + 1;
+
+    zhash_t *ext = fty_proto_ext (ftymsg);
+    const char *group = ext ? (const char *) zhash_first (ext) : NULL;
+    while (group) {
+        if (strncmp ("group.", zhash_cursor (ext), 6) == 0)
+            size += strlen (group) + 1;
+        group = (const char *) zhash_next (ext);
+    }
+
+    asset_info_t *self = (asset_info_t *) zmalloc (sizeof (asset_info_t));
+    assert (self);
+    self->buffer = (char *) zmalloc (size);
+    assert (self->buffer);
+
+    //  second pass: fill the buffer
+    char *p = self->buffer;
+    self->name = s_store (&p, name);
+    self->ename = ename ? s_store (&p, ename) : NULL;
+    self->type = s_store (&p, type);
+    self->subtype = s_store (&p, subtype);
+    self->model = s_store (&p, model);
+    self->device_part = s_store (&p, device_part);
+    self->groups = p;
+    group = ext ? (const char *) zhash_first (ext) : NULL;
+    while (group) {
+        if (strncmp ("group.", zhash_cursor (ext), 6) == 0) {
+            s_store (&p, group);
+            self->groups_count++;
+        }
+        group = (const char *) zhash_next (ext);
+    }
+    return self;
+}
+
+//  --------------------------------------------------------------------------
+//  Destroy the asset_info
+
+void
+asset_info_destroy (asset_info_t **self_p)
+{
+    assert (self_p);
+    if (*self_p) {
+        asset_info_t *self = *self_p;
+        //  Free class properties here
+        free (self->buffer);
+        //  Free object itself
+        free (self);
+        *self_p = NULL;
+    }
+}
+
+//  --------------------------------------------------------------------------
+//  Get asset (internal) name
+
+const char *
+asset_info_name (asset_info_t *self)
+{
+    assert (self);
+    return self->name;
+}
+
+//  --------------------------------------------------------------------------
+//  Get asset friendly name, NULL if not known
+
+const char *
+asset_info_ename (asset_info_t *self)
+{
+    assert (self);
+    return self->ename;
+}
+
+//  --------------------------------------------------------------------------
+//  Get asset type, empty string if not known
+
+const char *
+asset_info_type (asset_info_t *self)
+{
+    assert (self);
+    return self->type;
+}
+
+//  --------------------------------------------------------------------------
+//  Get asset subtype, empty string if not known
+
+const char *
+asset_info_subtype (asset_info_t *self)
+{
+    assert (self);
+    return self->subtype;
+}
+
+//  --------------------------------------------------------------------------
+//  Get asset model, empty string if not known
+
+const char *
+asset_info_model (asset_info_t *self)
+{
+    assert (self);
+    return self->model;
+}
+
+//  --------------------------------------------------------------------------
+//  Get asset device part, empty string if not known
+
+const char *
+asset_info_device_part (asset_info_t *self)
+{
+    assert (self);
+    return self->device_part;
+}
+
+//  --------------------------------------------------------------------------
+//  Return the first group. If there are no groups, returns NULL.
+
+const char *
+asset_info_group_first (asset_info_t *self)
+{
+    assert (self);
+    self->cursor = self->groups;
+    self->cursor_index = 0;
+    return self->groups_count ? self->cursor : NULL;
+}
+
+//  --------------------------------------------------------------------------
+//  Return the next group. If there are no (more) groups, returns NULL.
+
+const char *
+asset_info_group_next (asset_info_t *self)
+{
+    assert (self);
+    if (!self->cursor || self->cursor_index + 1 >= self->groups_count)
+        return NULL;
+    self->cursor += strlen (self->cursor) + 1;
+    self->cursor_index++;
+    return self->cursor;
+}
+
+//  --------------------------------------------------------------------------
+//  Self test of this class
+
+void
+asset_info_test (bool verbose)
+{
+    printf (" * asset_info: ");
+
+    //  @selftest
+    {
+        zhash_t *aux = zhash_new ();
+        zhash_autofree (aux);
+        zhash_insert (aux, FTY_PROTO_ASSET_AUX_TYPE, (void *) "device");
+        zhash_insert (aux, FTY_PROTO_ASSET_AUX_SUBTYPE, (void *) "ups");
+        zhash_t *ext = zhash_new ();
+        zhash_autofree (ext);
+        zhash_insert (ext, "name", (void *) "My UPS");
+        zhash_insert (ext, "group.1", (void *) "all-upses");
+        zhash_insert (ext, "group.2", (void *) "room-1");
+        zhash_insert (ext, FTY_PROTO_ASSET_EXT_MODEL, (void *) "9PX");
+        zmsg_t *msg = fty_proto_encode_asset (aux, "ups-1", FTY_PROTO_ASSET_OP_UPDATE, ext);
+        fty_proto_t *ftymsg = fty_proto_decode (&msg);
+        assert (ftymsg);
+
+        asset_info_t *self = asset_info_new (ftymsg);
+        assert (self);
+        fty_proto_destroy (&ftymsg);
+
+        assert (streq (asset_info_name (self), "ups-1"));
+        assert (streq (asset_info_ename (self), "My UPS"));
+        assert (streq (asset_info_type (self), "device"));
+        assert (streq (asset_info_subtype (self), "ups"));
+        assert (streq (asset_info_model (self), "9PX"));
+        assert (streq (asset_info_device_part (self), ""));
+
+        int groups = 0;
+        bool upses = false, room = false;
+        const char *group = asset_info_group_first (self);
+        while (group) {
+            if (streq (group, "all-upses")) upses = true;
+            if (streq (group, "room-1")) room = true;
+            groups++;
+            group = asset_info_group_next (self);
+        }
+        assert (groups == 2 && upses && room);
+
+        asset_info_destroy (&self);
+        assert (self == NULL);
+        zhash_destroy (&aux);
+        zhash_destroy (&ext);
+    }
+    {
+        //  asset without optional attributes
+        zmsg_t *msg = fty_proto_encode_asset (NULL, "sensor-1", FTY_PROTO_ASSET_OP_INVENTORY, NULL);
+        fty_proto_t *ftymsg = fty_proto_decode (&msg);
+        asset_info_t *self = asset_info_new (ftymsg);
+        fty_proto_destroy (&ftymsg);
+        assert (streq (asset_info_name (self), "sensor-1"));
+        assert (asset_info_ename (self) == NULL);
+        assert (streq (asset_info_model (self), ""));
+        assert (asset_info_group_first (self) == NULL);
+        assert (asset_info_group_next (self) == NULL);
+        asset_info_destroy (&self);
+    }
+    //  @end
+    printf ("OK\n");
+}
@@ -0,0 +1,87 @@
+/*  =========================================================================
+    asset_info - Cached asset attributes used for rule matching
+
+    Copyright (C) 2016 - 2017 Tomas Halman
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+#ifndef ASSET_INFO_H_INCLUDED
+#define ASSET_INFO_H_INCLUDED
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//  Opaque class structures to allow forward references
+#ifndef ASSET_INFO_T_DEFINED
+typedef struct _asset_info_t asset_info_t;
+#define ASSET_INFO_T_DEFINED
+#endif
+
+//  @interface
+//  Create a new asset_info from fty_proto ASSET message. Only attributes
+//  needed for rule matching are kept.
+FTY_ALERT_FLEXIBLE_PRIVATE asset_info_t *
+    asset_info_new (fty_proto_t *ftymsg);
+
+//  Destroy the asset_info
+FTY_ALERT_FLEXIBLE_PRIVATE void
+    asset_info_destroy (asset_info_t **self_p);
+
+//  Get asset (internal) name
+FTY_ALERT_FLEXIBLE_PRIVATE const char *
+    asset_info_name (asset_info_t *self);
+
+//  Get asset friendly name, NULL if not known
+FTY_ALERT_FLEXIBLE_PRIVATE const char *
+    asset_info_ename (asset_info_t *self);
+
+//  Get asset type, empty string if not known
+FTY_ALERT_FLEXIBLE_PRIVATE const char *
+    asset_info_type (asset_info_t *self);
+
+//  Get asset subtype, empty string if not known
+FTY_ALERT_FLEXIBLE_PRIVATE const char *
+    asset_info_subtype (asset_info_t *self);
+
+//  Get asset model, empty string if not known
+FTY_ALERT_FLEXIBLE_PRIVATE const char *
+    asset_info_model (asset_info_t *self);
+
+//  Get asset device part, empty string if not known
+FTY_ALERT_FLEXIBLE_PRIVATE const char *
+    asset_info_device_part (asset_info_t *self);
+
+//  Return the first group. If there are no groups, returns NULL.
+FTY_ALERT_FLEXIBLE_PRIVATE const char *
+    asset_info_group_first (asset_info_t *self);
+
+//  Return the next group. If there are no (more) groups, returns NULL.
+FTY_ALERT_FLEXIBLE_PRIVATE const char *
+    asset_info_group_next (asset_info_t *self);
+
+//  Self test of this class
+FTY_ALERT_FLEXIBLE_PRIVATE void
+    asset_info_test (bool verbose);
+
+//  @end
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
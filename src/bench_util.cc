@@ -0,0 +1,98 @@
+/*  =========================================================================
+    bench_util - Measurements shared by benchmarks
+
+    Copyright (C) 2016 - 2017 Tomas Halman
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+/*
+@header
+    bench_util - Measurements shared by benchmarks
+@discuss
+    Built into benchmark programs only, never into the library: with glibc,
+    malloc, calloc and realloc of the whole process (engine, czmq and lua
+    included) are interposed to count heap allocations.
+@end
+*/
+
+#include "fty_alert_flexible_classes.h"
+#include "bench_util.h"
+#include <time.h>
+
+static uint64_t s_allocs;
+static uint64_t s_alloc_bytes;
+
+#if BENCH_ALLOCS
+extern "C" {
+void *__libc_malloc (size_t size);
+void *__libc_calloc (size_t count, size_t size);
+void *__libc_realloc (void *ptr, size_t size);
+
+void *
+malloc (size_t size) __THROW
+{
+    __atomic_add_fetch (&s_allocs, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch (&s_alloc_bytes, size, __ATOMIC_RELAXED);
+    return __libc_malloc (size);
+}
+
+void *
+calloc (size_t count, size_t size) __THROW
+{
+    __atomic_add_fetch (&s_allocs, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch (&s_alloc_bytes, count * size, __ATOMIC_RELAXED);
+    return __libc_calloc (count, size);
+}
+
+void *
+realloc (void *ptr, size_t size) __THROW
+{
+    __atomic_add_fetch (&s_allocs, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch (&s_alloc_bytes, size, __ATOMIC_RELAXED);
+    return __libc_realloc (ptr, size);
+}
+}
+#endif
+
+//  --------------------------------------------------------------------------
+//  Number of heap allocations of the process so far
+
+uint64_t
+bench_allocs (void)
+{
+    return __atomic_load_n (&s_allocs, __ATOMIC_RELAXED);
+}
+
+//  --------------------------------------------------------------------------
+//  Bytes requested by heap allocations of the process so far
+
+uint64_t
+bench_alloc_bytes (void)
+{
+    return __atomic_load_n (&s_alloc_bytes, __ATOMIC_RELAXED);
+}
+
+//  --------------------------------------------------------------------------
+//  Monotonic time [ns]
+
+uint64_t
+bench_nsecs (void)
+{
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
@@ -0,0 +1,46 @@
+/*  =========================================================================
+    bench_util - Measurements shared by benchmarks
+
+    Copyright (C) 2016 - 2017 Tomas Halman
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+#ifndef BENCH_UTIL_H_INCLUDED
+#define BENCH_UTIL_H_INCLUDED
+
+#include <stdint.h>
+
+//  Heap allocations are counted with glibc only
+#if defined (__GLIBC__)
+#define BENCH_ALLOCS 1
+#else
+#define BENCH_ALLOCS 0
+#endif
+
+//  Number of heap allocations of the process so far
+uint64_t
+    bench_allocs (void);
+
+//  Bytes requested by heap allocations of the process so far
+uint64_t
+    bench_alloc_bytes (void);
+
+//  Monotonic time [ns]
+uint64_t
+    bench_nsecs (void);
+
+#endif
@@ -27,7 +27,9 @@
 */
 
 #include "fty_alert_flexible_classes.h"
-
+#include <inttypes.h>
+#include <math.h>
+#include <sys/utsname.h>
 
 #define ANSI_COLOR_WHITE_ON_BLUE  "\x1b[44;97m"
 #define ANSI_COLOR_BOLD    "\x1b[1;39m"
@@ -36,17 +38,73 @@
 #define ANSI_COLOR_CYAN    "\x1b[1;36m"
 #define ANSI_COLOR_RESET   "\x1b[0m"
 
+#define REPUBLISH_INTERVAL      1000    //  flush of pending REPUBLISH requests [ms]
+#define GC_IDLE_INTERVAL        100     //  idle time before lua garbage collection [ms]
+#define REPUBLISH_BACKOFF_MIN   5000    //  first retry for unknown asset [ms]
+#define REPUBLISH_BACKOFF_MAX   300000  //  maximal retry delay [ms]
+#define REPUBLISH_EXPIRY        3600000 //  unknown asset not asked for is forgotten [ms]
+#define MAILBOX_WEIGHT          16      //  mailbox requests served in one round
+#define ASSET_WEIGHT            64      //  asset updates handled in one round
+#define METRIC_WEIGHT           256     //  metrics handled in one round
+#define INGRESS_CAPACITY        10000   //  pending metric subjects, newer are dropped
+#define INGRESS_BATCH           4096    //  metrics moved to ingress queue in one round
+#define DEFERRED_TICK           100     //  granularity of deferred evaluations [ms]
+#define DEFERRED_SLOTS          512     //  slots of deferred evaluations wheel
+#define SHARD_SUBJECT           "SHARD"             //  rule change replicated by other shard
+#define SHARD_INCOMPLETE        "SHARD-INCOMPLETE"  //  dtto, rule from fty-autoconfig
+#define SHARD_REPLY             "SHARD-REPLY"       //  reply to replicated rule change
+
 //  Structure of our class
 
 struct _flexible_alert_t {
-    zhash_t *rules;
+    ruleset_t *rules;           //  published rules, never changed in place
+    zhash_t *templates;         //  template name -> template rule
     zhash_t *assets;
-    zhash_t *metrics;
-    zhash_t *enames;
-    mlm_client_t *mlm;
+    zhash_t *metrics;           //  "quantity@asset" -> cached_metric_t
+    zhash_t *asset_infos;       //  attributes of all known active assets
+    republish_queue_t *republish;
+    zhash_t *rule_files;        //  rule file name -> rule name
+    rule_store_t *store;        //  rule journal, NULL for one file per rule
+    zhash_t *alerts;            //  "rule@asset" -> last published alert
+    zhash_t *evaluated;         //  "rule@asset" -> last evaluation of rule with min interval
+    timer_wheel_t *deferred;    //  "rule@asset" waiting for trailing evaluation
+    int min_interval;           //  default of rules without min_interval [ms]
+    mlm_client_t *mlm;          //  mailbox requests and published alerts
+    mlm_client_t *asset_stream; //  consumer of asset stream
+    mlm_client_t *metric_stream;    //  consumer of metric streams
+    metric_queue_t *ingress;    //  latest pending metric of every subject
+    shard_map_t *shards;        //  share of assets of this instance, NULL if not sharded
+    flexible_alert_clock_fn *clock; //  current time, NULL for time (NULL)
+    void *clock_arg;
+    flexible_alert_sink_fn *sink;   //  receiver of alerts, NULL to publish them
+    void *sink_arg;
+    input_log_t *recorder;      //  log of received input, NULL if not recorded
 };
 
-static void rule_freefn (void *rule)
+//  Last alert published for rule and asset
+typedef struct {
+    int result;
+    time_t time;
+} published_alert_t;
+
+//  Metric in cache, value is converted to number once when metric comes
+typedef struct {
+    fty_proto_t *msg;
+    double number;              //  value as rule_threshold_number gives it, NAN if not a number
+} cached_metric_t;
+
+//  Values of one rule collected from shm poll cycle
+typedef struct {
+    rule_t *rule;
+    bool numeric;               //  rule can be classified in batch
+    size_t count;
+    size_t capacity;
+    double *values;
+    char **assets;
+    int *ttls;
+} metric_batch_t;
+
+static void template_freefn (void *rule)
 {
     if (rule) {
         rule_t *self = (rule_t *) rule;
@@ -62,16 +120,26 @@ static void asset_freefn (void *asset)
     }
 }
 
-void ftymsg_freefn (void *ptr)
+static void cached_metric_freefn (void *ptr)
 {
     if (!ptr) return;
-    fty_proto_t *fty = (fty_proto_t *)ptr;
-    fty_proto_destroy (&fty);
+    cached_metric_t *metric = (cached_metric_t *) ptr;
+    fty_proto_destroy (&metric->msg);
+    free (metric);
+}
+
+static void asset_info_freefn (void *info)
+{
+    if (info) {
+        asset_info_t *self = (asset_info_t *) info;
+        asset_info_destroy (&self);
+    }
 }
 
-static void ename_freefn (void *ename)
+static int
+string_comparefn (void *i1, void *i2)
 {
-    if (ename) free (ename);
+    return strcmp ((char *)i1, (char *)i2);
 }
 
 //  --------------------------------------------------------------------------
@@ -83,12 +151,21 @@ flexible_alert_new (void)
     flexible_alert_t *self = (flexible_alert_t *) zmalloc (sizeof (flexible_alert_t));
     assert (self);
     //  Initialize class properties here
-    self->rules = zhash_new ();
+    self->rules = ruleset_new ();
+    self->templates = zhash_new ();
     self->assets = zhash_new ();
     self->metrics = zhash_new ();
-    self->enames = zhash_new ();
-    zhash_autofree (self->enames);
+    self->asset_infos = zhash_new ();
+    self->republish = republish_queue_new (REPUBLISH_BACKOFF_MIN, REPUBLISH_BACKOFF_MAX);
+    self->rule_files = zhash_new ();
+    zhash_autofree (self->rule_files);
+    self->alerts = zhash_new ();
+    self->evaluated = zhash_new ();
+    self->deferred = timer_wheel_new (DEFERRED_TICK, DEFERRED_SLOTS, zclock_mono ());
     self->mlm = mlm_client_new ();
+    self->asset_stream = mlm_client_new ();
+    self->metric_stream = mlm_client_new ();
+    self->ingress = metric_queue_new (INGRESS_CAPACITY);
     return self;
 }
 
@@ -102,11 +179,23 @@ flexible_alert_destroy (flexible_alert_t **self_p)
     if (*self_p) {
         flexible_alert_t *self = *self_p;
         //  Free class properties here
-        zhash_destroy (&self->rules);
+        ruleset_destroy (&self->rules);
+        zhash_destroy (&self->templates);
         zhash_destroy (&self->assets);
         zhash_destroy (&self->metrics);
-        zhash_destroy (&self->enames);
+        zhash_destroy (&self->asset_infos);
+        republish_queue_destroy (&self->republish);
+        zhash_destroy (&self->rule_files);
+        rule_store_destroy (&self->store);
+        zhash_destroy (&self->alerts);
+        zhash_destroy (&self->evaluated);
+        timer_wheel_destroy (&self->deferred);
         mlm_client_destroy (&self->mlm);
+        mlm_client_destroy (&self->asset_stream);
+        mlm_client_destroy (&self->metric_stream);
+        metric_queue_destroy (&self->ingress);
+        shard_map_destroy (&self->shards);
+        input_log_destroy (&self->recorder);
         //  Free object itself
         free (self);
         *self_p = NULL;
@@ -114,17 +203,362 @@ flexible_alert_destroy (flexible_alert_t **self_p)
 }
 
 //  --------------------------------------------------------------------------
-//  Load one rule from path. Returns valid rule_t* on success, else NULL.
+//  Use clock instead of time (NULL) for metric and alert times, NULL
+//  restores the system clock. Replay of recorded input uses it.
+
+void
+flexible_alert_set_clock (flexible_alert_t *self, flexible_alert_clock_fn *clock, void *arg)
+{
+    assert (self);
+    self->clock = clock;
+    self->clock_arg = arg;
+}
+
+//  --------------------------------------------------------------------------
+//  Pass alerts to sink instead of publishing them on stream, NULL restores
+//  publishing. Benchmark drives the engine without broker with it.
+
+void
+flexible_alert_set_sink (flexible_alert_t *self, flexible_alert_sink_fn *sink, void *arg)
+{
+    assert (self);
+    self->sink = sink;
+    self->sink_arg = arg;
+}
+
+//  --------------------------------------------------------------------------
+//  Current time of metrics and alerts
+
+static time_t
+flexible_alert_now (flexible_alert_t *self)
+{
+    return self->clock ? self->clock (self->clock_arg) : time (NULL);
+}
+
+//  --------------------------------------------------------------------------
+//  Append received message to input log, if input is recorded
+
+static void
+flexible_alert_record (flexible_alert_t *self, int kind, const char *address, const char *subject, zmsg_t *msg)
+{
+    if (self->recorder && msg && input_log_append (self->recorder, kind, zclock_usecs (), address, subject, &msg, 1) != 0)
+        log_error ("Failed to record input");
+}
+
+//  --------------------------------------------------------------------------
+//  Append metrics of one shm poll cycle to input log, if input is recorded
+
+static void
+flexible_alert_record_poll (flexible_alert_t *self, fty_proto_t **metrics, size_t count)
+{
+    if (!self->recorder)
+        return;
+    zmsg_t **msgs = (zmsg_t **) zmalloc ((count + 1) * sizeof (zmsg_t *));
+    assert (msgs);
+    size_t encoded = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (!metrics [i])
+            continue;
+        fty_proto_t *dup = fty_proto_dup (metrics [i]);
+        msgs [encoded++] = fty_proto_encode (&dup);
+    }
+    if (input_log_append (self->recorder, INPUT_LOG_POLL, zclock_usecs (), NULL, NULL, msgs, encoded) != 0)
+        log_error ("Failed to record shm poll");
+    for (size_t i = 0; i < encoded; i++)
+        zmsg_destroy (&msgs [i]);
+    free (msgs);
+}
+
+//  --------------------------------------------------------------------------
+//  Get current rules, they stay valid while evaluation changes rules, e.g.
+//  lua code of rule is compiled again. Caller must drop the reference with
+//  ruleset_destroy.
+
+static ruleset_t *
+flexible_alert_acquire_rules (flexible_alert_t *self)
+{
+    return ruleset_ref (self->rules);
+}
+
+//  --------------------------------------------------------------------------
+//  Replace current rules. Old rules are released with the last reference.
+
+static void
+flexible_alert_publish_rules (flexible_alert_t *self, ruleset_t **rules_p)
+{
+    ruleset_t *old = self->rules;
+    self->rules = *rules_p;
+    *rules_p = NULL;
+    log_trace ("rules version %" PRIu64 " published (%zu rules)",
+        ruleset_version (self->rules), ruleset_size (self->rules));
+    ruleset_destroy (&old);
+}
+
+//  --------------------------------------------------------------------------
+//  Function returns true if rule should be evaluated for particular asset.
+//  This is decided by asset name (json "assets": []) or group (json "groups":[])
+
+static int
+is_rule_for_this_asset (rule_t *rule, asset_info_t *info)
+{
+    if (!rule || !info) return 0;
+
+    if (streq (asset_info_subtype (info), "sensorgpio") )
+    {
+        if (rule_asset_exists (rule, asset_info_name (info)) &&
+            rule_model_exists (rule, asset_info_model (info)) )
+            return 1;
+        else
+            return 0;
+    }
+
+    if (rule_asset_exists (rule, asset_info_name (info)))
+        return 1;
+
+    const char *group = asset_info_group_first (info);
+    while (group) {
+        if (rule_group_exists (rule, group))
+            return 1;
+        group = asset_info_group_next (info);
+    }
+
+    if (rule_model_exists (rule, asset_info_model (info)))
+        return 1;
+    if (rule_model_exists (rule, asset_info_device_part (info)))
+        return 1;
+
+    if (rule_type_exists (rule, asset_info_type (info)))
+        return 1;
+    if (rule_type_exists (rule, asset_info_subtype (info)))
+        return 1;
+
+    return 0;
+}
+
+//  --------------------------------------------------------------------------
+//  Recompute list of rules valid for one known asset.
+
+void
+flexible_alert_bind_asset (flexible_alert_t *self, asset_info_t *info)
+{
+    const char *assetname = asset_info_name (info);
+    zlist_t *functions_for_asset = zlist_new ();
+    zlist_autofree (functions_for_asset);
+    zlist_comparefn (functions_for_asset, string_comparefn);
+
+    for (size_t i = 0; i < ruleset_size (self->rules); i++) {
+        rule_t *rule = ruleset_at (self->rules, i);
+        if (is_rule_for_this_asset (rule, info)) {
+            zlist_append (functions_for_asset, (char *)rule_name (rule));
+            log_debug ("rule '%s' is valid for '%s'", rule_name (rule), assetname);
+        }
+    }
+
+    if (zlist_size (functions_for_asset) == 0) {
+        log_trace ("no rule for %s", assetname);
+        zhash_delete (self->assets, assetname);
+        zlist_destroy (&functions_for_asset);
+        return;
+    }
+    zhash_update (self->assets, assetname, functions_for_asset);
+    zhash_freefn (self->assets, assetname, asset_freefn);
+}
+
+//  --------------------------------------------------------------------------
+//  Is alert for rule and asset already published with this result and not
+//  older than ttl?
+
+static bool
+flexible_alert_alert_current (flexible_alert_t *self, rule_t *rule, const char *asset, int result, int ttl)
+{
+    char *key = zsys_sprintf ("%s@%s", rule_name (rule), asset);
+    published_alert_t *published = (published_alert_t *) zhash_lookup (self->alerts, key);
+    bool current = published && published->result == result && flexible_alert_now (self) - published->time < ttl;
+    zstr_free (&key);
+    return current;
+}
+
+//  --------------------------------------------------------------------------
+//  Forget published alerts and evaluation times of rule, it was changed or
+//  removed
+
+static void
+flexible_alert_forget_alerts (flexible_alert_t *self, const char *name)
+{
+    size_t length = strlen (name);
+    zlist_t *keys = zhash_keys (self->alerts);
+    for (char *key = (char *) zlist_first (keys); key; key = (char *) zlist_next (keys))
+        if (strncmp (key, name, length) == 0 && key [length] == '@')
+            zhash_delete (self->alerts, key);
+    zlist_destroy (&keys);
+
+    keys = zhash_keys (self->evaluated);
+    for (char *key = (char *) zlist_first (keys); key; key = (char *) zlist_next (keys))
+        if (strncmp (key, name, length) == 0 && key [length] == '@') {
+            zhash_delete (self->evaluated, key);
+            timer_wheel_remove (self->deferred, key);
+        }
+    zlist_destroy (&keys);
+}
+
+//  --------------------------------------------------------------------------
+//  Forget evaluation times and deferred evaluations of asset, it was deleted
+
+static void
+flexible_alert_forget_asset (flexible_alert_t *self, const char *assetname)
+{
+    zlist_t *keys = zhash_keys (self->evaluated);
+    for (char *key = (char *) zlist_first (keys); key; key = (char *) zlist_next (keys)) {
+        //  asset names don't contain '@', rule names can
+        if (streq (strrchr (key, '@') + 1, assetname)) {
+            zhash_delete (self->evaluated, key);
+            timer_wheel_remove (self->deferred, key);
+        }
+    }
+    zlist_destroy (&keys);
+}
+
+//  --------------------------------------------------------------------------
+//  Match one (new or changed) rule against all known assets and update the
+//  lists of rules valid for them. No asset republish is needed.
+
+void
+flexible_alert_bind_rule (flexible_alert_t *self, rule_t *rule)
+{
+    const char *name = rule_name (rule);
+    flexible_alert_forget_alerts (self, name);
+    asset_info_t *info = (asset_info_t *) zhash_first (self->asset_infos);
+    while (info) {
+        const char *assetname = asset_info_name (info);
+        zlist_t *functions_for_asset = (zlist_t *) zhash_lookup (self->assets, assetname);
+        bool bound = functions_for_asset && zlist_exists (functions_for_asset, (void *) name);
+
+        if (is_rule_for_this_asset (rule, info)) {
+            if (!bound) {
+                if (!functions_for_asset) {
+                    functions_for_asset = zlist_new ();
+                    zlist_autofree (functions_for_asset);
+                    zlist_comparefn (functions_for_asset, string_comparefn);
+                    zhash_update (self->assets, assetname, functions_for_asset);
+                    zhash_freefn (self->assets, assetname, asset_freefn);
+                }
+                zlist_append (functions_for_asset, (char *) name);
+                log_debug ("rule '%s' is valid for '%s'", name, assetname);
+            }
+        }
+        else if (bound) {
+            zlist_remove (functions_for_asset, (void *) name);
+            if (zlist_size (functions_for_asset) == 0)
+                zhash_delete (self->assets, assetname);
+        }
+        info = (asset_info_t *) zhash_next (self->asset_infos);
+    }
+}
+
+//  --------------------------------------------------------------------------
+//  Remove rule from lists of rules valid for assets.
+
+void
+flexible_alert_unbind_rule (flexible_alert_t *self, const char *name)
+{
+    flexible_alert_forget_alerts (self, name);
+    zlist_t *assets = zhash_keys (self->assets);
+    const char *assetname = (const char *) zlist_first (assets);
+    while (assetname) {
+        zlist_t *functions_for_asset = (zlist_t *) zhash_lookup (self->assets, assetname);
+        zlist_remove (functions_for_asset, (void *) name);
+        if (zlist_size (functions_for_asset) == 0)
+            zhash_delete (self->assets, assetname);
+        assetname = (const char *) zlist_next (assets);
+    }
+    zlist_destroy (&assets);
+}
+
+//  --------------------------------------------------------------------------
+//  Bind rules to all already known assets
+
+static void
+flexible_alert_bind_assets (flexible_alert_t *self)
+{
+    asset_info_t *info = (asset_info_t *) zhash_first (self->asset_infos);
+    while (info) {
+        flexible_alert_bind_asset (self, info);
+        info = (asset_info_t *) zhash_next (self->asset_infos);
+    }
+}
+
+//  --------------------------------------------------------------------------
+//  Load template rules from "templates" subdirectory of rules directory.
+//  Template name is its file name without ".rule" extension.
+
+void
+flexible_alert_load_templates (flexible_alert_t *self, const char *path)
+{
+    char *dirpath = zsys_sprintf ("%s/templates", path);
+    DIR *dir = opendir (dirpath);
+    if (!dir) {
+        log_debug ("no templates in '%s'", dirpath);
+        zstr_free (&dirpath);
+        return;
+    }
+    struct dirent *entry;
+    while ((entry = readdir (dir)) != NULL) {
+        size_t l = strlen (entry->d_name);
+        if (l <= 5 || !streq (&entry->d_name [l - 5], ".rule"))
+            continue;
+        char *fullpath = zsys_sprintf ("%s/%s", dirpath, entry->d_name);
+        rule_t *tmpl = rule_new ();
+        if (rule_load (tmpl, fullpath) == 0) {
+            char *name = strndup (entry->d_name, l - 5);
+            zhash_update (self->templates, name, tmpl);
+            zhash_freefn (self->templates, name, template_freefn);
+            zstr_free (&name);
+        }
+        else {
+            log_error ("failed to load template '%s'", fullpath);
+            rule_destroy (&tmpl);
+        }
+        zstr_free (&fullpath);
+    }
+    closedir (dir);
+    log_info ("%zu rule templates loaded from '%s'", zhash_size (self->templates), dirpath);
+    zstr_free (&dirpath);
+}
+
+//  --------------------------------------------------------------------------
+//  Resolve template of rule which is template instance. Returns 0 if rule
+//  is usable.
+
+static int
+flexible_alert_instantiate (flexible_alert_t *self, rule_t *rule)
+{
+    const char *name = rule_template (rule);
+    if (!name)
+        return 0;
+    rule_t *tmpl = (rule_t *) zhash_lookup (self->templates, name);
+    if (!tmpl) {
+        log_error ("rule %s: unknown template %s", rule_name (rule), name);
+        return -1;
+    }
+    return rule_instantiate (rule, tmpl);
+}
+
+//  --------------------------------------------------------------------------
+//  Load one rule from path into (not yet published) rules. Returns valid
+//  rule_t* on success, else NULL.
 
 rule_t*
-flexible_alert_load_one_rule (flexible_alert_t *self, const char *fullpath)
+flexible_alert_load_one_rule (flexible_alert_t *self, ruleset_t *rules, const char *fullpath)
 {
     rule_t *rule = rule_new();
     int r = rule_load (rule, fullpath);
+    if (r == 0)
+        r = flexible_alert_instantiate (self, rule);
     if (r == 0) {
         log_info ("rule %s loaded", fullpath);
-        zhash_update (self->rules, rule_name (rule), rule);
-        zhash_freefn (self->rules, rule_name (rule), rule_freefn);
+        ruleset_insert (rules, rule);
+        const char *file = strrchr (fullpath, '/');
+        zhash_update (self->rule_files, file ? file + 1 : fullpath, (void *) rule_name (rule));
         return rule;
     }
     log_error ("failed to load rule '%s' (r: %d)", fullpath, r);
@@ -132,19 +566,56 @@ flexible_alert_load_one_rule (flexible_alert_t *self, const char *fullpath)
     return NULL;
 }
 
+//  --------------------------------------------------------------------------
+//  Load all rules from journal. Empty journal is filled from directory
+//  first, so switching from one file per rule keeps existing rules.
+
+static void
+flexible_alert_load_store (flexible_alert_t *self, ruleset_t *rules, const char *path)
+{
+    if (rule_store_size (self->store) == 0)
+        rule_store_import (self->store, path);
+
+    int64_t start = zclock_mono ();
+    const char *json = rule_store_first (self->store);
+    while (json) {
+        rule_t *rule = rule_new ();
+        if (rule_parse (rule, json) == 0 && rule_name (rule) && flexible_alert_instantiate (self, rule) == 0)
+            ruleset_insert (rules, rule);
+        else {
+            log_error ("failed to load rule '%s' from journal", rule_store_cursor (self->store));
+            rule_destroy (&rule);
+        }
+        json = rule_store_next (self->store);
+    }
+    log_info ("%zu rules loaded from journal in %d ms",
+        ruleset_size (rules), (int) (zclock_mono () - start));
+}
+
 //  --------------------------------------------------------------------------
 //  Load all rules in directory. Rule MUST have ".rule" extension.
+//  When rule journal is used, rules are loaded from it instead.
 
 void
 flexible_alert_load_rules (flexible_alert_t *self, const char *path)
 {
     if (!self || !path) return;
 
+    flexible_alert_load_templates (self, path);
+    ruleset_t *rules = ruleset_dup (self->rules);
+    if (self->store) {
+        flexible_alert_load_store (self, rules, path);
+        flexible_alert_publish_rules (self, &rules);
+        flexible_alert_bind_assets (self);
+        return;
+    }
+
     log_info ("reading rules from dir '%s'", path);
 
     DIR *dir = opendir(path);
     if (!dir) {
         log_error ("cannot open dir '%s' (%s)", path, strerror(errno));
+        ruleset_destroy (&rules);
         return;
     }
 
@@ -158,12 +629,120 @@ flexible_alert_load_rules (flexible_alert_t *self, const char *path)
                 // .rule file (json payload)
                 char* fullpath = NULL;
                 asprintf (&fullpath, "%s/%s", path, entry -> d_name);
-                flexible_alert_load_one_rule (self, fullpath);
+                flexible_alert_load_one_rule (self, rules, fullpath);
                 zstr_free(&fullpath);
             }
         }
     }
     closedir(dir);
+    flexible_alert_publish_rules (self, &rules);
+    flexible_alert_bind_assets (self);
+}
+
+//  --------------------------------------------------------------------------
+//  Reload rule files which were created, modified or deleted in directory.
+//  Only rules from those files are parsed and matched against known assets.
+
+void
+flexible_alert_reload_rule_files (flexible_alert_t *self, const char *path, zlist_t *files)
+{
+    if (!self || !path || !files) return;
+
+    int64_t start = zclock_mono ();
+    int loaded = 0, removed = 0, unchanged = 0, failed = 0;
+    ruleset_t *rules = ruleset_dup (self->rules);
+    zlist_t *changed = zlist_new ();     //  names of loaded rules
+    zlist_autofree (changed);
+    zlist_t *gone = zlist_new ();        //  names of removed rules
+    zlist_autofree (gone);
+
+    const char *file = (const char *) zlist_first (files);
+    while (file) {
+        char *fullpath = zsys_sprintf ("%s/%s", path, file);
+        char *old_name = NULL;
+        if (zhash_lookup (self->rule_files, file))
+            old_name = strdup ((const char *) zhash_lookup (self->rule_files, file));
+
+        if (access (fullpath, F_OK) != 0) {
+            // rule file was deleted
+            if (old_name && ruleset_remove (rules, old_name) == 0) {
+                log_info ("rule %s removed", fullpath);
+                if (self->store)
+                    rule_store_delete (self->store, old_name);
+                zlist_append (gone, old_name);
+                removed++;
+            }
+            zhash_delete (self->rule_files, file);
+        }
+        else {
+            rule_t *rule = rule_new ();
+            int r = rule_load (rule, fullpath);
+            if (r == 0)
+                r = flexible_alert_instantiate (self, rule);
+            if (r != 0 || !rule_name (rule)) {
+                log_error ("failed to load rule '%s' (r: %d)", fullpath, r);
+                rule_destroy (&rule);
+                failed++;
+            }
+            else {
+                rule_t *current = ruleset_lookup (rules, rule_name (rule));
+                char *json = current ? rule_json (current) : NULL;
+                char *new_json = current ? rule_json (rule) : NULL;
+                if (json && new_json && streq (json, new_json)) {
+                    // typically our own ADD
+                    zhash_update (self->rule_files, file, (void *) rule_name (current));
+                    rule_destroy (&rule);
+                    unchanged++;
+                }
+                else {
+                    if (old_name && !streq (old_name, rule_name (rule))) {
+                        // file now holds different rule
+                        if (self->store)
+                            rule_store_delete (self->store, old_name);
+                        if (ruleset_remove (rules, old_name) == 0)
+                            zlist_append (gone, old_name);
+                    }
+                    log_info ("rule %s loaded", fullpath);
+                    if (self->store) {
+                        char *rjson = rule_json (rule);
+                        rule_store_put (self->store, rule_name (rule), rjson);
+                        zstr_free (&rjson);
+                    }
+                    zlist_append (changed, (void *) rule_name (rule));
+                    ruleset_insert (rules, rule);
+                    loaded++;
+                }
+                zstr_free (&json);
+                zstr_free (&new_json);
+                if (rule)
+                    zhash_update (self->rule_files, file, (void *) rule_name (rule));
+            }
+        }
+        zstr_free (&old_name);
+        zstr_free (&fullpath);
+        file = (const char *) zlist_next (files);
+    }
+
+    // publish once, then update bindings
+    flexible_alert_publish_rules (self, &rules);
+    const char *name = (const char *) zlist_first (gone);
+    while (name) {
+        if (!ruleset_lookup (self->rules, name))
+            flexible_alert_unbind_rule (self, name);
+        name = (const char *) zlist_next (gone);
+    }
+    name = (const char *) zlist_first (changed);
+    while (name) {
+        rule_t *rule = ruleset_lookup (self->rules, name);
+        if (rule)
+            flexible_alert_bind_rule (self, rule);
+        name = (const char *) zlist_next (changed);
+    }
+    zlist_destroy (&gone);
+    zlist_destroy (&changed);
+    log_info ("rules reloaded from '%s' in %d ms: %zu files, %d loaded, %d removed, %d unchanged, %d failed, %zu rules",
+        path, (int) (zclock_mono () - start), zlist_size (files), loaded, removed, unchanged, failed,
+        ruleset_size (self->rules));
 }
 
 void
@@ -177,6 +756,16 @@ flexible_alert_send_alert (flexible_alert_t *self, rule_t *rule, const char *ass
     char *topic = NULL;
     asprintf (&topic, "%s/%s@%s", rule_name (rule), severity, asset);
 
+    // remember what was published, batch evaluation skips unchanged alerts
+    char *key = zsys_sprintf ("%s@%s", rule_name (rule), asset);
+    published_alert_t *published = (published_alert_t *) zmalloc (sizeof (published_alert_t));
+    assert (published);
+    published->result = result;
+    published->time = flexible_alert_now (self);
+    zhash_update (self->alerts, key, published);
+    zhash_freefn (self->alerts, key, free);
+    zstr_free (&key);
+
     // Logical asset if specified
     const char *la = rule_logical_asset (rule);
     if (la != NULL && !streq (la, "")) {
@@ -186,7 +775,7 @@ flexible_alert_send_alert (flexible_alert_t *self, rule_t *rule, const char *ass
     // message
     zmsg_t *alert = fty_proto_encode_alert (
         NULL,
-        time(NULL),
+        flexible_alert_now (self),
         ttl,
         rule_name (rule),
         asset,
@@ -204,7 +793,10 @@ flexible_alert_send_alert (flexible_alert_t *self, rule_t *rule, const char *ass
             rule_name(rule), asset, severity, result);
     }
 
-    mlm_client_send (self -> mlm, topic, &alert);
+    if (self->sink)
+        self->sink (self->sink_arg, topic, &alert);
+    else
+        mlm_client_send (self -> mlm, topic, &alert);
 
     zstr_free (&topic);
     zmsg_destroy (&alert);
@@ -213,8 +805,15 @@ flexible_alert_send_alert (flexible_alert_t *self, rule_t *rule, const char *ass
 void
 flexible_alert_evaluate (flexible_alert_t *self, rule_t *rule, const char *assetname, const char *ename)
 {
+    if (rule_quarantined (rule)) {
+        log_trace ("rule %s is quarantined, %s not evaluated", rule_name (rule), assetname);
+        return;
+    }
+
     zlist_t *params = zlist_new ();
     zlist_autofree (params);
+    //  values converted when metrics came
+    double *numbers = NULL;
 
     // prepare lua function parameters
 
@@ -223,17 +822,22 @@ flexible_alert_evaluate (flexible_alert_t *self, rule_t *rule, const char *asset
     while (param) {
         char *topic = NULL;
         asprintf (&topic, "%s@%s", param, assetname);
-        fty_proto_t *ftymsg = (fty_proto_t *) zhash_lookup (self->metrics, topic);
-        if (!ftymsg) {
+        cached_metric_t *metric = (cached_metric_t *) zhash_lookup (self->metrics, topic);
+        if (!metric) {
             // some metrics are missing
             zlist_destroy (&params);
+            free (numbers);
             log_trace ("abort evaluation of rule %s because %s metric is missing", rule_name(rule), topic);
             zstr_free (&topic);
             return;
         }
+        fty_proto_t *ftymsg = metric->msg;
         // TTL should be set accorning shortest ttl in metric
         if (ttl == 0 || ttl > (int) fty_proto_ttl (ftymsg)) ttl = fty_proto_ttl (ftymsg);
         zstr_free (&topic);
+        numbers = (double *) realloc (numbers, (zlist_size (params) + 1) * sizeof (double));
+        assert (numbers);
+        numbers [zlist_size (params)] = metric->number;
         zlist_append (params, (char *) fty_proto_value (ftymsg));
         param = rule_metric_next (rule);
     }
@@ -242,12 +846,17 @@ flexible_alert_evaluate (flexible_alert_t *self, rule_t *rule, const char *asset
     char *message = NULL;
     int result = 0;
 
-    rule_evaluate (rule, params, assetname, ename, &result, &message);
+    rule_evaluate (rule, params, numbers, assetname, ename, &result, &message);
 
     log_debug(ANSI_COLOR_WHITE_ON_BLUE  "rule_evaluate %s, assetname: %s: result = %d" ANSI_COLOR_RESET,
         rule_name(rule), assetname, result);
 
-    if (result != RULE_ERROR) {
+    if (result == RULE_ABORTED) {
+        log_error (ANSI_COLOR_RED "evaluation of rule %s for %s aborted (%" PRIu64 " aborted so far)" ANSI_COLOR_RESET,
+            rule_name (rule), assetname,
+            rule_chunk_aborted (RULE_CHUNK_INSTRUCTIONS_EXCEEDED) + rule_chunk_aborted (RULE_CHUNK_MEMORY_EXCEEDED));
+    }
+    else if (result != RULE_ERROR && result != RULE_QUARANTINED) {
         flexible_alert_send_alert (
             self,
             rule,
@@ -262,6 +871,89 @@ flexible_alert_evaluate (flexible_alert_t *self, rule_t *rule, const char *asset
 
     zstr_free (&message);
     zlist_destroy (&params);
+    free (numbers);
+}
+
+//  --------------------------------------------------------------------------
+//  Rule with minimal interval was evaluated for asset less than the interval
+//  ago? Then the evaluation is deferred to one trailing run on the latest
+//  values when the interval is over, and true is returned.
+
+static bool
+flexible_alert_throttle (flexible_alert_t *self, rule_t *rule, const char *assetname)
+{
+    int interval = rule_min_interval (rule);
+    if (interval < 0)
+        interval = self->min_interval;
+    if (interval == 0)
+        return false;
+
+    char *key = zsys_sprintf ("%s@%s", rule_name (rule), assetname);
+    int64_t now = zclock_mono ();
+    int64_t *evaluated = (int64_t *) zhash_lookup (self->evaluated, key);
+    bool deferred = evaluated && now - *evaluated < interval;
+    if (deferred)
+        timer_wheel_add (self->deferred, key, *evaluated + interval);
+    else {
+        if (!evaluated) {
+            evaluated = (int64_t *) zmalloc (sizeof (int64_t));
+            assert (evaluated);
+            zhash_insert (self->evaluated, key, evaluated);
+            zhash_freefn (self->evaluated, key, free);
+        }
+        *evaluated = now;
+    }
+    zstr_free (&key);
+    return deferred;
+}
+
+//  --------------------------------------------------------------------------
+//  Run deferred evaluations whose interval is over. Returns number of
+//  evaluations.
+
+size_t
+flexible_alert_evaluate_deferred (flexible_alert_t *self)
+{
+    int64_t now = zclock_mono ();
+    zlist_t *expired = timer_wheel_expire (self->deferred, now);
+    for (char *key = expired ? (char *) zlist_first (expired) : NULL; key; key = (char *) zlist_next (expired)) {
+        int64_t *evaluated = (int64_t *) zhash_lookup (self->evaluated, key);
+        if (evaluated)
+            *evaluated = now;
+    }
+    if (!expired)
+        return 0;
+
+    size_t count = 0;
+    ruleset_t *rules = flexible_alert_acquire_rules (self);
+    for (char *key = (char *) zlist_first (expired); key; key = (char *) zlist_next (expired)) {
+        //  asset names don't contain '@', rule names can
+        char *at = strrchr (key, '@');
+        *at = 0;
+        const char *assetname = at + 1;
+        rule_t *rule = ruleset_lookup (rules, key);
+        if (!rule)
+            continue;
+        //  rule or asset could change since the evaluation was deferred
+        zlist_t *functions_for_asset = (zlist_t *) zhash_lookup (self->assets, assetname);
+        if (!functions_for_asset || !zlist_exists (functions_for_asset, (void *) rule_name (rule)))
+            continue;
+        asset_info_t *info = (asset_info_t *) zhash_lookup (self->asset_infos, assetname);
+        flexible_alert_evaluate (self, rule, assetname, info ? asset_info_ename (info) : NULL);
+        count++;
+    }
+    ruleset_destroy (&rules);
+    zlist_destroy (&expired);
+    return count;
+}
+
+//  --------------------------------------------------------------------------
+//  Milliseconds till next deferred evaluation may be due, -1 if none
+
+static int
+flexible_alert_deferred_timeout (flexible_alert_t *self)
+{
+    return timer_wheel_timeout (self->deferred, zclock_mono ());
 }
 
 //  --------------------------------------------------------------------------
@@ -273,8 +965,8 @@ flexible_alert_clean_metrics (flexible_alert_t *self)
     zlist_t *topics = zhash_keys (self->metrics);
     char *topic = (char *) zlist_first (topics);
     while (topic) {
-        fty_proto_t *ftymsg = (fty_proto_t *) zhash_lookup (self->metrics, topic);
-        if ( (int) (fty_proto_time (ftymsg) + fty_proto_ttl (ftymsg)) <   time (NULL)) {
+        fty_proto_t *ftymsg = ((cached_metric_t *) zhash_lookup (self->metrics, topic))->msg;
+        if ( (int) (fty_proto_time (ftymsg) + fty_proto_ttl (ftymsg)) < flexible_alert_now (self)) {
             log_warning("delete topic %s", topic);
             zhash_delete (self->metrics, topic);
         }
@@ -300,35 +992,65 @@ is_gpi_metric (fty_proto_t* metric)
 
 
 //  --------------------------------------------------------------------------
-//  Function handles incoming metrics, drives lua evaluation
+//  Add metric value to batch of rule. Returns false if metric must be
+//  evaluated right away.
 
-void
-flexible_alert_handle_metric (flexible_alert_t *self, fty_proto_t **ftymsg_p, bool isShm)
+static bool
+flexible_alert_batch_metric (zhash_t *batches, rule_t *rule, const char *assetname, cached_metric_t *metric)
 {
-    if (!self || !ftymsg_p || !*ftymsg_p) return;
-    fty_proto_t *ftymsg = *ftymsg_p;
-    if (fty_proto_id (ftymsg) != FTY_PROTO_METRIC) return;
-
-    if(isShm) {
-        char *subject = NULL;
-        asprintf (&subject, "%s@%s", fty_proto_type (ftymsg), fty_proto_name (ftymsg));
-        if (zhash_lookup (self->metrics, subject)) {
-            flexible_alert_clean_metrics (self);
-        }
-        zstr_free(&subject);
+    metric_batch_t *batch = (metric_batch_t *) zhash_lookup (batches, rule_name (rule));
+    if (!batch) {
+        batch = (metric_batch_t *) zmalloc (sizeof (metric_batch_t));
+        assert (batch);
+        batch->rule = rule;
+        batch->numeric = rule_classify (rule, NULL, 0, NULL) == 0;
+        zhash_insert (batches, rule_name (rule), batch);
     }
-    else if (zhash_lookup (self->metrics, mlm_client_subject (self->mlm))) {
-        flexible_alert_clean_metrics (self);
+    if (!batch->numeric || isnan (metric->number))
+        return false;
+    if (batch->count == batch->capacity) {
+        batch->capacity = batch->capacity ? batch->capacity * 2 : 64;
+        batch->values = (double *) realloc (batch->values, batch->capacity * sizeof (double));
+        batch->assets = (char **) realloc (batch->assets, batch->capacity * sizeof (char *));
+        batch->ttls = (int *) realloc (batch->ttls, batch->capacity * sizeof (int));
+        assert (batch->values && batch->assets && batch->ttls);
     }
+    batch->values [batch->count] = metric->number;
+    batch->assets [batch->count] = strdup (assetname);
+    batch->ttls [batch->count] = (int) fty_proto_ttl (metric->msg);
+    batch->count++;
+    return true;
+}
+
+static void
+metric_batch_freefn (void *ptr)
+{
+    metric_batch_t *batch = (metric_batch_t *) ptr;
+    for (size_t i = 0; i < batch->count; i++)
+        zstr_free (&batch->assets [i]);
+    free (batch->values);
+    free (batch->assets);
+    free (batch->ttls);
+    free (batch);
+}
 
+//  --------------------------------------------------------------------------
+//  Cache metric and evaluate rules using it. With batches, evaluation of
+//  rules which can be classified in batch is postponed.
+
+static void
+flexible_alert_dispatch_metric (flexible_alert_t *self, ruleset_t *rules, fty_proto_t **ftymsg_p, zhash_t *batches)
+{
+    fty_proto_t *ftymsg = *ftymsg_p;
     const char *assetname = fty_proto_name (ftymsg);
     const char *quantity = fty_proto_type (ftymsg);
-    const char *ename = (const char *) zhash_lookup (self->enames, assetname);
+    asset_info_t *info = (asset_info_t *) zhash_lookup (self->asset_infos, assetname);
+    const char *ename = info ? asset_info_ename (info) : NULL;
     const char *extport = fty_proto_aux_string (ftymsg, "ext-port", NULL);
 
     char *qty_dup = strdup(quantity);
 
-    log_trace("handle metric: assetname: %s, qty: %s, isShm: %s", assetname, qty_dup, (isShm ? "true" : "false"));
+    log_trace("handle metric: assetname: %s, qty: %s, batch: %s", assetname, qty_dup, (batches ? "true" : "false"));
 
     // fix quantity for sensors connected to other sensors
     if (extport) {
@@ -357,11 +1079,11 @@ flexible_alert_handle_metric (flexible_alert_t *self, fty_proto_t **ftymsg_p, bo
     }
 
     // this asset has some evaluation functions
-    bool metric_saved =  false;
+    cached_metric_t *metric = NULL;
     char *func = (char *) zlist_first (functions_for_asset);
     for (; func; func = (char *) zlist_next (functions_for_asset))
     {
-        rule_t *rule = (rule_t *) zhash_lookup (self -> rules, func);
+        rule_t *rule = ruleset_lookup (rules, func);
         if (!rule) continue;
         if (!rule_metric_exists (rule, qty_dup)) continue;
 
@@ -369,118 +1091,186 @@ flexible_alert_handle_metric (flexible_alert_t *self, fty_proto_t **ftymsg_p, bo
 
         // we have to evaluate this function/rule for our asset
         // save metric into cache
-        if (! metric_saved) {
-            fty_proto_set_time (ftymsg, time (NULL));
+        if (! metric) {
+            fty_proto_set_time (ftymsg, flexible_alert_now (self));
             //char *topic = zsys_sprintf ("%s@%s", qty_dup, assetname);
             char *topic = NULL;
             asprintf (&topic, "%s@%s", qty_dup, assetname);
-            zhash_update (self->metrics, topic, ftymsg);
-            zhash_freefn (self->metrics, topic, ftymsg_freefn);
+            //  value is converted once for all rules using it
+            metric = (cached_metric_t *) zmalloc (sizeof (cached_metric_t));
+            assert (metric);
+            metric->msg = ftymsg;
+            if (!rule_threshold_number (fty_proto_value (ftymsg), &metric->number))
+                metric->number = NAN;
+            zhash_update (self->metrics, topic, metric);
+            zhash_freefn (self->metrics, topic, cached_metric_freefn);
             *ftymsg_p = NULL;
             zstr_free (&topic);
-            metric_saved = true;
         }
 
-        // evaluate
-        flexible_alert_evaluate (self, rule, assetname, ename);
-    }
-    zstr_free(&qty_dup);
-}
-
-int
-ask_for_sensor (flexible_alert_t *self, const char* sensor_name)
-{
-
-    if (!zhash_lookup (self->assets, sensor_name))
-    {
-        log_debug ("I have to ask for sensor  %s", sensor_name);
+        if (batches && flexible_alert_batch_metric (batches, rule, assetname, metric))
+            continue;
 
-        zmsg_t *msg = zmsg_new ();
-        zmsg_addstr (msg, "REPUBLISH");
-        zmsg_addstr (msg, sensor_name);
-
-        int rv = mlm_client_sendto (self->mlm, "asset-agent", "REPUBLISH" , NULL, 5000, &msg);
-        if (rv != 0)
-        {
-            log_error ("mlm_client_sendto (address = '%s', subject = '%s', timeout = '5000') for '%s' failed.",
-                        "asset-agent", "REPUBLISH", sensor_name);
-        }
-        return rv;
+        // evaluate, unless it was done recently
+        if (!flexible_alert_throttle (self, rule, assetname))
+            flexible_alert_evaluate (self, rule, assetname, ename);
     }
-    log_trace ("I know this sensor %s", sensor_name);
-    return 0;
+    zstr_free(&qty_dup);
 }
 
 //  --------------------------------------------------------------------------
-//  Function handles infoming metric sensors, fix message and pass it to metrics evaluation
+//  Function handles incoming metrics, drives lua evaluation
 
 void
-flexible_alert_handle_metric_sensor (flexible_alert_t *self, fty_proto_t **ftymsg_p)
+flexible_alert_handle_metric (flexible_alert_t *self, fty_proto_t **ftymsg_p, bool isShm)
 {
     if (!self || !ftymsg_p || !*ftymsg_p) return;
     fty_proto_t *ftymsg = *ftymsg_p;
     if (fty_proto_id (ftymsg) != FTY_PROTO_METRIC) return;
 
-    // get name of asset based on GPIO port
-    const char *sensor_name = fty_proto_aux_string (ftymsg, FTY_PROTO_METRICS_SENSOR_AUX_SNAME, NULL);
-    if (!sensor_name) {
-        log_warning ("No sensor name provided in sensor message");
-        return;
+    //  messages from stream come through ingress queue, subject of client
+    //  is not the one of this message
+    char *subject = NULL;
+    asprintf (&subject, "%s@%s", fty_proto_type (ftymsg), fty_proto_name (ftymsg));
+    if (zhash_lookup (self->metrics, subject)) {
+        flexible_alert_clean_metrics (self);
     }
+    zstr_free(&subject);
 
-    ask_for_sensor (self, sensor_name);
-    fty_proto_set_name (ftymsg, "%s", sensor_name);
-    flexible_alert_handle_metric(self, ftymsg_p, false);
+    ruleset_t *rules = flexible_alert_acquire_rules (self);
+    flexible_alert_dispatch_metric (self, rules, ftymsg_p, NULL);
+    ruleset_destroy (&rules);
 }
 
 //  --------------------------------------------------------------------------
-//  Function returns true if rule should be evaluated for particular asset.
-//  This is decided by asset name (json "assets": []) or group (json "groups":[])
+//  Handle metrics of one shm poll cycle. Values of single metric threshold
+//  rules are collected per rule and classified at once; only assets whose
+//  severity changed, or whose alert is older than metric ttl, are evaluated
+//  and published. Other rules are evaluated for every metric as usual.
 
-static int
-is_rule_for_this_asset (rule_t *rule, fty_proto_t *ftymsg)
+void
+flexible_alert_handle_metrics (flexible_alert_t *self, fty_proto_t **metrics, size_t count)
 {
-    if (!rule || !ftymsg) return 0;
+    if (!self || !metrics) return;
+    flexible_alert_record_poll (self, metrics, count);
+    flexible_alert_clean_metrics (self);
+
+    zhash_t *batches = zhash_new ();
+    ruleset_t *rules = flexible_alert_acquire_rules (self);
+    for (size_t i = 0; i < count; i++) {
+        if (metrics [i] && fty_proto_id (metrics [i]) == FTY_PROTO_METRIC)
+            flexible_alert_dispatch_metric (self, rules, &metrics [i], batches);
+    }
+
+    size_t evaluated = 0, skipped = 0;
+    for (metric_batch_t *batch = (metric_batch_t *) zhash_first (batches);
+         batch; batch = (metric_batch_t *) zhash_next (batches)) {
+        int *results = (int *) zmalloc ((batch->count + 1) * sizeof (int));
+        assert (results);
+        bool classified = rule_classify (batch->rule, batch->values, batch->count, results) == 0;
+        for (size_t i = 0; i < batch->count; i++) {
+            const char *assetname = batch->assets [i];
+            if (classified
+            &&  flexible_alert_alert_current (self, batch->rule, assetname, results [i], batch->ttls [i])) {
+                skipped++;
+                continue;
+            }
+            if (flexible_alert_throttle (self, batch->rule, assetname))
+                continue;
+            asset_info_t *info = (asset_info_t *) zhash_lookup (self->asset_infos, assetname);
+            flexible_alert_evaluate (self, batch->rule, assetname, info ? asset_info_ename (info) : NULL);
+            evaluated++;
+        }
+        free (results);
+        metric_batch_freefn (batch);
+    }
+    ruleset_destroy (&rules);
+    zhash_destroy (&batches);
+    if (evaluated || skipped)
+        log_debug ("batch evaluation: %zu alerts published, %zu unchanged", evaluated, skipped);
+}
+
+//  --------------------------------------------------------------------------
+//  Is asset evaluated by this instance? Without sharding all assets are.
+
+static bool
+flexible_alert_owns (flexible_alert_t *self, const char *assetname)
+{
+    return !self->shards || shard_map_owns (self->shards, assetname);
+}
+
+//  --------------------------------------------------------------------------
+//  Queue REPUBLISH request for sensor we don't know yet. Requests are sent
+//  in batches by flexible_alert_flush_republish.
 
-    const char *subtype = fty_proto_aux_string (ftymsg, FTY_PROTO_ASSET_SUBTYPE, "");
-    if (streq (subtype, "sensorgpio") )
+void
+ask_for_sensor (flexible_alert_t *self, const char* sensor_name)
+{
+    if (!zhash_lookup (self->asset_infos, sensor_name))
     {
-        if (rule_asset_exists (rule, fty_proto_name (ftymsg)) &&
-            rule_model_exists (rule, fty_proto_ext_string (ftymsg, FTY_PROTO_ASSET_EXT_MODEL, "")) )
-            return 1;
-        else
-            return 0;
+        if (republish_queue_request (self->republish, sensor_name, zclock_mono ()))
+            log_debug ("I have to ask for sensor  %s", sensor_name);
+        return;
     }
+    log_trace ("I know this sensor %s", sensor_name);
+}
 
-    if (rule_asset_exists (rule, fty_proto_name (ftymsg)))
-        return 1;
+//  --------------------------------------------------------------------------
+//  Send one REPUBLISH request for all queued assets. Send doesn't block
+//  the actor; if it fails, assets are sent with the next flush.
 
-    zhash_t *ext = fty_proto_ext (ftymsg);
-    zlist_t *keys = zhash_keys (ext);
-    char *key = (char *)zlist_first (keys);
-    while (key) {
-        if (strncmp ("group.", key, 6) == 0) {
-            // this is group
-            if (rule_group_exists (rule, (char *) zhash_lookup (ext, key))) {
-                zlist_destroy (&keys);
-                return 1;
-            }
+void
+flexible_alert_flush_republish (flexible_alert_t *self)
+{
+    size_t expired = republish_queue_expire (self->republish, zclock_mono (), REPUBLISH_EXPIRY);
+    if (expired)
+        log_debug ("forgot %zu assets unknown to asset-agent", expired);
+
+    zmsg_t *msg = republish_queue_flush (self->republish);
+    if (!msg) return;
+
+    size_t count = zmsg_size (msg) - 1;
+    zmsg_t *names = zmsg_dup (msg);
+    int rv = mlm_client_sendto (self->mlm, "asset-agent", "REPUBLISH" , NULL, 0, &msg);
+    if (rv != 0)
+    {
+        log_error ("mlm_client_sendto (address = '%s', subject = '%s', timeout = '0') for %zu assets failed.",
+                    "asset-agent", "REPUBLISH", count);
+        char *name = zmsg_popstr (names);
+        zstr_free (&name);
+        for (name = zmsg_popstr (names); name; name = zmsg_popstr (names)) {
+            republish_queue_requeue (self->republish, name);
+            zstr_free (&name);
         }
-        key = (char *)zlist_next (keys);
     }
-    zlist_destroy (&keys);
+    else
+        log_debug ("asked asset-agent to republish %zu assets", count);
+    zmsg_destroy (&msg);
+    zmsg_destroy (&names);
+}
 
-    if (rule_model_exists (rule, fty_proto_ext_string (ftymsg, FTY_PROTO_ASSET_EXT_MODEL, "")))
-        return 1;
-    if (rule_model_exists (rule, fty_proto_ext_string (ftymsg, FTY_PROTO_ASSET_EXT_DEVICE_PART, "")))
-        return 1;
+//  --------------------------------------------------------------------------
+//  Function handles infoming metric sensors, fix message and pass it to metrics evaluation
 
-    if (rule_type_exists (rule, fty_proto_aux_string (ftymsg, FTY_PROTO_ASSET_AUX_TYPE, "")))
-        return 1;
-    if (rule_type_exists (rule, fty_proto_aux_string (ftymsg, FTY_PROTO_ASSET_AUX_SUBTYPE, "")))
-        return 1;
+void
+flexible_alert_handle_metric_sensor (flexible_alert_t *self, fty_proto_t **ftymsg_p)
+{
+    if (!self || !ftymsg_p || !*ftymsg_p) return;
+    fty_proto_t *ftymsg = *ftymsg_p;
+    if (fty_proto_id (ftymsg) != FTY_PROTO_METRIC) return;
 
-    return 0;
+    // get name of asset based on GPIO port
+    const char *sensor_name = fty_proto_aux_string (ftymsg, FTY_PROTO_METRICS_SENSOR_AUX_SNAME, NULL);
+    if (!sensor_name) {
+        log_warning ("No sensor name provided in sensor message");
+        return;
+    }
+    if (!flexible_alert_owns (self, sensor_name))
+        return;
+
+    ask_for_sensor (self, sensor_name);
+    fty_proto_set_name (ftymsg, "%s", sensor_name);
+    flexible_alert_handle_metric(self, ftymsg_p, false);
 }
 
 //  --------------------------------------------------------------------------
@@ -495,46 +1285,28 @@ flexible_alert_handle_asset (flexible_alert_t *self, fty_proto_t *ftymsg)
 
     const char *operation = fty_proto_operation (ftymsg);
     const char *assetname = fty_proto_name (ftymsg);
+    if (!flexible_alert_owns (self, assetname))
+        return;
 
     if (streq (operation, FTY_PROTO_ASSET_OP_DELETE) ||
             !streq(fty_proto_aux_string (ftymsg, FTY_PROTO_ASSET_STATUS, "active"), "active")) {
         if (zhash_lookup (self->assets, assetname)) {
             zhash_delete (self->assets, assetname);
         }
-        if (zhash_lookup (self->enames, assetname)) {
-            zhash_delete (self->enames, assetname);
-        }
+        zhash_delete (self->asset_infos, assetname);
+        flexible_alert_forget_asset (self, assetname);
         return;
     }
 
     if (streq (operation, FTY_PROTO_ASSET_OP_UPDATE) ||
             streq (operation, FTY_PROTO_ASSET_OP_INVENTORY)) {
-        zlist_t *functions_for_asset = zlist_new ();
-        zlist_autofree (functions_for_asset);
-
-        rule_t *rule = (rule_t *)zhash_first (self->rules);
-        while (rule) {
-            if (is_rule_for_this_asset (rule, ftymsg)) {
-                zlist_append (functions_for_asset, (char *)rule_name (rule));
-                log_debug ("rule '%s' is valid for '%s'", rule_name (rule), assetname);
-            }
-            rule = (rule_t *)zhash_next (self->rules);
-        }
-
-        if (zlist_size (functions_for_asset) == 0) {
-            log_trace ("no rule for %s", assetname);
-            zhash_delete (self->assets, assetname);
-            zlist_destroy (&functions_for_asset);
-            return;
-        }
-        zhash_update (self->assets, assetname, functions_for_asset);
-        zhash_freefn (self->assets, assetname, asset_freefn);
+        // keep attributes, so rules added later can be matched locally
+        republish_queue_resolve (self->republish, assetname);
+        asset_info_t *info = asset_info_new (ftymsg);
+        zhash_update (self->asset_infos, assetname, info);
+        zhash_freefn (self->asset_infos, assetname, asset_info_freefn);
 
-        const char *ename = fty_proto_ext_string (ftymsg, "name", NULL);
-        if (ename) {
-            zhash_update (self->enames, assetname, (void *)ename);
-            zhash_freefn (self->enames, assetname, ename_freefn);
-        }
+        flexible_alert_bind_asset (self, info);
     }
 }
 
@@ -560,9 +1332,9 @@ flexible_alert_list_rules (flexible_alert_t *self, char *type, char *ruleclass)
     zmsg_addstr (reply, type);
     zmsg_addstr (reply, ruleclass ? ruleclass : "");
 
-    rule_t *rule = (rule_t *) zhash_first (self->rules);
-    while (rule) {
-        char *json = rule_json (rule);
+    for (size_t i = 0; i < ruleset_size (self->rules); i++) {
+        rule_t *rule = ruleset_at (self->rules, i);
+        char *json = rule_json_expanded (rule);
         if (json) {
             char *uistyle = NULL;
             asprintf (&uistyle, "{\"flexible\": %s }", json);
@@ -572,11 +1344,128 @@ flexible_alert_list_rules (flexible_alert_t *self, char *type, char *ruleclass)
             }
             zstr_free (&json);
         }
-        rule = (rule_t *) zhash_next (self->rules);
     }
     return reply;
 }
 
+//  --------------------------------------------------------------------------
+//  Memory of lua states: MEMORY/<rule>/<bytes>/..., rules with the same
+//  evaluation share one state. Rules without lua state are not listed.
+
+zmsg_t *
+flexible_alert_memory (flexible_alert_t *self)
+{
+    if (! self) return NULL;
+
+    zmsg_t *reply = zmsg_new ();
+    zmsg_addstr (reply, "MEMORY");
+    for (size_t i = 0; i < ruleset_size (self->rules); i++) {
+        rule_t *rule = ruleset_at (self->rules, i);
+        size_t memory = rule_lua_memory (rule);
+        if (memory) {
+            zmsg_addstr (reply, rule_name (rule));
+            zmsg_addstrf (reply, "%zu", memory);
+        }
+    }
+    return reply;
+}
+
+//  --------------------------------------------------------------------------
+//  Time of lua garbage collection: GC/<during evaluations us>/<idle us>
+
+zmsg_t *
+flexible_alert_gc (flexible_alert_t *self)
+{
+    if (! self) return NULL;
+
+    uint64_t hot, idle;
+    rule_chunk_gc_time (&hot, &idle);
+    zmsg_t *reply = zmsg_new ();
+    zmsg_addstr (reply, "GC");
+    zmsg_addstrf (reply, "%" PRIu64, hot);
+    zmsg_addstrf (reply, "%" PRIu64, idle);
+    return reply;
+}
+
+//  --------------------------------------------------------------------------
+//  Lua evaluations answered from memo: MEMO/<hits>/<misses>/<hit rate %>
+
+zmsg_t *
+flexible_alert_memo (flexible_alert_t *self)
+{
+    if (! self) return NULL;
+
+    uint64_t hits, misses;
+    rule_memo_stats (&hits, &misses);
+    zmsg_t *reply = zmsg_new ();
+    zmsg_addstr (reply, "MEMO");
+    zmsg_addstrf (reply, "%" PRIu64, hits);
+    zmsg_addstrf (reply, "%" PRIu64, misses);
+    zmsg_addstrf (reply, "%.1f", hits + misses ? 100.0 * hits / (hits + misses) : 0.0);
+    return reply;
+}
+
+//  --------------------------------------------------------------------------
+//  Ingress queue of metrics: INGRESS/<pending>/<coalesced>/<shed>, numbers of
+//  pending subjects, of metrics replaced by newer value before they were
+//  evaluated and of metrics dropped because the queue was full
+
+zmsg_t *
+flexible_alert_ingress (flexible_alert_t *self)
+{
+    if (! self) return NULL;
+
+    zmsg_t *reply = zmsg_new ();
+    zmsg_addstr (reply, "INGRESS");
+    zmsg_addstrf (reply, "%zu", metric_queue_size (self->ingress));
+    zmsg_addstrf (reply, "%" PRIu64, metric_queue_coalesced (self->ingress));
+    zmsg_addstrf (reply, "%" PRIu64, metric_queue_shed (self->ingress));
+    return reply;
+}
+
+//  --------------------------------------------------------------------------
+//  Rules which fail: QUARANTINE/<rule>/<state>/<failures>/<remaining ms>/...,
+//  state is BROKEN, FAILING or QUARANTINED. Healthy rules are not listed.
+
+zmsg_t *
+flexible_alert_quarantine (flexible_alert_t *self)
+{
+    if (! self) return NULL;
+
+    zmsg_t *reply = zmsg_new ();
+    zmsg_addstr (reply, "QUARANTINE");
+    for (size_t i = 0; i < ruleset_size (self->rules); i++) {
+        rule_t *rule = ruleset_at (self->rules, i);
+        int failures;
+        int64_t remaining;
+        const char *state = rule_health (rule, &failures, &remaining);
+        if (streq (state, "OK"))
+            continue;
+        zmsg_addstr (reply, rule_name (rule));
+        zmsg_addstr (reply, state);
+        zmsg_addstrf (reply, "%d", failures);
+        zmsg_addstrf (reply, "%" PRIi64, remaining);
+    }
+    return reply;
+}
+
+//  --------------------------------------------------------------------------
+//  Share of assets of this instance: SHARD/<index>/<count>/<known assets>,
+//  not sharded instance is the only one of one
+
+zmsg_t *
+flexible_alert_shard (flexible_alert_t *self)
+{
+    if (! self) return NULL;
+
+    zmsg_t *reply = zmsg_new ();
+    zmsg_addstr (reply, "SHARD");
+    zmsg_addstrf (reply, "%zu", self->shards ? shard_map_index (self->shards) : 0);
+    zmsg_addstrf (reply, "%zu", self->shards ? shard_map_count (self->shards) : 1);
+    zmsg_addstrf (reply, "%zu", zhash_size (self->asset_infos));
+    return reply;
+}
+
 //  --------------------------------------------------------------------------
 //  handling requests for getting rule.
 
@@ -585,10 +1474,10 @@ flexible_alert_get_rule (flexible_alert_t *self, char *name)
 {
     if (! self || !name) return NULL;
 
-    rule_t *rule = (rule_t *) zhash_lookup (self->rules, name);
+    rule_t *rule = ruleset_lookup (self->rules, name);
     zmsg_t *reply = zmsg_new ();
     if (rule) {
-        char *json = rule_json (rule);
+        char *json = rule_json_expanded (rule);
         zmsg_addstr (reply, "OK");
         zmsg_addstr (reply, json);
         zstr_free (&json);
@@ -600,6 +1489,31 @@ flexible_alert_get_rule (flexible_alert_t *self, char *name)
     return reply;
 }
 
+//  --------------------------------------------------------------------------
+//  Publish rules with one rule added or replaced, rules take over the
+//  caller's reference. Rule is matched against known assets.
+
+static void
+flexible_alert_update_rule (flexible_alert_t *self, rule_t *rule)
+{
+    ruleset_t *rules = ruleset_dup (self->rules);
+    ruleset_insert (rules, rule);
+    flexible_alert_publish_rules (self, &rules);
+    flexible_alert_bind_rule (self, rule);
+}
+
+//  --------------------------------------------------------------------------
+//  Publish rules without one rule and unbind it from assets
+
+static void
+flexible_alert_remove_rule (flexible_alert_t *self, const char *name)
+{
+    flexible_alert_unbind_rule (self, name);
+    ruleset_t *rules = ruleset_dup (self->rules);
+    ruleset_remove (rules, name);
+    flexible_alert_publish_rules (self, &rules);
+}
+
 //  --------------------------------------------------------------------------
 //  handling requests for deleting rule.
 
@@ -612,13 +1526,26 @@ flexible_alert_delete_rule (flexible_alert_t *self, const char *name, const char
     zmsg_addstr (reply, "DELETE");
     zmsg_addstr (reply, name);
 
-    rule_t *rule = (rule_t *) zhash_lookup (self->rules, name);
-    if (rule) {
+    rule_t *rule = ruleset_lookup (self->rules, name);
+    if (rule && self->store) {
+        if (rule_store_delete (self->store, name) == 0) {
+            zmsg_addstr (reply, "OK");
+            flexible_alert_remove_rule (self, name);
+        } else {
+            log_error ("Can't remove %s from rule journal", name);
+            zmsg_addstr (reply, "ERROR");
+            zmsg_addstr (reply, "CAN_NOT_REMOVE");
+        }
+    }
+    else if (rule) {
         char *path = NULL;
         asprintf (&path, "%s/%s.rule", dir, name);
         if (unlink (path) == 0) {
             zmsg_addstr (reply, "OK");
-            zhash_delete (self->rules, name);
+            flexible_alert_remove_rule (self, name);
+            char *file = zsys_sprintf ("%s.rule", name);
+            zhash_delete (self->rule_files, file);
+            zstr_free (&file);
         } else {
             log_error ("Can't remove %s", path);
             zmsg_addstr (reply, "ERROR");
@@ -649,8 +1576,14 @@ flexible_alert_add_rule (flexible_alert_t *self, const char *json, const char *o
         rule_destroy (&newrule);
         return reply;
     };
+    if (flexible_alert_instantiate (self, newrule) != 0) {
+        zmsg_addstr (reply, "ERROR");
+        zmsg_addstr (reply, "UNKNOWN_TEMPLATE");
+        rule_destroy (&newrule);
+        return reply;
+    }
 
-    rule_t *oldrule = (rule_t *) zhash_lookup (self->rules, rule_name (newrule));
+    rule_t *oldrule = ruleset_lookup (self->rules, rule_name (newrule));
     // we probably shouldn't merge other rules
     if (incomplete && oldrule && strstr (rule_name (oldrule), "sensorgpio")) {
         log_info ("merging incomplete rule %s from fty-alert-engine",
@@ -662,12 +1595,28 @@ flexible_alert_add_rule (flexible_alert_t *self, const char *json, const char *o
         zmsg_t *msg = flexible_alert_delete_rule (self, old_name, dir);
         zmsg_destroy (&msg);
     }
-    rule_t *rule = (rule_t *) zhash_lookup (self->rules, rule_name (newrule));
+    rule_t *rule = ruleset_lookup (self->rules, rule_name (newrule));
     if (rule && strstr (rule_name (rule), "sensorgpio") == NULL) {
         log_error ("Rule %s exists", rule_name (rule));
         zmsg_addstr (reply, "ERROR");
         zmsg_addstr (reply, "ALREADY_EXISTS");
     }
+    else if (self->store) {
+        char *rjson = rule_json (newrule);
+        int r = rule_store_put (self->store, rule_name (newrule), rjson);
+        zstr_free (&rjson);
+        if (r != 0) {
+            log_error ("Error while saving rule %s to journal", rule_name (newrule));
+            zmsg_addstr (reply, "ERROR");
+            zmsg_addstr (reply, "SAVE_FAILURE");
+        }
+        else {
+            zmsg_addstr (reply, "OK");
+            zmsg_addstr (reply, json);
+            flexible_alert_update_rule (self, newrule);
+            newrule = NULL;
+        }
+    }
     else {
 
         char *path = NULL;
@@ -683,24 +1632,14 @@ flexible_alert_add_rule (flexible_alert_t *self, const char *json, const char *o
             zmsg_addstr (reply, json);
 
             log_info ("Loading rule %s", path);
-            rule_t* rule = flexible_alert_load_one_rule (self, path);
+            ruleset_t *rules = ruleset_dup (self->rules);
+            rule_t* rule = flexible_alert_load_one_rule (self, rules, path);
             log_info ("Loading rule %s done (%s)", path, (rule ? "success" : "failed"));
+            flexible_alert_publish_rules (self, &rules);
 
             if (rule) {
                 // we need to update our lists
-                zlist_t* assets = zhash_keys (self->assets);
-                const char* asset = (const char*) zlist_first(assets);
-                while (asset) {
-                    if (rule_asset_exists(rule, asset)) {
-                        zmsg_t *msg = zmsg_new ();
-                        zmsg_addstr (msg, "REPUBLISH");
-                        zmsg_addstr (msg, asset);
-                        mlm_client_sendto (self->mlm, "asset-agent", "REPUBLISH" , NULL, 5000, &msg);
-                        zmsg_destroy (&msg);
-                    }
-                    asset = (const char*) zlist_next(assets);
-                }
-                zlist_destroy (&assets);
+                flexible_alert_bind_rule (self, rule);
             }
         }
         zstr_free (&path);
@@ -709,6 +1648,12 @@ flexible_alert_add_rule (flexible_alert_t *self, const char *json, const char *o
     return reply;
 }
 
+//  --------------------------------------------------------------------------
+//  Actor polling metrics from shm. Every poll cycle is sent to the parent as
+//  POLL/metrics/count, parent evaluates and destroys the metrics, as it owns
+//  asset bindings and metric cache. Actor ends on STOP or $TERM, always
+//  sending STOPPED after the last POLL.
+
 void
 flexible_alert_metric_polling (zsock_t *pipe, void *args)
 {
@@ -717,7 +1662,6 @@ flexible_alert_metric_polling (zsock_t *pipe, void *args)
     zlist_t *params = (zlist_t*) args;
     char* assets_pattern = (char*)zlist_first (params);
     char* metrics_pattern = (char*)zlist_next (params);
-    flexible_alert_t *self = (flexible_alert_t*)zlist_next (params);;
 
     log_info("flexible_alert_metric_polling started (assets_pattern: %s, metrics_pattern: %s)", assets_pattern, metrics_pattern);
 
@@ -732,16 +1676,21 @@ flexible_alert_metric_polling (zsock_t *pipe, void *args)
             fty::shm::shmMetrics result;
             fty::shm::read_metrics(assets_pattern, metrics_pattern, result);
             log_debug("poll: read metrics from SHM (size: %d, assets: %s, metrics: %s)", result.size(), assets_pattern, metrics_pattern);
+            fty_proto_t **metrics = (fty_proto_t **) zmalloc ((result.size () + 1) * sizeof (fty_proto_t *));
+            assert (metrics);
+            uint64_t count = 0;
             for (auto &element : result) {
-                flexible_alert_handle_metric(self, &element, true);
+                metrics [count++] = element;
+                element = NULL;
             }
+            zsock_send (pipe, "sp8", "POLL", metrics, count);
         }
         else if (which == pipe) {
             zmsg_t *message = zmsg_recv (pipe);
             if (message) {
                 char *cmd = zmsg_popstr (message);
                 if (cmd) {
-                    if(streq (cmd, "$TERM")) {
+                    if(streq (cmd, "$TERM") || streq (cmd, "STOP")) {
                         zstr_free(&cmd);
                         zmsg_destroy(&message);
                         break;
@@ -754,11 +1703,474 @@ flexible_alert_metric_polling (zsock_t *pipe, void *args)
     }
 
     log_info ("flexible_alert_metric_polling: Terminating.");
+    zsock_send (pipe, "sp8", "STOPPED", NULL, (uint64_t) 0);
 
     zlist_destroy(&params);
     zpoller_destroy(&poller);
 }
 
+//  --------------------------------------------------------------------------
+//  Handle one message of stream client
+
+static void
+flexible_alert_handle_stream (flexible_alert_t *self, const char *address, zmsg_t **msg_p)
+{
+    if (!is_fty_proto (*msg_p)) {
+        zmsg_destroy (msg_p);
+        return;
+    }
+    fty_proto_t *fmsg = fty_proto_decode (msg_p);
+    if (fty_proto_id (fmsg) == FTY_PROTO_ASSET) {
+        log_trace(ANSI_COLOR_CYAN "Receive PROTO_ASSET %s@%s on stream %s" ANSI_COLOR_RESET,
+            fty_proto_operation (fmsg), fty_proto_name (fmsg), address);
+        flexible_alert_handle_asset (self, fmsg);
+    }
+    else if (fty_proto_id (fmsg) == FTY_PROTO_METRIC) {
+        log_trace(ANSI_COLOR_CYAN "Receive PROTO_METRIC %s@%s on stream %s" ANSI_COLOR_RESET,
+            fty_proto_type (fmsg), fty_proto_name (fmsg), address);
+
+        if (0 == strcmp(address, FTY_PROTO_STREAM_METRICS) ||
+            0 == strcmp(address, FTY_PROTO_STREAM_LICENSING_ANNOUNCEMENTS)) {
+            // messages from FTY_PROTO_STREAM_METRICS are regular metrics
+            // LICENSING.EXPIRE: bmsg publish licensing-limitation licensing.expire 7 days
+            flexible_alert_handle_metric (self, &fmsg, false);
+        }
+        else if (0 == strcmp(address, FTY_PROTO_STREAM_METRICS_SENSOR)) {
+            // messages from FTY_PROTO_STREAM_METRICS_SENSORS are gpi sensors
+            if (is_gpi_metric (fmsg))
+                flexible_alert_handle_metric_sensor (self, &fmsg);
+        }
+        else {
+            log_debug("Message proto ID = FTY_PROTO_METRIC, message address not valid = '%s'", address);
+        }
+    }
+    fty_proto_destroy (&fmsg);
+}
+
+//  --------------------------------------------------------------------------
+//  Is reply to ADD or DELETE request successful?
+
+static bool
+s_reply_ok (zmsg_t *reply)
+{
+    zframe_t *frame = zmsg_first (reply);
+    if (frame && zframe_streq (frame, "DELETE")) {
+        // DELETE/name/OK
+        zmsg_next (reply);
+        frame = zmsg_next (reply);
+    }
+    return frame && zframe_streq (frame, "OK");
+}
+
+//  --------------------------------------------------------------------------
+//  Send rule change done here to other shards, every shard keeps own copy
+//  of all rules. Shards reply with SHARD_REPLY subject.
+
+static void
+flexible_alert_replicate (flexible_alert_t *self, const char *cmd, const char *p1, const char *p2, bool incomplete)
+{
+    for (size_t i = 0; i < shard_map_count (self->shards); i++) {
+        if (i == shard_map_index (self->shards))
+            continue;
+        const char *peer = shard_map_peer (self->shards, i);
+        zmsg_t *msg = zmsg_new ();
+        zmsg_addstr (msg, cmd);
+        zmsg_addstr (msg, p1);
+        if (p2)
+            zmsg_addstr (msg, p2);
+        if (mlm_client_sendto (self->mlm, peer, incomplete ? SHARD_INCOMPLETE : SHARD_SUBJECT, NULL, 1000, &msg) != 0)
+            log_error ("Failed to replicate %s to shard %s", cmd, peer);
+        zmsg_destroy (&msg);
+    }
+}
+
+//  --------------------------------------------------------------------------
+//  Handle mailbox request of sender, return reply or NULL if there is none.
+//  Request frames are popped from the message.
+
+static zmsg_t *
+flexible_alert_handle_request (flexible_alert_t *self, const char *sender, const char *subject, zmsg_t *msg, const char *ruledir)
+{
+    if (streq (subject, SHARD_REPLY)) {
+        // other shard applied rule change replicated by us
+        if (!s_reply_ok (msg)) {
+            char *reason = zmsg_size (msg) ? zframe_strdup (zmsg_last (msg)) : NULL;
+            log_error ("Shard %s failed to apply rule change (%s)", sender, reason ? reason : "");
+            zstr_free (&reason);
+        }
+        return NULL;
+    }
+
+    // protocol frames COMMAND/param1/param2
+    char *cmd = zmsg_popstr (msg);
+    char *p1 = zmsg_popstr (msg);
+    char *p2 = zmsg_popstr (msg);
+
+    log_info("MAILBOX DELIVER: %s from %s", cmd, sender);
+
+    // rule changes done by other shard are not replicated again
+    bool from_shard = self->shards && shard_map_is_peer (self->shards, sender);
+
+    // XXX: fty-alert-engine does not know about configured
+    // actions. The proper fix is to extend the protocol to
+    // flag a rule as incomplete.
+    bool incomplete = streq (sender, "fty-autoconfig")
+        || (from_shard && streq (subject, SHARD_INCOMPLETE));
+
+    zmsg_t *reply = NULL;
+    if (!cmd) {
+        log_error("command is NULL");
+    }
+    else if (streq (cmd, "LIST")) {
+        // request: LIST/type/class
+        // reply: LIST/type/class/name1/name2/...nameX
+        // reply: ERROR/reason
+        log_info("%s %s %s", cmd, p1, p2);
+        reply = flexible_alert_list_rules (self, p1, p2);
+    }
+    else if (streq (cmd, "GET")) {
+        // request: GET/name
+        // reply: OK/rulejson
+        // reply: ERROR/reason
+        log_info("%s %s", cmd, p1);
+        reply = flexible_alert_get_rule (self, p1);
+    }
+    else if (streq (cmd, "ADD")) {
+        // request: ADD/rulejson -- this is create
+        // request: ADD/rulejson/rulename -- this is replace
+        // reply: OK/rulejson
+        // reply: ERROR/reason
+        log_info("%s %s %s (incomplete: %s)", cmd, p1, p2, (incomplete ? "true" : "false"));
+        reply = flexible_alert_add_rule (self, p1, p2, incomplete, ruledir);
+        if (self->shards && !from_shard && s_reply_ok (reply))
+            flexible_alert_replicate (self, cmd, p1, p2, incomplete);
+    }
+    else if (streq (cmd, "MEMORY")) {
+        // request: MEMORY
+        // reply: MEMORY/name1/bytes1/.../nameX/bytesX
+        reply = flexible_alert_memory (self);
+    }
+    else if (streq (cmd, "GC")) {
+        // request: GC
+        // reply: GC/hot_usecs/idle_usecs
+        reply = flexible_alert_gc (self);
+    }
+    else if (streq (cmd, "MEMO")) {
+        // request: MEMO
+        // reply: MEMO/hits/misses/hit_rate
+        reply = flexible_alert_memo (self);
+    }
+    else if (streq (cmd, "INGRESS")) {
+        // request: INGRESS
+        // reply: INGRESS/pending/coalesced/shed
+        reply = flexible_alert_ingress (self);
+    }
+    else if (streq (cmd, "QUARANTINE")) {
+        // request: QUARANTINE
+        // reply: QUARANTINE/name1/state1/failures1/remaining1/...
+        reply = flexible_alert_quarantine (self);
+    }
+    else if (streq (cmd, "SHARD")) {
+        // request: SHARD
+        // reply: SHARD/index/count/known_assets
+        reply = flexible_alert_shard (self);
+    }
+    else if (streq (cmd, "DELETE")) {
+        // request: DELETE/name
+        // reply: DELETE/name/OK
+        // reply: DELETE/name/ERROR/reason
+        log_info("%s %s", cmd, p1);
+        reply = flexible_alert_delete_rule (self, p1, ruledir);
+        if (self->shards && !from_shard && s_reply_ok (reply))
+            flexible_alert_replicate (self, cmd, p1, NULL, false);
+    }
+    else {
+        log_warning("command '%s' not handled", cmd);
+    }
+
+
+    zstr_free (&cmd);
+    zstr_free (&p1);
+    zstr_free (&p2);
+    return reply;
+}
+
+//  --------------------------------------------------------------------------
+//  Handle one message of mailbox client
+
+static void
+flexible_alert_handle_mailbox (flexible_alert_t *self, const char *ruledir)
+{
+    zmsg_t *msg = mlm_client_recv (self->mlm);
+    if (!msg)
+        return;
+    const char *sender = mlm_client_sender (self->mlm);
+    flexible_alert_record (self, INPUT_LOG_MAILBOX, sender, mlm_client_subject (self->mlm), msg);
+    if (is_fty_proto (msg))
+        flexible_alert_handle_stream (self, mlm_client_address (self->mlm), &msg);
+    else
+    if (streq (mlm_client_command (self->mlm), "MAILBOX DELIVER")) {
+        // someone is addressing us directly
+        zmsg_t *reply = flexible_alert_handle_request (self, sender, mlm_client_subject (self->mlm), msg, ruledir);
+        if (reply) {
+            bool from_shard = self->shards && shard_map_is_peer (self->shards, sender);
+            mlm_client_sendto (
+                self->mlm,
+                sender,
+                from_shard ? SHARD_REPLY : mlm_client_subject (self->mlm),
+                mlm_client_tracker (self->mlm),
+                1000,
+                &reply
+            );
+            if (reply) {
+                log_error ("Failed to send reply to %s", sender);
+            }
+        }
+        zmsg_destroy (&reply);
+    }
+    zmsg_destroy (&msg);
+}
+
+//  --------------------------------------------------------------------------
+//  Has client a message to receive?
+
+static bool
+s_client_ready (mlm_client_t *client)
+{
+    return (zsock_events (mlm_client_msgpipe (client)) & ZMQ_POLLIN) != 0;
+}
+
+//  --------------------------------------------------------------------------
+//  One round of weighted service of clients: mailbox requests first, then
+//  asset updates, then metrics. Metrics give way as soon as a mailbox
+//  request arrives, so a request waits for one metric evaluation at most.
+//  Received metrics wait in ingress queue, where newer value of the same
+//  subject replaces the pending one.
+
+static void
+flexible_alert_serve (flexible_alert_t *self, const char *ruledir)
+{
+    for (int i = 0; i < MAILBOX_WEIGHT && s_client_ready (self->mlm); i++)
+        flexible_alert_handle_mailbox (self, ruledir);
+    for (int i = 0; i < ASSET_WEIGHT && s_client_ready (self->asset_stream); i++) {
+        zmsg_t *msg = mlm_client_recv (self->asset_stream);
+        flexible_alert_record (self, INPUT_LOG_STREAM, mlm_client_address (self->asset_stream),
+            mlm_client_subject (self->asset_stream), msg);
+        flexible_alert_handle_stream (self, mlm_client_address (self->asset_stream), &msg);
+    }
+    uint64_t shed = metric_queue_shed (self->ingress);
+    for (int i = 0; i < INGRESS_BATCH && s_client_ready (self->metric_stream); i++) {
+        zmsg_t *msg = mlm_client_recv (self->metric_stream);
+        const char *subject = mlm_client_subject (self->metric_stream);
+        flexible_alert_record (self, INPUT_LOG_STREAM, mlm_client_address (self->metric_stream), subject, msg);
+        //  metrics of assets owned by other shard are dropped undecoded
+        const char *at = subject ? strrchr (subject, '@') : NULL;
+        if (msg && at && streq (mlm_client_address (self->metric_stream), FTY_PROTO_STREAM_METRICS)
+        &&  !flexible_alert_owns (self, at + 1))
+            zmsg_destroy (&msg);
+        else
+        if (msg && subject && *subject)
+            metric_queue_push (self->ingress, mlm_client_address (self->metric_stream), subject, &msg);
+        else
+        if (msg)
+            flexible_alert_handle_stream (self, mlm_client_address (self->metric_stream), &msg);
+    }
+    if (metric_queue_shed (self->ingress) > shed)
+        log_warning ("ingress queue is full, %" PRIu64 " metrics dropped",
+            metric_queue_shed (self->ingress) - shed);
+    for (int i = 0; i < METRIC_WEIGHT && metric_queue_size (self->ingress); i++) {
+        if (s_client_ready (self->mlm))
+            break;
+        zmsg_t *msg = metric_queue_pop (self->ingress);
+        flexible_alert_handle_stream (self, metric_queue_stream (self->ingress), &msg);
+    }
+}
+
+//  --------------------------------------------------------------------------
+//  Clock of replay, time of record being replayed
+
+static time_t
+s_replay_clock (void *arg)
+{
+    return *(time_t *) arg;
+}
+
+//  --------------------------------------------------------------------------
+//  Sink of replay when caller didn't set one, recorded alerts are counted
+//  and dropped not to be published again on live stream
+
+static void
+s_replay_sink (void *arg, const char *topic, zmsg_t **alert_p)
+{
+    (*(size_t *) arg)++;
+    log_debug ("replayed alert %s not published", topic);
+    zmsg_destroy (alert_p);
+}
+
+//  --------------------------------------------------------------------------
+//  Wait on actor pipe until time of next record. Returns false if replay
+//  has to stop, on $TERM or interrupt. Other commands are not handled
+//  during replay.
+
+static bool
+flexible_alert_replay_wait (zpoller_t *poller, zsock_t *pipe, int64_t until, bool *terminated)
+{
+    while (true) {
+        int64_t wait = until - zclock_usecs ();
+        void *which = zpoller_wait (poller, wait >= 1000 ? (int) (wait / 1000) : 0);
+        if (zpoller_terminated (poller))
+            return false;
+        if (which != pipe)
+            return true;
+        zmsg_t *msg = zmsg_recv (pipe);
+        char *cmd = msg ? zmsg_popstr (msg) : NULL;
+        bool term = !cmd || streq (cmd, "$TERM");
+        if (!term)
+            log_warning ("command %s ignored during replay", cmd);
+        zstr_free (&cmd);
+        zmsg_destroy (&msg);
+        if (term) {
+            *terminated = true;
+            return false;
+        }
+    }
+}
+
+//  --------------------------------------------------------------------------
+//  Replay input log, pipe of actor (or NULL) is watched for $TERM while
+//  records are fed to engine.
+
+#define REPLAY_CHECK 256           //  records replayed between checks of pipe
+
+static int
+flexible_alert_replay_input (flexible_alert_t *self, const char *path, double speed, const char *ruledir,
+    zsock_t *pipe, bool *terminated)
+{
+    if (!self || !path) return -1;
+
+    input_log_t *log = input_log_new (path, false);
+    if (!log)
+        return -1;
+    flexible_alert_clock_fn *clock = self->clock;
+    void *clock_arg = self->clock_arg;
+    time_t now = 0;
+    flexible_alert_set_clock (self, s_replay_clock, &now);
+    //  recorded alerts went to stream already
+    size_t dropped = 0;
+    bool sink = self->sink == NULL;
+    if (sink)
+        flexible_alert_set_sink (self, s_replay_sink, &dropped);
+    zpoller_t *poller = pipe ? zpoller_new (pipe, NULL) : NULL;
+
+    int records = 0;
+    int64_t first = 0, start = zclock_usecs ();
+    while (!zsys_interrupted && input_log_read (log) == 0) {
+        int64_t at = input_log_time (log);
+        if (records == 0)
+            first = at;
+        int64_t until = speed > 0 ? start + (int64_t) ((at - first) / speed) : 0;
+        if (poller) {
+            if ((until - zclock_usecs () >= 1000 || records % REPLAY_CHECK == 0)
+            &&  !flexible_alert_replay_wait (poller, pipe, until, terminated))
+                break;
+        }
+        else {
+            int64_t wait = until - zclock_usecs ();
+            if (wait >= 1000)
+                zclock_sleep ((int) (wait / 1000));
+        }
+        now = (time_t) (at / 1000000);
+
+        if (input_log_kind (log) == INPUT_LOG_POLL) {
+            size_t count = input_log_count (log);
+            fty_proto_t **metrics = (fty_proto_t **) zmalloc ((count + 1) * sizeof (fty_proto_t *));
+            assert (metrics);
+            for (size_t i = 0; i < count; i++) {
+                zmsg_t *msg = input_log_pop (log);
+                metrics [i] = msg ? fty_proto_decode (&msg) : NULL;
+            }
+            flexible_alert_handle_metrics (self, metrics, count);
+            for (size_t i = 0; i < count; i++)
+                fty_proto_destroy (&metrics [i]);
+            free (metrics);
+        }
+        else {
+            zmsg_t *msg = input_log_pop (log);
+            if (msg && input_log_kind (log) == INPUT_LOG_MAILBOX && !is_fty_proto (msg)) {
+                zmsg_t *reply = flexible_alert_handle_request (self, input_log_address (log),
+                    input_log_subject (log), msg, ruledir);
+                zmsg_destroy (&reply);
+            }
+            else
+            if (msg)
+                flexible_alert_handle_stream (self, input_log_address (log), &msg);
+            zmsg_destroy (&msg);
+        }
+        records++;
+    }
+    log_info ("replayed %d records of %s in %d ms", records, path, (int) ((zclock_usecs () - start) / 1000));
+    if (sink) {
+        log_info ("%zu replayed alerts not published", dropped);
+        flexible_alert_set_sink (self, NULL, NULL);
+    }
+    zpoller_destroy (&poller);
+    flexible_alert_set_clock (self, clock, clock_arg);
+    input_log_destroy (&log);
+    return records;
+}
+
+//  --------------------------------------------------------------------------
+//  Feed input recorded by RECORD command of actor to the engine, with
+//  clock running as it was recorded. Speed 1 replays at original pace,
+//  N N times faster, 0 as fast as possible. Rule requests are applied to
+//  ruledir, which should be a scratch copy of rules. Alerts go to sink,
+//  if none is set they are counted and dropped. Returns number of
+//  replayed records or -1 if log can't be read.
+
+static int
+flexible_alert_replay (flexible_alert_t *self, const char *path, double speed, const char *ruledir)
+{
+    return flexible_alert_replay_input (self, path, speed, ruledir, NULL, NULL);
+}
+
+//  --------------------------------------------------------------------------
+//  Handle POLL of metric polling actor. Returns false if polling stopped.
+
+static bool
+flexible_alert_handle_poll (flexible_alert_t *self, zactor_t *metric_polling)
+{
+    char *cmd = NULL;
+    fty_proto_t **metrics = NULL;
+    uint64_t count = 0;
+    if (zsock_recv (metric_polling, "sp8", &cmd, &metrics, &count) != 0)
+        return false;
+    bool poll = cmd && streq (cmd, "POLL");
+    if (poll && metrics) {
+        flexible_alert_handle_metrics (self, metrics, count);
+        for (uint64_t i = 0; i < count; i++)
+            fty_proto_destroy (&metrics [i]);
+    }
+    free (metrics);
+    zstr_free (&cmd);
+    return poll;
+}
+
+//  --------------------------------------------------------------------------
+//  Stop metric polling actor, polls sent before it stopped are handled.
+//  Polling may have ended already, so STOP isn't waited for.
+
+static void
+flexible_alert_stop_polling (flexible_alert_t *self, zactor_t **metric_polling_p)
+{
+    if (!*metric_polling_p)
+        return;
+    zsock_set_sndtimeo (zactor_sock (*metric_polling_p), 0);
+    zstr_send (*metric_polling_p, "STOP");
+    while (flexible_alert_handle_poll (self, *metric_polling_p))
+        ;
+    zactor_destroy (metric_polling_p);
+}
+
 //  --------------------------------------------------------------------------
 //  Actor running one instance of flexible alert class
 
@@ -769,14 +2181,40 @@ flexible_alert_actor (zsock_t *pipe, void *args)
     assert (self);
     zsock_signal (pipe, 0);
     char *ruledir = NULL;
+    zactor_t *rule_watch = NULL;
 
     zlist_t *params = (zlist_t*) args;
     zlist_append (params, self);
     zactor_t *metric_polling =  zactor_new (flexible_alert_metric_polling, params);
 
-    zpoller_t *poller = zpoller_new (mlm_client_msgpipe(self->mlm), pipe, NULL);
-    while (!zsys_interrupted) {
-        void *which = zpoller_wait (poller, -1);
+    zpoller_t *poller = zpoller_new (pipe, mlm_client_msgpipe (self->mlm),
+        mlm_client_msgpipe (self->asset_stream), mlm_client_msgpipe (self->metric_stream), metric_polling, NULL);
+    int64_t republish_at = zclock_mono () + REPUBLISH_INTERVAL;
+    bool garbage = true;
+    bool terminated = false;
+    while (!zsys_interrupted && !terminated) {
+        int timeout = (int) (republish_at - zclock_mono ());
+        if (garbage && timeout > GC_IDLE_INTERVAL)
+            timeout = GC_IDLE_INTERVAL;
+        int deferred = flexible_alert_deferred_timeout (self);
+        if (deferred >= 0 && timeout > deferred)
+            timeout = deferred;
+        //  pending metrics are handled without waiting
+        bool pending = metric_queue_size (self->ingress) > 0;
+        if (pending)
+            timeout = 0;
+        void *which = zpoller_wait (poller, timeout > 0 ? timeout : 0);
+        if (flexible_alert_evaluate_deferred (self))
+            garbage = true;
+        if (zclock_mono () >= republish_at) {
+            flexible_alert_flush_republish (self);
+            republish_at = zclock_mono () + REPUBLISH_INTERVAL;
+        }
+        if (which || pending)
+            garbage = true;
+        else
+        if (garbage && zpoller_expired (poller))
+            garbage = rule_chunk_gc_idle ();
         if (which == pipe) {
             zmsg_t *msg = zmsg_recv (pipe);
             char *cmd = zmsg_popstr (msg);
@@ -790,10 +2228,40 @@ flexible_alert_actor (zsock_t *pipe, void *args)
                     char *endpoint = zmsg_popstr (msg);
                     char *myname = zmsg_popstr (msg);
                     assert (endpoint && myname);
+                    if (self->shards) {
+                        zstr_free (&myname);
+                        myname = strdup (shard_map_peer (self->shards, shard_map_index (self->shards)));
+                    }
                     mlm_client_connect (self->mlm, endpoint, 5000, myname);
+                    //  streams have own connections, so metric flood doesn't
+                    //  delay mailbox requests
+                    char *name = zsys_sprintf ("%s-assets", myname);
+                    mlm_client_connect (self->asset_stream, endpoint, 5000, name);
+                    zstr_free (&name);
+                    name = zsys_sprintf ("%s-metrics", myname);
+                    mlm_client_connect (self->metric_stream, endpoint, 5000, name);
+                    zstr_free (&name);
                     zstr_free (&endpoint);
                     zstr_free (&myname);
                 }
+                else if (streq (cmd, "SHARD")) {
+                    // SHARD/name/index/count, before BIND: instance evaluates
+                    // only its share of assets, name is the one of shard 0
+                    char *name = zmsg_popstr (msg);
+                    char *index = zmsg_popstr (msg);
+                    char *count = zmsg_popstr (msg);
+                    assert (name && index && count);
+                    shard_map_destroy (&self->shards);
+                    self->shards = shard_map_new (name, (size_t) atoi (index), (size_t) atoi (count));
+                    if (self->shards)
+                        log_info ("shard %s of %s, mailbox %s", index, count,
+                            shard_map_peer (self->shards, shard_map_index (self->shards)));
+                    else
+                        log_error ("invalid shard %s of %s, evaluating all assets", index, count);
+                    zstr_free (&name);
+                    zstr_free (&index);
+                    zstr_free (&count);
+                }
                 else if (streq (cmd, "PRODUCER")) {
                     char *stream = zmsg_popstr (msg);
                     assert (stream);
@@ -804,15 +2272,101 @@ flexible_alert_actor (zsock_t *pipe, void *args)
                     char *stream = zmsg_popstr (msg);
                     char *pattern = zmsg_popstr (msg);
                     assert (stream && pattern);
-                    mlm_client_set_consumer (self->mlm, stream, pattern);
+                    mlm_client_t *client = streq (stream, FTY_PROTO_STREAM_ASSETS) ? self->asset_stream : self->metric_stream;
+                    mlm_client_set_consumer (client, stream, pattern);
                     zstr_free (&stream);
                     zstr_free (&pattern);
                 }
+                else if (streq (cmd, "JOURNAL")) {
+                    char *path = zmsg_popstr (msg);
+                    assert (path);
+                    rule_store_destroy (&self->store);
+                    self->store = rule_store_new (path);
+                    if (!self->store)
+                        log_error ("can't use rule journal %s, keeping one file per rule", path);
+                    zstr_free (&path);
+                }
+                else if (streq (cmd, "LUALIMITS")) {
+                    // LUALIMITS/instructions/memory, 0 for no limit
+                    char *instructions = zmsg_popstr (msg);
+                    char *memory = zmsg_popstr (msg);
+                    assert (instructions && memory);
+                    rule_chunk_set_limits (atoi (instructions), (size_t) strtoull (memory, NULL, 10));
+                    log_info ("lua limits: %s instructions, %s bytes", instructions, memory);
+                    zstr_free (&instructions);
+                    zstr_free (&memory);
+                }
+                else if (streq (cmd, "LUAGC")) {
+                    // LUAGC/budget, microseconds of one idle collection, 0 for lua default
+                    char *budget = zmsg_popstr (msg);
+                    assert (budget);
+                    rule_chunk_set_gc_budget (atoi (budget));
+                    log_info ("lua idle gc budget: %s us", budget);
+                    zstr_free (&budget);
+                }
+                else if (streq (cmd, "MININTERVAL")) {
+                    // MININTERVAL/ms, default time between evaluations of rule for one asset
+                    char *interval = zmsg_popstr (msg);
+                    assert (interval);
+                    self->min_interval = atoi (interval) > 0 ? atoi (interval) : 0;
+                    log_info ("minimal interval of evaluations: %s ms", interval);
+                    zstr_free (&interval);
+                }
+                else if (streq (cmd, "LUAALLOCATOR")) {
+                    // LUAALLOCATOR/pool|system, for rules loaded later
+                    char *allocator = zmsg_popstr (msg);
+                    assert (allocator);
+                    rule_chunk_set_pool (!streq (allocator, "system"));
+                    log_info ("lua allocator: %s", streq (allocator, "system") ? "system" : "pool");
+                    zstr_free (&allocator);
+                }
+                else if (streq (cmd, "RECORD")) {
+                    // RECORD/path, append all received input to log
+                    char *path = zmsg_popstr (msg);
+                    assert (path);
+                    if (self->recorder)
+                        log_warning ("input is already recorded, %s not used", path);
+                    else {
+                        self->recorder = input_log_new (path, true);
+                        if (self->recorder)
+                            log_info ("recording input to %s", path);
+                    }
+                    zstr_free (&path);
+                }
+                else if (streq (cmd, "REPLAY")) {
+                    // REPLAY/path/speed, reply REPLAYED/records; live shm
+                    // polling is stopped not to mix with recorded polls
+                    char *path = zmsg_popstr (msg);
+                    char *speed = zmsg_popstr (msg);
+                    assert (path);
+                    zpoller_remove (poller, metric_polling);
+                    flexible_alert_stop_polling (self, &metric_polling);
+                    int records = flexible_alert_replay_input (self, path, speed ? atof (speed) : 1, ruledir,
+                        pipe, &terminated);
+                    if (!terminated)
+                        zsock_send (pipe, "si", "REPLAYED", records);
+                    zstr_free (&path);
+                    zstr_free (&speed);
+                }
+                else if (streq (cmd, "EXPORTRULES")) {
+                    char *path = zmsg_popstr (msg);
+                    assert (path);
+                    if (self->store)
+                        rule_store_export (self->store, path);
+                    zstr_free (&path);
+                }
                 else if (streq (cmd, "LOADRULES")) {
+                    if (rule_watch) {
+                        zpoller_remove (poller, rule_watch);
+                        zactor_destroy (&rule_watch);
+                    }
                     zstr_free (&ruledir);
                     ruledir = zmsg_popstr (msg);
                     assert (ruledir);
                     flexible_alert_load_rules (self, ruledir);
+                    // pick up rule files changed later
+                    rule_watch = zactor_new (rule_watch_actor, ruledir);
+                    zpoller_add (poller, rule_watch);
                 }
                 else {
                     log_warning ("Unknown command.");
@@ -822,112 +2376,36 @@ flexible_alert_actor (zsock_t *pipe, void *args)
             }
             zmsg_destroy (&msg);
         }
-        else if (which == mlm_client_msgpipe (self->mlm)) {
-            zmsg_t *msg = mlm_client_recv (self->mlm);
-            if (is_fty_proto (msg)) {
-                fty_proto_t *fmsg = fty_proto_decode (&msg);
-                if (fty_proto_id (fmsg) == FTY_PROTO_ASSET) {
-                    const char *address = mlm_client_address(self->mlm);
-                    log_trace(ANSI_COLOR_CYAN "Receive PROTO_ASSET %s@%s on stream %s" ANSI_COLOR_RESET,
-                        fty_proto_operation (fmsg), fty_proto_name (fmsg), address);
-                    flexible_alert_handle_asset (self, fmsg);
-                }
-                else if (fty_proto_id (fmsg) == FTY_PROTO_METRIC) {
-                    const char *address = mlm_client_address(self->mlm);
-                    log_trace(ANSI_COLOR_CYAN "Receive PROTO_METRIC %s@%s on stream %s" ANSI_COLOR_RESET,
-                        fty_proto_type (fmsg), fty_proto_name (fmsg), address);
-
-                    if (0 == strcmp(address, FTY_PROTO_STREAM_METRICS) ||
-                        0 == strcmp(address, FTY_PROTO_STREAM_LICENSING_ANNOUNCEMENTS)) {
-                        // messages from FTY_PROTO_STREAM_METRICS are regular metrics
-                        // LICENSING.EXPIRE: bmsg publish licensing-limitation licensing.expire 7 days
-                        flexible_alert_handle_metric (self, &fmsg, false);
-                    }
-                    else if (0 == strcmp(address, FTY_PROTO_STREAM_METRICS_SENSOR)) {
-                        // messages from FTY_PROTO_STREAM_METRICS_SENSORS are gpi sensors
-                        if (is_gpi_metric (fmsg))
-                            flexible_alert_handle_metric_sensor (self, &fmsg);
-                    }
-                    else {
-                        log_debug("Message proto ID = FTY_PROTO_METRIC, message address not valid = '%s'", address);
-                    }
-                }
-                fty_proto_destroy (&fmsg);
-            }
-            else if (streq (mlm_client_command (self->mlm), "MAILBOX DELIVER")) {
-                // someone is addressing us directly
-                // protocol frames COMMAND/param1/param2
-                char *cmd = zmsg_popstr (msg);
-                char *p1 = zmsg_popstr (msg);
-                char *p2 = zmsg_popstr (msg);
-
-                log_info("MAILBOX DELIVER: %s from %s", cmd, mlm_client_sender (self->mlm));
-
-                // XXX: fty-alert-engine does not know about configured
-                // actions. The proper fix is to extend the protocol to
-                // flag a rule as incomplete.
-                bool incomplete = streq (mlm_client_sender (self->mlm), "fty-autoconfig");
-
-                zmsg_t *reply = NULL;
-                if (!cmd) {
-                    log_error("command is NULL");
-                }
-                else if (streq (cmd, "LIST")) {
-                    // request: LIST/type/class
-                    // reply: LIST/type/class/name1/name2/...nameX
-                    // reply: ERROR/reason
-                    log_info("%s %s %s", cmd, p1, p2);
-                    reply = flexible_alert_list_rules (self, p1, p2);
-                }
-                else if (streq (cmd, "GET")) {
-                    // request: GET/name
-                    // reply: OK/rulejson
-                    // reply: ERROR/reason
-                    log_info("%s %s", cmd, p1);
-                    reply = flexible_alert_get_rule (self, p1);
-                }
-                else if (streq (cmd, "ADD")) {
-                    // request: ADD/rulejson -- this is create
-                    // request: ADD/rulejson/rulename -- this is replace
-                    // reply: OK/rulejson
-                    // reply: ERROR/reason
-                    log_info("%s %s %s (incomplete: %s)", cmd, p1, p2, (incomplete ? "true" : "false"));
-                    reply = flexible_alert_add_rule (self, p1, p2, incomplete, ruledir);
-                }
-                else if (streq (cmd, "DELETE")) {
-                    // request: DELETE/name
-                    // reply: DELETE/name/OK
-                    // reply: DELETE/name/ERROR/reason
-                    log_info("%s %s", cmd, p1);
-                    reply = flexible_alert_delete_rule (self, p1, ruledir);
-                }
-                else {
-                    log_warning("command '%s' not handled", cmd);
-                }
-
-                if (reply) {
-                    mlm_client_sendto (
-                        self->mlm,
-                        mlm_client_sender (self->mlm),
-                        mlm_client_subject (self->mlm),
-                        mlm_client_tracker (self->mlm),
-                        1000,
-                        &reply
-                    );
-                    if (reply) {
-                        log_error ("Failed to send %s reply to %s", cmd, mlm_client_sender (self->mlm));
-                    }
+        else if (rule_watch && which == rule_watch) {
+            zmsg_t *msg = zmsg_recv (rule_watch);
+            char *cmd = zmsg_popstr (msg);
+            if (cmd && streq (cmd, "CHANGED")) {
+                zlist_t *files = zlist_new ();
+                zlist_autofree (files);
+                char *file = zmsg_popstr (msg);
+                while (file) {
+                    zlist_append (files, file);
+                    zstr_free (&file);
+                    file = zmsg_popstr (msg);
                 }
-                zmsg_destroy (&reply);
-                zstr_free (&cmd);
-                zstr_free (&p1);
-                zstr_free (&p2);
+                flexible_alert_reload_rule_files (self, ruledir, files);
+                zlist_destroy (&files);
             }
+            zstr_free (&cmd);
             zmsg_destroy (&msg);
         }
+        else if (metric_polling && which == metric_polling) {
+            if (!flexible_alert_handle_poll (self, metric_polling)) {
+                zpoller_remove (poller, metric_polling);
+                zactor_destroy (&metric_polling);
+            }
+        }
+        else if (which || pending)
+            flexible_alert_serve (self, ruledir);
     }
 
-    zactor_destroy(&metric_polling);
+    flexible_alert_stop_polling (self, &metric_polling);
+    zactor_destroy (&rule_watch);
     zstr_free (&ruledir);
     zpoller_destroy (&poller);
     flexible_alert_destroy (&self);
@@ -936,6 +2414,258 @@ flexible_alert_actor (zsock_t *pipe, void *args)
 //  --------------------------------------------------------------------------
 //  Self test of this class
 
+//  Create racks in group batch-racks
+static void
+s_test_batch_racks (flexible_alert_t *self, size_t from, size_t to)
+{
+    zhash_t *ext = zhash_new ();
+    zhash_autofree (ext);
+    zhash_insert (ext, "group.1", (void *) "batch-racks");
+    for (size_t i = from; i < to; i++) {
+        char *name = zsys_sprintf ("batch-rack-%zu", i);
+        zmsg_t *assetmsg = fty_proto_encode_asset (NULL, name, FTY_PROTO_ASSET_OP_UPDATE, ext);
+        fty_proto_t *ftymsg = fty_proto_decode (&assetmsg);
+        flexible_alert_handle_asset (self, ftymsg);
+        fty_proto_destroy (&ftymsg);
+        zstr_free (&name);
+    }
+    zhash_destroy (&ext);
+}
+
+//  Feed one shm poll cycle of load metrics to racks, first ones overloaded
+static int64_t
+s_test_batch_cycle (flexible_alert_t *self, size_t racks, size_t overloaded, int ttl, bool batch)
+{
+    fty_proto_t **metrics = (fty_proto_t **) zmalloc (racks * sizeof (fty_proto_t *));
+    for (size_t i = 0; i < racks; i++) {
+        char *name = zsys_sprintf ("batch-rack-%zu", i);
+        zmsg_t *msg = fty_proto_encode_metric (NULL, time (NULL), ttl, "load.input", name,
+            i < overloaded ? "95" : "10", "%");
+        metrics [i] = fty_proto_decode (&msg);
+        zstr_free (&name);
+    }
+    int64_t start = zclock_usecs ();
+    if (batch)
+        flexible_alert_handle_metrics (self, metrics, racks);
+    else
+        for (size_t i = 0; i < racks; i++)
+            flexible_alert_handle_metric (self, &metrics [i], true);
+    int64_t time = zclock_usecs () - start;
+    for (size_t i = 0; i < racks; i++)
+        fty_proto_destroy (&metrics [i]);
+    free (metrics);
+    return time;
+}
+
+//  Count alerts until there is nothing more to receive
+static int
+s_test_count_alerts (mlm_client_t *client)
+{
+    int alerts = 0;
+    zpoller_t *poller = zpoller_new (mlm_client_msgpipe (client), NULL);
+    while (zpoller_wait (poller, 500)) {
+        zmsg_t *msg = mlm_client_recv (client);
+        zmsg_destroy (&msg);
+        alerts++;
+    }
+    zpoller_destroy (&poller);
+    return alerts;
+}
+
+//  Performance stage: fixed workload, results compared with baseline
+#define PERF_RULES      1000
+#define PERF_ASSETS     2000
+#define PERF_METRICS    10000
+#define PERF_LISTS      20
+
+//  Sink of performance stage, counts alerts
+static void
+s_perf_sink (void *arg, const char *topic, zmsg_t **alert_p)
+{
+    (*(size_t *) arg)++;
+    zmsg_destroy (alert_p);
+}
+
+//  Peak resident set size [kB], 0 if unknown
+static size_t
+s_perf_peak_rss (void)
+{
+    size_t peak = 0;
+    FILE *file = fopen ("/proc/self/status", "r");
+    if (!file)
+        return 0;
+    char line [256];
+    while (fgets (line, sizeof (line), file))
+        if (sscanf (line, "VmHWM: %zu", &peak) == 1)
+            break;
+    fclose (file);
+    return peak;
+}
+
+//  Compare result with perf/<name> of baseline: value, tolerance and
+//  better (lower or higher). Returns true on regression.
+static bool
+s_perf_check (zconfig_t *baseline, FILE *save, const char *name, double result)
+{
+    char *key = zsys_sprintf ("perf/%s/value", name);
+    double value = atof (zconfig_get (baseline, key, "0"));
+    zstr_free (&key);
+    key = zsys_sprintf ("perf/%s/tolerance", name);
+    double tolerance = atof (zconfig_get (baseline, key, "0.25"));
+    zstr_free (&key);
+    key = zsys_sprintf ("perf/%s/better", name);
+    bool higher = streq (zconfig_get (baseline, key, "lower"), "higher");
+    zstr_free (&key);
+
+    bool regression = value > 0
+        && (higher ? result < value * (1 - tolerance) : result > value * (1 + tolerance));
+    if (value > 0)
+        printf ("\t    %-20s %12.1f  baseline %12.1f +-%2.0f %% %s\n", name, result, value, tolerance * 100,
+            regression ? ANSI_COLOR_RED "REGRESSION" ANSI_COLOR_RESET : "");
+    else
+        printf ("\t    %-20s %12.1f  baseline not measured\n", name, result);
+    if (save)
+        fprintf (save, "    %s\n        value = %.1f\n        tolerance = %.2f\n        better = %s\n",
+            name, result, tolerance, higher ? "higher" : "lower");
+    return regression;
+}
+
+//  Run performance stage with rules written to dir. Returns number of
+//  regressions against baseline; results are written to save_path
+//  as new baseline if not NULL.
+static int
+s_perf_stage (const char *dir, const char *baseline_path, const char *save_path)
+{
+    zconfig_t *baseline = zconfig_load (baseline_path);
+    assert (baseline);
+    FILE *save = save_path ? fopen (save_path, "w") : NULL;
+    if (save) {
+        //  baseline is valid only for the machine and build it was measured on
+        struct utsname host;
+        if (uname (&host) != 0)
+            memset (&host, 0, sizeof (host));
+        char date [32];
+        time_t now = time (NULL);
+        strftime (date, sizeof (date), "%Y-%m-%d", gmtime (&now));
+        fprintf (save, "#   Baseline of performance stage of flexible_alert selftest, measured\n"
+            "#   by FTY_ALERT_FLEXIBLE_SELFTEST_PERF=save make check-perf on %s\n"
+            "#   host %s, %s %s %s, %ld CPUs, %s build\n"
+            "perf\n",
+            date, host.nodename, host.sysname, host.release, host.machine, sysconf (_SC_NPROCESSORS_ONLN),
+#if defined (NDEBUG)
+            "release"
+#else
+            "debug"
+#endif
+            );
+    }
+
+    //  peak resident set size is counted from here, if kernel can reset it
+    FILE *clear_refs = fopen ("/proc/self/clear_refs", "w");
+    if (clear_refs) {
+        fputs ("5", clear_refs);
+        fclose (clear_refs);
+    }
+
+    //  rules match assets by name, group or model
+    zsys_dir_create (dir);
+    for (int i = 0; i < PERF_RULES; i++) {
+        char *match = i % 3 == 0 ? zsys_sprintf ("\"assets\":[\"perf-ups-%d\"]", i)
+            : i % 3 == 1 ? zsys_sprintf ("\"groups\":[\"perf-group-%d\"]", i % 100)
+            : zsys_sprintf ("\"models\":[\"PERF-%d\"]", i % 200);
+        char *path = zsys_sprintf ("%s/perf-%d.rule", dir, i);
+        FILE *file = fopen (path, "w");
+        assert (file);
+        fprintf (file, "{\"name\":\"perf-%d\",\"metrics\":[\"perf.load\"],%s,"
+            "\"evaluation\":\"function main (load) if tonumber (load) > 90 then return CRITICAL, 'high' end "
+            "return OK, 'fine' end\"}", i, match);
+        fclose (file);
+        zstr_free (&path);
+        zstr_free (&match);
+    }
+
+    flexible_alert_t *self = flexible_alert_new ();
+    size_t alerts = 0;
+    flexible_alert_set_sink (self, s_perf_sink, &alerts);
+    int64_t start = zclock_usecs ();
+    flexible_alert_load_rules (self, dir);
+    double load_rules = (zclock_usecs () - start) / 1000.0;
+    assert (ruleset_size (self->rules) == PERF_RULES);
+
+    //  assets, messages are decoded in advance
+    fty_proto_t **messages = (fty_proto_t **) zmalloc (PERF_ASSETS * sizeof (fty_proto_t *));
+    zhash_t *ext = zhash_new ();
+    zhash_autofree (ext);
+    for (int i = 0; i < PERF_ASSETS; i++) {
+        char *name = zsys_sprintf ("perf-ups-%d", i);
+        char *group = zsys_sprintf ("perf-group-%d", i % 100);
+        char *model = zsys_sprintf ("PERF-%d", i % 200);
+        zhash_update (ext, "group.1", group);
+        zhash_update (ext, FTY_PROTO_ASSET_EXT_MODEL, model);
+        zmsg_t *msg = fty_proto_encode_asset (NULL, name, FTY_PROTO_ASSET_OP_UPDATE, ext);
+        messages [i] = fty_proto_decode (&msg);
+        zstr_free (&model);
+        zstr_free (&group);
+        zstr_free (&name);
+    }
+    zhash_destroy (&ext);
+    start = zclock_usecs ();
+    for (int i = 0; i < PERF_ASSETS; i++)
+        flexible_alert_handle_asset (self, messages [i]);
+    double asset_matching = (zclock_usecs () - start) / 1000.0;
+    for (int i = 0; i < PERF_ASSETS; i++)
+        fty_proto_destroy (&messages [i]);
+    free (messages);
+
+    //  metrics visit assets in fixed order, every seventh one is high
+    size_t evaluations = 0;
+    int64_t elapsed = 0;
+    for (int i = 0; i < PERF_METRICS; i++) {
+        char *name = zsys_sprintf ("perf-ups-%d", (i * 7919) % PERF_ASSETS);
+        zlist_t *functions = (zlist_t *) zhash_lookup (self->assets, name);
+        evaluations += functions ? zlist_size (functions) : 0;
+        zmsg_t *msg = fty_proto_encode_metric (NULL, time (NULL), 3600, "perf.load", name,
+            i % 7 == 0 ? "95" : "10", "%");
+        fty_proto_t *metric = fty_proto_decode (&msg);
+        start = zclock_usecs ();
+        flexible_alert_handle_metric (self, &metric, false);
+        elapsed += zclock_usecs () - start;
+        fty_proto_destroy (&metric);
+        zstr_free (&name);
+    }
+    assert (evaluations > 0 && alerts > 0);
+    double evaluations_per_sec = elapsed ? evaluations * 1e6 / elapsed : 0;
+
+    start = zclock_usecs ();
+    for (int i = 0; i < PERF_LISTS; i++) {
+        zmsg_t *reply = flexible_alert_list_rules (self, (char *) "all", NULL);
+        assert (zmsg_size (reply) == PERF_RULES + 3);
+        zmsg_destroy (&reply);
+    }
+    double list_rules = (zclock_usecs () - start) / 1000.0 / PERF_LISTS;
+    double peak_rss = s_perf_peak_rss ();
+    flexible_alert_destroy (&self);
+
+    int regressions = 0;
+    regressions += s_perf_check (baseline, save, "load_rules_ms", load_rules);
+    regressions += s_perf_check (baseline, save, "asset_matching_ms", asset_matching);
+    regressions += s_perf_check (baseline, save, "evaluations_per_sec", evaluations_per_sec);
+    regressions += s_perf_check (baseline, save, "list_rules_ms", list_rules);
+    if (peak_rss > 0)
+        regressions += s_perf_check (baseline, save, "peak_rss_kb", peak_rss);
+
+    for (int i = 0; i < PERF_RULES; i++) {
+        char *path = zsys_sprintf ("%s/perf-%d.rule", dir, i);
+        unlink (path);
+        zstr_free (&path);
+    }
+    zsys_dir_delete (dir);
+    if (save)
+        fclose (save);
+    zconfig_destroy (&baseline);
+    return regressions;
+}
+
 void
 flexible_alert_test (bool verbose)
 {
@@ -962,6 +2692,243 @@ flexible_alert_test (bool verbose)
     assert (self);
     flexible_alert_destroy (&self);
 
+    {
+        printf ("\t#0 Match new rule against cached assets ");
+        self = flexible_alert_new ();
+        zhash_t *ext = zhash_new ();
+        zhash_autofree (ext);
+        zhash_insert (ext, "group.1", (void *) "all-racks");
+        zhash_insert (ext, "name", (void *) "Rack 1");
+        zmsg_t *assetmsg = fty_proto_encode_asset (NULL, "rack-1", FTY_PROTO_ASSET_OP_UPDATE, ext);
+        fty_proto_t *ftymsg = fty_proto_decode (&assetmsg);
+        flexible_alert_handle_asset (self, ftymsg);
+        fty_proto_destroy (&ftymsg);
+        zhash_destroy (&ext);
+        assert (zhash_lookup (self->assets, "rack-1") == NULL);
+
+        // rule matched by group is bound without asset republish
+        const char *json = "{\"name\":\"rack-humidity\",\"metrics\":[\"humidity\"],\"groups\":[\"all-racks\"],"
+            "\"evaluation\":\"function main(x) return OK, 'yes' end\"}";
+        zmsg_t *reply = flexible_alert_add_rule (self, json, NULL, false, SELFTEST_DIR_RW);
+        char *item = zmsg_popstr (reply);
+        assert (streq (item, "OK"));
+        zstr_free (&item);
+        zmsg_destroy (&reply);
+        zlist_t *functions = (zlist_t *) zhash_lookup (self->assets, "rack-1");
+        assert (functions && zlist_exists (functions, (void *) "rack-humidity"));
+
+        // reader keeps its snapshot while rule is deleted
+        ruleset_t *snapshot = flexible_alert_acquire_rules (self);
+        reply = flexible_alert_delete_rule (self, "rack-humidity", SELFTEST_DIR_RW);
+        zmsg_destroy (&reply);
+        assert (zhash_lookup (self->assets, "rack-1") == NULL);
+        assert (ruleset_lookup (self->rules, "rack-humidity") == NULL);
+        rule_t *held = ruleset_lookup (snapshot, "rack-humidity");
+        assert (held && streq (rule_name (held), "rack-humidity"));
+        assert (ruleset_version (self->rules) > ruleset_version (snapshot));
+        ruleset_destroy (&snapshot);
+        assert (zhash_lookup (self->asset_infos, "rack-1"));
+
+        // rule file dropped to the directory, then modified and deleted
+        char *path = zsys_sprintf ("%s/watched.rule", SELFTEST_DIR_RW);
+        FILE *f = fopen (path, "w");
+        assert (f);
+        fputs (json, f);
+        fclose (f);
+        zlist_t *files = zlist_new ();
+        zlist_append (files, (void *) "watched.rule");
+        flexible_alert_reload_rule_files (self, SELFTEST_DIR_RW, files);
+        assert (ruleset_lookup (self->rules, "rack-humidity"));
+        functions = (zlist_t *) zhash_lookup (self->assets, "rack-1");
+        assert (functions && zlist_exists (functions, (void *) "rack-humidity"));
+
+        f = fopen (path, "w");
+        assert (f);
+        fputs ("{\"name\":\"rack-humidity\",\"metrics\":[\"humidity\"],\"groups\":[\"other-racks\"],"
+            "\"evaluation\":\"function main(x) return OK, 'yes' end\"}", f);
+        fclose (f);
+        flexible_alert_reload_rule_files (self, SELFTEST_DIR_RW, files);
+        assert (ruleset_lookup (self->rules, "rack-humidity"));
+        assert (zhash_lookup (self->assets, "rack-1") == NULL);
+
+        unlink (path);
+        flexible_alert_reload_rule_files (self, SELFTEST_DIR_RW, files);
+        assert (ruleset_lookup (self->rules, "rack-humidity") == NULL);
+        zlist_destroy (&files);
+        zstr_free (&path);
+
+        flexible_alert_destroy (&self);
+        printf ("OK\n");
+    }
+
+    {
+        printf ("\t#0.1 Rules in journal ");
+        char *journal = zsys_sprintf ("%s/rules.journal", SELFTEST_DIR_RW);
+        char *rules_dir = zsys_sprintf ("%s/rules", SELFTEST_DIR_RO);
+        unlink (journal);
+        self = flexible_alert_new ();
+        self->store = rule_store_new (journal);
+        assert (self->store);
+        const char *json = "{\"name\":\"journal-rule\",\"metrics\":[\"humidity\"],\"assets\":[\"rack-1\"],"
+            "\"evaluation\":\"function main(x) return OK, 'yes' end\"}";
+        zmsg_t *reply = flexible_alert_add_rule (self, json, NULL, false, SELFTEST_DIR_RW);
+        char *item = zmsg_popstr (reply);
+        assert (streq (item, "OK"));
+        zstr_free (&item);
+        zmsg_destroy (&reply);
+        assert (ruleset_lookup (self->rules, "journal-rule"));
+        char *path = zsys_sprintf ("%s/journal-rule.rule", SELFTEST_DIR_RW);
+        assert (access (path, F_OK) != 0);
+        flexible_alert_destroy (&self);
+
+        // rules survive restart, directory is not imported to non-empty journal
+        self = flexible_alert_new ();
+        self->store = rule_store_new (journal);
+        flexible_alert_load_rules (self, rules_dir);
+        assert (ruleset_size (self->rules) == 1);
+        assert (ruleset_lookup (self->rules, "journal-rule"));
+        reply = flexible_alert_delete_rule (self, "journal-rule", SELFTEST_DIR_RW);
+        item = zmsg_popstr (reply);
+        assert (streq (item, "DELETE"));
+        zstr_free (&item);
+        zmsg_destroy (&reply);
+        assert (rule_store_size (self->store) == 0);
+        flexible_alert_destroy (&self);
+
+        // empty journal imports rule directory
+        self = flexible_alert_new ();
+        self->store = rule_store_new (journal);
+        flexible_alert_load_rules (self, rules_dir);
+        assert (ruleset_size (self->rules) > 1);
+        assert (rule_store_size (self->store) == ruleset_size (self->rules));
+        flexible_alert_destroy (&self);
+
+        unlink (journal);
+        zstr_free (&path);
+        zstr_free (&rules_dir);
+        zstr_free (&journal);
+        printf ("OK\n");
+    }
+
+    {
+        printf ("\t#0.2 Template instance ");
+        self = flexible_alert_new ();
+        char *rules_dir = zsys_sprintf ("%s/rules", SELFTEST_DIR_RO);
+        flexible_alert_load_templates (self, rules_dir);
+        const char *json = "{\"name\":\"sts-voltage@sts-1\",\"template\":\"sts-voltage@__device_sts__\","
+            "\"substitutions\":{\"__name__\":\"sts-1\",\"__ename__\":\"STS 1\"}}";
+        zmsg_t *reply = flexible_alert_add_rule (self, json, NULL, false, SELFTEST_DIR_RW);
+        char *item = zmsg_popstr (reply);
+        assert (streq (item, "OK"));
+        zstr_free (&item);
+        zmsg_destroy (&reply);
+        rule_t *rule = ruleset_lookup (self->rules, "sts-voltage@sts-1");
+        assert (rule && rule_template (rule));
+        assert (rule_asset_exists (rule, "sts-1"));
+        assert (rule_metric_exists (rule, "status.input.1.voltage"));
+
+        // GET returns expanded rule
+        reply = flexible_alert_get_rule (self, (char *) "sts-voltage@sts-1");
+        item = zmsg_popstr (reply);
+        assert (streq (item, "OK"));
+        zstr_free (&item);
+        item = zmsg_popstr (reply);
+        assert (strstr (item, "\"evaluation\"") && strstr (item, "STS 1"));
+        zstr_free (&item);
+        zmsg_destroy (&reply);
+
+        reply = flexible_alert_add_rule (self, "{\"name\":\"x\",\"template\":\"missing\"}", NULL, false, SELFTEST_DIR_RW);
+        item = zmsg_popstr (reply);
+        assert (streq (item, "ERROR"));
+        zstr_free (&item);
+        item = zmsg_popstr (reply);
+        assert (streq (item, "UNKNOWN_TEMPLATE"));
+        zstr_free (&item);
+        zmsg_destroy (&reply);
+
+        reply = flexible_alert_delete_rule (self, "sts-voltage@sts-1", SELFTEST_DIR_RW);
+        zmsg_destroy (&reply);
+        assert (ruleset_lookup (self->rules, "sts-voltage@sts-1") == NULL);
+        zstr_free (&rules_dir);
+        flexible_alert_destroy (&self);
+        printf ("OK\n");
+    }
+
+    {
+        printf ("\t#0.3 Memory of lua states ");
+        self = flexible_alert_new ();
+        const char *json = "{\"name\":\"lua-memory\",\"metrics\":[\"load\"],\"assets\":[\"ups-1\"],"
+            "\"evaluation\":\"function main(x) for i = 1, 10 do x = x .. i end return OK, x end\"}";
+        zmsg_t *reply = flexible_alert_add_rule (self, json, NULL, false, SELFTEST_DIR_RW);
+        zmsg_destroy (&reply);
+        rule_t *rule = ruleset_lookup (self->rules, "lua-memory");
+        assert (rule);
+        reply = flexible_alert_memory (self);
+        assert (zmsg_size (reply) == 1);
+        zmsg_destroy (&reply);
+        //  lua state is created by the first evaluation
+        zlist_t *params = zlist_new ();
+        zlist_append (params, (void *) "1");
+        int result;
+        char *message = NULL;
+        rule_evaluate (rule, params, NULL, "ups-1", NULL, &result, &message);
+        assert (result == 0 && message);
+        zstr_free (&message);
+        zlist_destroy (&params);
+        reply = flexible_alert_memory (self);
+        char *item = zmsg_popstr (reply);
+        assert (streq (item, "MEMORY"));
+        zstr_free (&item);
+        item = zmsg_popstr (reply);
+        assert (streq (item, "lua-memory"));
+        zstr_free (&item);
+        item = zmsg_popstr (reply);
+        assert (item && atoi (item) > 0);
+        zstr_free (&item);
+        zmsg_destroy (&reply);
+        reply = flexible_alert_delete_rule (self, "lua-memory", SELFTEST_DIR_RW);
+        zmsg_destroy (&reply);
+        flexible_alert_destroy (&self);
+        printf ("OK\n");
+    }
+
+    {
+        printf ("\t#0.4 Quarantine of failing rules ");
+        self = flexible_alert_new ();
+        const char *json = "{\"name\":\"lua-broken\",\"metrics\":[\"load\"],\"assets\":[\"ups-1\"],"
+            "\"evaluation\":\"function main(x) return OK, x\"}";
+        zmsg_t *reply = flexible_alert_add_rule (self, json, NULL, false, SELFTEST_DIR_RW);
+        zmsg_destroy (&reply);
+        rule_t *rule = ruleset_lookup (self->rules, "lua-broken");
+        assert (rule);
+        reply = flexible_alert_quarantine (self);
+        assert (zmsg_size (reply) == 1);
+        zmsg_destroy (&reply);
+        zlist_t *params = zlist_new ();
+        zlist_append (params, (void *) "1");
+        int result;
+        char *message = NULL;
+        rule_evaluate (rule, params, NULL, "ups-1", NULL, &result, &message);
+        assert (result == RULE_ERROR);
+        zlist_destroy (&params);
+        reply = flexible_alert_quarantine (self);
+        assert (zmsg_size (reply) == 5);
+        char *item = zmsg_popstr (reply);
+        assert (streq (item, "QUARANTINE"));
+        zstr_free (&item);
+        item = zmsg_popstr (reply);
+        assert (streq (item, "lua-broken"));
+        zstr_free (&item);
+        item = zmsg_popstr (reply);
+        assert (streq (item, "BROKEN"));
+        zstr_free (&item);
+        zmsg_destroy (&reply);
+        reply = flexible_alert_delete_rule (self, "lua-broken", SELFTEST_DIR_RW);
+        zmsg_destroy (&reply);
+        flexible_alert_destroy (&self);
+        printf ("OK\n");
+    }
+
     // start malamute
     static const char *endpoint = "inproc://fty-metric-snmp";
     zactor_t *malamute = zactor_new (mlm_server, (void*) "Malamute");
@@ -1026,11 +2993,17 @@ flexible_alert_test (bool verbose)
 //            "64",
 //            "");
 //        mlm_client_send (metric, "status.ups@mydevice", &msg);
+        //  metric comes by shm POLL of polling actor, evaluated by actor
         fty::shm::write_metric("mydevice", "status.ups", "64", "", 5);
 
+        zpoller_t *poller = zpoller_new (mlm_client_msgpipe (asset), NULL);
+        assert (zpoller_wait (poller, (fty_get_polling_interval () + 5) * 1000));
+        zpoller_destroy (&poller);
         zmsg_t *alert = mlm_client_recv (asset);
         assert (is_fty_proto (alert));
         fty_proto_t *ftymsg = fty_proto_decode (&alert);
+        assert (fty_proto_id (ftymsg) == FTY_PROTO_ALERT);
+        assert (streq (fty_proto_name (ftymsg), "mydevice"));
         fty_proto_print (ftymsg);
         fty_proto_destroy (&ftymsg);
         zmsg_destroy (&alert);
@@ -1136,6 +3109,487 @@ flexible_alert_test (bool verbose)
         zmsg_destroy (&reply);
         printf ("OK\n");
     }
+    {
+        printf ("\t#5 Batch evaluation of shm cycle ");
+        self = flexible_alert_new ();
+        mlm_client_connect (self->mlm, endpoint, 5000, "batch-producer");
+        mlm_client_set_producer (self->mlm, FTY_PROTO_STREAM_ALERTS_SYS);
+        mlm_client_t *consumer = mlm_client_new ();
+        mlm_client_connect (consumer, endpoint, 5000, "batch-consumer");
+        mlm_client_set_consumer (consumer, FTY_PROTO_STREAM_ALERTS_SYS, "rack-load/.*");
+
+        size_t racks = 20;
+        s_test_batch_racks (self, 0, racks);
+        const char *json = "{\"name\":\"rack-load\",\"metrics\":[\"load.input\"],\"groups\":[\"batch-racks\"],"
+            "\"variables\":{\"high\":\"80\"},\"evaluation\":\"function main (load) "
+            "if tonumber (load) > tonumber (high) then return CRITICAL, 'Load of '..NAME..' is high' end "
+            "return OK, 'Load is fine' end\"}";
+        zmsg_t *reply = flexible_alert_add_rule (self, json, NULL, false, SELFTEST_DIR_RW);
+        char *item = zmsg_popstr (reply);
+        assert (streq (item, "OK"));
+        zstr_free (&item);
+        zmsg_destroy (&reply);
+        zclock_sleep (200);
+
+        //  first cycle publishes everything, then only changes
+        s_test_batch_cycle (self, racks, 0, 60, true);
+        assert (s_test_count_alerts (consumer) == (int) racks);
+        s_test_batch_cycle (self, racks, 0, 60, true);
+        assert (s_test_count_alerts (consumer) == 0);
+        s_test_batch_cycle (self, racks, 3, 60, true);
+        assert (s_test_count_alerts (consumer) == 3);
+        //  alerts are republished before they expire
+        zclock_sleep (1100);
+        s_test_batch_cycle (self, racks, 3, 1, true);
+        assert (s_test_count_alerts (consumer) == (int) racks);
+        //  changed rule is published again
+        reply = flexible_alert_add_rule (self, json, "rack-load", false, SELFTEST_DIR_RW);
+        zmsg_destroy (&reply);
+        s_test_batch_cycle (self, racks, 3, 60, true);
+        assert (s_test_count_alerts (consumer) == (int) racks);
+
+        //  per asset evaluation publishes every metric
+        s_test_batch_cycle (self, racks, 0, 60, false);
+        assert (s_test_count_alerts (consumer) == (int) racks);
+        mlm_client_destroy (&consumer);
+
+        if (verbose) {
+            //  steady cycle of 10k racks, few of them change
+            racks = 10000;
+            s_test_batch_racks (self, 20, racks);
+            s_test_batch_cycle (self, racks, 0, 60, true);
+            int64_t batch_time = s_test_batch_cycle (self, racks, 10, 60, true);
+            int64_t single_time = s_test_batch_cycle (self, racks, 20, 60, false);
+            log_info ("%zu assets cycle: batch evaluation %.3f ms, one by one %.3f ms",
+                racks, batch_time / 1000.0, single_time / 1000.0);
+        }
+
+        reply = flexible_alert_delete_rule (self, "rack-load", SELFTEST_DIR_RW);
+        zmsg_destroy (&reply);
+        assert (zhash_size (self->alerts) == 0);
+        flexible_alert_destroy (&self);
+        printf ("OK\n");
+    }
+    {
+        printf ("\t#6 Minimal interval of evaluations ");
+        self = flexible_alert_new ();
+        mlm_client_connect (self->mlm, endpoint, 5000, "interval-producer");
+        mlm_client_set_producer (self->mlm, FTY_PROTO_STREAM_ALERTS_SYS);
+        mlm_client_t *consumer = mlm_client_new ();
+        mlm_client_connect (consumer, endpoint, 5000, "interval-consumer");
+        mlm_client_set_consumer (consumer, FTY_PROTO_STREAM_ALERTS_SYS, "rack-interval/.*");
+
+        size_t racks = 5;
+        s_test_batch_racks (self, 0, racks);
+        const char *json = "{\"name\":\"rack-interval\",\"metrics\":[\"load.input\"],\"groups\":[\"batch-racks\"],"
+            "\"min_interval\":500,\"evaluation\":\"function main (load) "
+            "if tonumber (load) > 80 then return CRITICAL, 'Load is high' end return OK, 'Load is fine' end\"}";
+        zmsg_t *reply = flexible_alert_add_rule (self, json, NULL, false, SELFTEST_DIR_RW);
+        char *item = zmsg_popstr (reply);
+        assert (streq (item, "OK"));
+        zstr_free (&item);
+        zmsg_destroy (&reply);
+
+        //  burst is evaluated once, then once more on the latest values
+        s_test_batch_cycle (self, racks, 0, 60, false);
+        s_test_batch_cycle (self, racks, 0, 60, false);
+        s_test_batch_cycle (self, racks, 2, 60, false);
+        assert (s_test_count_alerts (consumer) == (int) racks);
+        assert (timer_wheel_size (self->deferred) == racks);
+        assert (flexible_alert_evaluate_deferred (self) == 0);
+        //  deleted asset is forgotten, asset which left the group is skipped
+        zmsg_t *assetmsg = fty_proto_encode_asset (NULL, "batch-rack-4", FTY_PROTO_ASSET_OP_DELETE, NULL);
+        fty_proto_t *ftymsg = fty_proto_decode (&assetmsg);
+        flexible_alert_handle_asset (self, ftymsg);
+        fty_proto_destroy (&ftymsg);
+        assert (timer_wheel_size (self->deferred) == racks - 1);
+        assert (zhash_size (self->evaluated) == racks - 1);
+        assetmsg = fty_proto_encode_asset (NULL, "batch-rack-3", FTY_PROTO_ASSET_OP_UPDATE, NULL);
+        ftymsg = fty_proto_decode (&assetmsg);
+        flexible_alert_handle_asset (self, ftymsg);
+        fty_proto_destroy (&ftymsg);
+        zclock_sleep (500 + DEFERRED_TICK);
+        assert (flexible_alert_evaluate_deferred (self) == racks - 2);
+        assert (timer_wheel_size (self->deferred) == 0);
+        zlist_t *severities = zlist_new ();
+        zlist_autofree (severities);
+        zpoller_t *poller = zpoller_new (mlm_client_msgpipe (consumer), NULL);
+        while (zpoller_wait (poller, 500)) {
+            zmsg_t *msg = mlm_client_recv (consumer);
+            zlist_append (severities, (void *) mlm_client_subject (consumer));
+            zmsg_destroy (&msg);
+        }
+        zpoller_destroy (&poller);
+        assert (zlist_size (severities) == racks - 2);
+        size_t critical = 0;
+        for (char *subject = (char *) zlist_first (severities); subject; subject = (char *) zlist_next (severities))
+            if (strstr (subject, "/CRITICAL@"))
+                critical++;
+        assert (critical == 2);
+        zlist_destroy (&severities);
+
+        //  deleted rule is forgotten with its deferred evaluations
+        s_test_batch_racks (self, 3, racks);
+        s_test_batch_cycle (self, racks, 0, 60, false);
+        assert (timer_wheel_size (self->deferred) > 0);
+        s_test_count_alerts (consumer);
+
+        //  default interval for rules without one, rule can turn it off
+        reply = flexible_alert_delete_rule (self, "rack-interval", SELFTEST_DIR_RW);
+        zmsg_destroy (&reply);
+        assert (zhash_size (self->evaluated) == 0);
+        assert (timer_wheel_size (self->deferred) == 0);
+        self->min_interval = 60000;
+        json = "{\"name\":\"rack-interval\",\"metrics\":[\"load.input\"],\"groups\":[\"batch-racks\"],"
+            "\"evaluation\":\"function main (load) return OK, 'Load is fine' end\"}";
+        reply = flexible_alert_add_rule (self, json, NULL, false, SELFTEST_DIR_RW);
+        zmsg_destroy (&reply);
+        s_test_batch_cycle (self, racks, 0, 60, false);
+        s_test_batch_cycle (self, racks, 0, 60, false);
+        assert (s_test_count_alerts (consumer) == (int) racks);
+        json = "{\"name\":\"rack-interval\",\"metrics\":[\"load.input\"],\"groups\":[\"batch-racks\"],"
+            "\"min_interval\":0,\"evaluation\":\"function main (load) return OK, 'Load is fine' end\"}";
+        reply = flexible_alert_add_rule (self, json, "rack-interval", false, SELFTEST_DIR_RW);
+        zmsg_destroy (&reply);
+        s_test_batch_cycle (self, racks, 0, 60, false);
+        s_test_batch_cycle (self, racks, 0, 60, false);
+        assert (s_test_count_alerts (consumer) == 2 * (int) racks);
+        mlm_client_destroy (&consumer);
+
+        reply = flexible_alert_delete_rule (self, "rack-interval", SELFTEST_DIR_RW);
+        zmsg_destroy (&reply);
+        flexible_alert_destroy (&self);
+        printf ("OK\n");
+    }
+    {
+        printf ("\t#7 Mailbox requests during metric flood ");
+        mlm_client_t *ui = mlm_client_new ();
+        mlm_client_connect (ui, endpoint, 5000, "flood-ui");
+        mlm_client_t *flood = mlm_client_new ();
+        mlm_client_connect (flood, endpoint, 5000, "flood-producer");
+        mlm_client_set_producer (flood, FTY_PROTO_STREAM_METRICS);
+        zstr_sendx (fs, "CONSUMER", FTY_PROTO_STREAM_METRICS, "flood.*", NULL);
+        const char *json = "{\"name\":\"flood\",\"metrics\":[\"flood.load\"],\"assets\":[\"mydevice\"],"
+            "\"pure\":false,\"evaluation\":\"function main (load) local sum = 0 "
+            "for i = 1, 1000 do sum = sum + i end return OK, 'load ' .. load end\"}";
+        zmsg_t *msg = zmsg_new ();
+        zmsg_addstr (msg, "ADD");
+        zmsg_addstr (msg, json);
+        mlm_client_sendto (ui, "me", "flood", NULL, 1000, &msg);
+        zmsg_t *reply = mlm_client_recv (ui);
+        char *item = zmsg_popstr (reply);
+        assert (streq (item, "OK"));
+        zstr_free (&item);
+        zmsg_destroy (&reply);
+        zclock_sleep (200);
+
+        //  requests sent behind thousands of metrics are served first
+        const int metrics = 20000, requests = 10;
+        for (int i = 0; i < metrics; i++) {
+            char *value = zsys_sprintf ("%d", i);
+            msg = fty_proto_encode_metric (NULL, time (NULL), 60, "flood.load", "mydevice", value, "%");
+            mlm_client_send (flood, "flood.load@mydevice", &msg);
+            zstr_free (&value);
+        }
+        zpoller_t *poller = zpoller_new (mlm_client_msgpipe (ui), NULL);
+        int64_t total = 0, worst = 0;
+        for (int i = 0; i < requests; i++) {
+            int64_t start = zclock_usecs ();
+            msg = zmsg_new ();
+            zmsg_addstr (msg, "GET");
+            zmsg_addstr (msg, "flood");
+            mlm_client_sendto (ui, "me", "flood", NULL, 1000, &msg);
+            assert (zpoller_wait (poller, 5000));
+            reply = mlm_client_recv (ui);
+            int64_t latency = zclock_usecs () - start;
+            item = zmsg_popstr (reply);
+            assert (streq (item, "OK"));
+            zstr_free (&item);
+            zmsg_destroy (&reply);
+            total += latency;
+            if (worst < latency)
+                worst = latency;
+        }
+        if (verbose)
+            log_info ("mailbox latency during flood of %d metrics: average %.3f ms, worst %.3f ms",
+                metrics, total / 1000.0 / requests, worst / 1000.0);
+        assert (worst < 1000000);
+
+        //  metrics of one subject waiting in ingress queue are coalesced
+        msg = zmsg_new ();
+        zmsg_addstr (msg, "INGRESS");
+        mlm_client_sendto (ui, "me", "flood", NULL, 1000, &msg);
+        assert (zpoller_wait (poller, 5000));
+        reply = mlm_client_recv (ui);
+        assert (zmsg_size (reply) == 4);
+        item = zmsg_popstr (reply);
+        assert (streq (item, "INGRESS"));
+        zstr_free (&item);
+        char *pending = zmsg_popstr (reply);
+        char *coalesced = zmsg_popstr (reply);
+        char *shed = zmsg_popstr (reply);
+        if (verbose)
+            log_info ("ingress queue: %s pending, %s coalesced, %s dropped", pending, coalesced, shed);
+        assert (atoi (pending) <= 1 && streq (shed, "0"));
+        zstr_free (&pending);
+        zstr_free (&coalesced);
+        zstr_free (&shed);
+        zmsg_destroy (&reply);
+        zpoller_destroy (&poller);
+
+        msg = zmsg_new ();
+        zmsg_addstr (msg, "DELETE");
+        zmsg_addstr (msg, "flood");
+        mlm_client_sendto (ui, "me", "flood", NULL, 1000, &msg);
+        reply = mlm_client_recv (ui);
+        zmsg_destroy (&reply);
+        mlm_client_destroy (&flood);
+        mlm_client_destroy (&ui);
+        printf ("OK\n");
+    }
+    {
+        printf ("\t#8 Assets shared by several instances ");
+        const size_t count = 2, racks = 20;
+        zactor_t *shards [count];
+        for (size_t i = 0; i < count; i++) {
+            zlist_t *shard_params = zlist_new ();
+            zlist_append (shard_params, (void*) ".*");
+            zlist_append (shard_params, (void*) ".*");
+            shards [i] = zactor_new (flexible_alert_actor, (void*) shard_params);
+            char *index = zsys_sprintf ("%zu", i);
+            char *total = zsys_sprintf ("%zu", count);
+            zstr_sendx (shards [i], "SHARD", "shard", index, total, NULL);
+            zstr_sendx (shards [i], "BIND", endpoint, "shard", NULL);
+            zstr_sendx (shards [i], "PRODUCER", FTY_PROTO_STREAM_ALERTS_SYS, NULL);
+            zstr_sendx (shards [i], "CONSUMER", FTY_PROTO_STREAM_ASSETS, ".*", NULL);
+            zstr_sendx (shards [i], "CONSUMER", FTY_PROTO_STREAM_METRICS, "load.*", NULL);
+            //  every shard keeps own copy of rules
+            char *dir = zsys_sprintf ("%s/shard-%zu", SELFTEST_DIR_RW, i);
+            zsys_dir_create (dir);
+            zstr_sendx (shards [i], "LOADRULES", dir, NULL);
+            zstr_free (&dir);
+            zstr_free (&index);
+            zstr_free (&total);
+        }
+        mlm_client_t *ui = mlm_client_new ();
+        mlm_client_connect (ui, endpoint, 5000, "shard-ui");
+        mlm_client_t *producer = mlm_client_new ();
+        mlm_client_connect (producer, endpoint, 5000, "shard-producer");
+        mlm_client_set_producer (producer, FTY_PROTO_STREAM_METRICS);
+        mlm_client_t *consumer = mlm_client_new ();
+        mlm_client_connect (consumer, endpoint, 5000, "shard-consumer");
+        mlm_client_set_consumer (consumer, FTY_PROTO_STREAM_ALERTS_SYS, "shard-load/.*");
+        zclock_sleep (200);
+
+        //  rule added to shard 0 is replicated to shard 1
+        const char *json = "{\"name\":\"shard-load\",\"metrics\":[\"load.input\"],\"groups\":[\"shard-racks\"],"
+            "\"evaluation\":\"function main (load) if load > 90 then return CRITICAL, 'high' end "
+            "return OK, 'fine' end\"}";
+        zmsg_t *msg = zmsg_new ();
+        zmsg_addstr (msg, "ADD");
+        zmsg_addstr (msg, json);
+        mlm_client_sendto (ui, "shard", "shard", NULL, 1000, &msg);
+        zmsg_t *reply = mlm_client_recv (ui);
+        char *item = zmsg_popstr (reply);
+        assert (streq (item, "OK"));
+        zstr_free (&item);
+        zmsg_destroy (&reply);
+        zclock_sleep (200);
+        msg = zmsg_new ();
+        zmsg_addstr (msg, "GET");
+        zmsg_addstr (msg, "shard-load");
+        mlm_client_sendto (ui, "shard-1", "shard", NULL, 1000, &msg);
+        reply = mlm_client_recv (ui);
+        item = zmsg_popstr (reply);
+        assert (streq (item, "OK"));
+        zstr_free (&item);
+        zmsg_destroy (&reply);
+
+        //  every asset is owned by exactly one shard
+        zhash_t *ext = zhash_new ();
+        zhash_autofree (ext);
+        zhash_insert (ext, "group.1", (void *) "shard-racks");
+        shard_map_t *map = shard_map_new ("shard", 0, count);
+        size_t owned [count] = { 0, 0 };
+        for (size_t i = 0; i < racks; i++) {
+            char *name = zsys_sprintf ("shard-rack-%zu", i);
+            msg = fty_proto_encode_asset (NULL, name, FTY_PROTO_ASSET_OP_UPDATE, ext);
+            mlm_client_send (asset, name, &msg);
+            owned [shard_map_owner (map, name)]++;
+            zstr_free (&name);
+        }
+        zhash_destroy (&ext);
+        shard_map_destroy (&map);
+        zclock_sleep (500);
+        for (size_t i = 0; i < count; i++) {
+            msg = zmsg_new ();
+            zmsg_addstr (msg, "SHARD");
+            mlm_client_sendto (ui, i ? "shard-1" : "shard", "shard", NULL, 1000, &msg);
+            reply = mlm_client_recv (ui);
+            assert (zmsg_size (reply) == 4);
+            item = zmsg_popstr (reply);
+            assert (streq (item, "SHARD"));
+            zstr_free (&item);
+            char *index = zmsg_popstr (reply);
+            char *total = zmsg_popstr (reply);
+            char *known = zmsg_popstr (reply);
+            assert ((size_t) atoi (index) == i && (size_t) atoi (total) == count);
+            assert ((size_t) atoi (known) == owned [i]);
+            zstr_free (&index);
+            zstr_free (&total);
+            zstr_free (&known);
+            zmsg_destroy (&reply);
+        }
+
+        //  metrics are evaluated by owner only, one alert per asset
+        for (size_t i = 0; i < racks; i++) {
+            char *name = zsys_sprintf ("shard-rack-%zu", i);
+            char *subject = zsys_sprintf ("load.input@%s", name);
+            msg = fty_proto_encode_metric (NULL, time (NULL), 60, "load.input", name, "95", "%");
+            mlm_client_send (producer, subject, &msg);
+            zstr_free (&subject);
+            zstr_free (&name);
+        }
+        assert (s_test_count_alerts (consumer) == (int) racks);
+
+        //  rule deleted on shard 1 is deleted on shard 0 too
+        msg = zmsg_new ();
+        zmsg_addstr (msg, "DELETE");
+        zmsg_addstr (msg, "shard-load");
+        mlm_client_sendto (ui, "shard-1", "shard", NULL, 1000, &msg);
+        reply = mlm_client_recv (ui);
+        assert (zmsg_size (reply) == 3);
+        zmsg_destroy (&reply);
+        zclock_sleep (200);
+        msg = zmsg_new ();
+        zmsg_addstr (msg, "GET");
+        zmsg_addstr (msg, "shard-load");
+        mlm_client_sendto (ui, "shard", "shard", NULL, 1000, &msg);
+        reply = mlm_client_recv (ui);
+        item = zmsg_popstr (reply);
+        assert (streq (item, "ERROR"));
+        zstr_free (&item);
+        zmsg_destroy (&reply);
+
+        mlm_client_destroy (&consumer);
+        mlm_client_destroy (&producer);
+        mlm_client_destroy (&ui);
+        for (size_t i = 0; i < count; i++) {
+            zactor_destroy (&shards [i]);
+            zsys_dir_delete ("%s/shard-%zu", SELFTEST_DIR_RW, i);
+        }
+        printf ("OK\n");
+    }
+    {
+        printf ("\t#9 Record and replay of input ");
+        char *log_path = zsys_sprintf ("%s/input.log", SELFTEST_DIR_RW);
+        char *dir = zsys_sprintf ("%s/replay", SELFTEST_DIR_RW);
+        unlink (log_path);
+        zsys_dir_create (dir);
+        zlist_t *recorder_params = zlist_new ();
+        zlist_append (recorder_params, (void*) ".*");
+        zlist_append (recorder_params, (void*) ".*");
+        zactor_t *recorder = zactor_new (flexible_alert_actor, (void*) recorder_params);
+        zstr_sendx (recorder, "RECORD", log_path, NULL);
+        zstr_sendx (recorder, "BIND", endpoint, "recorder", NULL);
+        zstr_sendx (recorder, "PRODUCER", FTY_PROTO_STREAM_ALERTS_SYS, NULL);
+        zstr_sendx (recorder, "CONSUMER", FTY_PROTO_STREAM_ASSETS, ".*", NULL);
+        zstr_sendx (recorder, "CONSUMER", FTY_PROTO_STREAM_METRICS, "replay.*", NULL);
+        zstr_sendx (recorder, "LOADRULES", dir, NULL);
+        mlm_client_t *ui = mlm_client_new ();
+        mlm_client_connect (ui, endpoint, 5000, "replay-ui");
+        mlm_client_t *producer = mlm_client_new ();
+        mlm_client_connect (producer, endpoint, 5000, "replay-producer");
+        mlm_client_set_producer (producer, FTY_PROTO_STREAM_METRICS);
+        mlm_client_t *consumer = mlm_client_new ();
+        mlm_client_connect (consumer, endpoint, 5000, "replay-consumer");
+        mlm_client_set_consumer (consumer, FTY_PROTO_STREAM_ALERTS_SYS, "replay-load/.*");
+        zclock_sleep (200);
+
+        //  record rule, asset and metrics
+        const char *json = "{\"name\":\"replay-load\",\"metrics\":[\"replay.load\"],\"assets\":[\"replay-ups\"],"
+            "\"evaluation\":\"function main (load) if load > 90 then return CRITICAL, 'high' end "
+            "return OK, 'fine' end\"}";
+        zmsg_t *msg = zmsg_new ();
+        zmsg_addstr (msg, "ADD");
+        zmsg_addstr (msg, json);
+        mlm_client_sendto (ui, "recorder", "replay", NULL, 1000, &msg);
+        zmsg_t *reply = mlm_client_recv (ui);
+        zmsg_destroy (&reply);
+        msg = fty_proto_encode_asset (NULL, "replay-ups", FTY_PROTO_ASSET_OP_UPDATE, NULL);
+        mlm_client_send (asset, "replay-ups", &msg);
+        zclock_sleep (200);
+        const char *values [] = { "10", "95", "10" };
+        for (int i = 0; i < 3; i++) {
+            msg = fty_proto_encode_metric (NULL, time (NULL), 60, "replay.load", "replay-ups", values [i], "%");
+            mlm_client_send (producer, "replay.load@replay-ups", &msg);
+            zclock_sleep (100);
+        }
+        assert (s_test_count_alerts (consumer) == 3);
+        zactor_destroy (&recorder);
+
+        //  replay into scratch rules dir doesn't publish recorded alerts
+        //  again, unless sink is set; as fast as possible or at recorded pace
+        char *scratch = zsys_sprintf ("%s/replay-scratch", SELFTEST_DIR_RW);
+        zsys_dir_create (scratch);
+        self = flexible_alert_new ();
+        mlm_client_connect (self->mlm, endpoint, 5000, "replayer");
+        mlm_client_set_producer (self->mlm, FTY_PROTO_STREAM_ALERTS_SYS);
+        assert (flexible_alert_replay (self, log_path, 0, scratch) >= 5);
+        assert (s_test_count_alerts (consumer) == 0);
+        assert (self->sink == NULL);
+        size_t alerts = 0;
+        flexible_alert_set_sink (self, s_perf_sink, &alerts);
+        int64_t start = zclock_mono ();
+        assert (flexible_alert_replay (self, log_path, 1, scratch) >= 5);
+        assert (zclock_mono () - start >= 250);
+        assert (alerts == 3);
+        assert (s_test_count_alerts (consumer) == 0);
+
+        //  metrics expire by injected clock
+        assert (zhash_size (self->metrics) == 1);
+        time_t later = time (NULL) + 3600;
+        flexible_alert_set_clock (self, s_replay_clock, &later);
+        flexible_alert_clean_metrics (self);
+        assert (zhash_size (self->metrics) == 0);
+        flexible_alert_destroy (&self);
+        assert (flexible_alert_replay (self, log_path, 0, dir) == -1);
+
+        mlm_client_destroy (&consumer);
+        mlm_client_destroy (&producer);
+        mlm_client_destroy (&ui);
+        char *path = zsys_sprintf ("%s/replay-load.rule", dir);
+        unlink (path);
+        zstr_free (&path);
+        zsys_dir_delete (dir);
+        path = zsys_sprintf ("%s/replay-load.rule", scratch);
+        unlink (path);
+        zstr_free (&path);
+        zsys_dir_delete (scratch);
+        zstr_free (&scratch);
+        unlink (log_path);
+        zstr_free (&dir);
+        zstr_free (&log_path);
+        printf ("OK\n");
+    }
+    //  Performance stage is opt-in: FTY_ALERT_FLEXIBLE_SELFTEST_PERF=1 checks
+    //  results against baseline, =save also writes them to selftest-rw
+    const char *perf = getenv ("FTY_ALERT_FLEXIBLE_SELFTEST_PERF");
+    if (perf && *perf && !streq (perf, "0")) {
+        printf ("\t#10 Performance stage\n");
+        char *dir = zsys_sprintf ("%s/perf-rules", SELFTEST_DIR_RW);
+        char *baseline = zsys_sprintf ("%s/perf-baseline.cfg", SELFTEST_DIR_RO);
+        char *save = streq (perf, "save") ? zsys_sprintf ("%s/perf-baseline.cfg", SELFTEST_DIR_RW) : NULL;
+        int regressions = s_perf_stage (dir, baseline, save);
+        if (regressions)
+            printf (ANSI_COLOR_RED "\t#10 %d performance regressions against %s" ANSI_COLOR_RESET "\n",
+                regressions, baseline);
+        assert (save || regressions == 0);
+        zstr_free (&save);
+        zstr_free (&baseline);
+        zstr_free (&dir);
+        printf ("\t#10 Performance stage OK\n");
+    }
     mlm_client_destroy (&asset);
     // destroy actor
     zactor_destroy (&fs);
@@ -0,0 +1,661 @@
+/*  =========================================================================
+    fty-alert-flexible-bench - In-process benchmark of rule evaluation
+
+    Copyright (C) 2016 - 2017 Tomas Halman
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+/*
+@header
+    fty-alert-flexible-bench - In-process benchmark of rule evaluation
+@discuss
+    Builds flexible_alert without broker, creates N assets and M rules
+    instantiated from templates of rules directory and feeds synthetic
+    metrics directly to flexible_alert_handle_metric. Alerts go to a sink
+    which only counts them. Every scenario is reported as one JSON (or CSV)
+    line with throughput, latency percentiles, allocations and RSS, so runs
+    can be compared by scripts. The program links the library statically,
+    because the engine functions it drives are private to the library.
+@end
+*/
+
+#include "fty_alert_flexible_classes.h"
+#include "bench_util.h"
+#include <inttypes.h>
+#include <time.h>
+
+#define ACTOR_NAME      "fty-alert-flexible-bench"
+#define RULES_DIR       "src/selftest-ro/rules"
+#define SCENARIOS       "steady,flapping,unmatched,unknown"
+#define METRIC_TTL      300
+
+//  Substitutions of template placeholders other than __name__ and __ename__
+static const char *s_placeholders [][2] = {
+    { "__port__", "GPI1" },
+    { "__normalstate__", "closed" },
+    { "__severity__", "WARNING" },
+    { "__rule_result__", "warning" },
+    { "__logicalasset__", "Bench room" },
+    { "__logicalasset_iname__", "bench-room" },
+};
+
+//  One template of rules directory
+typedef struct {
+    char *name;                 //  template name, file name without .rule
+    char *rule;                 //  name of instance, e.g. sts-voltage@__name__
+    char *subtype;              //  device subtype from __device_<subtype>__
+    char *model;                //  required asset model, NULL if any
+    zlist_t *metrics;
+} bench_template_t;
+
+//  Metric of one asset used by some rule
+typedef struct {
+    const char *asset;
+    char *metric;
+    const char *quiet;          //  value which evaluates to OK
+    const char *alert;          //  value which raises alert
+} bench_pair_t;
+
+//  --------------------------------------------------------------------------
+//  Read value of field (VmRSS, VmHWM) from /proc/self/status [kB], -1 if
+//  not known
+
+static long
+s_proc_status (const char *field)
+{
+    FILE *file = fopen ("/proc/self/status", "r");
+    if (!file)
+        return -1;
+    long value = -1;
+    char line [256];
+    size_t len = strlen (field);
+    while (fgets (line, sizeof (line), file)) {
+        if (strncmp (line, field, len) == 0 && line [len] == ':') {
+            value = atol (line + len + 1);
+            break;
+        }
+    }
+    fclose (file);
+    return value;
+}
+
+//  --------------------------------------------------------------------------
+//  Sink of alerts, just counts them
+
+static void
+s_sink (void *arg, const char *topic, zmsg_t **alert_p)
+{
+    (*(uint64_t *) arg)++;
+    zmsg_destroy (alert_p);
+}
+
+//  --------------------------------------------------------------------------
+//  Get string values of key from template text, "key" : "value" as well as
+//  "key" : ["value", ...]. Enough for templates, which are not parsed by
+//  the benchmark otherwise.
+
+static zlist_t *
+s_template_values (const char *text, const char *key)
+{
+    zlist_t *values = zlist_new ();
+    zlist_autofree (values);
+    char *quoted = zsys_sprintf ("\"%s\"", key);
+    const char *p = strstr (text, quoted);
+    zstr_free (&quoted);
+    if (!p)
+        return values;
+    p += strlen (key) + 2;
+    while (isspace (*p) || *p == ':')
+        p++;
+    bool array = *p == '[';
+    while (*p && *p != ']') {
+        const char *start = strchr (p, '"');
+        const char *end = start ? strchr (start + 1, '"') : NULL;
+        if (!end)
+            break;
+        if (array) {
+            const char *close = strchr (p, ']');
+            if (close && close < start)
+                break;
+        }
+        char *value = strndup (start + 1, end - start - 1);
+        zlist_append (values, value);
+        zstr_free (&value);
+        p = end + 1;
+        if (!array)
+            break;
+    }
+    return values;
+}
+
+//  --------------------------------------------------------------------------
+//  Replace placeholders of s_placeholders table in text
+
+static char *
+s_substitute (const char *text)
+{
+    char *result = strdup (text);
+    for (size_t i = 0; i < sizeof (s_placeholders) / sizeof (s_placeholders [0]); i++) {
+        char *found;
+        while ((found = strstr (result, s_placeholders [i][0])) != NULL) {
+            *found = 0;
+            char *replaced = zsys_sprintf ("%s%s%s", result, s_placeholders [i][1],
+                found + strlen (s_placeholders [i][0]));
+            zstr_free (&result);
+            result = replaced;
+        }
+    }
+    return result;
+}
+
+//  --------------------------------------------------------------------------
+//  Load templates from "templates" subdirectory of rules directory. Only
+//  templates for device subtype (name ending @__device_<subtype>__) are
+//  usable. Returns number of templates, -1 if directory can't be read.
+
+static int
+s_load_templates (const char *path, bench_template_t **templates_p)
+{
+    char *dirpath = zsys_sprintf ("%s/templates", path);
+    DIR *dir = opendir (dirpath);
+    if (!dir) {
+        zstr_free (&dirpath);
+        return -1;
+    }
+    size_t capacity = 16;
+    bench_template_t *templates = (bench_template_t *) zmalloc (capacity * sizeof (bench_template_t));
+    assert (templates);
+    int count = 0;
+    struct dirent *entry;
+    while ((entry = readdir (dir)) != NULL) {
+        size_t len = strlen (entry->d_name);
+        const char *device = strstr (entry->d_name, "@__device_");
+        if (len <= 5 || !streq (&entry->d_name [len - 5], ".rule") || !device)
+            continue;
+        char *subtype = strdup (device + strlen ("@__device_"));
+        char *end = strstr (subtype, "__");
+        char *fullpath = zsys_sprintf ("%s/%s", dirpath, entry->d_name);
+        FILE *file = end ? fopen (fullpath, "r") : NULL;
+        zstr_free (&fullpath);
+        if (!file) {
+            zstr_free (&subtype);
+            continue;
+        }
+        *end = 0;
+        fseek (file, 0, SEEK_END);
+        long size = ftell (file);
+        fseek (file, 0, SEEK_SET);
+        char *text = (char *) zmalloc (size + 1);
+        assert (text);
+        size_t got = fread (text, 1, size, file);
+        text [got] = 0;
+        fclose (file);
+
+        zlist_t *names = s_template_values (text, "name");
+        zlist_t *models = s_template_values (text, "models");
+        zlist_t *metrics = s_template_values (text, "metrics");
+        if (zlist_size (names) && zlist_size (metrics)) {
+            if ((size_t) count == capacity) {
+                capacity *= 2;
+                templates = (bench_template_t *) realloc (templates, capacity * sizeof (bench_template_t));
+                assert (templates);
+            }
+            bench_template_t *tmpl = &templates [count++];
+            tmpl->name = strndup (entry->d_name, len - 5);
+            tmpl->rule = strdup ((char *) zlist_first (names));
+            tmpl->subtype = subtype;
+            subtype = NULL;
+            tmpl->model = zlist_size (models) ? strdup ((char *) zlist_first (models)) : NULL;
+            tmpl->metrics = zlist_new ();
+            zlist_autofree (tmpl->metrics);
+            for (char *metric = (char *) zlist_first (metrics); metric; metric = (char *) zlist_next (metrics)) {
+                char *substituted = s_substitute (metric);
+                zlist_append (tmpl->metrics, substituted);
+                zstr_free (&substituted);
+            }
+        }
+        zlist_destroy (&names);
+        zlist_destroy (&models);
+        zlist_destroy (&metrics);
+        zstr_free (&subtype);
+        free (text);
+    }
+    closedir (dir);
+    zstr_free (&dirpath);
+    *templates_p = templates;
+    return count;
+}
+
+//  --------------------------------------------------------------------------
+//  Values of metric making rules OK and alerting. Shipped templates compare
+//  states or numbers; unknown metrics get 0 and 1.
+
+static void
+s_metric_values (const char *metric, const char **quiet, const char **alert)
+{
+    *quiet = "0";
+    *alert = "1";
+    if (strncmp (metric, "status.GPI", 10) == 0) {
+        *quiet = "closed";
+        *alert = "opened";
+    }
+    else
+    if (strncmp (metric, "status.input.", 13) == 0) {
+        *quiet = "good";
+        *alert = "bad";
+    }
+    else
+    if (streq (metric, "input.source")) {
+        *quiet = "1";
+        *alert = "2";
+    }
+    else
+    if (streq (metric, "input.source.preferred"))
+        *quiet = *alert = "1";
+    else
+    if (streq (metric, "licensing.expire")) {
+        *quiet = "60";
+        *alert = "30";
+    }
+}
+
+//  --------------------------------------------------------------------------
+//  Write rule instance of template for asset into directory, return 0 if
+//  successful
+
+static int
+s_write_rule (const char *dir, bench_template_t *tmpl, const char *asset, const char *ename, zlist_t *paths)
+{
+    char *rule = strdup (tmpl->rule);
+    char *placeholder = strstr (rule, "__name__");
+    if (placeholder) {
+        *placeholder = 0;
+        char *named = zsys_sprintf ("%s%s%s", rule, asset, placeholder + strlen ("__name__"));
+        zstr_free (&rule);
+        rule = named;
+    }
+    char *path = zsys_sprintf ("%s/%s.rule", dir, rule);
+    FILE *file = fopen (path, "w");
+    if (!file) {
+        zstr_free (&path);
+        zstr_free (&rule);
+        return -1;
+    }
+    fprintf (file, "{\"name\":\"%s\",\"template\":\"%s\",\"substitutions\":{"
+        "\"__name__\":\"%s\",\"__ename__\":\"%s\"",
+        rule, tmpl->name, asset, ename);
+    for (size_t i = 0; i < sizeof (s_placeholders) / sizeof (s_placeholders [0]); i++)
+        fprintf (file, ",\"%s\":\"%s\"", s_placeholders [i][0], s_placeholders [i][1]);
+    fprintf (file, "}}\n");
+    fclose (file);
+    zlist_append (paths, path);
+    zstr_free (&path);
+    zstr_free (&rule);
+    return 0;
+}
+
+//  --------------------------------------------------------------------------
+//  Send asset to engine
+
+static void
+s_send_asset (flexible_alert_t *engine, const char *name, const char *ename, bench_template_t *tmpl)
+{
+    zhash_t *aux = zhash_new ();
+    zhash_autofree (aux);
+    zhash_insert (aux, FTY_PROTO_ASSET_AUX_TYPE, (void *) "device");
+    zhash_insert (aux, FTY_PROTO_ASSET_AUX_SUBTYPE, (void *) tmpl->subtype);
+    zhash_t *ext = zhash_new ();
+    zhash_autofree (ext);
+    zhash_insert (ext, "name", (void *) ename);
+    if (tmpl->model)
+        zhash_insert (ext, FTY_PROTO_ASSET_EXT_MODEL, (void *) tmpl->model);
+    zmsg_t *msg = fty_proto_encode_asset (aux, name, FTY_PROTO_ASSET_OP_UPDATE, ext);
+    fty_proto_t *ftymsg = fty_proto_decode (&msg);
+    flexible_alert_handle_asset (engine, ftymsg);
+    fty_proto_destroy (&ftymsg);
+    zhash_destroy (&aux);
+    zhash_destroy (&ext);
+}
+
+//  --------------------------------------------------------------------------
+//  Create metric message
+
+static fty_proto_t *
+s_metric (const char *asset, const char *type, const char *value)
+{
+    zmsg_t *msg = fty_proto_encode_metric (NULL, time (NULL), METRIC_TTL, type, asset, value, "");
+    return fty_proto_decode (&msg);
+}
+
+static int
+s_compare_u64 (const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+    return x < y ? -1 : x > y ? 1 : 0;
+}
+
+//  --------------------------------------------------------------------------
+//  Latency percentile [us] of sorted latencies [ns]
+
+static double
+s_percentile (uint64_t *sorted, size_t count, double p)
+{
+    if (count == 0)
+        return 0;
+    size_t index = (size_t) (p * count);
+    if (index >= count)
+        index = count - 1;
+    return sorted [index] / 1000.0;
+}
+
+int main (int argc, char *argv [])
+{
+    ftylog_setInstance (ACTOR_NAME, "");
+    bool verbose = false;
+    const char *rules_dir = RULES_DIR;
+    const char *scenarios = SCENARIOS;
+    const char *format = "json";
+    const char *output = NULL;
+    const char *log_config = NULL;
+    long assets_count = 1000;
+    long rules_count = 0;
+    long metrics_count = 100000;
+
+    int argn;
+    for (argn = 1; argn < argc; argn++) {
+        const char *param = NULL;
+        if (argn < argc - 1) param = argv [argn+1];
+
+        if (streq (argv [argn], "--help")
+        ||  streq (argv [argn], "-h")) {
+            puts ("fty-alert-flexible-bench [options] ...");
+            puts ("  -v|--verbose          verbose output of the engine");
+            puts ("  -h|--help             this information");
+            puts ("  -t|--templates        rules directory with templates subdirectory [" RULES_DIR "]");
+            puts ("  -a|--assets           number of assets [1000]");
+            puts ("  -r|--rules            number of rules, 0 every template for every asset [0]");
+            puts ("  -m|--metrics          metrics sent in one scenario [100000]");
+            puts ("  -s|--scenario         comma separated scenarios [" SCENARIOS "]");
+            puts ("  -f|--format           json or csv [json]");
+            puts ("  -o|--output           append results to file instead of stdout");
+            puts ("  -l|--log-config       log4cplus configuration, to silence logs of the engine");
+            puts ("");
+            puts ("Scenarios:");
+            puts ("  steady                values keep rules OK");
+            puts ("  flapping              values alternate between OK and alert on every round");
+            puts ("  unmatched             metrics of known assets no rule uses");
+            puts ("  unknown               metrics of unknown assets");
+            return 0;
+        }
+        else if (streq (argv [argn], "--verbose") || streq (argv [argn], "-v")) {
+            verbose = true;
+        }
+        else if (streq (argv [argn], "--templates") || streq (argv [argn], "-t")) {
+            if (param) rules_dir = param;
+            ++argn;
+        }
+        else if (streq (argv [argn], "--assets") || streq (argv [argn], "-a")) {
+            if (param) assets_count = atol (param);
+            ++argn;
+        }
+        else if (streq (argv [argn], "--rules") || streq (argv [argn], "-r")) {
+            if (param) rules_count = atol (param);
+            ++argn;
+        }
+        else if (streq (argv [argn], "--metrics") || streq (argv [argn], "-m")) {
+            if (param) metrics_count = atol (param);
+            ++argn;
+        }
+        else if (streq (argv [argn], "--scenario") || streq (argv [argn], "-s")) {
+            if (param) scenarios = param;
+            ++argn;
+        }
+        else if (streq (argv [argn], "--format") || streq (argv [argn], "-f")) {
+            if (param) format = param;
+            ++argn;
+        }
+        else if (streq (argv [argn], "--output") || streq (argv [argn], "-o")) {
+            if (param) output = param;
+            ++argn;
+        }
+        else if (streq (argv [argn], "--log-config") || streq (argv [argn], "-l")) {
+            if (param) log_config = param;
+            ++argn;
+        }
+        else {
+            printf ("Unknown option: %s\n", argv [argn]);
+            return 1;
+        }
+    }
+    bool csv = streq (format, "csv");
+    if ((!csv && !streq (format, "json")) || assets_count <= 0 || rules_count < 0 || metrics_count <= 0) {
+        fprintf (stderr, "Invalid format or counts, see --help\n");
+        return 1;
+    }
+    if (log_config)
+        ftylog_setConfigFile (ftylog_getInstance (), log_config);
+    if (verbose)
+        ftylog_setVeboseMode (ftylog_getInstance ());
+
+    //  Templates and kinds of assets they apply to
+    bench_template_t *templates = NULL;
+    int templates_count = s_load_templates (rules_dir, &templates);
+    if (templates_count <= 0) {
+        fprintf (stderr, "No usable templates in %s/templates\n", rules_dir);
+        free (templates);
+        return 1;
+    }
+    //  kinds [i] is first template of i-th distinct subtype and model
+    int *kinds = (int *) zmalloc (templates_count * sizeof (int));
+    assert (kinds);
+    int kinds_count = 0;
+    for (int i = 0; i < templates_count; i++) {
+        bool known = false;
+        for (int k = 0; k < kinds_count && !known; k++) {
+            bench_template_t *kind = &templates [kinds [k]];
+            known = streq (kind->subtype, templates [i].subtype)
+                && ((!kind->model && !templates [i].model)
+                    || (kind->model && templates [i].model && streq (kind->model, templates [i].model)));
+        }
+        if (!known)
+            kinds [kinds_count++] = i;
+    }
+
+    //  Rules directory with instances, templates are linked
+    const char *tmpdir = getenv ("TMPDIR");
+    char *workdir = zsys_sprintf ("%s/" ACTOR_NAME ".XXXXXX", tmpdir ? tmpdir : "/tmp");
+    char *templates_dir = zsys_sprintf ("%s/templates", rules_dir);
+    char *templates_path = realpath (templates_dir, NULL);
+    char *templates_link = NULL;
+    if (!mkdtemp (workdir) || !templates_path
+    ||  symlink (templates_path, (templates_link = zsys_sprintf ("%s/templates", workdir))) != 0) {
+        fprintf (stderr, "Can't prepare rules in %s: %s\n", workdir, strerror (errno));
+        return 1;
+    }
+
+    char **names = (char **) zmalloc (assets_count * sizeof (char *));
+    char **enames = (char **) zmalloc (assets_count * sizeof (char *));
+    bench_pair_t *pairs = NULL;
+    size_t pairs_count = 0, pairs_capacity = 0;
+    zlist_t *paths = zlist_new ();
+    zlist_autofree (paths);
+    long rules_written = 0;
+    for (long i = 0; i < assets_count; i++) {
+        bench_template_t *kind = &templates [kinds [i % kinds_count]];
+        names [i] = zsys_sprintf ("bench-%s-%ld", kind->subtype, i);
+        enames [i] = zsys_sprintf ("Bench %s %ld", kind->subtype, i);
+    }
+    //  Instances are spread over assets, one template after other
+    for (int round = 0; rules_count == 0 || rules_written < rules_count; round++) {
+        bool written = false;
+        for (long i = 0; i < assets_count && (rules_count == 0 || rules_written < rules_count); i++) {
+            bench_template_t *kind = &templates [kinds [i % kinds_count]];
+            //  round-th template of asset kind
+            int index = -1;
+            for (int t = 0, seen = 0; t < templates_count && index < 0; t++) {
+                if (streq (templates [t].subtype, kind->subtype)
+                &&  ((!kind->model && !templates [t].model)
+                    || (kind->model && templates [t].model && streq (kind->model, templates [t].model)))
+                &&  seen++ == round)
+                    index = t;
+            }
+            if (index < 0)
+                continue;
+            bench_template_t *tmpl = &templates [index];
+            if (s_write_rule (workdir, tmpl, names [i], enames [i], paths) != 0) {
+                fprintf (stderr, "Can't write rule to %s: %s\n", workdir, strerror (errno));
+                return 1;
+            }
+            rules_written++;
+            written = true;
+            for (char *metric = (char *) zlist_first (tmpl->metrics); metric; metric = (char *) zlist_next (tmpl->metrics)) {
+                if (pairs_count == pairs_capacity) {
+                    pairs_capacity = pairs_capacity ? pairs_capacity * 2 : 1024;
+                    pairs = (bench_pair_t *) realloc (pairs, pairs_capacity * sizeof (bench_pair_t));
+                    assert (pairs);
+                }
+                bench_pair_t *pair = &pairs [pairs_count++];
+                pair->asset = names [i];
+                pair->metric = strdup (metric);
+                s_metric_values (metric, &pair->quiet, &pair->alert);
+            }
+        }
+        if (!written)
+            break;
+    }
+
+    //  Engine with rules and assets
+    uint64_t alerts = 0;
+    flexible_alert_t *engine = flexible_alert_new ();
+    flexible_alert_set_sink (engine, s_sink, &alerts);
+    uint64_t start = bench_nsecs ();
+    flexible_alert_load_rules (engine, workdir);
+    double load_ms = (bench_nsecs () - start) / 1e6;
+    start = bench_nsecs ();
+    for (long i = 0; i < assets_count; i++)
+        s_send_asset (engine, names [i], enames [i], &templates [kinds [i % kinds_count]]);
+    double assets_ms = (bench_nsecs () - start) / 1e6;
+
+    //  every rule gets all its metrics once, so scenarios evaluate them
+    for (size_t i = 0; i < pairs_count; i++) {
+        fty_proto_t *metric = s_metric (pairs [i].asset, pairs [i].metric, pairs [i].quiet);
+        flexible_alert_handle_metric (engine, &metric, false);
+        fty_proto_destroy (&metric);
+    }
+
+    FILE *out = output ? fopen (output, "a") : stdout;
+    if (!out) {
+        fprintf (stderr, "Can't open %s: %s\n", output, strerror (errno));
+        return 1;
+    }
+    if (csv)
+        fprintf (out, "scenario,assets,rules,metrics,alerts,seconds,metrics_per_sec,"
+            "p50_us,p99_us,p999_us,max_us,allocs_per_metric,bytes_per_metric,"
+            "rss_kb,peak_rss_kb,load_ms,assets_ms\n");
+
+    uint64_t *latencies = (uint64_t *) zmalloc (metrics_count * sizeof (uint64_t));
+    assert (latencies);
+    char *list = strdup (scenarios);
+    for (char *scenario = strtok (list, ","); scenario; scenario = strtok (NULL, ",")) {
+        bool flapping = streq (scenario, "flapping");
+        bool unmatched = streq (scenario, "unmatched");
+        bool unknown = streq (scenario, "unknown");
+        if (!flapping && !unmatched && !unknown && !streq (scenario, "steady")) {
+            fprintf (stderr, "Unknown scenario %s\n", scenario);
+            continue;
+        }
+        if (pairs_count == 0)
+            break;
+        alerts = 0;
+        uint64_t allocs = 0, alloc_bytes = 0, total = 0;
+        for (long n = 0; n < metrics_count; n++) {
+            bench_pair_t *pair = &pairs [n % pairs_count];
+            bool odd = (n / pairs_count) % 2 == 1;
+            char *unknown_name = unknown ? zsys_sprintf ("bench-unknown-%ld", n % assets_count) : NULL;
+            fty_proto_t *metric = s_metric (
+                unknown ? unknown_name : pair->asset,
+                unmatched ? "bench.unused" : pair->metric,
+                flapping && odd ? pair->alert : pair->quiet);
+
+            uint64_t allocs_before = bench_allocs ();
+            uint64_t bytes_before = bench_alloc_bytes ();
+            uint64_t t = bench_nsecs ();
+            flexible_alert_handle_metric (engine, &metric, false);
+            latencies [n] = bench_nsecs () - t;
+            allocs += bench_allocs () - allocs_before;
+            alloc_bytes += bench_alloc_bytes () - bytes_before;
+            total += latencies [n];
+
+            fty_proto_destroy (&metric);
+            zstr_free (&unknown_name);
+        }
+        qsort (latencies, metrics_count, sizeof (uint64_t), s_compare_u64);
+        double seconds = total / 1e9;
+        double per_sec = seconds > 0 ? metrics_count / seconds : 0;
+        double allocs_per_metric = BENCH_ALLOCS ? (double) allocs / metrics_count : -1;
+        double bytes_per_metric = BENCH_ALLOCS ? (double) alloc_bytes / metrics_count : -1;
+        const char *fmt = csv
+            ? "%s,%ld,%ld,%ld,%" PRIu64 ",%.6f,%.1f,%.3f,%.3f,%.3f,%.3f,%.2f,%.1f,%ld,%ld,%.3f,%.3f\n"
+            : "{\"scenario\":\"%s\",\"assets\":%ld,\"rules\":%ld,\"metrics\":%ld,\"alerts\":%" PRIu64 ","
+              "\"seconds\":%.6f,\"metrics_per_sec\":%.1f,\"p50_us\":%.3f,\"p99_us\":%.3f,"
+              "\"p999_us\":%.3f,\"max_us\":%.3f,\"allocs_per_metric\":%.2f,\"bytes_per_metric\":%.1f,"
+              "\"rss_kb\":%ld,\"peak_rss_kb\":%ld,\"load_ms\":%.3f,\"assets_ms\":%.3f}\n";
+        fprintf (out, fmt, scenario, assets_count, rules_written, metrics_count, alerts,
+            seconds, per_sec,
+            s_percentile (latencies, metrics_count, 0.5),
+            s_percentile (latencies, metrics_count, 0.99),
+            s_percentile (latencies, metrics_count, 0.999),
+            latencies [metrics_count - 1] / 1000.0,
+            allocs_per_metric, bytes_per_metric,
+            s_proc_status ("VmRSS"), s_proc_status ("VmHWM"), load_ms, assets_ms);
+        fflush (out);
+    }
+    zstr_free (&list);
+    if (out != stdout)
+        fclose (out);
+
+    flexible_alert_destroy (&engine);
+    for (const char *path = (const char *) zlist_first (paths); path; path = (const char *) zlist_next (paths))
+        unlink (path);
+    unlink (templates_link);
+    rmdir (workdir);
+    zlist_destroy (&paths);
+    for (size_t i = 0; i < pairs_count; i++)
+        free (pairs [i].metric);
+    free (pairs);
+    for (long i = 0; i < assets_count; i++) {
+        zstr_free (&names [i]);
+        zstr_free (&enames [i]);
+    }
+    free (names);
+    free (enames);
+    for (int i = 0; i < templates_count; i++) {
+        zstr_free (&templates [i].name);
+        zstr_free (&templates [i].rule);
+        zstr_free (&templates [i].subtype);
+        zstr_free (&templates [i].model);
+        zlist_destroy (&templates [i].metrics);
+    }
+    free (templates);
+    free (kinds);
+    free (latencies);
+    zstr_free (&templates_link);
+    zstr_free (&templates_dir);
+    free (templates_path);
+    zstr_free (&workdir);
+    return 0;
+}
@@ -0,0 +1,530 @@
+/*  =========================================================================
+    fty-alert-flexible-load - Load generator driving the agent through malamute
+
+    Copyright (C) 2016 - 2017 Tomas Halman
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+/*
+@header
+    fty-alert-flexible-load - Load generator driving the agent through malamute
+@discuss
+    Starts malamute and flexible_alert_actor in process, publishes assets on
+    ASSETS stream and metrics on METRICS and METRICS_SENSOR streams at given
+    rate and consumes _ALERTS_SYS. Every metric carries its sequence number
+    as value and rules return it in alert message, so each alert is matched
+    to the metric which raised it: latency is measured from publishing the
+    metric to receiving the alert. Without fixed rate, the rate is doubled
+    until delivery or latency fails and then bisected, the highest passing
+    rate being the saturation point.
+@end
+*/
+
+#include "fty_alert_flexible_classes.h"
+#include <inttypes.h>
+#include <time.h>
+
+#define ACTOR_NAME      "fty-alert-flexible"
+#define ENDPOINT        "inproc://fty-alert-flexible-load"
+#define METRIC_TTL      300
+#define SENSOR_MODEL    "LOAD-GPIO"
+#define UPS_METRIC      "load.default"
+#define SENSOR_PORT     "GPI1"
+#define SENSOR_METRIC   "status." SENSOR_PORT
+#define WARMUP_TIMEOUT  10000   //  wait for alerts of first metric of every asset [ms]
+
+//  Odd sequence numbers raise warning, even ones resolve it; every metric
+//  is evaluated and published, with its number as message. Message must not
+//  be numeric, first numeric return value would be taken as result.
+#define MESSAGE_PREFIX  "seq "
+#define EVALUATION \
+    "function main (x) if tonumber (x) % 2 == 1 then return WARNING, '" MESSAGE_PREFIX "' .. x end " \
+    "return OK, '" MESSAGE_PREFIX "' .. x end"
+
+//  Generator state
+typedef struct {
+    mlm_client_t *assets;       //  producer of ASSETS
+    mlm_client_t *metrics;      //  producer of METRICS
+    mlm_client_t *sensors;      //  producer of METRICS_SENSOR
+    mlm_client_t *alerts;       //  consumer of _ALERTS_SYS
+    zpoller_t *poller;
+    long ups_count;
+    long sensor_count;
+    double asset_rate;          //  asset updates per second during run
+    uint64_t seq;               //  sequence number of next metric
+    uint64_t asset_update;      //  next asset to republish
+    uint64_t base;              //  first sequence number of current run
+    uint64_t *sent_at;          //  publish time of metrics of current run [ns], 0 once alerted
+    uint64_t *latencies;        //  latencies of current run [ns]
+    size_t capacity;
+} load_t;
+
+//  Result of one run at given rate
+typedef struct {
+    const char *kind;           //  step or saturation
+    double rate;                //  offered metrics per second, 0 for burst
+    uint64_t sent;
+    uint64_t alerts;
+    double seconds;             //  publishing time
+    double p50, p99, p999, max; //  latency [ms]
+    bool passed;
+} load_step_t;
+
+//  --------------------------------------------------------------------------
+//  Monotonic time [ns]
+
+static uint64_t
+s_nsecs (void)
+{
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int
+s_compare_u64 (const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+    return x < y ? -1 : x > y ? 1 : 0;
+}
+
+//  --------------------------------------------------------------------------
+//  Latency percentile [ms] of sorted latencies [ns]
+
+static double
+s_percentile (uint64_t *sorted, size_t count, double p)
+{
+    if (count == 0)
+        return 0;
+    size_t index = (size_t) (p * count);
+    if (index >= count)
+        index = count - 1;
+    return sorted [index] / 1e6;
+}
+
+//  --------------------------------------------------------------------------
+//  Write rules into directory: one rule for all UPSes and one rule for
+//  every sensor, as sensor rules must name their asset. Returns 0 if
+//  successful.
+
+static int
+s_write_rules (const char *dir, long sensors, zlist_t *paths)
+{
+    for (long i = -1; i < sensors; i++) {
+        char *path = i < 0
+            ? zsys_sprintf ("%s/load-ups.rule", dir)
+            : zsys_sprintf ("%s/load-sensor-%ld.rule", dir, i);
+        FILE *file = fopen (path, "w");
+        if (!file) {
+            zstr_free (&path);
+            return -1;
+        }
+        if (i < 0)
+            fprintf (file, "{\"name\":\"load-ups\",\"metrics\":[\"" UPS_METRIC "\"],\"types\":[\"ups\"],"
+                "\"results\":{\"high_warning\":{\"action\":[]}},\"evaluation\":\"%s\"}\n", EVALUATION);
+        else
+            fprintf (file, "{\"name\":\"load-sensor@load-sensor-%ld\",\"metrics\":[\"" SENSOR_METRIC "\"],"
+                "\"assets\":[\"load-sensor-%ld\"],\"models\":[\"" SENSOR_MODEL "\"],"
+                "\"results\":{\"high_warning\":{\"action\":[]}},\"evaluation\":\"%s\"}\n", i, i, EVALUATION);
+        fclose (file);
+        zlist_append (paths, path);
+        zstr_free (&path);
+    }
+    return 0;
+}
+
+//  --------------------------------------------------------------------------
+//  Publish inventory of asset, index below ups_count is UPS, others are
+//  sensors
+
+static void
+s_publish_asset (load_t *self, long index)
+{
+    bool ups = index < self->ups_count;
+    char *name = ups
+        ? zsys_sprintf ("load-ups-%ld", index)
+        : zsys_sprintf ("load-sensor-%ld", index - self->ups_count);
+    zhash_t *aux = zhash_new ();
+    zhash_autofree (aux);
+    zhash_insert (aux, FTY_PROTO_ASSET_AUX_TYPE, (void *) "device");
+    zhash_insert (aux, FTY_PROTO_ASSET_AUX_SUBTYPE, (void *) (ups ? "ups" : "sensorgpio"));
+    zhash_t *ext = zhash_new ();
+    zhash_autofree (ext);
+    zhash_insert (ext, "name", (void *) name);
+    if (!ups)
+        zhash_insert (ext, FTY_PROTO_ASSET_EXT_MODEL, (void *) SENSOR_MODEL);
+    zmsg_t *msg = fty_proto_encode_asset (aux, name, FTY_PROTO_ASSET_OP_INVENTORY, ext);
+    char *subject = zsys_sprintf ("%s.%s@%s", "device", ups ? "ups" : "sensorgpio", name);
+    mlm_client_send (self->assets, subject, &msg);
+    zstr_free (&subject);
+    zhash_destroy (&aux);
+    zhash_destroy (&ext);
+    zstr_free (&name);
+}
+
+//  --------------------------------------------------------------------------
+//  Publish next metric, assets take turns
+
+static void
+s_publish_metric (load_t *self)
+{
+    uint64_t seq = self->seq++;
+    long index = (long) (seq % (self->ups_count + self->sensor_count));
+    char *value = zsys_sprintf ("%" PRIu64, seq);
+    self->sent_at [seq - self->base] = s_nsecs ();
+    if (index < self->ups_count) {
+        char *name = zsys_sprintf ("load-ups-%ld", index);
+        zmsg_t *msg = fty_proto_encode_metric (NULL, time (NULL), METRIC_TTL, UPS_METRIC, name, value, "%");
+        char *subject = zsys_sprintf ("%s@%s", UPS_METRIC, name);
+        mlm_client_send (self->metrics, subject, &msg);
+        zstr_free (&subject);
+        zstr_free (&name);
+    }
+    else {
+        char *name = zsys_sprintf ("load-sensor-%ld", index - self->ups_count);
+        zhash_t *aux = zhash_new ();
+        zhash_autofree (aux);
+        zhash_insert (aux, FTY_PROTO_METRICS_AUX_PORT, (void *) SENSOR_PORT);
+        zhash_insert (aux, FTY_PROTO_METRICS_SENSOR_AUX_SNAME, (void *) name);
+        zmsg_t *msg = fty_proto_encode_metric (aux, time (NULL), METRIC_TTL, SENSOR_METRIC, "load-parent", value, "");
+        char *subject = zsys_sprintf ("%s@%s", SENSOR_METRIC, name);
+        mlm_client_send (self->sensors, subject, &msg);
+        zstr_free (&subject);
+        zhash_destroy (&aux);
+        zstr_free (&name);
+    }
+    zstr_free (&value);
+}
+
+//  --------------------------------------------------------------------------
+//  Receive alerts for at most timeout [ms], return number of alerts of
+//  metrics of current run
+
+static uint64_t
+s_receive (load_t *self, int timeout, size_t *latencies_count)
+{
+    uint64_t received = 0;
+    void *which = zpoller_wait (self->poller, timeout);
+    while (which) {
+        zmsg_t *msg = mlm_client_recv (self->alerts);
+        uint64_t now = s_nsecs ();
+        fty_proto_t *alert = msg ? fty_proto_decode (&msg) : NULL;
+        const char *description = alert ? fty_proto_description (alert) : NULL;
+        if (description && strncmp (description, MESSAGE_PREFIX, strlen (MESSAGE_PREFIX)) == 0) {
+            uint64_t seq = strtoull (description + strlen (MESSAGE_PREFIX), NULL, 10);
+            if (seq >= self->base && seq - self->base < self->capacity && self->sent_at [seq - self->base]) {
+                self->latencies [(*latencies_count)++] = now - self->sent_at [seq - self->base];
+                self->sent_at [seq - self->base] = 0;
+                received++;
+            }
+        }
+        fty_proto_destroy (&alert);
+        zmsg_destroy (&msg);
+        which = zpoller_wait (self->poller, 0);
+    }
+    return received;
+}
+
+//  --------------------------------------------------------------------------
+//  Publish count metrics at rate per second (0 at once) and wait for their
+//  alerts until all arrive or none arrives for drain [ms]
+
+static void
+s_run (load_t *self, double rate, uint64_t count, int drain, load_step_t *step)
+{
+    if (count > self->capacity) {
+        self->capacity = count;
+        self->sent_at = (uint64_t *) realloc (self->sent_at, count * sizeof (uint64_t));
+        self->latencies = (uint64_t *) realloc (self->latencies, count * sizeof (uint64_t));
+        assert (self->sent_at && self->latencies);
+    }
+    memset (self->sent_at, 0, self->capacity * sizeof (uint64_t));
+    self->base = self->seq;
+    memset (step, 0, sizeof (load_step_t));
+    step->kind = "step";
+    step->rate = rate;
+    size_t latencies_count = 0;
+    uint64_t start = s_nsecs ();
+    uint64_t updates = 0;
+    while (step->sent < count && !zsys_interrupted) {
+        double elapsed = (s_nsecs () - start) / 1e9;
+        uint64_t due = rate > 0 ? (uint64_t) (elapsed * rate) + 1 : count;
+        if (due > count)
+            due = count;
+        for (; step->sent < due; step->sent++)
+            s_publish_metric (self);
+        //  inventory updates make the agent rebind assets meanwhile
+        for (; self->asset_rate > 0 && updates < (uint64_t) (elapsed * self->asset_rate); updates++)
+            s_publish_asset (self, (long) (self->asset_update++ % (self->ups_count + self->sensor_count)));
+        step->alerts += s_receive (self, rate > 0 ? 1 : 0, &latencies_count);
+    }
+    step->seconds = (s_nsecs () - start) / 1e9;
+    while (step->alerts < step->sent && !zsys_interrupted) {
+        uint64_t received = s_receive (self, drain, &latencies_count);
+        if (received == 0)
+            break;
+        step->alerts += received;
+    }
+    qsort (self->latencies, latencies_count, sizeof (uint64_t), s_compare_u64);
+    step->p50 = s_percentile (self->latencies, latencies_count, 0.5);
+    step->p99 = s_percentile (self->latencies, latencies_count, 0.99);
+    step->p999 = s_percentile (self->latencies, latencies_count, 0.999);
+    step->max = latencies_count ? self->latencies [latencies_count - 1] / 1e6 : 0;
+}
+
+//  --------------------------------------------------------------------------
+//  Print result of run
+
+static void
+s_report (FILE *out, bool csv, load_step_t *step)
+{
+    double delivered = step->sent ? (double) step->alerts / step->sent : 0;
+    double throughput = step->seconds > 0 ? step->alerts / step->seconds : 0;
+    const char *fmt = csv
+        ? "%s,%.1f,%" PRIu64 ",%" PRIu64 ",%.4f,%.1f,%.3f,%.3f,%.3f,%.3f,%s\n"
+        : "{\"kind\":\"%s\",\"rate\":%.1f,\"sent\":%" PRIu64 ",\"alerts\":%" PRIu64 ","
+          "\"delivered\":%.4f,\"alerts_per_sec\":%.1f,\"p50_ms\":%.3f,\"p99_ms\":%.3f,"
+          "\"p999_ms\":%.3f,\"max_ms\":%.3f,\"passed\":%s}\n";
+    fprintf (out, fmt, step->kind, step->rate, step->sent, step->alerts, delivered, throughput,
+        step->p50, step->p99, step->p999, step->max, step->passed ? "true" : "false");
+    fflush (out);
+}
+
+int main (int argc, char *argv [])
+{
+    ftylog_setInstance ("fty-alert-flexible-load", "");
+    bool verbose = false;
+    const char *endpoint = ENDPOINT;
+    const char *format = "json";
+    const char *output = NULL;
+    const char *log_config = NULL;
+    long ups_count = 1000;
+    long sensor_count = 100;
+    double rate = 0;
+    double start_rate = 1000;
+    double duration = 5;
+    double asset_rate = 10;
+    double max_latency = 1000;
+    double min_delivery = 0.99;
+    int bisections = 4;
+
+    int argn;
+    for (argn = 1; argn < argc; argn++) {
+        const char *param = NULL;
+        if (argn < argc - 1) param = argv [argn+1];
+
+        if (streq (argv [argn], "--help")
+        ||  streq (argv [argn], "-h")) {
+            puts ("fty-alert-flexible-load [options] ...");
+            puts ("  -v|--verbose          verbose output of the agent");
+            puts ("  -h|--help             this information");
+            puts ("  -e|--endpoint         malamute endpoint started in process [" ENDPOINT "]");
+            puts ("  -a|--assets           number of UPSes, metrics on METRICS stream [1000]");
+            puts ("  -g|--sensors          number of GPIO sensors, metrics on METRICS_SENSOR stream [100]");
+            puts ("  -r|--rate             metrics per second, 0 to find saturation point [0]");
+            puts ("  --start-rate          first rate of saturation search [1000]");
+            puts ("  -d|--duration         seconds of publishing at one rate [5]");
+            puts ("  --asset-rate          asset inventory updates per second while publishing [10]");
+            puts ("  --max-latency         passing p99 latency from metric to alert [1000 ms]");
+            puts ("  --min-delivery        passing fraction of metrics which raised alert [0.99]");
+            puts ("  --bisections          runs refining saturation point after first failure [4]");
+            puts ("  -f|--format           json or csv [json]");
+            puts ("  -o|--output           append results to file instead of stdout");
+            puts ("  -l|--log-config       log4cplus configuration of the agent");
+            return 0;
+        }
+        else if (streq (argv [argn], "--verbose") || streq (argv [argn], "-v")) {
+            verbose = true;
+        }
+        else if (streq (argv [argn], "--endpoint") || streq (argv [argn], "-e")) {
+            if (param) endpoint = param;
+            ++argn;
+        }
+        else if (streq (argv [argn], "--assets") || streq (argv [argn], "-a")) {
+            if (param) ups_count = atol (param);
+            ++argn;
+        }
+        else if (streq (argv [argn], "--sensors") || streq (argv [argn], "-g")) {
+            if (param) sensor_count = atol (param);
+            ++argn;
+        }
+        else if (streq (argv [argn], "--rate") || streq (argv [argn], "-r")) {
+            if (param) rate = atof (param);
+            ++argn;
+        }
+        else if (streq (argv [argn], "--start-rate")) {
+            if (param) start_rate = atof (param);
+            ++argn;
+        }
+        else if (streq (argv [argn], "--duration") || streq (argv [argn], "-d")) {
+            if (param) duration = atof (param);
+            ++argn;
+        }
+        else if (streq (argv [argn], "--asset-rate")) {
+            if (param) asset_rate = atof (param);
+            ++argn;
+        }
+        else if (streq (argv [argn], "--max-latency")) {
+            if (param) max_latency = atof (param);
+            ++argn;
+        }
+        else if (streq (argv [argn], "--min-delivery")) {
+            if (param) min_delivery = atof (param);
+            ++argn;
+        }
+        else if (streq (argv [argn], "--bisections")) {
+            if (param) bisections = atoi (param);
+            ++argn;
+        }
+        else if (streq (argv [argn], "--format") || streq (argv [argn], "-f")) {
+            if (param) format = param;
+            ++argn;
+        }
+        else if (streq (argv [argn], "--output") || streq (argv [argn], "-o")) {
+            if (param) output = param;
+            ++argn;
+        }
+        else if (streq (argv [argn], "--log-config") || streq (argv [argn], "-l")) {
+            if (param) log_config = param;
+            ++argn;
+        }
+        else {
+            printf ("Unknown option: %s\n", argv [argn]);
+            return 1;
+        }
+    }
+    bool csv = streq (format, "csv");
+    if ((!csv && !streq (format, "json")) || ups_count < 0 || sensor_count < 0 || ups_count + sensor_count == 0
+    ||  rate < 0 || start_rate <= 0 || duration <= 0) {
+        fprintf (stderr, "Invalid format, counts or rates, see --help\n");
+        return 1;
+    }
+    if (log_config)
+        ftylog_setConfigFile (ftylog_getInstance (), log_config);
+    if (verbose)
+        ftylog_setVeboseMode (ftylog_getInstance ());
+
+    const char *tmpdir = getenv ("TMPDIR");
+    char *workdir = zsys_sprintf ("%s/fty-alert-flexible-load.XXXXXX", tmpdir ? tmpdir : "/tmp");
+    zlist_t *paths = zlist_new ();
+    zlist_autofree (paths);
+    if (!mkdtemp (workdir) || s_write_rules (workdir, sensor_count, paths) != 0) {
+        fprintf (stderr, "Can't write rules to %s: %s\n", workdir, strerror (errno));
+        return 1;
+    }
+    FILE *out = output ? fopen (output, "a") : stdout;
+    if (!out) {
+        fprintf (stderr, "Can't open %s: %s\n", output, strerror (errno));
+        return 1;
+    }
+
+    //  broker and the agent as it runs in production
+    zactor_t *server = zactor_new (mlm_server, (void *) "Malamute");
+    zstr_sendx (server, "BIND", endpoint, NULL);
+    zlist_t *params = zlist_new ();
+    zlist_append (params, (void *) ".*");
+    zlist_append (params, (void *) ".*");
+    zactor_t *agent = zactor_new (flexible_alert_actor, (void *) params);
+    zstr_sendx (agent, "BIND", endpoint, ACTOR_NAME, NULL);
+    zstr_sendx (agent, "PRODUCER", FTY_PROTO_STREAM_ALERTS_SYS, NULL);
+    zstr_sendx (agent, "CONSUMER", FTY_PROTO_STREAM_METRICS, ".*", NULL);
+    zstr_sendx (agent, "CONSUMER", FTY_PROTO_STREAM_METRICS_SENSOR, "status.*", NULL);
+    zstr_sendx (agent, "CONSUMER", FTY_PROTO_STREAM_ASSETS, ".*", NULL);
+    zstr_sendx (agent, "LOADRULES", workdir, NULL);
+
+    load_t self;
+    memset (&self, 0, sizeof (self));
+    self.ups_count = ups_count;
+    self.sensor_count = sensor_count;
+    self.asset_rate = asset_rate;
+    self.assets = mlm_client_new ();
+    mlm_client_connect (self.assets, endpoint, 5000, "fty-alert-flexible-load-assets");
+    mlm_client_set_producer (self.assets, FTY_PROTO_STREAM_ASSETS);
+    self.metrics = mlm_client_new ();
+    mlm_client_connect (self.metrics, endpoint, 5000, "fty-alert-flexible-load-metrics");
+    mlm_client_set_producer (self.metrics, FTY_PROTO_STREAM_METRICS);
+    self.sensors = mlm_client_new ();
+    mlm_client_connect (self.sensors, endpoint, 5000, "fty-alert-flexible-load-sensors");
+    mlm_client_set_producer (self.sensors, FTY_PROTO_STREAM_METRICS_SENSOR);
+    self.alerts = mlm_client_new ();
+    mlm_client_connect (self.alerts, endpoint, 5000, "fty-alert-flexible-load-alerts");
+    mlm_client_set_consumer (self.alerts, FTY_PROTO_STREAM_ALERTS_SYS, ".*");
+    self.poller = zpoller_new (mlm_client_msgpipe (self.alerts), NULL);
+    //  let malamute establish everything
+    zclock_sleep (500);
+
+    //  every asset is known and its first metric evaluated before measuring
+    for (long i = 0; i < ups_count + sensor_count; i++)
+        s_publish_asset (&self, i);
+    double saved_asset_rate = self.asset_rate;
+    self.asset_rate = 0;
+    load_step_t step;
+    s_run (&self, 0, ups_count + sensor_count, WARMUP_TIMEOUT, &step);
+    self.asset_rate = saved_asset_rate;
+    if (step.alerts < step.sent)
+        fprintf (stderr, "Only %" PRIu64 " of %" PRIu64 " assets raised alert on first metric\n", step.alerts, step.sent);
+
+    if (csv)
+        fprintf (out, "kind,rate,sent,alerts,delivered,alerts_per_sec,p50_ms,p99_ms,p999_ms,max_ms,passed\n");
+    int drain = (int) (max_latency * 2);
+    load_step_t best;
+    memset (&best, 0, sizeof (best));
+    double passing = 0, failing = 0;
+    double next = rate > 0 ? rate : start_rate;
+    while (!zsys_interrupted) {
+        s_run (&self, next, (uint64_t) (next * duration), drain, &step);
+        step.passed = step.sent > 0 && step.alerts >= min_delivery * step.sent && step.p99 <= max_latency;
+        s_report (out, csv, &step);
+        if (rate > 0)
+            break;
+        if (step.passed) {
+            passing = next;
+            best = step;
+        }
+        else
+            failing = next;
+        if (failing == 0)
+            next *= 2;
+        else
+        if (bisections-- > 0)
+            next = (passing + failing) / 2;
+        else
+            break;
+    }
+    if (rate == 0 && !zsys_interrupted) {
+        best.kind = "saturation";
+        s_report (out, csv, &best);
+    }
+
+    zpoller_destroy (&self.poller);
+    mlm_client_destroy (&self.assets);
+    mlm_client_destroy (&self.metrics);
+    mlm_client_destroy (&self.sensors);
+    mlm_client_destroy (&self.alerts);
+    zactor_destroy (&agent);
+    zactor_destroy (&server);
+    if (out != stdout)
+        fclose (out);
+    for (const char *path = (const char *) zlist_first (paths); path; path = (const char *) zlist_next (paths))
+        unlink (path);
+    rmdir (workdir);
+    zlist_destroy (&paths);
+    zstr_free (&workdir);
+    free (self.sent_at);
+    free (self.latencies);
+    return 0;
+}
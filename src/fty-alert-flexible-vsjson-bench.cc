@@ -0,0 +1,477 @@
+/*  =========================================================================
+    fty-alert-flexible-vsjson-bench - Microbenchmarks of JSON parser
+
+    Copyright (C) 2016 - 2017 Tomas Halman
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+/*
+@header
+    fty-alert-flexible-vsjson-bench - Microbenchmarks of JSON parser
+@discuss
+    Measures vsjson on the rules corpus and on generated rules of growing
+    size and nesting: vsjson_parse with rule_json_callback, tokenization
+    alone, vsjson_decode_string and vsjson_encode_string. Every case and
+    input is reported as one JSON (or CSV) line with MB/s and heap
+    allocations per document. Results can be saved as baseline and later
+    runs checked against it. The program links the library statically,
+    because rule_json_callback is private to the library.
+@end
+*/
+
+#include "fty_alert_flexible_classes.h"
+#include "bench_util.h"
+#include <inttypes.h>
+
+#define CORPUS_DIR      "src/selftest-ro/rules"
+#define CASE_TIME       0.5     //  minimal run time of one case [s]
+#define TOLERANCE       0.2     //  allowed slowdown and allocation growth
+
+//  Set of documents
+typedef struct {
+    char *name;
+    zlist_t *documents;         //  JSON texts
+    zlist_t *strings;           //  string tokens of documents, quotes included
+    zlist_t *decoded;           //  decoded string tokens
+} bench_input_t;
+
+//  Result of one case on one input
+typedef struct {
+    char *name;                 //  case/input
+    double mb_per_sec;
+    double allocs_per_doc;
+} bench_result_t;
+
+//  --------------------------------------------------------------------------
+//  Create input, documents are added later
+
+static bench_input_t *
+s_input_new (const char *name)
+{
+    bench_input_t *self = (bench_input_t *) zmalloc (sizeof (bench_input_t));
+    assert (self);
+    self->name = strdup (name);
+    self->documents = zlist_new ();
+    zlist_autofree (self->documents);
+    self->strings = zlist_new ();
+    zlist_autofree (self->strings);
+    self->decoded = zlist_new ();
+    zlist_autofree (self->decoded);
+    return self;
+}
+
+static void
+s_input_destroy (bench_input_t **self_p)
+{
+    if (*self_p) {
+        bench_input_t *self = *self_p;
+        zstr_free (&self->name);
+        zlist_destroy (&self->documents);
+        zlist_destroy (&self->strings);
+        zlist_destroy (&self->decoded);
+        free (self);
+        *self_p = NULL;
+    }
+}
+
+//  --------------------------------------------------------------------------
+//  Add document to input, its string tokens are collected for decode and
+//  encode cases
+
+static void
+s_input_add (bench_input_t *self, const char *json)
+{
+    zlist_append (self->documents, (void *) json);
+    vsjson_t *parser = vsjson_new (json);
+    for (const char *token = vsjson_first_token (parser); token; token = vsjson_next_token (parser)) {
+        if (token [0] != '"')
+            continue;
+        char *decoded = vsjson_decode_string (token);
+        if (!decoded)
+            continue;
+        zlist_append (self->strings, (void *) token);
+        zlist_append (self->decoded, decoded);
+        zstr_free (&decoded);
+    }
+    vsjson_destroy (&parser);
+}
+
+//  --------------------------------------------------------------------------
+//  Add rule files (*.rule, *.json) of directory to input, return number
+//  of files added
+
+static int
+s_input_load (bench_input_t *self, const char *path)
+{
+    DIR *dir = opendir (path);
+    if (!dir)
+        return 0;
+    int count = 0;
+    struct dirent *entry;
+    while ((entry = readdir (dir)) != NULL) {
+        size_t len = strlen (entry->d_name);
+        if (!(len > 5 && streq (&entry->d_name [len - 5], ".rule"))
+        &&  !(len > 5 && streq (&entry->d_name [len - 5], ".json")))
+            continue;
+        char *fullpath = zsys_sprintf ("%s/%s", path, entry->d_name);
+        FILE *file = fopen (fullpath, "r");
+        zstr_free (&fullpath);
+        if (!file)
+            continue;
+        fseek (file, 0, SEEK_END);
+        long size = ftell (file);
+        fseek (file, 0, SEEK_SET);
+        char *text = (char *) zmalloc (size + 1);
+        assert (text);
+        text [fread (text, 1, size, file)] = 0;
+        fclose (file);
+        s_input_add (self, text);
+        free (text);
+        count++;
+    }
+    closedir (dir);
+    return count;
+}
+
+//  --------------------------------------------------------------------------
+//  Generate rule with items metrics, assets, variables and actions, and
+//  extra object nested depth levels deep
+
+static char *
+s_generate (size_t items, size_t depth)
+{
+    char *json = zsys_sprintf ("{\n    \"name\" : \"generated-%zu-%zu\",\n"
+        "    \"description\" : \"Generated rule, \\\"quoted\\\"\\n\\ttext and \\/slashes\\/\",\n",
+        items, depth);
+    const char *arrays [] = { "metrics", "assets", "groups" };
+    for (size_t a = 0; a < sizeof (arrays) / sizeof (arrays [0]); a++) {
+        char *next = zsys_sprintf ("%s    \"%s\" : [", json, arrays [a]);
+        zstr_free (&json);
+        json = next;
+        for (size_t i = 0; i < items; i++) {
+            next = zsys_sprintf ("%s%s\"%s.%zu\"", json, i ? ", " : "", arrays [a], i);
+            zstr_free (&json);
+            json = next;
+        }
+        next = zsys_sprintf ("%s],\n", json);
+        zstr_free (&json);
+        json = next;
+    }
+    char *next = zsys_sprintf ("%s    \"results\" : {\n        \"high_warning\" : { \"action\" : [", json);
+    zstr_free (&json);
+    json = next;
+    for (size_t i = 0; i < items; i++) {
+        next = zsys_sprintf ("%s%s{\"action\" : \"GPO_INTERACTION\", \"asset\" : \"gpo-%zu\", \"mode\" : \"open\"}",
+            json, i ? ", " : "", i);
+        zstr_free (&json);
+        json = next;
+    }
+    next = zsys_sprintf ("%s] },\n        \"high_critical\" : { \"action\" : [\"EMAIL\", \"SMS\"] }\n    },\n"
+        "    \"variables\" : {", json);
+    zstr_free (&json);
+    json = next;
+    for (size_t i = 0; i < items; i++) {
+        next = zsys_sprintf ("%s%s\"v%zu\" : \"value %zu\"", json, i ? ", " : "", i, i);
+        zstr_free (&json);
+        json = next;
+    }
+    next = zsys_sprintf ("%s},\n    \"extra\" : ", json);
+    zstr_free (&json);
+    json = next;
+    for (size_t i = 0; i < depth; i++) {
+        next = zsys_sprintf ("%s{\"level\" : [%zu, ", json, i);
+        zstr_free (&json);
+        json = next;
+    }
+    next = zsys_sprintf ("%s\"leaf\"", json);
+    zstr_free (&json);
+    json = next;
+    for (size_t i = 0; i < depth; i++) {
+        next = zsys_sprintf ("%s]}", json);
+        zstr_free (&json);
+        json = next;
+    }
+    next = zsys_sprintf ("%s,\n    \"evaluation\" : \"\n        function main (x)\n", json);
+    zstr_free (&json);
+    json = next;
+    for (size_t i = 0; i < items; i++) {
+        next = zsys_sprintf ("%s            if x == '%zu' then return WARNING, 'value \\\"%zu\\\"' end\n", json, i, i);
+        zstr_free (&json);
+        json = next;
+    }
+    next = zsys_sprintf ("%s            return OK, 'ok'\n        end\n    \"\n}\n", json);
+    zstr_free (&json);
+    return next;
+}
+
+//  --------------------------------------------------------------------------
+//  Run one pass of case over input, return bytes processed
+
+static size_t
+s_pass (const char *name, bench_input_t *input)
+{
+    size_t bytes = 0;
+    if (streq (name, "parse-rule")) {
+        for (const char *json = (const char *) zlist_first (input->documents); json;
+             json = (const char *) zlist_next (input->documents)) {
+            rule_t *rule = rule_new ();
+            vsjson_parse (json, rule_json_callback, rule, true);
+            rule_destroy (&rule);
+            bytes += strlen (json);
+        }
+    }
+    else
+    if (streq (name, "tokenize")) {
+        for (const char *json = (const char *) zlist_first (input->documents); json;
+             json = (const char *) zlist_next (input->documents)) {
+            vsjson_t *parser = vsjson_new (json);
+            for (const char *token = vsjson_first_token (parser); token; token = vsjson_next_token (parser))
+                ;
+            vsjson_destroy (&parser);
+            bytes += strlen (json);
+        }
+    }
+    else
+    if (streq (name, "decode")) {
+        for (const char *string = (const char *) zlist_first (input->strings); string;
+             string = (const char *) zlist_next (input->strings)) {
+            char *decoded = vsjson_decode_string (string);
+            zstr_free (&decoded);
+            bytes += strlen (string);
+        }
+    }
+    else {
+        for (const char *string = (const char *) zlist_first (input->decoded); string;
+             string = (const char *) zlist_next (input->decoded)) {
+            char *encoded = vsjson_encode_string (string);
+            zstr_free (&encoded);
+            bytes += strlen (string);
+        }
+    }
+    return bytes;
+}
+
+//  --------------------------------------------------------------------------
+//  Repeat case over input for at least seconds, fill result
+
+static void
+s_measure (const char *name, bench_input_t *input, double seconds, bench_result_t *result)
+{
+    s_pass (name, input);   //  warm up
+    uint64_t bytes = 0, passes = 0, allocs = 0, elapsed = 0;
+    while (elapsed < seconds * 1e9 || passes == 0) {
+        uint64_t allocs_before = bench_allocs ();
+        uint64_t start = bench_nsecs ();
+        bytes += s_pass (name, input);
+        elapsed += bench_nsecs () - start;
+        allocs += bench_allocs () - allocs_before;
+        passes++;
+    }
+    size_t documents = zlist_size (input->documents);
+    result->name = zsys_sprintf ("%s/%s", name, input->name);
+    result->mb_per_sec = elapsed ? bytes / 1e6 / (elapsed / 1e9) : 0;
+    result->allocs_per_doc = BENCH_ALLOCS && documents ? (double) allocs / passes / documents : -1;
+}
+
+//  --------------------------------------------------------------------------
+//  Find result of case/input in baseline loaded into hash, NULL if none
+
+static bench_result_t *
+s_baseline_lookup (zhashx_t *baseline, const char *name)
+{
+    return baseline ? (bench_result_t *) zhashx_lookup (baseline, name) : NULL;
+}
+
+//  --------------------------------------------------------------------------
+//  Load baseline, lines "case/input MB/s allocs/doc", # starts comment
+
+static zhashx_t *
+s_baseline_load (const char *path)
+{
+    FILE *file = fopen (path, "r");
+    if (!file)
+        return NULL;
+    zhashx_t *baseline = zhashx_new ();
+    zhashx_set_destructor (baseline, (zhashx_destructor_fn *) zstr_free);
+    char line [1024];
+    while (fgets (line, sizeof (line), file)) {
+        char name [512];
+        double mb_per_sec, allocs_per_doc;
+        if (line [0] == '#' || sscanf (line, "%511s %lf %lf", name, &mb_per_sec, &allocs_per_doc) != 3)
+            continue;
+        bench_result_t *result = (bench_result_t *) zmalloc (sizeof (bench_result_t));
+        assert (result);
+        result->mb_per_sec = mb_per_sec;
+        result->allocs_per_doc = allocs_per_doc;
+        zhashx_update (baseline, name, result);
+    }
+    fclose (file);
+    return baseline;
+}
+
+int main (int argc, char *argv [])
+{
+    ftylog_setInstance ("fty-alert-flexible-vsjson-bench", "");
+    const char *corpus = CORPUS_DIR;
+    const char *format = "json";
+    const char *output = NULL;
+    const char *baseline_path = NULL;
+    const char *save = NULL;
+    double seconds = CASE_TIME;
+    double tolerance = TOLERANCE;
+
+    int argn;
+    for (argn = 1; argn < argc; argn++) {
+        const char *param = NULL;
+        if (argn < argc - 1) param = argv [argn+1];
+
+        if (streq (argv [argn], "--help")
+        ||  streq (argv [argn], "-h")) {
+            puts ("fty-alert-flexible-vsjson-bench [options] ...");
+            puts ("  -h|--help             this information");
+            puts ("  -c|--corpus           directory with rule files, templates included [" CORPUS_DIR "]");
+            puts ("  -t|--time             minimal seconds of one case [0.5]");
+            puts ("  -b|--baseline         compare with baseline, exit 2 on regression");
+            puts ("  --tolerance           allowed slowdown and growth of allocations [0.2]");
+            puts ("  -s|--save             write results as baseline");
+            puts ("  -f|--format           json or csv [json]");
+            puts ("  -o|--output           append results to file instead of stdout");
+            return 0;
+        }
+        else if (streq (argv [argn], "--corpus") || streq (argv [argn], "-c")) {
+            if (param) corpus = param;
+            ++argn;
+        }
+        else if (streq (argv [argn], "--time") || streq (argv [argn], "-t")) {
+            if (param) seconds = atof (param);
+            ++argn;
+        }
+        else if (streq (argv [argn], "--baseline") || streq (argv [argn], "-b")) {
+            if (param) baseline_path = param;
+            ++argn;
+        }
+        else if (streq (argv [argn], "--tolerance")) {
+            if (param) tolerance = atof (param);
+            ++argn;
+        }
+        else if (streq (argv [argn], "--save") || streq (argv [argn], "-s")) {
+            if (param) save = param;
+            ++argn;
+        }
+        else if (streq (argv [argn], "--format") || streq (argv [argn], "-f")) {
+            if (param) format = param;
+            ++argn;
+        }
+        else if (streq (argv [argn], "--output") || streq (argv [argn], "-o")) {
+            if (param) output = param;
+            ++argn;
+        }
+        else {
+            printf ("Unknown option: %s\n", argv [argn]);
+            return 1;
+        }
+    }
+    bool csv = streq (format, "csv");
+    if ((!csv && !streq (format, "json")) || seconds <= 0 || tolerance < 0) {
+        fprintf (stderr, "Invalid format, time or tolerance, see --help\n");
+        return 1;
+    }
+    zhashx_t *baseline = NULL;
+    if (baseline_path && !(baseline = s_baseline_load (baseline_path))) {
+        fprintf (stderr, "Can't read baseline %s: %s\n", baseline_path, strerror (errno));
+        return 1;
+    }
+
+    //  Inputs: corpus, then generated rules growing in size and in nesting
+    zlist_t *inputs = zlist_new ();
+    bench_input_t *input = s_input_new ("corpus");
+    char *templates = zsys_sprintf ("%s/templates", corpus);
+    int files = s_input_load (input, corpus) + s_input_load (input, templates);
+    zstr_free (&templates);
+    if (files == 0) {
+        fprintf (stderr, "No rule files in %s\n", corpus);
+        s_input_destroy (&input);
+        return 1;
+    }
+    zlist_append (inputs, input);
+    const size_t generated [][2] = { { 10, 2 }, { 100, 2 }, { 1000, 2 }, { 10, 16 }, { 10, 64 } };
+    for (size_t i = 0; i < sizeof (generated) / sizeof (generated [0]); i++) {
+        char *name = zsys_sprintf ("items-%zu-depth-%zu", generated [i][0], generated [i][1]);
+        input = s_input_new (name);
+        char *json = s_generate (generated [i][0], generated [i][1]);
+        s_input_add (input, json);
+        zstr_free (&json);
+        zstr_free (&name);
+        zlist_append (inputs, input);
+    }
+
+    FILE *out = output ? fopen (output, "a") : stdout;
+    if (!out) {
+        fprintf (stderr, "Can't open %s: %s\n", output, strerror (errno));
+        return 1;
+    }
+    FILE *saved = save ? fopen (save, "w") : NULL;
+    if (save && !saved) {
+        fprintf (stderr, "Can't write %s: %s\n", save, strerror (errno));
+        return 1;
+    }
+    if (saved)
+        fprintf (saved, "# case/input MB/s allocations/document\n");
+    if (csv)
+        fprintf (out, "case,input,documents,mb_per_sec,allocs_per_doc,baseline_mb_per_sec,baseline_allocs_per_doc,regression\n");
+
+    const char *cases [] = { "parse-rule", "tokenize", "decode", "encode" };
+    int regressions = 0;
+    for (size_t c = 0; c < sizeof (cases) / sizeof (cases [0]); c++) {
+        for (input = (bench_input_t *) zlist_first (inputs); input; input = (bench_input_t *) zlist_next (inputs)) {
+            bench_result_t result;
+            s_measure (cases [c], input, seconds, &result);
+            bench_result_t *base = s_baseline_lookup (baseline, result.name);
+            bool regression = base
+                && (result.mb_per_sec < base->mb_per_sec * (1 - tolerance)
+                    || result.allocs_per_doc > base->allocs_per_doc * (1 + tolerance));
+            if (regression)
+                regressions++;
+            const char *fmt = csv
+                ? "%s,%s,%zu,%.2f,%.2f,%.2f,%.2f,%s\n"
+                : "{\"case\":\"%s\",\"input\":\"%s\",\"documents\":%zu,\"mb_per_sec\":%.2f,"
+                  "\"allocs_per_doc\":%.2f,\"baseline_mb_per_sec\":%.2f,\"baseline_allocs_per_doc\":%.2f,"
+                  "\"regression\":%s}\n";
+            fprintf (out, fmt, cases [c], input->name, zlist_size (input->documents),
+                result.mb_per_sec, result.allocs_per_doc,
+                base ? base->mb_per_sec : 0, base ? base->allocs_per_doc : 0,
+                regression ? "true" : "false");
+            fflush (out);
+            if (saved)
+                fprintf (saved, "%s %.2f %.2f\n", result.name, result.mb_per_sec, result.allocs_per_doc);
+            zstr_free (&result.name);
+        }
+    }
+    if (regressions)
+        fprintf (stderr, "%d results regressed more than %.0f %% against %s\n",
+            regressions, tolerance * 100, baseline_path);
+
+    if (saved)
+        fclose (saved);
+    if (out != stdout)
+        fclose (out);
+    for (input = (bench_input_t *) zlist_first (inputs); input; input = (bench_input_t *) zlist_next (inputs))
+        s_input_destroy (&input);
+    zlist_destroy (&inputs);
+    zhashx_destroy (&baseline);
+    return regressions ? 2 : 0;
+}
@@ -55,8 +55,22 @@ int main (int argc, char *argv [])
     const char *config_file     = CONFIG;
     const char *rules           = RULES_DIR;
     bool isCmdRules              = false;
+    const char *journal         = NULL;
+    bool isCmdJournal            = false;
+    const char *config_rules    = RULES_DIR;
+    const char *config_journal  = NULL;
     const char *metrics_pattern = METRICS_PATTERN;
     const char *assets_pattern = ASSETS_PATTERN;
+    const char *lua_instructions = NULL;
+    const char *lua_memory = NULL;
+    const char *lua_allocator = NULL;
+    const char *lua_gc_budget = NULL;
+    const char *min_interval = NULL;
+    const char *shard_index = "0";
+    const char *shard_count = NULL;
+    const char *record = NULL;
+    const char *replay = NULL;
+    const char *speed = "1";
 
     int argn;
     for (argn = 1; argn < argc; argn++) {
@@ -70,6 +84,11 @@ int main (int argc, char *argv [])
             puts ("  -h|--help             this information");
             puts ("  -e|--endpoint         malamute endpoint [ipc://@/malamute]");
             puts ("  -r|--rules            directory with rules [./rules]");
+            puts ("  -j|--journal          keep rules in one journal file instead of rules directory");
+            puts ("  --record              append all received input to log file");
+            puts ("  --replay              feed input log to the agent instead of listening to streams,");
+            puts ("                        needs scratch copy of rules given by --rules or --journal");
+            puts ("  --speed               replay speed, 1 original, N N times faster, 0 as fast as possible [1]");
             puts ("  -c|--config           path to config file[/etc/fty-alert-flexible/fty-alert-flexible.cfg]\n");
             return 0;
         }
@@ -90,6 +109,25 @@ int main (int argc, char *argv [])
             }
             ++argn;
         }
+        else if (streq (argv [argn], "--journal") || streq (argv [argn], "-j")) {
+            if (param) {
+                journal = param;
+                isCmdJournal = true;
+            }
+            ++argn;
+        }
+        else if (streq (argv [argn], "--record")) {
+            if (param) record = param;
+            ++argn;
+        }
+        else if (streq (argv [argn], "--replay")) {
+            if (param) replay = param;
+            ++argn;
+        }
+        else if (streq (argv [argn], "--speed")) {
+            if (param) speed = param;
+            ++argn;
+        }
         else if (streq (argv [argn], "--config") || streq (argv [argn], "-c")) {
             if (param) config_file = param;
             ++argn;
@@ -106,10 +144,20 @@ int main (int argc, char *argv [])
         if (streq (zconfig_get (config, "server/verbose", (verbose?"1":"0")), "1")) {
             verbose = true;
         }
-        //rules
-        if (!isCmdRules){
-            rules = s_get (config, "server/rules", rules);
+        //rules, replay never uses the configured ones
+        config_rules = s_get (config, "server/rules", config_rules);
+        config_journal = s_get (config, "server/journal", config_journal);
+        if (!isCmdRules && !replay){
+            rules = config_rules;
+        }
+        if (!isCmdJournal && !replay){
+            journal = config_journal;
         }
+        min_interval = s_get (config, "server/min_interval", min_interval);
+        shard_index = s_get (config, "server/shard_index", shard_index);
+        shard_count = s_get (config, "server/shard_count", shard_count);
+        if (!record)
+            record = s_get (config, "server/record", record);
 
         // endpoint
         if (!isCmdEndpoint){
@@ -120,6 +168,12 @@ int main (int argc, char *argv [])
         assets_pattern = s_get (config, "malamute/assets_pattern", assets_pattern);
         metrics_pattern = s_get (config, "malamute/metrics_pattern", metrics_pattern);
 
+        // limits of one lua evaluation
+        lua_instructions = s_get (config, "lua/max_instructions", lua_instructions);
+        lua_memory = s_get (config, "lua/max_memory", lua_memory);
+        lua_allocator = s_get (config, "lua/allocator", lua_allocator);
+        lua_gc_budget = s_get (config, "lua/gc_budget", lua_gc_budget);
+
         logConfigFile = s_get (config, "log/config", "");
     } else {
         log_error ("Failed to load config file %s",config_file);
@@ -134,6 +188,15 @@ int main (int argc, char *argv [])
     if (verbose)
         ftylog_setVeboseMode(ftylog_getInstance());
 
+    if (replay
+    &&  ((!isCmdRules && !isCmdJournal)
+    ||   (isCmdRules && streq (rules, config_rules))
+    ||   (isCmdJournal && config_journal && streq (journal, config_journal)))) {
+        // recorded rule requests would change rules of the running agent
+        log_error ("replay needs scratch copy of rules, use --rules or --journal other than configured");
+        return 1;
+    }
+
     log_debug ("fty_alert_flexible - started");
     //  Insert main code here
     zlist_t *params = zlist_new ();
@@ -142,22 +205,58 @@ int main (int argc, char *argv [])
 
     zactor_t *server = zactor_new (flexible_alert_actor, (void*) params);
     assert (server);
-    zstr_sendx (server, "BIND", endpoint, ACTOR_NAME, NULL);
-    zstr_sendx (server, "PRODUCER", FTY_PROTO_STREAM_ALERTS_SYS, NULL);
-    //zstr_sendx (server, "CONSUMER", FTY_PROTO_STREAM_METRICS, metrics_pattern, NULL);
-    zstr_sendx (server, "CONSUMER", FTY_PROTO_STREAM_METRICS_SENSOR, "status.*", NULL);
-    zstr_sendx (server, "CONSUMER", FTY_PROTO_STREAM_ASSETS, ".*", NULL);
+    if (shard_count && atoi (shard_count) > 1)
+        zstr_sendx (server, "SHARD", ACTOR_NAME, shard_index, shard_count, NULL);
+    // replay doesn't take over mailbox of running agent
+    zstr_sendx (server, "BIND", endpoint, replay ? ACTOR_NAME "-replay" : ACTOR_NAME, NULL);
+    if (record && !replay)
+        zstr_sendx (server, "RECORD", record, NULL);
+    // replayed alerts are counted and dropped, not published again
+    if (!replay) {
+        zstr_sendx (server, "PRODUCER", FTY_PROTO_STREAM_ALERTS_SYS, NULL);
+        //zstr_sendx (server, "CONSUMER", FTY_PROTO_STREAM_METRICS, metrics_pattern, NULL);
+        zstr_sendx (server, "CONSUMER", FTY_PROTO_STREAM_METRICS_SENSOR, "status.*", NULL);
+        zstr_sendx (server, "CONSUMER", FTY_PROTO_STREAM_ASSETS, ".*", NULL);
 
-    // Note: 'licensing.expire.*' pattern don't work ! (nothing appears on stream) BUT IT SHOULD WORK
-    // TODO: investigate on regex with malamute/zmq
-    // Was: zstr_sendx (server, "CONSUMER", FTY_PROTO_STREAM_LICENSING_ANNOUNCEMENTS, "licensing.expire.*", NULL);
-    zstr_sendx (server, "CONSUMER", FTY_PROTO_STREAM_LICENSING_ANNOUNCEMENTS, ".*", NULL);
+        // Note: 'licensing.expire.*' pattern don't work ! (nothing appears on stream) BUT IT SHOULD WORK
+        // TODO: investigate on regex with malamute/zmq
+        // Was: zstr_sendx (server, "CONSUMER", FTY_PROTO_STREAM_LICENSING_ANNOUNCEMENTS, "licensing.expire.*", NULL);
+        zstr_sendx (server, "CONSUMER", FTY_PROTO_STREAM_LICENSING_ANNOUNCEMENTS, ".*", NULL);
+    }
 
+    if (lua_instructions || lua_memory) {
+        char *instructions = zsys_sprintf ("%d", RULE_CHUNK_INSTRUCTIONS_LIMIT);
+        char *memory = zsys_sprintf ("%d", RULE_CHUNK_MEMORY_LIMIT);
+        zstr_sendx (server, "LUALIMITS",
+            lua_instructions ? lua_instructions : instructions, lua_memory ? lua_memory : memory, NULL);
+        zstr_free (&instructions);
+        zstr_free (&memory);
+    }
+    if (lua_allocator)
+        zstr_sendx (server, "LUAALLOCATOR", lua_allocator, NULL);
+    if (lua_gc_budget)
+        zstr_sendx (server, "LUAGC", lua_gc_budget, NULL);
+    if (min_interval)
+        zstr_sendx (server, "MININTERVAL", min_interval, NULL);
+    if (journal)
+        zstr_sendx (server, "JOURNAL", journal, NULL);
     zstr_sendx (server, "LOADRULES", rules, NULL);
+    if (replay)
+        zstr_sendx (server, "REPLAY", replay, speed, NULL);
 
     while (!zsys_interrupted) {
         zmsg_t *msg = zactor_recv (server);
+        char *cmd = msg ? zmsg_popstr (msg) : NULL;
+        bool replayed = cmd && streq (cmd, "REPLAYED");
+        if (replayed) {
+            char *records = zmsg_popstr (msg);
+            log_info ("replay of %s finished, %s records", replay, records);
+            zstr_free (&records);
+        }
+        zstr_free (&cmd);
         zmsg_destroy (&msg);
+        if (replayed)
+            break;
     }
     log_debug ("fty_alert_flexible - exited");
     zactor_destroy (&server);
@@ -46,6 +46,62 @@ typedef struct _vsjson_t vsjson_t;
 typedef struct _metrics_t metrics_t;
 #define METRICS_T_DEFINED
 #endif
+#ifndef ASSET_INFO_T_DEFINED
+typedef struct _asset_info_t asset_info_t;
+#define ASSET_INFO_T_DEFINED
+#endif
+#ifndef REPUBLISH_QUEUE_T_DEFINED
+typedef struct _republish_queue_t republish_queue_t;
+#define REPUBLISH_QUEUE_T_DEFINED
+#endif
+#ifndef RULE_WATCH_T_DEFINED
+typedef struct _rule_watch_t rule_watch_t;
+#define RULE_WATCH_T_DEFINED
+#endif
+#ifndef RULE_STORE_T_DEFINED
+typedef struct _rule_store_t rule_store_t;
+#define RULE_STORE_T_DEFINED
+#endif
+#ifndef RULESET_T_DEFINED
+typedef struct _ruleset_t ruleset_t;
+#define RULESET_T_DEFINED
+#endif
+#ifndef RULE_CHUNK_T_DEFINED
+typedef struct _rule_chunk_t rule_chunk_t;
+#define RULE_CHUNK_T_DEFINED
+#endif
+#ifndef RULE_LEXER_T_DEFINED
+typedef struct _rule_lexer_t rule_lexer_t;
+#define RULE_LEXER_T_DEFINED
+#endif
+#ifndef RULE_THRESHOLD_T_DEFINED
+typedef struct _rule_threshold_t rule_threshold_t;
+#define RULE_THRESHOLD_T_DEFINED
+#endif
+#ifndef RULE_EXPRESSION_T_DEFINED
+typedef struct _rule_expression_t rule_expression_t;
+#define RULE_EXPRESSION_T_DEFINED
+#endif
+#ifndef LUA_POOL_T_DEFINED
+typedef struct _lua_pool_t lua_pool_t;
+#define LUA_POOL_T_DEFINED
+#endif
+#ifndef TIMER_WHEEL_T_DEFINED
+typedef struct _timer_wheel_t timer_wheel_t;
+#define TIMER_WHEEL_T_DEFINED
+#endif
+#ifndef METRIC_QUEUE_T_DEFINED
+typedef struct _metric_queue_t metric_queue_t;
+#define METRIC_QUEUE_T_DEFINED
+#endif
+#ifndef SHARD_MAP_T_DEFINED
+typedef struct _shard_map_t shard_map_t;
+#define SHARD_MAP_T_DEFINED
+#endif
+#ifndef INPUT_LOG_T_DEFINED
+typedef struct _input_log_t input_log_t;
+#define INPUT_LOG_T_DEFINED
+#endif
 
 //  Extra headers
 
@@ -54,6 +110,60 @@ typedef struct _metrics_t metrics_t;
 #include "rule.h"
 #include "vsjson.h"
 #include "metrics.h"
+#include "asset_info.h"
+#include "republish_queue.h"
+#include "rule_watch.h"
+#include "rule_store.h"
+#include "ruleset.h"
+#include "rule_chunk.h"
+#include "rule_lexer.h"
+#include "rule_threshold.h"
+#include "rule_expression.h"
+#include "lua_pool.h"
+#include "timer_wheel.h"
+#include "metric_queue.h"
+#include "shard_map.h"
+#include "input_log.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//  Engine of flexible_alert, private to the library. Selftest and
+//  benchmarks drive it without broker.
+
+//  Load all rules in directory. Rule MUST have ".rule" extension.
+FTY_ALERT_FLEXIBLE_PRIVATE void
+    flexible_alert_load_rules (flexible_alert_t *self, const char *path);
+
+//  Match asset against rules, asset message stays owned by caller
+FTY_ALERT_FLEXIBLE_PRIVATE void
+    flexible_alert_handle_asset (flexible_alert_t *self, fty_proto_t *ftymsg);
+
+//  Evaluate rules of metric, takes the metric message
+FTY_ALERT_FLEXIBLE_PRIVATE void
+    flexible_alert_handle_metric (flexible_alert_t *self, fty_proto_t **ftymsg_p, bool isShm);
+
+//  Function returning current time, arg is the one given to set_clock
+typedef time_t (flexible_alert_clock_fn) (void *arg);
+
+//  Use clock instead of time (NULL) for metric and alert times, NULL
+//  restores the system clock. Replay of recorded input uses it.
+FTY_ALERT_FLEXIBLE_PRIVATE void
+    flexible_alert_set_clock (flexible_alert_t *self, flexible_alert_clock_fn *clock, void *arg);
+
+//  Function receiving alert published for rule, topic is the one of
+//  _ALERTS_SYS stream. Sink can take the message.
+typedef void (flexible_alert_sink_fn) (void *arg, const char *topic, zmsg_t **alert_p);
+
+//  Pass alerts to sink instead of publishing them on stream, NULL restores
+//  publishing. Benchmark drives the engine without broker with it.
+FTY_ALERT_FLEXIBLE_PRIVATE void
+    flexible_alert_set_sink (flexible_alert_t *self, flexible_alert_sink_fn *sink, void *arg);
+
+#ifdef __cplusplus
+}
+#endif
 
 //  *** To avoid double-definitions, only define if building without draft ***
 #ifndef FTY_ALERT_FLEXIBLE_BUILD_DRAFT_API
@@ -73,6 +183,76 @@ FTY_ALERT_FLEXIBLE_PRIVATE void
 FTY_ALERT_FLEXIBLE_PRIVATE void
     metrics_test (bool verbose);
 
+//  *** Draft method, defined for internal use only ***
+//  Self test of this class.
+FTY_ALERT_FLEXIBLE_PRIVATE void
+    asset_info_test (bool verbose);
+
+//  *** Draft method, defined for internal use only ***
+//  Self test of this class.
+FTY_ALERT_FLEXIBLE_PRIVATE void
+    republish_queue_test (bool verbose);
+
+//  *** Draft method, defined for internal use only ***
+//  Self test of this class.
+FTY_ALERT_FLEXIBLE_PRIVATE void
+    rule_watch_test (bool verbose);
+
+//  *** Draft method, defined for internal use only ***
+//  Self test of this class.
+FTY_ALERT_FLEXIBLE_PRIVATE void
+    rule_store_test (bool verbose);
+
+//  *** Draft method, defined for internal use only ***
+//  Self test of this class.
+FTY_ALERT_FLEXIBLE_PRIVATE void
+    ruleset_test (bool verbose);
+
+//  *** Draft method, defined for internal use only ***
+//  Self test of this class.
+FTY_ALERT_FLEXIBLE_PRIVATE void
+    rule_chunk_test (bool verbose);
+
+//  *** Draft method, defined for internal use only ***
+//  Self test of this class.
+FTY_ALERT_FLEXIBLE_PRIVATE void
+    rule_lexer_test (bool verbose);
+
+//  *** Draft method, defined for internal use only ***
+//  Self test of this class.
+FTY_ALERT_FLEXIBLE_PRIVATE void
+    rule_threshold_test (bool verbose);
+
+//  *** Draft method, defined for internal use only ***
+//  Self test of this class.
+FTY_ALERT_FLEXIBLE_PRIVATE void
+    rule_expression_test (bool verbose);
+
+//  *** Draft method, defined for internal use only ***
+//  Self test of this class.
+FTY_ALERT_FLEXIBLE_PRIVATE void
+    lua_pool_test (bool verbose);
+
+//  *** Draft method, defined for internal use only ***
+//  Self test of this class.
+FTY_ALERT_FLEXIBLE_PRIVATE void
+    timer_wheel_test (bool verbose);
+
+//  *** Draft method, defined for internal use only ***
+//  Self test of this class.
+FTY_ALERT_FLEXIBLE_PRIVATE void
+    metric_queue_test (bool verbose);
+
+//  *** Draft method, defined for internal use only ***
+//  Self test of this class.
+FTY_ALERT_FLEXIBLE_PRIVATE void
+    shard_map_test (bool verbose);
+
+//  *** Draft method, defined for internal use only ***
+//  Self test of this class.
+FTY_ALERT_FLEXIBLE_PRIVATE void
+    input_log_test (bool verbose);
+
 //  Self test for private classes
 FTY_ALERT_FLEXIBLE_PRIVATE void
     fty_alert_flexible_private_selftest (bool verbose, const char *subtest);
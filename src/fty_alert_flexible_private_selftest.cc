@@ -45,6 +45,34 @@ fty_alert_flexible_private_selftest (bool verbose, const char *subtest)
         vsjson_test (verbose);
     if (streq (subtest, "$ALL") || streq (subtest, "metrics_test"))
         metrics_test (verbose);
+    if (streq (subtest, "$ALL") || streq (subtest, "asset_info_test"))
+        asset_info_test (verbose);
+    if (streq (subtest, "$ALL") || streq (subtest, "republish_queue_test"))
+        republish_queue_test (verbose);
+    if (streq (subtest, "$ALL") || streq (subtest, "rule_watch_test"))
+        rule_watch_test (verbose);
+    if (streq (subtest, "$ALL") || streq (subtest, "rule_store_test"))
+        rule_store_test (verbose);
+    if (streq (subtest, "$ALL") || streq (subtest, "ruleset_test"))
+        ruleset_test (verbose);
+    if (streq (subtest, "$ALL") || streq (subtest, "rule_chunk_test"))
+        rule_chunk_test (verbose);
+    if (streq (subtest, "$ALL") || streq (subtest, "rule_lexer_test"))
+        rule_lexer_test (verbose);
+    if (streq (subtest, "$ALL") || streq (subtest, "rule_threshold_test"))
+        rule_threshold_test (verbose);
+    if (streq (subtest, "$ALL") || streq (subtest, "rule_expression_test"))
+        rule_expression_test (verbose);
+    if (streq (subtest, "$ALL") || streq (subtest, "lua_pool_test"))
+        lua_pool_test (verbose);
+    if (streq (subtest, "$ALL") || streq (subtest, "timer_wheel_test"))
+        timer_wheel_test (verbose);
+    if (streq (subtest, "$ALL") || streq (subtest, "metric_queue_test"))
+        metric_queue_test (verbose);
+    if (streq (subtest, "$ALL") || streq (subtest, "shard_map_test"))
+        shard_map_test (verbose);
+    if (streq (subtest, "$ALL") || streq (subtest, "input_log_test"))
+        input_log_test (verbose);
 }
 /*
 ################################################################################
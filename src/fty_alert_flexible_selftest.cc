@@ -46,6 +46,20 @@ all_tests [] = {
     { "rule", NULL, true, false, "rule_test" },
     { "vsjson", NULL, true, false, "vsjson_test" },
     { "metrics", NULL, true, false, "metrics_test" },
+    { "asset_info", NULL, true, false, "asset_info_test" },
+    { "republish_queue", NULL, true, false, "republish_queue_test" },
+    { "rule_watch", NULL, true, false, "rule_watch_test" },
+    { "rule_store", NULL, true, false, "rule_store_test" },
+    { "ruleset", NULL, true, false, "ruleset_test" },
+    { "rule_chunk", NULL, true, false, "rule_chunk_test" },
+    { "rule_lexer", NULL, true, false, "rule_lexer_test" },
+    { "rule_threshold", NULL, true, false, "rule_threshold_test" },
+    { "rule_expression", NULL, true, false, "rule_expression_test" },
+    { "lua_pool", NULL, true, false, "lua_pool_test" },
+    { "timer_wheel", NULL, true, false, "timer_wheel_test" },
+    { "metric_queue", NULL, true, false, "metric_queue_test" },
+    { "shard_map", NULL, true, false, "shard_map_test" },
+    { "input_log", NULL, true, false, "input_log_test" },
     { "private_classes", NULL, false, false, "$ALL" }, // compat option for older projects
 #endif // FTY_ALERT_FLEXIBLE_BUILD_DRAFT_API
 // Tests for stable public classes:
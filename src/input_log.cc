@@ -0,0 +1,435 @@
+/*  =========================================================================
+    input_log - Binary log of agent input for replay
+
+    Copyright (C) 2016 - 2017 Tomas Halman
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+/*
+@header
+    input_log - Binary log of agent input for replay
+@discuss
+    Recording of everything the agent received, so problems from the field
+    can be reproduced by replaying it. Log is append only:
+
+        header      "FTYINPT1"
+        record      magic, kind, time [us], body size, message count
+                    address (zero terminated), subject (zero terminated),
+                    messages: frame count, frames: size, data
+
+    Numbers are in host byte order. Record cut off by crash at the end of
+    log is ignored when log is read. Records are appended from several
+    threads (actor and shm polling), so append is serialized by a mutex;
+    log is flushed at most once per second.
+@end
+*/
+
+#include "fty_alert_flexible_classes.h"
+#include <pthread.h>
+
+#define INPUT_LOG_HEADER        "FTYINPT1"
+#define INPUT_LOG_HEADER_SIZE   8
+#define INPUT_LOG_MAGIC         0x494e5054      //  "INPT"
+#define INPUT_LOG_FLUSH         1000000         //  flush interval [us]
+
+typedef struct {
+    uint32_t magic;
+    uint32_t kind;
+    int64_t time;
+    uint32_t size;              //  bytes of body following the record
+    uint32_t count;             //  messages in body
+} record_t;
+
+//  Structure of our class
+
+struct _input_log_t {
+    FILE *file;
+    bool writing;
+    pthread_mutex_t mutex;
+    char *body;                 //  body of record being written or read
+    size_t body_size;
+    size_t body_capacity;
+    int64_t flushed;            //  time of last flush
+    uint64_t records;
+    record_t record;            //  last record read
+    const char *address;        //  points to body
+    const char *subject;        //  points to body
+    size_t cursor;              //  offset of next message in body
+    size_t remaining;           //  messages not popped yet
+};
+
+//  --------------------------------------------------------------------------
+//  Create a new input_log. With append true, log at path is created or
+//  records are appended to it, else log is opened for reading. Returns
+//  NULL if log can't be opened or isn't input log.
+
+input_log_t *
+input_log_new (const char *path, bool append)
+{
+    assert (path);
+    FILE *file = fopen (path, append ? "ab" : "rb");
+    if (!file) {
+        log_error ("can't open input log %s (%s)", path, strerror (errno));
+        return NULL;
+    }
+    char header [INPUT_LOG_HEADER_SIZE];
+    if (append && ftell (file) == 0)
+        fwrite (INPUT_LOG_HEADER, 1, INPUT_LOG_HEADER_SIZE, file);
+    else
+    if (!append && (fread (header, 1, INPUT_LOG_HEADER_SIZE, file) != INPUT_LOG_HEADER_SIZE
+    ||  memcmp (header, INPUT_LOG_HEADER, INPUT_LOG_HEADER_SIZE) != 0)) {
+        log_error ("%s is not input log", path);
+        fclose (file);
+        return NULL;
+    }
+
+    input_log_t *self = (input_log_t *) zmalloc (sizeof (input_log_t));
+    assert (self);
+    //  Initialize class properties here
+    self->file = file;
+    self->writing = append;
+    pthread_mutex_init (&self->mutex, NULL);
+    return self;
+}
+
+//  --------------------------------------------------------------------------
+//  Destroy the input_log
+
+void
+input_log_destroy (input_log_t **self_p)
+{
+    assert (self_p);
+    if (*self_p) {
+        input_log_t *self = *self_p;
+        //  Free class properties here
+        fclose (self->file);
+        pthread_mutex_destroy (&self->mutex);
+        free (self->body);
+        //  Free object itself
+        free (self);
+        *self_p = NULL;
+    }
+}
+
+//  --------------------------------------------------------------------------
+//  Make room for size bytes of body
+
+static void
+s_reserve (input_log_t *self, size_t size)
+{
+    if (size <= self->body_capacity)
+        return;
+    self->body_capacity = size < 4096 ? 4096 : size * 2;
+    self->body = (char *) realloc (self->body, self->body_capacity);
+    assert (self->body);
+}
+
+//  --------------------------------------------------------------------------
+//  Append data to body
+
+static void
+s_put (input_log_t *self, const void *data, size_t size)
+{
+    s_reserve (self, self->body_size + size);
+    if (size)
+        memcpy (self->body + self->body_size, data, size);
+    self->body_size += size;
+}
+
+static void
+s_put_size (input_log_t *self, size_t size)
+{
+    uint32_t value = (uint32_t) size;
+    s_put (self, &value, sizeof (value));
+}
+
+//  --------------------------------------------------------------------------
+//  Append record of messages received at time [us]. Messages are not
+//  changed. Returns 0 on success.
+
+int
+input_log_append (input_log_t *self, int kind, int64_t time, const char *address, const char *subject,
+    zmsg_t **msgs, size_t count)
+{
+    assert (self);
+    assert (self->writing);
+    assert (msgs || count == 0);
+
+    pthread_mutex_lock (&self->mutex);
+    self->body_size = 0;
+    if (!address)
+        address = "";
+    if (!subject)
+        subject = "";
+    s_put (self, address, strlen (address) + 1);
+    s_put (self, subject, strlen (subject) + 1);
+    for (size_t i = 0; i < count; i++) {
+        s_put_size (self, zmsg_size (msgs [i]));
+        for (zframe_t *frame = zmsg_first (msgs [i]); frame; frame = zmsg_next (msgs [i])) {
+            s_put_size (self, zframe_size (frame));
+            s_put (self, zframe_data (frame), zframe_size (frame));
+        }
+    }
+    record_t record = { INPUT_LOG_MAGIC, (uint32_t) kind, time, (uint32_t) self->body_size, (uint32_t) count };
+    int rc = 0;
+    if (fwrite (&record, sizeof (record), 1, self->file) != 1
+    ||  fwrite (self->body, self->body_size, 1, self->file) != 1)
+        rc = -1;
+    if (rc == 0 && time - self->flushed >= INPUT_LOG_FLUSH) {
+        rc = fflush (self->file);
+        self->flushed = time;
+    }
+    if (rc == 0)
+        self->records++;
+    pthread_mutex_unlock (&self->mutex);
+    return rc;
+}
+
+//  --------------------------------------------------------------------------
+//  Read next record. Returns 0 on success, -1 at the end of log.
+
+int
+input_log_read (input_log_t *self)
+{
+    assert (self);
+    assert (!self->writing);
+
+    record_t record;
+    if (fread (&record, sizeof (record), 1, self->file) != 1
+    ||  record.magic != INPUT_LOG_MAGIC)
+        return -1;
+    s_reserve (self, record.size);
+    if (fread (self->body, 1, record.size, self->file) != record.size)
+        return -1;
+    self->body_size = record.size;
+
+    //  address and subject are zero terminated
+    const char *data = self->body;
+    const char *end = data + record.size;
+    const char *subject = (const char *) memchr (data, 0, record.size);
+    if (!subject || ++subject >= end || !memchr (subject, 0, end - subject))
+        return -1;
+    self->record = record;
+    self->address = data;
+    self->subject = subject;
+    self->cursor = subject + strlen (subject) + 1 - data;
+    self->remaining = record.count;
+    self->records++;
+    return 0;
+}
+
+//  --------------------------------------------------------------------------
+//  Read number from body at cursor. Returns -1 if there isn't enough data.
+
+static int
+s_get_size (input_log_t *self, size_t *size)
+{
+    uint32_t value;
+    if (self->cursor + sizeof (value) > self->body_size)
+        return -1;
+    memcpy (&value, self->body + self->cursor, sizeof (value));
+    self->cursor += sizeof (value);
+    *size = value;
+    return 0;
+}
+
+//  --------------------------------------------------------------------------
+//  Return next message of record read last, NULL if there are no more.
+//  Caller is responsible for destroying the return value.
+
+zmsg_t *
+input_log_pop (input_log_t *self)
+{
+    assert (self);
+    size_t frames;
+    if (self->remaining == 0 || s_get_size (self, &frames) != 0)
+        return NULL;
+    self->remaining--;
+    zmsg_t *msg = zmsg_new ();
+    for (size_t i = 0; i < frames; i++) {
+        size_t size;
+        if (s_get_size (self, &size) != 0
+        ||  self->cursor + size > self->body_size) {
+            zmsg_destroy (&msg);
+            self->remaining = 0;
+            return NULL;
+        }
+        zmsg_addmem (msg, self->body + self->cursor, size);
+        self->cursor += size;
+    }
+    return msg;
+}
+
+//  --------------------------------------------------------------------------
+//  Get kind of record read last
+
+int
+input_log_kind (input_log_t *self)
+{
+    assert (self);
+    return (int) self->record.kind;
+}
+
+//  --------------------------------------------------------------------------
+//  Get time of record read last [us]
+
+int64_t
+input_log_time (input_log_t *self)
+{
+    assert (self);
+    return self->record.time;
+}
+
+//  --------------------------------------------------------------------------
+//  Get address of record read last
+
+const char *
+input_log_address (input_log_t *self)
+{
+    assert (self);
+    return self->address;
+}
+
+//  --------------------------------------------------------------------------
+//  Get subject of record read last
+
+const char *
+input_log_subject (input_log_t *self)
+{
+    assert (self);
+    return self->subject;
+}
+
+//  --------------------------------------------------------------------------
+//  Get number of messages in record read last
+
+size_t
+input_log_count (input_log_t *self)
+{
+    assert (self);
+    return self->record.count;
+}
+
+//  --------------------------------------------------------------------------
+//  Get number of records written or read so far
+
+uint64_t
+input_log_records (input_log_t *self)
+{
+    assert (self);
+    pthread_mutex_lock (&self->mutex);
+    uint64_t records = self->records;
+    pthread_mutex_unlock (&self->mutex);
+    return records;
+}
+
+//  --------------------------------------------------------------------------
+//  Self test of this class
+
+void
+input_log_test (bool verbose)
+{
+    printf (" * input_log: ");
+
+    //  @selftest
+    const char *SELFTEST_DIR_RW = "src/selftest-rw";
+    char *path = zsys_sprintf ("%s/input.log", SELFTEST_DIR_RW);
+    unlink (path);
+
+    input_log_t *self = input_log_new (path, true);
+    assert (self);
+    zmsg_t *msgs [2];
+    msgs [0] = zmsg_new ();
+    zmsg_addstr (msgs [0], "GET");
+    zmsg_addstr (msgs [0], "rule");
+    zmsg_addmem (msgs [0], NULL, 0);
+    msgs [1] = zmsg_new ();
+    zmsg_addstr (msgs [1], "second");
+    assert (input_log_append (self, INPUT_LOG_MAILBOX, 1000, "ui", "subject", msgs, 1) == 0);
+    assert (input_log_append (self, INPUT_LOG_POLL, 2000, NULL, NULL, msgs, 2) == 0);
+    assert (input_log_append (self, INPUT_LOG_STREAM, 3000, "METRICS", "load@ups", NULL, 0) == 0);
+    assert (input_log_records (self) == 3);
+    input_log_destroy (&self);
+    assert (self == NULL);
+
+    //  records are appended to existing log
+    self = input_log_new (path, true);
+    assert (input_log_append (self, INPUT_LOG_STREAM, 4000, "ASSETS", "ups", msgs + 1, 1) == 0);
+    input_log_destroy (&self);
+    zmsg_destroy (&msgs [0]);
+    zmsg_destroy (&msgs [1]);
+
+    //  write is interrupted in the middle of record
+    FILE *f = fopen (path, "ab");
+    record_t partial = { INPUT_LOG_MAGIC, INPUT_LOG_STREAM, 5000, 100, 1 };
+    fwrite (&partial, sizeof (partial), 1, f);
+    fputs ("cut", f);
+    fclose (f);
+
+    self = input_log_new (path, false);
+    assert (self);
+    assert (input_log_read (self) == 0);
+    assert (input_log_kind (self) == INPUT_LOG_MAILBOX);
+    assert (input_log_time (self) == 1000);
+    assert (streq (input_log_address (self), "ui"));
+    assert (streq (input_log_subject (self), "subject"));
+    assert (input_log_count (self) == 1);
+    zmsg_t *msg = input_log_pop (self);
+    assert (msg && zmsg_size (msg) == 3);
+    char *item = zmsg_popstr (msg);
+    assert (streq (item, "GET"));
+    zstr_free (&item);
+    item = zmsg_popstr (msg);
+    assert (streq (item, "rule"));
+    zstr_free (&item);
+    zmsg_destroy (&msg);
+    assert (input_log_pop (self) == NULL);
+
+    assert (input_log_read (self) == 0);
+    assert (input_log_kind (self) == INPUT_LOG_POLL);
+    assert (streq (input_log_address (self), ""));
+    msg = input_log_pop (self);
+    assert (zmsg_size (msg) == 3);
+    zmsg_destroy (&msg);
+    msg = input_log_pop (self);
+    item = zmsg_popstr (msg);
+    assert (streq (item, "second"));
+    zstr_free (&item);
+    zmsg_destroy (&msg);
+    assert (input_log_pop (self) == NULL);
+
+    assert (input_log_read (self) == 0);
+    assert (input_log_count (self) == 0);
+    assert (streq (input_log_subject (self), "load@ups"));
+    assert (input_log_read (self) == 0);
+    assert (input_log_time (self) == 4000);
+    assert (streq (input_log_address (self), "ASSETS"));
+    //  partial record is end of log
+    assert (input_log_read (self) == -1);
+    assert (input_log_records (self) == 4);
+    input_log_destroy (&self);
+
+    //  other files are refused
+    f = fopen (path, "wb");
+    fputs ("FTYRULE1", f);
+    fclose (f);
+    assert (input_log_new (path, false) == NULL);
+    unlink (path);
+    zstr_free (&path);
+    //  @end
+    printf ("OK\n");
+}
@@ -0,0 +1,100 @@
+/*  =========================================================================
+    input_log - Binary log of agent input for replay
+
+    Copyright (C) 2016 - 2017 Tomas Halman
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+#ifndef INPUT_LOG_H_INCLUDED
+#define INPUT_LOG_H_INCLUDED
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//  Opaque class structures to allow forward references
+#ifndef INPUT_LOG_T_DEFINED
+typedef struct _input_log_t input_log_t;
+#define INPUT_LOG_T_DEFINED
+#endif
+
+//  Kinds of records
+#define INPUT_LOG_STREAM        1       //  message of asset or metric stream
+#define INPUT_LOG_MAILBOX       2       //  message of mailbox client
+#define INPUT_LOG_POLL          3       //  metrics of one shm poll cycle
+
+//  @interface
+//  Create a new input_log. With append true, log at path is created or
+//  records are appended to it, else log is opened for reading. Returns
+//  NULL if log can't be opened or isn't input log.
+FTY_ALERT_FLEXIBLE_PRIVATE input_log_t *
+    input_log_new (const char *path, bool append);
+
+//  Destroy the input_log
+FTY_ALERT_FLEXIBLE_PRIVATE void
+    input_log_destroy (input_log_t **self_p);
+
+//  Append record of messages received at time [us]. Messages are not
+//  changed. Returns 0 on success.
+FTY_ALERT_FLEXIBLE_PRIVATE int
+    input_log_append (input_log_t *self, int kind, int64_t time, const char *address, const char *subject,
+        zmsg_t **msgs, size_t count);
+
+//  Read next record. Returns 0 on success, -1 at the end of log.
+FTY_ALERT_FLEXIBLE_PRIVATE int
+    input_log_read (input_log_t *self);
+
+//  Return next message of record read last, NULL if there are no more.
+//  Caller is responsible for destroying the return value.
+FTY_ALERT_FLEXIBLE_PRIVATE zmsg_t *
+    input_log_pop (input_log_t *self);
+
+//  Get kind of record read last
+FTY_ALERT_FLEXIBLE_PRIVATE int
+    input_log_kind (input_log_t *self);
+
+//  Get time of record read last [us]
+FTY_ALERT_FLEXIBLE_PRIVATE int64_t
+    input_log_time (input_log_t *self);
+
+//  Get address of record read last
+FTY_ALERT_FLEXIBLE_PRIVATE const char *
+    input_log_address (input_log_t *self);
+
+//  Get subject of record read last
+FTY_ALERT_FLEXIBLE_PRIVATE const char *
+    input_log_subject (input_log_t *self);
+
+//  Get number of messages in record read last
+FTY_ALERT_FLEXIBLE_PRIVATE size_t
+    input_log_count (input_log_t *self);
+
+//  Get number of records written or read so far
+FTY_ALERT_FLEXIBLE_PRIVATE uint64_t
+    input_log_records (input_log_t *self);
+
+//  Self test of this class
+FTY_ALERT_FLEXIBLE_PRIVATE void
+    input_log_test (bool verbose);
+
+//  @end
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,469 @@
+/*  =========================================================================
+    lua_pool - Size class pool allocator for lua states
+
+    Copyright (C) 2016 - 2017 Tomas Halman
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+/*
+@header
+    lua_pool - Size class pool allocator for lua states
+@discuss
+    Lua allocates mostly small objects (strings, tables, closures, upvalues)
+    and every rule evaluation creates short-lived strings. Blocks up to
+    LUA_POOL_MAX_BLOCK bytes are carved from slabs into size classes 16
+    bytes apart and reused through per-class free lists, so the process
+    heap doesn't get fragmented by them. Bigger blocks go to malloc. Lua
+    tells the size of every block it frees, so blocks carry no header.
+
+    Slabs are aligned to their size, so the slab of a block is found from
+    its address and every slab counts its live blocks. lua_pool_trim gives
+    slabs without live blocks back to the system, call it when idle.
+
+    Pool is locked by mutex, lua states of one pool can be used from more
+    threads.
+@end
+*/
+
+#include "fty_alert_flexible_classes.h"
+#include <pthread.h>
+
+#define LUA_POOL_GRANULARITY    16
+#define LUA_POOL_MAX_BLOCK      256
+#define LUA_POOL_CLASSES        (LUA_POOL_MAX_BLOCK / LUA_POOL_GRANULARITY)
+#define LUA_POOL_SLAB_SIZE      (16 * 1024)
+
+//  Free block, linked in free list of its size class
+typedef struct _free_block_t {
+    struct _free_block_t *next;
+} free_block_t;
+
+//  Slab memory, blocks are carved from its end
+typedef struct _slab_t {
+    struct _slab_t *next;
+    size_t used;
+    size_t live;                //  blocks allocated and not freed
+} slab_t;
+
+//  Structure of our class
+
+struct _lua_pool_t {
+    int refs;                   //  guarded by s_shared_mutex
+    pthread_mutex_t mutex;
+    free_block_t *free [LUA_POOL_CLASSES];
+    slab_t *slabs;              //  first one is carved
+    size_t in_use;
+    size_t reserved;
+};
+
+static lua_pool_t *s_shared = NULL;
+static pthread_mutex_t s_shared_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+//  Space of slab for blocks, aligned like malloc
+#define SLAB_HEADER ((sizeof (slab_t) + 15) & ~(size_t) 15)
+
+//  Slab of pooled block
+#define SLAB_OF(block) ((slab_t *) ((uintptr_t) (block) & ~(uintptr_t) (LUA_POOL_SLAB_SIZE - 1)))
+
+//  --------------------------------------------------------------------------
+//  Create a new lua_pool
+
+lua_pool_t *
+lua_pool_new (void)
+{
+    lua_pool_t *self = (lua_pool_t *) zmalloc (sizeof (lua_pool_t));
+    assert (self);
+    //  Initialize class properties here
+    self->refs = 1;
+    pthread_mutex_init (&self->mutex, NULL);
+    return self;
+}
+
+//  --------------------------------------------------------------------------
+//  Get pool shared by the whole agent, it is created on first use. Caller
+//  must drop the reference with lua_pool_destroy.
+
+lua_pool_t *
+lua_pool_shared (void)
+{
+    pthread_mutex_lock (&s_shared_mutex);
+    if (s_shared)
+        s_shared->refs++;
+    else
+        s_shared = lua_pool_new ();
+    lua_pool_t *self = s_shared;
+    pthread_mutex_unlock (&s_shared_mutex);
+    return self;
+}
+
+//  --------------------------------------------------------------------------
+//  Destroy the lua_pool. Pool is freed when the last reference is dropped,
+//  all blocks must be freed by then.
+
+void
+lua_pool_destroy (lua_pool_t **self_p)
+{
+    assert (self_p);
+    if (*self_p) {
+        lua_pool_t *self = *self_p;
+        *self_p = NULL;
+        pthread_mutex_lock (&s_shared_mutex);
+        if (--self->refs > 0) {
+            pthread_mutex_unlock (&s_shared_mutex);
+            return;
+        }
+        if (self == s_shared)
+            s_shared = NULL;
+        pthread_mutex_unlock (&s_shared_mutex);
+        //  Free class properties here
+        if (self->in_use)
+            log_warning ("lua pool destroyed with %zu bytes in use", self->in_use);
+        while (self->slabs) {
+            slab_t *next = self->slabs->next;
+            free (self->slabs);
+            self->slabs = next;
+        }
+        pthread_mutex_destroy (&self->mutex);
+        //  Free object itself
+        free (self);
+    }
+}
+
+//  --------------------------------------------------------------------------
+//  Block of size class from free list or slab, called locked
+
+static void *
+s_pool_alloc (lua_pool_t *self, size_t index)
+{
+    free_block_t *block = self->free [index];
+    if (block) {
+        self->free [index] = block->next;
+        SLAB_OF (block)->live++;
+        return block;
+    }
+    size_t size = (index + 1) * LUA_POOL_GRANULARITY;
+    slab_t *slab = self->slabs;
+    if (!slab || slab->used + size > LUA_POOL_SLAB_SIZE) {
+        //  rest of old slab goes to free lists of smaller classes
+        if (slab) {
+            size_t rest = LUA_POOL_SLAB_SIZE - slab->used;
+            if (rest >= LUA_POOL_GRANULARITY) {
+                size_t rest_index = rest / LUA_POOL_GRANULARITY - 1;
+                free_block_t *rest_block = (free_block_t *) ((char *) slab + slab->used);
+                rest_block->next = self->free [rest_index];
+                self->free [rest_index] = rest_block;
+            }
+            //  trim can make it the first slab again
+            slab->used = LUA_POOL_SLAB_SIZE;
+        }
+        void *memory = NULL;
+        if (posix_memalign (&memory, LUA_POOL_SLAB_SIZE, LUA_POOL_SLAB_SIZE))
+            return NULL;
+        slab = (slab_t *) memory;
+        slab->next = self->slabs;
+        slab->used = SLAB_HEADER;
+        slab->live = 0;
+        self->slabs = slab;
+        self->reserved += LUA_POOL_SLAB_SIZE;
+    }
+    void *result = (char *) slab + slab->used;
+    slab->used += size;
+    slab->live++;
+    return result;
+}
+
+//  --------------------------------------------------------------------------
+//  Allocate, resize or free block with semantics of lua_Alloc: osize is
+//  the size of ptr (ignored if ptr is NULL), nsize 0 frees the block.
+
+void *
+lua_pool_realloc (lua_pool_t *self, void *ptr, size_t osize, size_t nsize)
+{
+    assert (self);
+    if (!ptr)
+        osize = 0;
+    size_t old_index = osize ? (osize - 1) / LUA_POOL_GRANULARITY : 0;
+    size_t new_index = nsize ? (nsize - 1) / LUA_POOL_GRANULARITY : 0;
+    bool old_pooled = osize && osize <= LUA_POOL_MAX_BLOCK;
+    bool new_pooled = nsize && nsize <= LUA_POOL_MAX_BLOCK;
+
+    //  big blocks stay in malloc
+    if ((!osize || !old_pooled) && (!nsize || !new_pooled)) {
+        void *block = NULL;
+        if (nsize)
+            block = realloc (ptr, nsize);
+        else
+            free (ptr);
+        if (nsize && !block)
+            return NULL;
+        pthread_mutex_lock (&self->mutex);
+        self->in_use = self->in_use - osize + nsize;
+        self->reserved = self->reserved - osize + nsize;
+        pthread_mutex_unlock (&self->mutex);
+        return block;
+    }
+    //  block stays in its size class
+    if (old_pooled && new_pooled && old_index == new_index) {
+        pthread_mutex_lock (&self->mutex);
+        self->in_use = self->in_use - osize + nsize;
+        pthread_mutex_unlock (&self->mutex);
+        return ptr;
+    }
+
+    void *block = NULL;
+    if (new_pooled) {
+        pthread_mutex_lock (&self->mutex);
+        block = s_pool_alloc (self, new_index);
+        pthread_mutex_unlock (&self->mutex);
+    }
+    else
+    if (nsize)
+        block = malloc (nsize);
+    if (nsize && !block)
+        return NULL;            //  lua keeps the old block
+    if (ptr && block)
+        memcpy (block, ptr, osize < nsize ? osize : nsize);
+
+    pthread_mutex_lock (&self->mutex);
+    if (old_pooled) {
+        free_block_t *freed = (free_block_t *) ptr;
+        freed->next = self->free [old_index];
+        self->free [old_index] = freed;
+        SLAB_OF (freed)->live--;
+    }
+    self->in_use = self->in_use - osize + nsize;
+    if (!old_pooled)
+        self->reserved -= osize;
+    if (nsize && !new_pooled)
+        self->reserved += nsize;
+    pthread_mutex_unlock (&self->mutex);
+    if (ptr && !old_pooled)
+        free (ptr);
+    return block;
+}
+
+//  --------------------------------------------------------------------------
+//  Bytes allocated from the pool and not freed yet
+
+size_t
+lua_pool_in_use (lua_pool_t *self)
+{
+    assert (self);
+    pthread_mutex_lock (&self->mutex);
+    size_t in_use = self->in_use;
+    pthread_mutex_unlock (&self->mutex);
+    return in_use;
+}
+
+//  --------------------------------------------------------------------------
+//  Bytes the pool got from system, including free lists
+
+size_t
+lua_pool_reserved (lua_pool_t *self)
+{
+    assert (self);
+    pthread_mutex_lock (&self->mutex);
+    size_t reserved = self->reserved;
+    pthread_mutex_unlock (&self->mutex);
+    return reserved;
+}
+
+//  --------------------------------------------------------------------------
+//  Give slabs without live blocks back to the system, their blocks are
+//  dropped from free lists. Returns number of bytes released.
+
+size_t
+lua_pool_trim (lua_pool_t *self)
+{
+    assert (self);
+    pthread_mutex_lock (&self->mutex);
+    bool empty = false;
+    for (slab_t *slab = self->slabs; slab && !empty; slab = slab->next)
+        empty = slab->live == 0;
+    if (!empty) {
+        pthread_mutex_unlock (&self->mutex);
+        return 0;
+    }
+    for (size_t index = 0; index < LUA_POOL_CLASSES; index++) {
+        free_block_t **link = &self->free [index];
+        while (*link) {
+            if (SLAB_OF (*link)->live == 0)
+                *link = (*link)->next;
+            else
+                link = &(*link)->next;
+        }
+    }
+    size_t released = 0;
+    slab_t **link = &self->slabs;
+    while (*link) {
+        slab_t *slab = *link;
+        if (slab->live == 0) {
+            *link = slab->next;
+            free (slab);
+            released += LUA_POOL_SLAB_SIZE;
+        }
+        else
+            link = &slab->next;
+    }
+    self->reserved -= released;
+    pthread_mutex_unlock (&self->mutex);
+    return released;
+}
+
+//  --------------------------------------------------------------------------
+//  Self test of this class
+
+//  Lua like allocation churn: small objects, sometimes resized, most of
+//  them short-lived
+static int64_t
+s_test_churn (lua_pool_t *pool, size_t rounds)
+{
+    const size_t slots = 4096;
+    void **blocks = (void **) zmalloc (slots * sizeof (void *));
+    size_t *sizes = (size_t *) zmalloc (slots * sizeof (size_t));
+    unsigned int seed = 1;
+    int64_t start = zclock_usecs ();
+    for (size_t i = 0; i < rounds; i++) {
+        seed = seed * 1103515245 + 12345;
+        size_t slot = (seed >> 8) % slots;
+        size_t size = 0;
+        switch ((seed >> 4) % 8) {
+            case 0: case 1: case 2: size = 24 + (seed >> 20) % 40; break;    //  strings
+            case 3: size = 64; break;                                       //  table
+            case 4: size = 40; break;                                       //  closure, upvalue
+            case 5: size = 16 << ((seed >> 20) % 5); break;                 //  arrays
+            case 6: size = 40 << ((seed >> 20) % 6); break;                 //  hash parts
+            default: size = 0;                                              //  free
+        }
+        if (pool)
+            blocks [slot] = lua_pool_realloc (pool, blocks [slot], sizes [slot], size);
+        else
+        if (size)
+            blocks [slot] = realloc (blocks [slot], size);
+        else {
+            free (blocks [slot]);
+            blocks [slot] = NULL;
+        }
+        assert (!size || blocks [slot]);
+        if (size)
+            memset (blocks [slot], (int) i, size);
+        sizes [slot] = size;
+    }
+    int64_t time = zclock_usecs () - start;
+    for (size_t slot = 0; slot < slots; slot++) {
+        if (pool)
+            lua_pool_realloc (pool, blocks [slot], sizes [slot], 0);
+        else
+            free (blocks [slot]);
+    }
+    free (blocks);
+    free (sizes);
+    return time;
+}
+
+void
+lua_pool_test (bool verbose)
+{
+    printf (" * lua_pool: ");
+
+    //  @selftest
+    lua_pool_t *self = lua_pool_new ();
+    assert (self);
+    assert (lua_pool_in_use (self) == 0);
+
+    //  small blocks are reused
+    char *a = (char *) lua_pool_realloc (self, NULL, 7, 30);
+    assert (a);
+    strcpy (a, "short lived string");
+    assert (lua_pool_in_use (self) == 30);
+    assert (lua_pool_reserved (self) == LUA_POOL_SLAB_SIZE);
+    assert (lua_pool_realloc (self, a, 30, 0) == NULL);
+    assert (lua_pool_in_use (self) == 0);
+    char *b = (char *) lua_pool_realloc (self, NULL, 0, 32);
+    assert (b == a);
+
+    //  growing within class keeps block, over class moves data
+    assert (lua_pool_realloc (self, b, 32, 20) == b);
+    strcpy (b, "moved");
+    char *c = (char *) lua_pool_realloc (self, b, 20, 200);
+    assert (c && c != b && streq (c, "moved"));
+    char *d = (char *) lua_pool_realloc (self, c, 200, 100000);
+    assert (d && streq (d, "moved"));
+    assert (lua_pool_in_use (self) == 100000);
+    assert (lua_pool_reserved (self) == LUA_POOL_SLAB_SIZE + 100000);
+    c = (char *) lua_pool_realloc (self, d, 100000, 10);
+    assert (c && streq (c, "moved"));
+    assert (lua_pool_reserved (self) == LUA_POOL_SLAB_SIZE);
+    lua_pool_realloc (self, c, 10, 0);
+    assert (lua_pool_in_use (self) == 0);
+
+    //  blocks are aligned for any lua object
+    for (size_t size = 1; size <= LUA_POOL_MAX_BLOCK; size++) {
+        void *block = lua_pool_realloc (self, NULL, 0, size);
+        assert (((uintptr_t) block & 15) == 0);
+        lua_pool_realloc (self, block, size, 0);
+    }
+    assert (lua_pool_in_use (self) == 0);
+
+    //  lua like churn, pool against malloc
+    size_t rounds = verbose ? 10000000 : 100000;
+    int64_t pool_time = s_test_churn (self, rounds);
+    int64_t malloc_time = s_test_churn (NULL, rounds);
+    assert (lua_pool_in_use (self) == 0);
+    if (verbose)
+        log_info ("%zu allocations: pool %.3f ms (%zu bytes reserved), malloc %.3f ms",
+            rounds, pool_time / 1000.0, lua_pool_reserved (self), malloc_time / 1000.0);
+
+    //  empty slabs are released, slabs with live blocks are kept
+    void *live [3 * LUA_POOL_SLAB_SIZE / 64];
+    size_t count = sizeof (live) / sizeof (live [0]);
+    for (size_t i = 0; i < count; i++) {
+        live [i] = lua_pool_realloc (self, NULL, 0, 64);
+        assert (live [i]);
+    }
+    assert (lua_pool_reserved (self) >= 3 * LUA_POOL_SLAB_SIZE);
+    for (size_t i = 1; i < count; i++)
+        lua_pool_realloc (self, live [i], 64, 0);
+    assert (lua_pool_trim (self) > 0);
+    assert (lua_pool_reserved (self) == LUA_POOL_SLAB_SIZE);
+    assert (lua_pool_in_use (self) == 64);
+    assert (lua_pool_trim (self) == 0);
+    //  free lists hold no block of released slab
+    for (size_t i = 1; i < count; i++) {
+        live [i] = lua_pool_realloc (self, NULL, 0, 64);
+        assert (live [i]);
+        memset (live [i], 0, 64);
+    }
+    for (size_t i = 0; i < count; i++)
+        lua_pool_realloc (self, live [i], 64, 0);
+    assert (lua_pool_in_use (self) == 0);
+    lua_pool_trim (self);
+    assert (lua_pool_reserved (self) == 0);
+    lua_pool_destroy (&self);
+    assert (self == NULL);
+
+    //  shared pool
+    lua_pool_t *first = lua_pool_shared ();
+    lua_pool_t *second = lua_pool_shared ();
+    assert (first && first == second);
+    lua_pool_destroy (&first);
+    void *block = lua_pool_realloc (second, NULL, 0, 64);
+    lua_pool_realloc (second, block, 64, 0);
+    lua_pool_destroy (&second);
+    //  @end
+    printf ("OK\n");
+}
@@ -0,0 +1,78 @@
+/*  =========================================================================
+    lua_pool - Size class pool allocator for lua states
+
+    Copyright (C) 2016 - 2017 Tomas Halman
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+#ifndef LUA_POOL_H_INCLUDED
+#define LUA_POOL_H_INCLUDED
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//  Opaque class structures to allow forward references
+#ifndef LUA_POOL_T_DEFINED
+typedef struct _lua_pool_t lua_pool_t;
+#define LUA_POOL_T_DEFINED
+#endif
+
+//  @interface
+//  Create a new lua_pool
+FTY_ALERT_FLEXIBLE_PRIVATE lua_pool_t *
+    lua_pool_new (void);
+
+//  Get pool shared by the whole agent, it is created on first use. Caller
+//  must drop the reference with lua_pool_destroy.
+FTY_ALERT_FLEXIBLE_PRIVATE lua_pool_t *
+    lua_pool_shared (void);
+
+//  Destroy the lua_pool. Pool is freed when the last reference is dropped,
+//  all blocks must be freed by then.
+FTY_ALERT_FLEXIBLE_PRIVATE void
+    lua_pool_destroy (lua_pool_t **self_p);
+
+//  Allocate, resize or free block with semantics of lua_Alloc: osize is
+//  the size of ptr (ignored if ptr is NULL), nsize 0 frees the block.
+FTY_ALERT_FLEXIBLE_PRIVATE void *
+    lua_pool_realloc (lua_pool_t *self, void *ptr, size_t osize, size_t nsize);
+
+//  Bytes allocated from the pool and not freed yet
+FTY_ALERT_FLEXIBLE_PRIVATE size_t
+    lua_pool_in_use (lua_pool_t *self);
+
+//  Bytes the pool got from system, including free lists
+FTY_ALERT_FLEXIBLE_PRIVATE size_t
+    lua_pool_reserved (lua_pool_t *self);
+
+//  Give slabs without live blocks back to the system, their blocks are
+//  dropped from free lists. Returns number of bytes released.
+FTY_ALERT_FLEXIBLE_PRIVATE size_t
+    lua_pool_trim (lua_pool_t *self);
+
+//  Self test of this class
+FTY_ALERT_FLEXIBLE_PRIVATE void
+    lua_pool_test (bool verbose);
+
+//  @end
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,275 @@
+/*  =========================================================================
+    metric_queue - Latest value queue of incoming metrics
+
+    Copyright (C) 2016 - 2017 Tomas Halman
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+/*
+@header
+    metric_queue - Latest value queue of incoming metrics
+@discuss
+    When the agent falls behind, most queued metrics are superseded by
+    newer values of the same quantity@asset. The queue keeps only the
+    newest pending message of every subject, in a map of subjects plus a
+    FIFO of subjects in order they became pending, so each subject is
+    handled once with its latest value and keeps its place in the line.
+    Number of pending subjects is limited; messages of new subjects are
+    dropped when the queue is full.
+@end
+*/
+
+#include "fty_alert_flexible_classes.h"
+
+//  Structure of our class
+
+struct _metric_queue_t {
+    zhash_t *slots;             //  subject -> slot_t
+    zlist_t *order;             //  pending subjects, oldest first
+    size_t capacity;
+    char *stream;               //  stream of last popped message
+    uint64_t coalesced;
+    uint64_t shed;
+};
+
+typedef struct {
+    zmsg_t *msg;
+    char *stream;
+} slot_t;
+
+static void
+s_slot_destroy (void *data)
+{
+    slot_t *slot = (slot_t *) data;
+    zmsg_destroy (&slot->msg);
+    zstr_free (&slot->stream);
+    free (slot);
+}
+
+//  --------------------------------------------------------------------------
+//  Create a new metric_queue holding at most capacity pending subjects
+
+metric_queue_t *
+metric_queue_new (size_t capacity)
+{
+    metric_queue_t *self = (metric_queue_t *) zmalloc (sizeof (metric_queue_t));
+    assert (self);
+    //  Initialize class properties here
+    self->slots = zhash_new ();
+    self->order = zlist_new ();
+    zlist_autofree (self->order);
+    self->capacity = capacity;
+    return self;
+}
+
+//  --------------------------------------------------------------------------
+//  Destroy the metric_queue
+
+void
+metric_queue_destroy (metric_queue_t **self_p)
+{
+    assert (self_p);
+    if (*self_p) {
+        metric_queue_t *self = *self_p;
+        //  Free class properties here
+        zhash_destroy (&self->slots);
+        zlist_destroy (&self->order);
+        zstr_free (&self->stream);
+        //  Free object itself
+        free (self);
+        *self_p = NULL;
+    }
+}
+
+//  --------------------------------------------------------------------------
+//  Queue message received from stream with subject. Returns 0 if subject
+//  was queued, 1 if it was pending and the message replaced the older one,
+//  -1 if queue is full and the message was dropped. Takes ownership of the
+//  message.
+
+int
+metric_queue_push (metric_queue_t *self, const char *stream, const char *subject, zmsg_t **msg_p)
+{
+    assert (self);
+    assert (stream && subject);
+    assert (msg_p);
+
+    slot_t *slot = (slot_t *) zhash_lookup (self->slots, subject);
+    if (slot) {
+        zmsg_destroy (&slot->msg);
+        slot->msg = *msg_p;
+        *msg_p = NULL;
+        if (!streq (slot->stream, stream)) {
+            zstr_free (&slot->stream);
+            slot->stream = strdup (stream);
+        }
+        self->coalesced++;
+        return 1;
+    }
+    if (zhash_size (self->slots) >= self->capacity) {
+        zmsg_destroy (msg_p);
+        self->shed++;
+        return -1;
+    }
+    slot = (slot_t *) zmalloc (sizeof (slot_t));
+    assert (slot);
+    slot->msg = *msg_p;
+    *msg_p = NULL;
+    slot->stream = strdup (stream);
+    zhash_insert (self->slots, subject, slot);
+    zhash_freefn (self->slots, subject, s_slot_destroy);
+    zlist_append (self->order, (void *) subject);
+    return 0;
+}
+
+//  --------------------------------------------------------------------------
+//  Return the latest message of subject pending longest, or NULL if queue
+//  is empty. Caller is responsible for destroying the return value.
+
+zmsg_t *
+metric_queue_pop (metric_queue_t *self)
+{
+    assert (self);
+
+    char *subject = (char *) zlist_pop (self->order);
+    if (!subject)
+        return NULL;
+    slot_t *slot = (slot_t *) zhash_lookup (self->slots, subject);
+    assert (slot);
+    zmsg_t *msg = slot->msg;
+    slot->msg = NULL;
+    zstr_free (&self->stream);
+    self->stream = slot->stream;
+    slot->stream = NULL;
+    zhash_delete (self->slots, subject);
+    zstr_free (&subject);
+    return msg;
+}
+
+//  --------------------------------------------------------------------------
+//  Get stream of message returned by last pop
+
+const char *
+metric_queue_stream (metric_queue_t *self)
+{
+    assert (self);
+    return self->stream;
+}
+
+//  --------------------------------------------------------------------------
+//  Number of pending subjects
+
+size_t
+metric_queue_size (metric_queue_t *self)
+{
+    assert (self);
+    return zhash_size (self->slots);
+}
+
+//  --------------------------------------------------------------------------
+//  Number of messages replaced by newer ones
+
+uint64_t
+metric_queue_coalesced (metric_queue_t *self)
+{
+    assert (self);
+    return self->coalesced;
+}
+
+//  --------------------------------------------------------------------------
+//  Number of messages dropped because queue was full
+
+uint64_t
+metric_queue_shed (metric_queue_t *self)
+{
+    assert (self);
+    return self->shed;
+}
+
+//  --------------------------------------------------------------------------
+//  Self test of this class
+
+static zmsg_t *
+s_test_msg (const char *value)
+{
+    zmsg_t *msg = zmsg_new ();
+    zmsg_addstr (msg, value);
+    return msg;
+}
+
+static void
+s_test_pop (metric_queue_t *self, const char *stream, const char *value)
+{
+    zmsg_t *msg = metric_queue_pop (self);
+    assert (msg);
+    char *item = zmsg_popstr (msg);
+    assert (streq (item, value));
+    assert (streq (metric_queue_stream (self), stream));
+    zstr_free (&item);
+    zmsg_destroy (&msg);
+}
+
+void
+metric_queue_test (bool verbose)
+{
+    printf (" * metric_queue: ");
+
+    //  @selftest
+    metric_queue_t *self = metric_queue_new (2);
+    assert (self);
+    assert (metric_queue_pop (self) == NULL);
+
+    //  pending subject keeps its place and the latest value
+    zmsg_t *msg = s_test_msg ("1");
+    assert (metric_queue_push (self, "METRICS", "load@ups-1", &msg) == 0);
+    assert (msg == NULL);
+    msg = s_test_msg ("10");
+    assert (metric_queue_push (self, "METRICS", "load@ups-2", &msg) == 0);
+    msg = s_test_msg ("2");
+    assert (metric_queue_push (self, "METRICS", "load@ups-1", &msg) == 1);
+    assert (metric_queue_size (self) == 2);
+    assert (metric_queue_coalesced (self) == 1);
+
+    //  full queue drops new subjects, but still takes newer values
+    msg = s_test_msg ("100");
+    assert (metric_queue_push (self, "METRICS", "load@ups-3", &msg) == -1);
+    assert (msg == NULL);
+    assert (metric_queue_shed (self) == 1);
+    msg = s_test_msg ("3");
+    assert (metric_queue_push (self, "LICENSING", "load@ups-1", &msg) == 1);
+
+    s_test_pop (self, "LICENSING", "3");
+    s_test_pop (self, "METRICS", "10");
+    assert (metric_queue_pop (self) == NULL);
+    assert (metric_queue_size (self) == 0);
+
+    //  popped subject is queued again at the end
+    msg = s_test_msg ("4");
+    metric_queue_push (self, "METRICS", "load@ups-1", &msg);
+    msg = s_test_msg ("11");
+    metric_queue_push (self, "METRICS", "load@ups-2", &msg);
+    s_test_pop (self, "METRICS", "4");
+    msg = s_test_msg ("5");
+    assert (metric_queue_push (self, "METRICS", "load@ups-1", &msg) == 0);
+    s_test_pop (self, "METRICS", "11");
+
+    //  pending messages are freed with the queue
+    metric_queue_destroy (&self);
+    assert (self == NULL);
+    //  @end
+    printf ("OK\n");
+}
@@ -0,0 +1,82 @@
+/*  =========================================================================
+    metric_queue - Latest value queue of incoming metrics
+
+    Copyright (C) 2016 - 2017 Tomas Halman
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+#ifndef METRIC_QUEUE_H_INCLUDED
+#define METRIC_QUEUE_H_INCLUDED
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//  Opaque class structures to allow forward references
+#ifndef METRIC_QUEUE_T_DEFINED
+typedef struct _metric_queue_t metric_queue_t;
+#define METRIC_QUEUE_T_DEFINED
+#endif
+
+//  @interface
+//  Create a new metric_queue holding at most capacity pending subjects
+FTY_ALERT_FLEXIBLE_PRIVATE metric_queue_t *
+    metric_queue_new (size_t capacity);
+
+//  Destroy the metric_queue
+FTY_ALERT_FLEXIBLE_PRIVATE void
+    metric_queue_destroy (metric_queue_t **self_p);
+
+//  Queue message received from stream with subject. Returns 0 if subject
+//  was queued, 1 if it was pending and the message replaced the older one,
+//  -1 if queue is full and the message was dropped. Takes ownership of the
+//  message.
+FTY_ALERT_FLEXIBLE_PRIVATE int
+    metric_queue_push (metric_queue_t *self, const char *stream, const char *subject, zmsg_t **msg_p);
+
+//  Return the latest message of subject pending longest, or NULL if queue
+//  is empty. Caller is responsible for destroying the return value.
+FTY_ALERT_FLEXIBLE_PRIVATE zmsg_t *
+    metric_queue_pop (metric_queue_t *self);
+
+//  Get stream of message returned by last pop
+FTY_ALERT_FLEXIBLE_PRIVATE const char *
+    metric_queue_stream (metric_queue_t *self);
+
+//  Number of pending subjects
+FTY_ALERT_FLEXIBLE_PRIVATE size_t
+    metric_queue_size (metric_queue_t *self);
+
+//  Number of messages replaced by newer ones
+FTY_ALERT_FLEXIBLE_PRIVATE uint64_t
+    metric_queue_coalesced (metric_queue_t *self);
+
+//  Number of messages dropped because queue was full
+FTY_ALERT_FLEXIBLE_PRIVATE uint64_t
+    metric_queue_shed (metric_queue_t *self);
+
+//  Self test of this class
+FTY_ALERT_FLEXIBLE_PRIVATE void
+    metric_queue_test (bool verbose);
+
+//  @end
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,286 @@
+/*  =========================================================================
+    republish_queue - Pending asset REPUBLISH requests with backoff
+
+    Copyright (C) 2016 - 2017 Tomas Halman
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+/*
+@header
+    republish_queue - Pending asset REPUBLISH requests with backoff
+@discuss
+    Sensor metrics can arrive for sensors asset-agent did not tell us about.
+    Instead of asking for every such metric, each unknown name is asked for
+    at most once per backoff period and all names queued since the last
+    flush are sent to asset-agent in one REPUBLISH message.
+@end
+*/
+
+#include "fty_alert_flexible_classes.h"
+
+//  Structure of our class
+
+struct _republish_queue_t {
+    zhash_t *pending;           //  asset name -> request_t
+    zlist_t *queued;            //  names to be sent on next flush
+    int backoff_min;
+    int backoff_max;
+};
+
+typedef struct {
+    int64_t next;               //  earliest time of next request
+    int backoff;                //  delay after next request
+    int64_t seen;               //  last time asset was asked for
+    bool queued;
+} request_t;
+
+//  --------------------------------------------------------------------------
+//  Create a new republish_queue
+
+republish_queue_t *
+republish_queue_new (int backoff_min, int backoff_max)
+{
+    republish_queue_t *self = (republish_queue_t *) zmalloc (sizeof (republish_queue_t));
+    assert (self);
+    //  Initialize class properties here
+    self->pending = zhash_new ();
+    self->queued = zlist_new ();
+    zlist_autofree (self->queued);
+    self->backoff_min = backoff_min;
+    self->backoff_max = backoff_max < backoff_min ? backoff_min : backoff_max;
+    return self;
+}
+
+//  --------------------------------------------------------------------------
+//  Destroy the republish_queue
+
+void
+republish_queue_destroy (republish_queue_t **self_p)
+{
+    assert (self_p);
+    if (*self_p) {
+        republish_queue_t *self = *self_p;
+        //  Free class properties here
+        zhash_destroy (&self->pending);
+        zlist_destroy (&self->queued);
+        //  Free object itself
+        free (self);
+        *self_p = NULL;
+    }
+}
+
+//  --------------------------------------------------------------------------
+//  Ask for unknown asset. Returns true if the name was queued for the next
+//  flush, false if it is already queued or still backing off.
+
+bool
+republish_queue_request (republish_queue_t *self, const char *name, int64_t now)
+{
+    assert (self);
+    assert (name);
+
+    request_t *request = (request_t *) zhash_lookup (self->pending, name);
+    if (!request) {
+        request = (request_t *) zmalloc (sizeof (request_t));
+        assert (request);
+        request->next = now;
+        request->backoff = self->backoff_min;
+        zhash_insert (self->pending, name, request);
+        zhash_freefn (self->pending, name, free);
+    }
+    request->seen = now;
+    if (request->queued || now < request->next)
+        return false;
+
+    request->queued = true;
+    request->next = now + request->backoff;
+    request->backoff = request->backoff * 2 > self->backoff_max ? self->backoff_max : request->backoff * 2;
+    zlist_append (self->queued, (void *) name);
+    return true;
+}
+
+//  --------------------------------------------------------------------------
+//  Asset is known now, forget pending request.
+
+void
+republish_queue_resolve (republish_queue_t *self, const char *name)
+{
+    assert (self);
+    assert (name);
+    //  a queued name stays in the list, flush skips it
+    zhash_delete (self->pending, name);
+}
+
+//  --------------------------------------------------------------------------
+//  Sending of flushed request failed, queue asset for the next flush again
+//  without changing its backoff.
+
+void
+republish_queue_requeue (republish_queue_t *self, const char *name)
+{
+    assert (self);
+    assert (name);
+
+    request_t *request = (request_t *) zhash_lookup (self->pending, name);
+    if (!request || request->queued)
+        return;
+    request->queued = true;
+    zlist_append (self->queued, (void *) name);
+}
+
+//  --------------------------------------------------------------------------
+//  Forget assets asked for with maximal backoff which were not asked for
+//  again for idle milliseconds; asset-agent doesn't know them. Returns
+//  number of forgotten assets.
+
+size_t
+republish_queue_expire (republish_queue_t *self, int64_t now, int64_t idle)
+{
+    assert (self);
+
+    zlist_t *expired = zlist_new ();
+    zlist_autofree (expired);
+    for (request_t *request = (request_t *) zhash_first (self->pending); request;
+         request = (request_t *) zhash_next (self->pending)) {
+        if (!request->queued && request->backoff == self->backoff_max && now - request->seen >= idle)
+            zlist_append (expired, (void *) zhash_cursor (self->pending));
+    }
+    size_t count = zlist_size (expired);
+    for (char *name = (char *) zlist_first (expired); name; name = (char *) zlist_next (expired))
+        zhash_delete (self->pending, name);
+    zlist_destroy (&expired);
+    return count;
+}
+
+//  --------------------------------------------------------------------------
+//  Return one REPUBLISH message with all queued asset names or NULL if
+//  nothing is queued. Caller is responsible for destroying the return value.
+
+zmsg_t *
+republish_queue_flush (republish_queue_t *self)
+{
+    assert (self);
+
+    zmsg_t *msg = NULL;
+    char *name = (char *) zlist_pop (self->queued);
+    while (name) {
+        request_t *request = (request_t *) zhash_lookup (self->pending, name);
+        if (request && request->queued) {
+            request->queued = false;
+            if (!msg) {
+                msg = zmsg_new ();
+                zmsg_addstr (msg, "REPUBLISH");
+            }
+            zmsg_addstr (msg, name);
+        }
+        zstr_free (&name);
+        name = (char *) zlist_pop (self->queued);
+    }
+    return msg;
+}
+
+//  --------------------------------------------------------------------------
+//  Number of assets with pending request
+
+size_t
+republish_queue_size (republish_queue_t *self)
+{
+    assert (self);
+    return zhash_size (self->pending);
+}
+
+//  --------------------------------------------------------------------------
+//  Self test of this class
+
+void
+republish_queue_test (bool verbose)
+{
+    printf (" * republish_queue: ");
+
+    //  @selftest
+    republish_queue_t *self = republish_queue_new (1000, 3000);
+    assert (self);
+    assert (republish_queue_flush (self) == NULL);
+
+    //  duplicate requests are coalesced
+    assert (republish_queue_request (self, "sensor-1", 0));
+    assert (!republish_queue_request (self, "sensor-1", 10));
+    assert (republish_queue_request (self, "sensor-2", 20));
+    assert (republish_queue_size (self) == 2);
+
+    zmsg_t *msg = republish_queue_flush (self);
+    assert (msg);
+    assert (zmsg_size (msg) == 3);
+    char *item = zmsg_popstr (msg);
+    assert (streq (item, "REPUBLISH"));
+    zstr_free (&item);
+    item = zmsg_popstr (msg);
+    assert (streq (item, "sensor-1"));
+    zstr_free (&item);
+    item = zmsg_popstr (msg);
+    assert (streq (item, "sensor-2"));
+    zstr_free (&item);
+    zmsg_destroy (&msg);
+    assert (republish_queue_flush (self) == NULL);
+
+    //  exponential backoff: 1000, 2000, then capped at 3000
+    assert (!republish_queue_request (self, "sensor-1", 999));
+    assert (republish_queue_request (self, "sensor-1", 1000));
+    msg = republish_queue_flush (self);
+    zmsg_destroy (&msg);
+    assert (!republish_queue_request (self, "sensor-1", 2999));
+    assert (republish_queue_request (self, "sensor-1", 3000));
+    msg = republish_queue_flush (self);
+    zmsg_destroy (&msg);
+    assert (!republish_queue_request (self, "sensor-1", 5999));
+    assert (republish_queue_request (self, "sensor-1", 6000));
+
+    //  resolved asset is not sent even when queued
+    republish_queue_resolve (self, "sensor-1");
+    assert (republish_queue_flush (self) == NULL);
+    assert (republish_queue_size (self) == 1);
+
+    //  failed send is queued again with the same backoff
+    assert (republish_queue_request (self, "sensor-3", 0));
+    msg = republish_queue_flush (self);
+    zmsg_destroy (&msg);
+    republish_queue_requeue (self, "sensor-3");
+    republish_queue_requeue (self, "sensor-3");
+    msg = republish_queue_flush (self);
+    assert (msg && zmsg_size (msg) == 2);
+    zmsg_destroy (&msg);
+    assert (!republish_queue_request (self, "sensor-3", 999));
+
+    //  only assets at maximal backoff and idle long enough are forgotten
+    assert (republish_queue_request (self, "sensor-3", 1000));
+    msg = republish_queue_flush (self);
+    zmsg_destroy (&msg);
+    assert (republish_queue_size (self) == 2);
+    assert (republish_queue_expire (self, 100000, 10000) == 1);
+    assert (republish_queue_size (self) == 1);
+    assert (republish_queue_request (self, "sensor-2", 100000));
+    msg = republish_queue_flush (self);
+    zmsg_destroy (&msg);
+    assert (republish_queue_expire (self, 105000, 10000) == 0);
+    assert (republish_queue_expire (self, 110000, 10000) == 1);
+    assert (republish_queue_size (self) == 0);
+
+    republish_queue_destroy (&self);
+    assert (self == NULL);
+    //  @end
+    printf ("OK\n");
+}
@@ -0,0 +1,84 @@
+/*  =========================================================================
+    republish_queue - Pending asset REPUBLISH requests with backoff
+
+    Copyright (C) 2016 - 2017 Tomas Halman
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+#ifndef REPUBLISH_QUEUE_H_INCLUDED
+#define REPUBLISH_QUEUE_H_INCLUDED
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//  Opaque class structures to allow forward references
+#ifndef REPUBLISH_QUEUE_T_DEFINED
+typedef struct _republish_queue_t republish_queue_t;
+#define REPUBLISH_QUEUE_T_DEFINED
+#endif
+
+//  @interface
+//  Create a new republish_queue. Asset is asked for again after backoff_min
+//  milliseconds, every next attempt doubles the delay up to backoff_max.
+FTY_ALERT_FLEXIBLE_PRIVATE republish_queue_t *
+    republish_queue_new (int backoff_min, int backoff_max);
+
+//  Destroy the republish_queue
+FTY_ALERT_FLEXIBLE_PRIVATE void
+    republish_queue_destroy (republish_queue_t **self_p);
+
+//  Ask for unknown asset. Returns true if the name was queued for the next
+//  flush, false if it is already queued or still backing off.
+FTY_ALERT_FLEXIBLE_PRIVATE bool
+    republish_queue_request (republish_queue_t *self, const char *name, int64_t now);
+
+//  Asset is known now, forget pending request.
+FTY_ALERT_FLEXIBLE_PRIVATE void
+    republish_queue_resolve (republish_queue_t *self, const char *name);
+
+//  Sending of flushed request failed, queue asset for the next flush again
+//  without changing its backoff.
+FTY_ALERT_FLEXIBLE_PRIVATE void
+    republish_queue_requeue (republish_queue_t *self, const char *name);
+
+//  Forget assets asked for with maximal backoff which were not asked for
+//  again for idle milliseconds; asset-agent doesn't know them. Returns
+//  number of forgotten assets.
+FTY_ALERT_FLEXIBLE_PRIVATE size_t
+    republish_queue_expire (republish_queue_t *self, int64_t now, int64_t idle);
+
+//  Return one REPUBLISH message with all queued asset names or NULL if
+//  nothing is queued. Caller is responsible for destroying the return value.
+FTY_ALERT_FLEXIBLE_PRIVATE zmsg_t *
+    republish_queue_flush (republish_queue_t *self);
+
+//  Number of assets with pending request
+FTY_ALERT_FLEXIBLE_PRIVATE size_t
+    republish_queue_size (republish_queue_t *self);
+
+//  Self test of this class
+FTY_ALERT_FLEXIBLE_PRIVATE void
+    republish_queue_test (bool verbose);
+
+//  @end
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
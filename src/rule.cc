@@ -28,9 +28,28 @@
 
 #include "fty_alert_flexible_classes.h"
 
+#define QUARANTINE_FAILURES     3       //  consecutive failures before quarantine
+#define QUARANTINE_MIN          10000   //  first quarantine [ms]
+#define QUARANTINE_MAX          600000  //  maximal quarantine [ms]
+
+#define MEMO_MAX                10000   //  memoized assets per rule, then cache is dropped
+
+static int s_quarantine_failures = QUARANTINE_FAILURES;
+static uint64_t s_memo_hits;
+static uint64_t s_memo_misses;
+
 #include <lua.h>
 #include <lauxlib.h>
 #include <lualib.h>
+#include <ctype.h>
+#include <math.h>
+
+//  Expression engine formats numbers like tostring of lua 5.1 and 5.2. Lua
+//  5.3 has integer subtype and prints floats with .0 (5 / 1 is "5.0"), so
+//  its rules are evaluated by lua.
+#if LUA_VERSION_NUM < 503
+#define RULE_EXPRESSION_ENGINE 1
+#endif
 
 //  Structure of our class
 
@@ -46,7 +65,29 @@ struct _rule_t {
     zhash_t *result_actions;
     zhashx_t *variables;        //  lua context global variables
     char *evaluation;
-    lua_State *lua;
+    char *engine;               //  "lua", "threshold" or "expression", NULL to detect
+    char *values;               //  "number" or "string", NULL to detect
+    bool typed;                 //  values and variables which are numbers are lua numbers
+    rule_threshold_t *threshold;    //  native evaluation of threshold rule
+    rule_expression_t *expression;  //  bytecode of evaluation for expression engine
+    rule_chunk_t *chunk;        //  compiled evaluation, shared by rules with the same code
+    int environment;            //  registry reference of rule environment in chunk
+    bool broken;                //  evaluation doesn't compile, not retried
+    int failures;               //  consecutive failed lua evaluations
+    int64_t quarantine;         //  length of current or last quarantine [ms]
+    int64_t quarantine_until;   //  zclock_mono end of quarantine, 0 if none
+    bool impure;                //  rule declares "pure":false
+    bool declared_pure;         //  rule declares "pure":true, code is not checked
+    bool pure;                  //  lua result depends only on values and NAME
+    zhashx_t *memo;             //  asset -> memo_t, last lua evaluation
+    int min_interval;           //  between evaluations for one asset [ms], -1 for default
+    int refs;                   //  rule can be shared by rule set snapshots
+    char *template_name;        //  instance: name of template rule
+    zhashx_t *substitutions;    //  instance: placeholder -> value
+    rule_t *tmpl;               //  instance: template with compiled code
+    char *template_source;      //  template: evaluation with placeholders as lua variables
+    zlist_t *placeholders;      //  template: placeholders used in lua strings
+    zlist_t *bare_placeholders; //  template: placeholders used as lua code
     struct {
         char *action;
         char *act_asset;
@@ -55,6 +96,27 @@ struct _rule_t {
 };
 
 
+//  Inputs and outcome of last lua evaluation for one asset
+typedef struct {
+    uint64_t hash;              //  fingerprint of inputs
+    size_t size;
+    char *inputs;               //  NAME and values, each zero terminated
+    int result;
+    char *message;
+} memo_t;
+
+static void
+s_memo_destroy (memo_t **self_p)
+{
+    if (*self_p) {
+        memo_t *self = *self_p;
+        free (self->inputs);
+        zstr_free (&self->message);
+        free (self);
+        *self_p = NULL;
+    }
+}
+
 static
 int string_comparefn (void *i1, void *i2)
 {
@@ -70,6 +132,9 @@ rule_new (void)
     rule_t *self = (rule_t *) zmalloc (sizeof (rule_t));
     assert (self);
     memset(self, 0, sizeof(*self));
+    self->refs = 1;
+    self->environment = LUA_NOREF;
+    self->min_interval = -1;
 
     //  Initialize class properties here
     self -> metrics = zlist_new ();
@@ -92,6 +157,9 @@ rule_new (void)
     self->variables = zhashx_new ();
     zhashx_set_duplicator (self->variables, (zhashx_duplicator_fn *) strdup);
     zhashx_set_destructor (self->variables, (zhashx_destructor_fn *) zstr_free);
+    self->substitutions = zhashx_new ();
+    zhashx_set_duplicator (self->substitutions, (zhashx_duplicator_fn *) strdup);
+    zhashx_set_destructor (self->substitutions, (zhashx_destructor_fn *) zstr_free);
 
     return self;
 }
@@ -122,9 +190,9 @@ void rule_add_result_action (rule_t *self, const char *result, const char *actio
 }
 
 //  --------------------------------------------------------------------------
-//  Rule loading callback
+//  Rule loading callback of vsjson_parse, data is the rule
 
-static int
+int
 rule_json_callback (const char *locator, const char *value, void *data)
 {
     if (!data) return 1;
@@ -258,6 +326,35 @@ rule_json_callback (const char *locator, const char *value, void *data)
         zstr_free (&self -> evaluation);
         self -> evaluation = vsjson_decode_string (value);
     }
+    else if (streq (mylocator, "engine")) {
+        zstr_free (&self->engine);
+        self->engine = vsjson_decode_string (value);
+    }
+    else if (streq (mylocator, "values")) {
+        zstr_free (&self->values);
+        self->values = vsjson_decode_string (value);
+    }
+    else if (streq (mylocator, "min_interval")) {
+        char *interval = vsjson_decode_string (value);
+        self->min_interval = atoi (interval ? interval : value);
+        if (self->min_interval < 0)
+            self->min_interval = -1;
+        zstr_free (&interval);
+    }
+    else if (streq (mylocator, "pure")) {
+        self->impure = streq (value, "false");
+        self->declared_pure = streq (value, "true");
+    }
+    else if (streq (mylocator, "template")) {
+        zstr_free (&self->template_name);
+        self->template_name = vsjson_decode_string (value);
+    }
+    else if (strncmp (mylocator, "substitutions/", 14) == 0) {
+        char *substitution = vsjson_decode_string (value);
+        if (substitution)
+            zhashx_update (self->substitutions, mylocator + 14, substitution);
+        zstr_free (&substitution);
+    }
     else
     if (strncmp (mylocator, "variables/", 10) == 0)
     {
@@ -278,6 +375,313 @@ rule_json_callback (const char *locator, const char *value, void *data)
     return 0;
 }
 
+//  --------------------------------------------------------------------------
+//  Does lua code contain string literal which is a number, like '0'? Such
+//  code compares values with strings.
+
+static bool
+s_numeric_literal (const char *evaluation)
+{
+    for (const char *p = evaluation; p && *p; p++) {
+        if (*p != '\'' && *p != '"')
+            continue;
+        const char *start = p + 1;
+        const char *end = start;
+        while (*end && *end != *p && *end != '\n') {
+            if (*end == '\\' && end [1])
+                end++;
+            end++;
+        }
+        if (end > start) {
+            char *literal = strndup (start, end - start);
+            double number;
+            bool numeric = rule_threshold_number (literal, &number);
+            zstr_free (&literal);
+            if (numeric)
+                return true;
+        }
+        if (!*end)
+            break;
+        p = end;
+    }
+    return false;
+}
+
+//  Lua function scanned by s_impure_writes
+typedef struct {
+    int depth;                  //  block depth at its start
+    int braces;                 //  open table constructors
+    zlist_t *locals;            //  names local to it, parameters included
+} code_scope_t;
+
+//  --------------------------------------------------------------------------
+//  Is name local to function?
+
+static bool
+s_code_local (code_scope_t *scope, const char *name)
+{
+    for (const char *local = (const char *) zlist_first (scope->locals); local;
+        local = (const char *) zlist_next (scope->locals))
+        if (streq (local, name))
+            return true;
+    return false;
+}
+
+//  --------------------------------------------------------------------------
+//  Do targets of assignment on token i write anything but locals of the
+//  function (or fields of tables in them)? Targets are read backwards:
+//  name, then .name and [key] suffixes, more targets separated by commas.
+
+static bool
+s_code_writes (char **tokens, int *types, int i, code_scope_t *scope)
+{
+    int j = i - 1;
+    while (true) {
+        while (j > 0) {
+            if (streq (tokens [j], "]") && types [j] == RULE_LEXER_SYMBOL) {
+                int nesting = 0;
+                for (; j >= 0; j--) {
+                    if (types [j] != RULE_LEXER_SYMBOL)
+                        continue;
+                    if (streq (tokens [j], "]"))
+                        nesting++;
+                    else
+                    if (streq (tokens [j], "[") && --nesting == 0)
+                        break;
+                }
+                j--;
+            }
+            else
+            if (types [j] == RULE_LEXER_NAME && types [j - 1] == RULE_LEXER_SYMBOL && streq (tokens [j - 1], "."))
+                j -= 2;
+            else
+                break;
+        }
+        //  result of call or parenthesized expression, can't tell
+        if (j < 0 || types [j] != RULE_LEXER_NAME || rule_lexer_keyword (tokens [j], strlen (tokens [j])))
+            return true;
+        if (!s_code_local (scope, tokens [j]))
+            return true;
+        if (j > 0 && types [j - 1] == RULE_LEXER_SYMBOL && streq (tokens [j - 1], ",")) {
+            j -= 2;
+            continue;
+        }
+        return false;
+    }
+}
+
+//  --------------------------------------------------------------------------
+//  Does any function of lua code assign globals, upvalues or fields of
+//  tables which are not its locals? Such state survives the evaluation.
+//  Chunk itself runs once per rule, its assignments don't count. Code
+//  which the lexer doesn't understand is treated as writing.
+
+static bool
+s_impure_writes (const char *evaluation)
+{
+    size_t count = 0, capacity = 64;
+    char **tokens = (char **) zmalloc (capacity * sizeof (char *));
+    int *types = (int *) zmalloc (capacity * sizeof (int));
+    assert (tokens && types);
+    bool impure = false;
+    rule_lexer_t *lexer = rule_lexer_new (evaluation);
+    while (rule_lexer_type (lexer) != RULE_LEXER_END) {
+        if (rule_lexer_type (lexer) == RULE_LEXER_ERROR) {
+            impure = true;
+            break;
+        }
+        if (count == capacity) {
+            capacity *= 2;
+            tokens = (char **) realloc (tokens, capacity * sizeof (char *));
+            types = (int *) realloc (types, capacity * sizeof (int));
+            assert (tokens && types);
+        }
+        size_t size;
+        const char *text = rule_lexer_text (lexer, &size);
+        tokens [count] = strndup (text, size);
+        types [count++] = rule_lexer_type (lexer);
+        rule_lexer_next (lexer);
+    }
+    rule_lexer_destroy (&lexer);
+
+    #define CODE_IS(i,text) ((i) >= 0 && (i) < (int) count \
+        && (types [i] == RULE_LEXER_NAME || types [i] == RULE_LEXER_SYMBOL) && streq (tokens [i], (text)))
+    //  scopes [0] is the chunk, every function nests one more
+    code_scope_t *scopes = (code_scope_t *) zmalloc ((count + 1) * sizeof (code_scope_t));
+    assert (scopes);
+    int level = 0;
+    int depth = 0;
+    scopes [0].locals = zlist_new ();
+    for (int i = 0; i < (int) count && !impure; i++) {
+        code_scope_t *scope = &scopes [level];
+        if (CODE_IS (i, "[") && (CODE_IS (i + 1, "[") || CODE_IS (i + 1, "=")))
+            impure = true;      //  long string, lexer doesn't know it
+        else
+        if (CODE_IS (i, "local")) {
+            if (CODE_IS (i + 1, "function")) {
+                if (i + 2 < (int) count && types [i + 2] == RULE_LEXER_NAME)
+                    zlist_append (scope->locals, tokens [i + 2]);
+                continue;
+            }
+            while (i + 1 < (int) count && types [i + 1] == RULE_LEXER_NAME) {
+                zlist_append (scope->locals, tokens [++i]);
+                if (CODE_IS (i + 1, "<"))
+                    i += 3;         //  attribute of lua 5.4
+                if (!CODE_IS (i + 1, ","))
+                    break;
+                i++;
+            }
+            if (CODE_IS (i + 1, "="))
+                i++;
+        }
+        else
+        if (CODE_IS (i, "for")) {
+            while (i + 1 < (int) count && (CODE_IS (i + 1, ",") || (types [i + 1] == RULE_LEXER_NAME
+                && !rule_lexer_keyword (tokens [i + 1], strlen (tokens [i + 1]))))) {
+                i++;
+                if (types [i] == RULE_LEXER_NAME)
+                    zlist_append (scope->locals, tokens [i]);
+            }
+            if (CODE_IS (i + 1, "="))
+                i++;
+        }
+        else
+        if (CODE_IS (i, "function")) {
+            //  function statement assigns its name like variable
+            int j = i + 1;
+            bool method = false;
+            if (j < (int) count && types [j] == RULE_LEXER_NAME) {
+                if (level > 0 && !CODE_IS (i - 1, "local") && !s_code_local (scope, tokens [j]))
+                    impure = true;
+                while (CODE_IS (j + 1, ".") || CODE_IS (j + 1, ":")) {
+                    method = CODE_IS (j + 1, ":");
+                    j += 2;
+                }
+                j++;
+            }
+            level++;
+            scopes [level].depth = depth++;
+            scopes [level].locals = zlist_new ();
+            if (method)
+                zlist_append (scopes [level].locals, (void *) "self");
+            if (CODE_IS (j, "("))
+                for (j++; j < (int) count && !CODE_IS (j, ")"); j++)
+                    if (types [j] == RULE_LEXER_NAME)
+                        zlist_append (scopes [level].locals, tokens [j]);
+            i = j;
+        }
+        else
+        if (CODE_IS (i, "if") || CODE_IS (i, "do") || CODE_IS (i, "repeat"))
+            depth++;
+        else
+        if (CODE_IS (i, "end") || CODE_IS (i, "until")) {
+            depth--;
+            if (level > 0 && depth == scope->depth)
+                zlist_destroy (&scopes [level--].locals);
+        }
+        else
+        if (CODE_IS (i, "{"))
+            scope->braces++;
+        else
+        if (CODE_IS (i, "}"))
+            scope->braces--;
+        else
+        if (CODE_IS (i, "=") && level > 0 && scope->braces == 0)
+            impure = s_code_writes (tokens, types, i, scope);
+    }
+    #undef CODE_IS
+    for (int l = 0; l <= level; l++)
+        zlist_destroy (&scopes [l].locals);
+    free (scopes);
+    for (size_t i = 0; i < count; i++)
+        free (tokens [i]);
+    free (tokens);
+    free (types);
+    return impure;
+}
+
+//  --------------------------------------------------------------------------
+//  Does lua code read clock, random numbers or files, or keep state between
+//  evaluations? Result of such code can change even if values don't.
+
+static bool
+s_impure_code (const char *evaluation)
+{
+    static const char *calls [] = {
+        "os.", "io.", "debug.", "math.random", "math.randomseed", "require", "dofile", "loadfile",
+        "load", "loadstring", "collectgarbage", "rawset", "setmetatable", "setfenv",
+        "table.insert", "table.remove", "table.sort", NULL
+    };
+    if (!evaluation)
+        return false;
+    for (int i = 0; calls [i]; i++) {
+        size_t length = strlen (calls [i]);
+        bool prefix = calls [i][length - 1] == '.';
+        for (const char *p = strstr (evaluation, calls [i]); p; p = strstr (p + length, calls [i])) {
+            if (p != evaluation && (isalnum ((unsigned char) p [-1]) || p [-1] == '_' || p [-1] == '.'))
+                continue;
+            if (!prefix && (isalnum ((unsigned char) p [length]) || p [length] == '_'))
+                continue;
+            return true;
+        }
+    }
+    return s_impure_writes (evaluation);
+}
+
+//  --------------------------------------------------------------------------
+//  Select evaluation engine. Plain threshold rules are evaluated natively
+//  unless rule asks for lua, "engine":"threshold" requires it. Evaluation
+//  of "engine":"expression" rules is compiled to bytecode.
+//  Values and variables which are numbers are passed to evaluation as
+//  numbers, unless rule asks for "values":"string" or its code compares
+//  them with numeric strings. Results of lua code are reused for the same
+//  values unless rule is "pure":false, or its code is impure and the rule
+//  doesn't declare "pure":true.
+
+static int
+s_rule_engine (rule_t *self)
+{
+    rule_threshold_destroy (&self->threshold);
+    rule_expression_destroy (&self->expression);
+    if (self->values && !streq (self->values, "number") && !streq (self->values, "string")) {
+        log_error ("rule %s: unknown values '%s'", self->name, self->values);
+        return -1;
+    }
+    if (self->values)
+        self->typed = streq (self->values, "number");
+    else
+        self->typed = !s_numeric_literal (self->evaluation);
+    self->pure = !self->impure && (self->declared_pure || !s_impure_code (self->evaluation));
+    zhashx_destroy (&self->memo);
+    if (self->engine && !streq (self->engine, "lua") && !streq (self->engine, "threshold")
+    &&  !streq (self->engine, "expression")) {
+        log_error ("rule %s: unknown engine '%s'", self->name, self->engine);
+        return -1;
+    }
+    if (self->engine && streq (self->engine, "lua"))
+        return 0;
+    if (self->engine && streq (self->engine, "expression")) {
+#if defined (RULE_EXPRESSION_ENGINE)
+        self->expression = rule_expression_new (self->evaluation, self->variables, self->typed);
+        if (!self->expression) {
+            log_error ("rule %s: evaluation can't be compiled by expression engine", self->name);
+            return -1;
+        }
+#else
+        log_debug ("rule %s: expression engine needs lua 5.1 or 5.2, using lua", self->name);
+#endif
+        return 0;
+    }
+    self->threshold = rule_threshold_new (self->evaluation, self->typed);
+    if (!self->threshold && self->engine) {
+        log_error ("rule %s: evaluation is not a threshold, can't use threshold engine", self->name);
+        return -1;
+    }
+    if (self->threshold)
+        log_debug ("rule %s: using threshold engine", self->name);
+    return 0;
+}
+
 //  --------------------------------------------------------------------------
 //  Parse JSON into rule.
 
@@ -286,6 +690,8 @@ int rule_parse (rule_t *self, const char *json)
     int r = vsjson_parse (json, rule_json_callback, self, true);
     if (r != 0)
         log_error("vsjson_parse failed (r: %d)\njson:\n%s\n", r, json);
+    else
+        r = s_rule_engine (self);
     return r;
 }
 
@@ -470,14 +876,21 @@ int rule_load (rule_t *self, const char *path)
 }
 
 //  --------------------------------------------------------------------------
-// Update new_rule with configured actions of old_rule
+// Update new_rule with configured actions of old_rule. Actions are copied,
+// old_rule stays untouched as it can still be used by held rulesets.
 void rule_merge (rule_t *old_rule, rule_t *new_rule)
 {
     zhash_destroy (&new_rule->result_actions);
-    // XXX: We invalidate the old rule here, because we know it's going to
-    // be destroyed. The proper fix is to use zhashx and duplicate the hash.
-    new_rule->result_actions = old_rule->result_actions;
-    old_rule->result_actions = NULL;
+    new_rule->result_actions = zhash_new ();
+    zlist_t *list = (zlist_t *) zhash_first (old_rule->result_actions);
+    while (list) {
+        const char *result = zhash_cursor (old_rule->result_actions);
+        zlist_t *copy = zlist_dup (list);
+        zlist_autofree (copy);
+        zhash_insert (new_rule->result_actions, result, copy);
+        zhash_freefn (new_rule->result_actions, result, free_action);
+        list = (zlist_t *) zhash_next (old_rule->result_actions);
+    }
 }
 
 //  --------------------------------------------------------------------------
@@ -500,155 +913,755 @@ int rule_save (rule_t *self, const char *path)
     return 0;
 }
 
+//  --------------------------------------------------------------------------
+//  Template placeholder (__name__) at the beginning of string. Returns its
+//  length or 0.
+
+static size_t
+s_placeholder (const char *string)
+{
+    if (string [0] != '_' || string [1] != '_' || !isalpha ((unsigned char) string [2]))
+        return 0;
+    for (const char *p = string + 2; isalnum ((unsigned char) *p) || *p == '_'; p++)
+        if (p [0] == '_' && p [1] == '_')
+            return p + 2 - string;
+    return 0;
+}
+
+static bool
+s_is_identifier_char (char c)
+{
+    return isalnum ((unsigned char) c) || c == '_';
+}
+
+//  --------------------------------------------------------------------------
+//  Append to growing buffer
+
+static void
+s_buffer_append (char **buffer, size_t *size, size_t *capacity, const char *data, size_t length)
+{
+    if (*size + length + 1 > *capacity) {
+        while (*size + length + 1 > *capacity)
+            *capacity = *capacity ? *capacity * 2 : 256;
+        *buffer = (char *) realloc (*buffer, *capacity);
+        assert (*buffer);
+    }
+    memcpy (*buffer + *size, data, length);
+    *size += length;
+    (*buffer) [*size] = 0;
+}
+
+//  --------------------------------------------------------------------------
+//  Replace all placeholders in string by their values. Caller is
+//  responsible for destroying the return value.
+
+static char *
+s_substitute (const char *string, zhashx_t *substitutions)
+{
+    if (!string)
+        return NULL;
+    char *result = NULL;
+    size_t size = 0, capacity = 0;
+    s_buffer_append (&result, &size, &capacity, "", 0);
+    const char *p = string;
+    while (*p) {
+        size_t length = s_placeholder (p);
+        const char *value = NULL;
+        if (length) {
+            char *placeholder = strndup (p, length);
+            value = (const char *) zhashx_lookup (substitutions, placeholder);
+            zstr_free (&placeholder);
+        }
+        if (value) {
+            s_buffer_append (&result, &size, &capacity, value, strlen (value));
+            p += length;
+        }
+        else {
+            s_buffer_append (&result, &size, &capacity, p, 1);
+            p++;
+        }
+    }
+    return result;
+}
+
+//  --------------------------------------------------------------------------
+//  Copy list of strings with placeholders substituted
+
+static void
+s_substitute_list (zlist_t *target, zlist_t *source, zhashx_t *substitutions)
+{
+    const char *item = (const char *) zlist_first (source);
+    while (item) {
+        char *value = s_substitute (item, substitutions);
+        zlist_append (target, value);
+        zstr_free (&value);
+        item = (const char *) zlist_next (source);
+    }
+}
+
+//  --------------------------------------------------------------------------
+//  Prepare template evaluation for sharing among instances. Placeholders
+//  inside lua strings are replaced by lookups to __substitutions table,
+//
+//      'of __ename__ is'  ->  'of ' .. __substitutions["__ename__"] .. ' is'
+//
+//  placeholders used as lua code (return __severity__, ...) stay as global
+//  variables set before each evaluation.
+
+static void
+s_template_prepare (rule_t *self)
+{
+    if (self->template_source || !self->evaluation)
+        return;
+
+    self->placeholders = zlist_new ();
+    zlist_autofree (self->placeholders);
+    zlist_comparefn (self->placeholders, string_comparefn);
+    self->bare_placeholders = zlist_new ();
+    zlist_autofree (self->bare_placeholders);
+    zlist_comparefn (self->bare_placeholders, string_comparefn);
+
+    enum { CODE, QUOTED, LONG_STRING, COMMENT } state = CODE;
+    char quote = 0;
+    char *source = NULL;
+    size_t size = 0, capacity = 0;
+    const char *evaluation = self->evaluation;
+    const char *p = evaluation;
+    while (*p) {
+        size_t length = 0;
+        switch (state) {
+        case CODE:
+            if (p [0] == '-' && p [1] == '-') {
+                state = COMMENT;
+                length = 2;
+            }
+            else if (*p == '\'' || *p == '"') {
+                state = QUOTED;
+                quote = *p;
+                length = 1;
+            }
+            else if (p [0] == '[' && p [1] == '[') {
+                state = LONG_STRING;
+                length = 2;
+            }
+            else if ((p == evaluation || !s_is_identifier_char (p [-1]))
+                 && (length = s_placeholder (p)) && !s_is_identifier_char (p [length])) {
+                char *placeholder = strndup (p, length);
+                if (!zlist_exists (self->bare_placeholders, placeholder))
+                    zlist_append (self->bare_placeholders, placeholder);
+                zstr_free (&placeholder);
+            }
+            else
+                length = 1;
+            break;
+        case QUOTED:
+        case LONG_STRING:
+            if (state == QUOTED && *p == '\\' && p [1])
+                length = 2;
+            else if ((state == QUOTED && *p == quote) || (state == LONG_STRING && p [0] == ']' && p [1] == ']')) {
+                length = state == QUOTED ? 1 : 2;
+                state = CODE;
+            }
+            else if ((length = s_placeholder (p))) {
+                char *placeholder = strndup (p, length);
+                if (!zlist_exists (self->placeholders, placeholder))
+                    zlist_append (self->placeholders, placeholder);
+                char *lookup = state == QUOTED
+                    ? zsys_sprintf ("%c .. __substitutions[\"%s\"] .. %c", quote, placeholder, quote)
+                    : zsys_sprintf ("]] .. __substitutions[\"%s\"] .. [[", placeholder);
+                s_buffer_append (&source, &size, &capacity, lookup, strlen (lookup));
+                zstr_free (&lookup);
+                zstr_free (&placeholder);
+                p += length;
+                continue;
+            }
+            else
+                length = 1;
+            break;
+        case COMMENT:
+            if (*p == '\n')
+                state = CODE;
+            length = 1;
+            break;
+        }
+        s_buffer_append (&source, &size, &capacity, p, length);
+        p += length;
+    }
+    self->template_source = source ? source : strdup ("");
+    log_debug ("template %s: %zu placeholders in strings, %zu in code",
+        self->name, zlist_size (self->placeholders), zlist_size (self->bare_placeholders));
+}
+
+//  --------------------------------------------------------------------------
+//  Make rule an instance of template rule. Attributes which instance does
+//  not specify are taken from template with placeholders substituted,
+//  evaluation is shared with template. Returns 0 on success.
+
+int
+rule_instantiate (rule_t *self, rule_t *tmpl)
+{
+    assert (self);
+    assert (tmpl);
+    if (!self->template_name || !tmpl->evaluation || !tmpl->name) {
+        log_error ("rule %s can't be instance of template %s", self->name, tmpl->name);
+        return -1;
+    }
+    s_template_prepare (tmpl);
+
+    zhashx_t *substitutions = self->substitutions;
+    if (!self->name)
+        self->name = s_substitute (tmpl->name, substitutions);
+    if (!self->description)
+        self->description = s_substitute (tmpl->description, substitutions);
+    if (!self->logical_asset)
+        self->logical_asset = s_substitute (tmpl->logical_asset, substitutions);
+    if (zlist_size (self->metrics) == 0)
+        s_substitute_list (self->metrics, tmpl->metrics, substitutions);
+    if (zlist_size (self->assets) == 0)
+        s_substitute_list (self->assets, tmpl->assets, substitutions);
+    if (zlist_size (self->groups) == 0)
+        s_substitute_list (self->groups, tmpl->groups, substitutions);
+    if (zlist_size (self->models) == 0)
+        s_substitute_list (self->models, tmpl->models, substitutions);
+    if (zlist_size (self->types) == 0)
+        s_substitute_list (self->types, tmpl->types, substitutions);
+    if (zhash_size (self->result_actions) == 0) {
+        zlist_t *actions = (zlist_t *) zhash_first (tmpl->result_actions);
+        while (actions) {
+            char *result = s_substitute (zhash_cursor (tmpl->result_actions), substitutions);
+            rule_add_result_action (self, result, NULL);
+            zlist_t *list = (zlist_t *) zhash_lookup (self->result_actions, result);
+            s_substitute_list (list, actions, substitutions);
+            zstr_free (&result);
+            actions = (zlist_t *) zhash_next (tmpl->result_actions);
+        }
+    }
+    rule_destroy (&self->tmpl);
+    self->tmpl = rule_ref (tmpl);
+
+    rule_expression_destroy (&self->expression);
+#if defined (RULE_EXPRESSION_ENGINE)
+    if (tmpl->engine && streq (tmpl->engine, "expression")) {
+        //  bytecode is small, every instance has its own with placeholders substituted
+        zhashx_t *variables = zhashx_new ();
+        zhashx_t *sources [] = { tmpl->variables, self->variables };
+        for (int i = 0; i < 2; i++) {
+            void *item = zhashx_first (sources [i]);
+            while (item) {
+                zhashx_update (variables, zhashx_cursor (sources [i]), item);
+                item = zhashx_next (sources [i]);
+            }
+        }
+        char *evaluation = s_substitute (tmpl->evaluation, self->substitutions);
+        self->expression = rule_expression_new (evaluation, variables, tmpl->typed);
+        zstr_free (&evaluation);
+        zhashx_destroy (&variables);
+        if (!self->expression) {
+            log_error ("rule %s: evaluation of template %s can't be compiled by expression engine", self->name, tmpl->name);
+            return -1;
+        }
+    }
+#endif
+    return 0;
+}
+
+//  --------------------------------------------------------------------------
+//  Get name of template, NULL if rule is not template instance
+
+const char *
+rule_template (rule_t *self)
+{
+    assert (self);
+    return self->template_name;
+}
+
+//  --------------------------------------------------------------------------
+//  Push metric value or variable: number for typed rule, if it is a number,
+//  otherwise string. Integers are pushed as integers where lua has them, so
+//  all lua versions format them the same. Cached is the value converted
+//  when metric came (NAN if not a number), NULL to convert it here.
+
+static void
+s_push_value (lua_State *lua, const char *value, const double *cached, bool typed)
+{
+    double number = cached ? *cached : NAN;
+    if (typed && !cached && !rule_threshold_number (value, &number))
+        number = NAN;
+    if (!typed || isnan (number)) {
+        lua_pushstring (lua, value);
+        return;
+    }
+#if LUA_VERSION_NUM >= 503
+    if (fabs (number) < 1e14 && number == (double) (long long) number) {
+        lua_pushinteger (lua, (lua_Integer) number);
+        return;
+    }
+#endif
+    lua_pushnumber (lua, number);
+}
+
+//  --------------------------------------------------------------------------
+//  Push value of placeholder used as lua code: number, name of lua variable
+//  (e.g. CRITICAL) from environment on index 1 or string.
+
+static void
+s_push_code_value (lua_State *lua, const char *value)
+{
+    if (!value) {
+        lua_pushnil (lua);
+        return;
+    }
+    char *end = NULL;
+    double number = strtod (value, &end);
+    if (*value && end && *end == 0) {
+        lua_pushnumber (lua, number);
+        return;
+    }
+    lua_getfield (lua, 1, value);
+    if (lua_isnil (lua, -1)) {
+        lua_pop (lua, 1);
+        lua_pushstring (lua, value);
+    }
+}
+
+//  --------------------------------------------------------------------------
+//  Set variables of instance in template environment on index 1, called
+//  with chunk locked
+
+static void
+s_set_instance (lua_State *lua, rule_t *tmpl, rule_t *instance)
+{
+    lua_getfield (lua, 1, "__substitutions");
+    const char *placeholder = (const char *) zlist_first (tmpl->placeholders);
+    while (placeholder) {
+        const char *value = (const char *) zhashx_lookup (instance->substitutions, placeholder);
+        lua_pushstring (lua, value ? value : placeholder);
+        lua_setfield (lua, -2, placeholder);
+        placeholder = (const char *) zlist_next (tmpl->placeholders);
+    }
+    lua_pop (lua, 1);
+    placeholder = (const char *) zlist_first (tmpl->bare_placeholders);
+    while (placeholder) {
+        s_push_code_value (lua, (const char *) zhashx_lookup (instance->substitutions, placeholder));
+        lua_setfield (lua, 1, placeholder);
+        placeholder = (const char *) zlist_next (tmpl->bare_placeholders);
+    }
+    //  instance variables override template ones
+    if (zhashx_size (instance->variables) || zhashx_size (tmpl->variables)) {
+        zhashx_t *sources [] = { tmpl->variables, instance->variables };
+        for (int i = 0; i < 2; i++) {
+            const char *item = (const char *) zhashx_first (sources [i]);
+            while (item) {
+                s_push_value (lua, item, NULL, tmpl->typed);
+                lua_setfield (lua, 1, (const char *) zhashx_cursor (sources [i]));
+                item = (const char *) zhashx_next (sources [i]);
+            }
+        }
+    }
+}
+
 // ZZZ return 1 if ok, else 0
+//  Rules with the same evaluation share compiled chunk, every rule has its
+//  own environment with variables.
 static int rule_compile (rule_t *self)
 {
     if (!self) return 0;
-    // destroy old context
-    if (self -> lua) {
-        lua_close (self->lua);
-        self->lua = NULL;
-    }
-    // compile
-#if LUA_VERSION_NUM > 501
-    self -> lua = luaL_newstate();
-#else
-    self -> lua = lua_open();
-#endif
-    if (!self->lua) return 0;
-    luaL_openlibs(self -> lua); // get functions like print();
-    if (luaL_dostring (self -> lua, self -> evaluation) != 0) {
+    // release old context
+    if (self -> chunk) {
+        rule_chunk_environment_destroy (self->chunk, &self->environment);
+        rule_chunk_destroy (&self->chunk);
+    }
+    const char *source = self->template_source ? self->template_source : self->evaluation;
+    if (!source) return 0;
+    // compile or find already compiled
+    self -> chunk = rule_chunk_intern (source);
+    if (!self -> chunk) {
         log_error ("rule '%s' has an error", self -> name);
         log_debug ("ERROR, rule '%s' evaluation part\n%s", self -> name, self -> evaluation);
-        lua_close (self -> lua);
-        self -> lua = NULL;
         return 0;
     }
-    lua_getglobal (self -> lua, "main");
-    if (!lua_isfunction (self -> lua, -1)) {
+    self -> environment = rule_chunk_environment_new (self->chunk);
+    if (self -> environment == LUA_NOREF) {
         log_error ("main function not found in rule %s", self -> name);
-        lua_close (self->lua);
-        self -> lua = NULL;
+        rule_chunk_destroy (&self->chunk);
         return 0;
     }
-    lua_pushnumber(self -> lua, 0);
-    lua_setglobal(self -> lua, "OK");
-    lua_pushnumber(self -> lua, 1);
-    lua_setglobal(self -> lua, "WARNING");
-    lua_pushnumber(self -> lua, 1);
-    lua_setglobal(self -> lua, "HIGH_WARNING");
-    lua_pushnumber(self -> lua, 2);
-    lua_setglobal(self -> lua, "CRITICAL");
-    lua_pushnumber(self -> lua, 2);
-    lua_setglobal(self -> lua, "HIGH_CRITICAL");
-    lua_pushnumber(self -> lua, -1);
-    lua_setglobal(self -> lua, "LOW_WARNING");
-    lua_pushnumber(self -> lua, -2);
-    lua_setglobal(self -> lua, "LOW_CRITICAL");
 
+    lua_State *lua = rule_chunk_lock (self->chunk);
+    lua_rawgeti (lua, LUA_REGISTRYINDEX, self->environment);
     //  set global variables
     const char *item = (const char *) zhashx_first (self->variables);
     while (item) {
         const char *key = (const char *) zhashx_cursor (self->variables);
-        lua_pushstring (self->lua, item);
-        lua_setglobal (self->lua, key);
+        s_push_value (lua, item, NULL, self->typed);
+        lua_setfield (lua, -2, key);
         item = (const char *) zhashx_next (self->variables);
     }
 
+    //  template: unset placeholders keep their names, like in unexpanded text
+    if (self->placeholders) {
+        lua_newtable (lua);
+        const char *placeholder = (const char *) zlist_first (self->placeholders);
+        while (placeholder) {
+            lua_pushstring (lua, placeholder);
+            lua_setfield (lua, -2, placeholder);
+            placeholder = (const char *) zlist_next (self->placeholders);
+        }
+        lua_setfield (lua, -2, "__substitutions");
+    }
+    lua_pop (lua, 1);
+    rule_chunk_unlock (self->chunk);
+
     return 1;
 }
 
 //  --------------------------------------------------------------------------
-//  Evaluate rule
+//  Evaluate rule. For template instance, self is the template.
 
-void
-rule_evaluate (rule_t *self, zlist_t *params, const char *iname, const char *ename, int *result, char **message)
+static void
+s_rule_evaluate (rule_t *self, rule_t *instance, zlist_t *params, const double *numbers,
+    const char *iname, const char *ename, int *result, char **message)
 {
-    if (result) *result = RULE_ERROR;
-    if (message) *message = NULL;
-
-    if (!self || !params || !iname || !result || !message) {
-        log_error("bad args");
-        return;
-    }
-
-    log_trace("rule_evaluate %s", rule_name(self));
-
-    if (!self -> lua) {
+    if (!self -> chunk) {
+        if (self->broken)
+            return;
         if (! rule_compile (self)) {
-            log_error("rule_compile %s failed", rule_name(self));
+            //  not retried until the rule changes
+            log_error("rule_compile %s failed, rule won't be evaluated", rule_name(self));
+            self->broken = true;
             return;
         }
     }
 
-    lua_pushstring(self -> lua, ename ? ename : iname);
-    lua_setglobal(self -> lua, "NAME");
-    lua_pushstring(self -> lua, iname);
-    lua_setglobal(self -> lua, "INAME");
-    lua_settop (self->lua, 0);
-    lua_getglobal (self->lua, "main");
+    lua_State *lua = rule_chunk_lock (self->chunk);
+    lua_settop (lua, 0);
+    lua_rawgeti (lua, LUA_REGISTRYINDEX, self->environment);
+    if (instance)
+        s_set_instance (lua, self, instance);
+    lua_pushstring(lua, ename ? ename : iname);
+    lua_setfield(lua, 1, "NAME");
+    lua_pushstring(lua, iname);
+    lua_setfield(lua, 1, "INAME");
+    lua_getfield (lua, 1, "main");
 
     char *value = (char *) zlist_first (params);
     int i = 0;
     while (value) {
         log_trace("rule_evaluate: push param #%d: %s", i, value);
-        lua_pushstring (self -> lua, value);
+        s_push_value (lua, value, numbers ? &numbers [i] : NULL, self->typed);
         value = (char *) zlist_next (params);
         i++;
     }
 
-    int r = lua_pcall(self -> lua, zlist_size (params), 2, 0);
+    int r = rule_chunk_pcall (self->chunk, zlist_size (params), 2);
 
     if (r == 0) {
         // calculated
-        if (lua_isnumber (self -> lua, -1)) {
-            *result = lua_tointeger(self -> lua, -1);
-            const char *msg = lua_tostring (self->lua, -2);
+        if (lua_isnumber (lua, -1)) {
+            *result = lua_tointeger(lua, -1);
+            const char *msg = lua_tostring (lua, -2);
             if (msg) *message = strdup (msg);
         }
-        else if (lua_isnumber (self -> lua, -2)) {
-            *result = lua_tointeger(self -> lua, -2);
-            const char *msg = lua_tostring (self->lua, -1);
+        else if (lua_isnumber (lua, -2)) {
+            *result = lua_tointeger(lua, -2);
+            const char *msg = lua_tostring (lua, -1);
             if (msg) *message = strdup (msg);
         }
         else {
             log_error("rule_evaluate: invalid content of self->lua.");
         }
-
-        lua_pop (self->lua, 2);
+    }
+    else if (r == RULE_CHUNK_INSTRUCTIONS_EXCEEDED || r == RULE_CHUNK_MEMORY_EXCEEDED) {
+        log_error("rule_evaluate: %s aborted, %s limit exceeded", rule_name(instance ? instance : self),
+            r == RULE_CHUNK_INSTRUCTIONS_EXCEEDED ? "instruction" : "memory");
+        *result = RULE_ABORTED;
     }
     else {
         log_error("rule_evaluate: lua_pcall %s failed (r: %d)", rule_name(self), r);
     }
+    lua_settop (lua, 0);
+    rule_chunk_unlock (self->chunk);
 }
 
 //  --------------------------------------------------------------------------
-//  Create json from rule
+//  Count result of lua evaluation, repeated failures put rule to quarantine
+//  with exponential backoff.
 
-static char * s_string_append (char **string_p, size_t *capacity, const char *append)
+static void
+s_rule_account (rule_t *self, int *result)
 {
-    if (! string_p) return NULL;
-    if (! capacity) return NULL;
-    if (! append) return *string_p;
+    if (*result != RULE_ERROR && *result != RULE_ABORTED) {
+        if (self->failures) {
+            if (self->quarantine)
+                log_info ("rule %s evaluated again after quarantine", rule_name (self));
+            self->failures = 0;
+            self->quarantine_until = 0;
+            self->quarantine = 0;
+        }
+        return;
+    }
+    int failures = self->failures + 1;
+    self->failures = failures;
+    int limit = __atomic_load_n (&s_quarantine_failures, __ATOMIC_RELAXED);
+    if (limit == 0 || failures < limit)
+        return;
+    //  first quarantine after few failures, then after every failed probe
+    self->quarantine = self->quarantine ? self->quarantine * 2 : QUARANTINE_MIN;
+    if (self->quarantine > QUARANTINE_MAX)
+        self->quarantine = QUARANTINE_MAX;
+    self->quarantine_until = zclock_mono () + self->quarantine;
+    log_warning ("rule %s failed %d times, quarantined for %d s", rule_name (self), failures,
+        (int) (self->quarantine / 1000));
+}
 
-    char *string = *string_p;
-    if (!string) {
-        string = (char *) zmalloc (512);
-        *capacity = 512;
+//  --------------------------------------------------------------------------
+//  Inputs of lua evaluation: NAME and values, each zero terminated, and
+//  their FNV-1a hash. Caller frees the inputs.
+
+static char *
+s_memo_inputs (zlist_t *params, const char *name, size_t *size_p, uint64_t *hash_p)
+{
+    size_t size = strlen (name) + 1;
+    for (char *value = (char *) zlist_first (params); value; value = (char *) zlist_next (params))
+        size += strlen (value) + 1;
+    char *inputs = (char *) malloc (size);
+    assert (inputs);
+    char *p = inputs;
+    size_t length = strlen (name) + 1;
+    memcpy (p, name, length);
+    p += length;
+    for (char *value = (char *) zlist_first (params); value; value = (char *) zlist_next (params)) {
+        length = strlen (value) + 1;
+        memcpy (p, value, length);
+        p += length;
     }
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < size; i++)
+        hash = (hash ^ (unsigned char) inputs [i]) * 1099511628211ULL;
+    *size_p = size;
+    *hash_p = hash;
+    return inputs;
+}
 
-    size_t l1 = strlen (string);
-    size_t l2 = strlen (append);
-    size_t required = l1+l2+1;
-    if (*capacity < required) {
-        size_t newcapacity = *capacity;
-        while (newcapacity < required) {
-            newcapacity += 512;
-        }
-        char *tmp = (char *) realloc (string, newcapacity);
-        if (!tmp) {
-            free (string);
-            *capacity = 0;
+//  --------------------------------------------------------------------------
+//  Evaluate lua code of rule, or reuse result of last evaluation for asset
+//  if inputs didn't change. Memo belongs to instance for template instance.
+
+static void
+s_rule_evaluate_memo (rule_t *self, rule_t *instance, zlist_t *params, const double *numbers,
+    const char *iname, const char *ename, int *result, char **message)
+{
+    rule_t *owner = instance ? instance : self;
+    if (!self->pure || owner->impure) {
+        s_rule_evaluate (self, instance, params, numbers, iname, ename, result, message);
+        return;
+    }
+    size_t size;
+    uint64_t hash;
+    char *inputs = s_memo_inputs (params, ename ? ename : iname, &size, &hash);
+    memo_t *memo = owner->memo ? (memo_t *) zhashx_lookup (owner->memo, iname) : NULL;
+    if (memo && memo->hash == hash && memo->size == size && memcmp (memo->inputs, inputs, size) == 0) {
+        __atomic_add_fetch (&s_memo_hits, 1, __ATOMIC_RELAXED);
+        *result = memo->result;
+        *message = memo->message ? strdup (memo->message) : NULL;
+        free (inputs);
+        return;
+    }
+    __atomic_add_fetch (&s_memo_misses, 1, __ATOMIC_RELAXED);
+    s_rule_evaluate (self, instance, params, numbers, iname, ename, result, message);
+    if (*result == RULE_ERROR || *result == RULE_ABORTED) {
+        free (inputs);
+        return;
+    }
+    if (!owner->memo) {
+        owner->memo = zhashx_new ();
+        zhashx_set_destructor (owner->memo, (zhashx_destructor_fn *) s_memo_destroy);
+    }
+    else
+    if (zhashx_size (owner->memo) >= MEMO_MAX && !memo)
+        zhashx_purge (owner->memo);
+    memo = (memo_t *) zmalloc (sizeof (memo_t));
+    assert (memo);
+    memo->hash = hash;
+    memo->size = size;
+    memo->inputs = inputs;
+    memo->result = *result;
+    memo->message = *message ? strdup (*message) : NULL;
+    zhashx_update (owner->memo, iname, memo);
+}
+
+//  --------------------------------------------------------------------------
+//  Evaluate rule. Numbers are params converted by rule_threshold_number
+//  when metrics came (NAN if not a number), NULL to convert them here. Lua
+//  state of the rule can be shared with rules of other agent instances in
+//  the process, it is used by one of them at a time.
+
+void
+rule_evaluate (rule_t *self, zlist_t *params, const double *numbers, const char *iname, const char *ename, int *result, char **message)
+{
+    if (result) *result = RULE_ERROR;
+    if (message) *message = NULL;
+
+    if (!self || !params || !iname || !result || !message) {
+        log_error("bad args");
+        return;
+    }
+
+    log_trace("rule_evaluate %s", rule_name(self));
+
+    if (rule_quarantined (self)) {
+        *result = RULE_QUARANTINED;
+        return;
+    }
+
+    if (self->expression
+    &&  rule_expression_evaluate (self->expression, params, numbers, iname, ename, result, message) == 0)
+        return;
+
+    if (self->tmpl) {
+        //  template instance, use compiled code of template
+        rule_t *tmpl = self->tmpl;
+        s_rule_evaluate_memo (tmpl, self, params, numbers, iname, ename, result, message);
+        s_rule_account (self, result);
+        return;
+    }
+
+    if (self->threshold
+    &&  rule_threshold_evaluate (self->threshold, params, numbers, self->variables, iname, ename, result, message) == 0)
+        return;
+
+    s_rule_evaluate_memo (self, NULL, params, numbers, iname, ename, result, message);
+    s_rule_account (self, result);
+}
+
+//  --------------------------------------------------------------------------
+//  Set number of consecutive failed evaluations which put rule to quarantine,
+//  zero disables quarantine. Rules failing to compile are never retried.
+
+void
+rule_set_quarantine (int failures)
+{
+    __atomic_store_n (&s_quarantine_failures, failures > 0 ? failures : 0, __ATOMIC_RELAXED);
+}
+
+//  --------------------------------------------------------------------------
+//  Get minimal time between evaluations of rule for one asset in ms, -1 if
+//  rule doesn't set it. Template instance inherits it from template.
+
+int
+rule_min_interval (rule_t *self)
+{
+    assert (self);
+    if (self->min_interval < 0 && self->tmpl)
+        return self->tmpl->min_interval;
+    return self->min_interval;
+}
+
+//  --------------------------------------------------------------------------
+//  Get number of lua evaluations answered from memo (hits) and evaluated
+//  (misses). Rules with impure code are not counted.
+
+void
+rule_memo_stats (uint64_t *hits, uint64_t *misses)
+{
+    if (hits)
+        *hits = __atomic_load_n (&s_memo_hits, __ATOMIC_RELAXED);
+    if (misses)
+        *misses = __atomic_load_n (&s_memo_misses, __ATOMIC_RELAXED);
+}
+
+//  --------------------------------------------------------------------------
+//  Return true if rule is broken or in quarantine, evaluation would return
+//  RULE_QUARANTINED.
+
+bool
+rule_quarantined (rule_t *self)
+{
+    assert (self);
+    rule_t *owner = self->tmpl ? self->tmpl : self;
+    if (owner->broken)
+        return true;
+    int64_t until = self->quarantine_until;
+    return until && zclock_mono () < until;
+}
+
+//  --------------------------------------------------------------------------
+//  State of rule evaluation: "OK", "BROKEN" (evaluation doesn't compile),
+//  "FAILING" (last evaluations failed) or "QUARANTINED" (not evaluated for
+//  quarantine_ms). Failures and quarantine_ms can be NULL.
+
+const char *
+rule_health (rule_t *self, int *failures, int64_t *quarantine_ms)
+{
+    assert (self);
+    rule_t *owner = self->tmpl ? self->tmpl : self;
+    int count = self->failures;
+    int64_t until = self->quarantine_until;
+    int64_t remaining = until ? until - zclock_mono () : 0;
+    if (failures)
+        *failures = count;
+    if (quarantine_ms)
+        *quarantine_ms = remaining > 0 ? remaining : 0;
+    if (owner->broken)
+        return "BROKEN";
+    if (remaining > 0)
+        return "QUARANTINED";
+    return count ? "FAILING" : "OK";
+}
+
+//  --------------------------------------------------------------------------
+//  Bytes in use by lua state of rule (shared by rules with the same
+//  evaluation), 0 if rule has no lua state
+
+size_t
+rule_lua_memory (rule_t *self)
+{
+    assert (self);
+    rule_t *owner = self->tmpl ? self->tmpl : self;
+    return owner->chunk ? rule_chunk_memory (owner->chunk) : 0;
+}
+
+//  --------------------------------------------------------------------------
+//  Classify numeric metric values of many assets by single metric rule at
+//  once, results are the same rule_evaluate would give. Returns 0 on
+//  success, -1 if rule can't be classified this way.
+
+int
+rule_classify (rule_t *self, const double *values, size_t count, int *results)
+{
+    assert (self);
+    if (!self->threshold || self->expression || self->tmpl || zlist_size (self->metrics) != 1)
+        return -1;
+    return rule_threshold_classify (self->threshold, values, count, self->variables, results);
+}
+
+//  --------------------------------------------------------------------------
+//  Create json from rule
+
+static char * s_string_append (char **string_p, size_t *capacity, const char *append)
+{
+    if (! string_p) return NULL;
+    if (! capacity) return NULL;
+    if (! append) return *string_p;
+
+    char *string = *string_p;
+    if (!string) {
+        string = (char *) zmalloc (512);
+        *capacity = 512;
+    }
+
+    size_t l1 = strlen (string);
+    size_t l2 = strlen (append);
+    size_t required = l1+l2+1;
+    if (*capacity < required) {
+        size_t newcapacity = *capacity;
+        while (newcapacity < required) {
+            newcapacity += 512;
+        }
+        char *tmp = (char *) realloc (string, newcapacity);
+        if (!tmp) {
+            free (string);
+            *capacity = 0;
             return NULL;
         }
         string = tmp;
@@ -735,13 +1748,71 @@ static char * s_actions_to_json_array (zlist_t *actions)
 }
 
 //  --------------------------------------------------------------------------
-//  Convert rule back to json
+//  Append results and variables of rule to json
+
+static void
+s_results_variables_json (rule_t *self, char **json_p, size_t *jsonsize_p)
+{
+    char *json = *json_p;
+    size_t jsonsize = *jsonsize_p;
+    {
+        //results
+        s_string_append (&json, &jsonsize, "\"results\": {\n");
+        const void *result = zhash_first (self->result_actions);
+        bool first = true;
+        while (result) {
+            if (first) {
+                first = false;
+            } else {
+                s_string_append (&json, &jsonsize, ",\n");
+            }
+            char *key = vsjson_encode_string (zhash_cursor (self->result_actions));
+            char *tmp = s_actions_to_json_array ((zlist_t *)result);
+            s_string_append (&json, &jsonsize, key);
+            s_string_append (&json, &jsonsize, ": {\"action\": ");
+            s_string_append (&json, &jsonsize, tmp);
+            s_string_append (&json, &jsonsize, "}");
+            zstr_free (&tmp);
+            zstr_free (&key);
+            result = zhash_next (self->result_actions);
+        }
+        s_string_append (&json, &jsonsize, "},\n");
+    }
+    {
+        //variables
+        if (zhashx_size (self->variables)) {
+            s_string_append (&json, &jsonsize, "\"variables\": {\n");
+            char *item = (char *)zhashx_first (self->variables);
+            bool first = true;
+            while (item) {
+                if (first) {
+                    first = false;
+                } else {
+                    s_string_append (&json, &jsonsize, ",\n");
+                }
+                char *key = vsjson_encode_string((char *)zhashx_cursor (self->variables));
+                char *value = vsjson_encode_string (item);
+                s_string_append (&json, &jsonsize, key);
+                s_string_append (&json, &jsonsize, ":");
+                s_string_append (&json, &jsonsize, value);
+                zstr_free (&key);
+                zstr_free (&value);
+                item = (char *) zhashx_next (self->variables);
+            }
+            s_string_append (&json, &jsonsize, "},\n");
+        }
+    }
+    *json_p = json;
+    *jsonsize_p = jsonsize;
+}
+
+//  --------------------------------------------------------------------------
+//  Convert rule back to json, with given evaluation
 //  Caller is responsible for destroying the return value
 
-char *
-rule_json (rule_t *self)
+static char *
+s_rule_json (rule_t *self, const char *evaluation)
 {
-    if (!self) return NULL;
 
     char *json = NULL;
     size_t jsonsize = 0;
@@ -799,56 +1870,33 @@ rule_json (rule_t *self)
         s_string_append (&json, &jsonsize, ",\n");
         zstr_free (&tmp);
     }
-    {
-        //results
-        s_string_append (&json, &jsonsize, "\"results\": {\n");
-        const void *result = zhash_first (self->result_actions);
-        bool first = true;
-        while (result) {
-            if (first) {
-                first = false;
-            } else {
-                s_string_append (&json, &jsonsize, ",\n");
-            }
-            char *key = vsjson_encode_string (zhash_cursor (self->result_actions));
-            char *tmp = s_actions_to_json_array ((zlist_t *)result);
-            s_string_append (&json, &jsonsize, key);
-            s_string_append (&json, &jsonsize, ": {\"action\": ");
-            s_string_append (&json, &jsonsize, tmp);
-            s_string_append (&json, &jsonsize, "}");
-            zstr_free (&tmp);
-            zstr_free (&key);
-            result = zhash_next (self->result_actions);
-        }
-        s_string_append (&json, &jsonsize, "},\n");
+    s_results_variables_json (self, &json, &jsonsize);
+    if (self->engine) {
+        char *engine = vsjson_encode_string (self->engine);
+        s_string_append (&json, &jsonsize, "\"engine\":");
+        s_string_append (&json, &jsonsize, engine);
+        s_string_append (&json, &jsonsize, ",\n");
+        zstr_free (&engine);
     }
-    {
-        //variables
-        if (zhashx_size (self->variables)) {
-            s_string_append (&json, &jsonsize, "\"variables\": {\n");
-            char *item = (char *)zhashx_first (self->variables);
-            bool first = true;
-            while (item) {
-                if (first) {
-                    first = false;
-                } else {
-                    s_string_append (&json, &jsonsize, ",\n");
-                }
-                char *key = vsjson_encode_string((char *)zhashx_cursor (self->variables));
-                char *value = vsjson_encode_string (item);
-                s_string_append (&json, &jsonsize, key);
-                s_string_append (&json, &jsonsize, ":");
-                s_string_append (&json, &jsonsize, value);
-                zstr_free (&key);
-                zstr_free (&value);
-                item = (char *) zhashx_next (self->variables);
-            }
-            s_string_append (&json, &jsonsize, "},\n");
-        }
+    if (self->values) {
+        char *values = vsjson_encode_string (self->values);
+        s_string_append (&json, &jsonsize, "\"values\":");
+        s_string_append (&json, &jsonsize, values);
+        s_string_append (&json, &jsonsize, ",\n");
+        zstr_free (&values);
+    }
+    if (self->impure)
+        s_string_append (&json, &jsonsize, "\"pure\":false,\n");
+    if (self->declared_pure)
+        s_string_append (&json, &jsonsize, "\"pure\":true,\n");
+    if (rule_min_interval (self) >= 0) {
+        char *interval = zsys_sprintf ("\"min_interval\":%d,\n", rule_min_interval (self));
+        s_string_append (&json, &jsonsize, interval);
+        zstr_free (&interval);
     }
     {
         //json evaluation
-        char *eval = vsjson_encode_string (self->evaluation);
+        char *eval = vsjson_encode_string (evaluation);
         s_string_append (&json, &jsonsize, "\"evaluation\":");
         s_string_append (&json, &jsonsize, eval);
         s_string_append (&json, &jsonsize, "\n}\n");
@@ -858,7 +1906,83 @@ rule_json (rule_t *self)
 }
 
 //  --------------------------------------------------------------------------
-//  Destroy the rule
+//  Create json from rule. Template instance is stored in short form:
+//  name, template, substitutions and actions.
+
+char *
+rule_json (rule_t *self)
+{
+    if (!self) return NULL;
+    if (!self->template_name)
+        return s_rule_json (self, self->evaluation);
+
+    char *json = NULL;
+    size_t jsonsize = 0;
+    char *tmp = vsjson_encode_string (self->name);
+    s_string_append (&json, &jsonsize, "{\n\"name\":");
+    s_string_append (&json, &jsonsize, tmp);
+    zstr_free (&tmp);
+    tmp = vsjson_encode_string (self->template_name);
+    s_string_append (&json, &jsonsize, ",\n\"template\":");
+    s_string_append (&json, &jsonsize, tmp);
+    zstr_free (&tmp);
+    s_string_append (&json, &jsonsize, ",\n\"substitutions\": {");
+    const char *value = (const char *) zhashx_first (self->substitutions);
+    bool first = true;
+    while (value) {
+        char *key = vsjson_encode_string ((const char *) zhashx_cursor (self->substitutions));
+        tmp = vsjson_encode_string (value);
+        s_string_append (&json, &jsonsize, first ? "\n" : ",\n");
+        s_string_append (&json, &jsonsize, key);
+        s_string_append (&json, &jsonsize, ":");
+        s_string_append (&json, &jsonsize, tmp);
+        zstr_free (&key);
+        zstr_free (&tmp);
+        first = false;
+        value = (const char *) zhashx_next (self->substitutions);
+    }
+    s_string_append (&json, &jsonsize, "},\n");
+    if (self->min_interval >= 0) {
+        tmp = zsys_sprintf ("\"min_interval\":%d,\n", self->min_interval);
+        s_string_append (&json, &jsonsize, tmp);
+        zstr_free (&tmp);
+    }
+    s_results_variables_json (self, &json, &jsonsize);
+    //  drop trailing comma
+    json [strlen (json) - 2] = '\n';
+    json [strlen (json) - 1] = '}';
+    s_string_append (&json, &jsonsize, "\n");
+    return json;
+}
+
+//  --------------------------------------------------------------------------
+//  Create json from rule, template instance is expanded to full rule
+
+char *
+rule_json_expanded (rule_t *self)
+{
+    if (!self) return NULL;
+    if (!self->tmpl)
+        return rule_json (self);
+    char *evaluation = s_substitute (self->tmpl->evaluation, self->substitutions);
+    char *json = s_rule_json (self, evaluation);
+    zstr_free (&evaluation);
+    return json;
+}
+
+//  --------------------------------------------------------------------------
+//  Add reference to rule, returns the rule
+
+rule_t *
+rule_ref (rule_t *self)
+{
+    assert (self);
+    __atomic_add_fetch (&self->refs, 1, __ATOMIC_RELAXED);
+    return self;
+}
+
+//  --------------------------------------------------------------------------
+//  Destroy the rule. Rule is freed when the last reference is dropped.
 
 void
 rule_destroy (rule_t **self_p)
@@ -866,15 +1990,26 @@ rule_destroy (rule_t **self_p)
     assert (self_p);
     if (*self_p) {
         rule_t *self = *self_p;
+        if (__atomic_sub_fetch (&self->refs, 1, __ATOMIC_ACQ_REL) > 0) {
+            *self_p = NULL;
+            return;
+        }
         //  Free class properties here
         zstr_free (&self->name);
         zstr_free (&self->description);
         zstr_free (&self->logical_asset);
         zstr_free (&self->evaluation);
+        zstr_free (&self->engine);
+        zstr_free (&self->values);
+        rule_threshold_destroy (&self->threshold);
+        rule_expression_destroy (&self->expression);
         zstr_free (&self->parser.action);
         zstr_free (&self->parser.act_asset);
         zstr_free (&self->parser.act_mode);
-        if (self->lua) lua_close (self->lua);
+        if (self->chunk) {
+            rule_chunk_environment_destroy (self->chunk, &self->environment);
+            rule_chunk_destroy (&self->chunk);
+        }
         zlist_destroy (&self->metrics);
         zlist_destroy (&self->assets);
         zlist_destroy (&self->groups);
@@ -882,6 +2017,13 @@ rule_destroy (rule_t **self_p)
         zlist_destroy (&self->types);
         zhash_destroy (&self->result_actions);
         zhashx_destroy (&self->variables);
+        zstr_free (&self->template_name);
+        zhashx_destroy (&self->substitutions);
+        rule_destroy (&self->tmpl);
+        zstr_free (&self->template_source);
+        zlist_destroy (&self->placeholders);
+        zlist_destroy (&self->bare_placeholders);
+        zhashx_destroy (&self->memo);
         //  Free object itself
         free (self);
         *self_p = NULL;
@@ -995,6 +2137,81 @@ void rule_test_lua(const char *dir, const char *basename)
     assert(self == NULL);
 }
 
+//  Read whole file, caller is responsible for destroying the return value
+static char *
+s_test_read_file (const char *path)
+{
+    FILE *f = fopen (path, "r");
+    assert (f);
+    char *content = NULL;
+    size_t size = 0, capacity = 0;
+    char buffer [4096];
+    size_t r;
+    while ((r = fread (buffer, 1, sizeof (buffer), f)) > 0)
+        s_buffer_append (&content, &size, &capacity, buffer, r);
+    fclose (f);
+    return content;
+}
+
+//  Memory used by lua state of compiled rule
+static size_t
+s_test_lua_memory (rule_t *self)
+{
+    lua_State *lua = rule_chunk_lock (self->chunk);
+    size_t memory = lua_gc (lua, LUA_GCCOUNT, 0) * 1024;
+    rule_chunk_unlock (self->chunk);
+    return memory;
+}
+
+//  Evaluate two rules with one parameter, check they give the same result
+static void
+s_test_same_result (rule_t *expanded, rule_t *instance, const char *param, int expected)
+{
+    zlist_t *params = zlist_new ();
+    zlist_append (params, (void *) param);
+    int result1, result2;
+    char *message1 = NULL, *message2 = NULL;
+    rule_evaluate (expanded, params, NULL, "sensor-1", "Sensor 1", &result1, &message1);
+    rule_evaluate (instance, params, NULL, "sensor-1", "Sensor 1", &result2, &message2);
+    assert (result1 == expected);
+    assert (result1 == result2);
+    assert (message1 && message2);
+    if (!streq (message1, message2)) {
+        fprintf (stderr, "Template instance gives different message\nEXPECTED:\n%s\nGOT:\n%s\n", message1, message2);
+        assert (0);
+    }
+    zstr_free (&message1);
+    zstr_free (&message2);
+    zlist_destroy (&params);
+}
+
+#if defined (RULE_EXPRESSION_ENGINE)
+//  Evaluate params by expression engine and lua, check they give the same
+//  result and message. Returns true if expression engine evaluated them.
+static bool
+s_test_same_as_lua (rule_expression_t *expression, rule_t *lua, zlist_t *params, const char *what,
+    int64_t *native_time, int64_t *lua_time)
+{
+    int result1 = RULE_ERROR, result2 = RULE_ERROR;
+    char *message1 = NULL, *message2 = NULL;
+    int64_t start = zclock_usecs ();
+    int rc = rule_expression_evaluate (expression, params, NULL, "sensor-1", "Sensor 1", &result1, &message1);
+    *native_time += zclock_usecs () - start;
+    start = zclock_usecs ();
+    rule_evaluate (lua, params, NULL, "sensor-1", "Sensor 1", &result2, &message2);
+    *lua_time += zclock_usecs () - start;
+    if (rc == 0 && (result1 != result2 || !message1 != !message2 || (message1 && !streq (message1, message2)))) {
+        fprintf (stderr, "Expression engine differs for %s (%s, %s)\nEXPECTED: %d %s\nGOT: %d %s\n", what,
+            (char *) zlist_first (params), zlist_size (params) > 1 ? (char *) zlist_next (params) : "",
+            result2, message2, result1, message1);
+        assert (false);
+    }
+    zstr_free (&message1);
+    zstr_free (&message2);
+    return rc == 0;
+}
+#endif
+
 void
 rule_test (bool verbose)
 {
@@ -1010,6 +2227,9 @@ rule_test (bool verbose)
     #define SELFTEST_DIR_RULES SELFTEST_DIR_RO"/rules"
 
     //  @selftest
+    //  tests below compare engines on inputs lua fails on, don't quarantine
+    rule_set_quarantine (0);
+
     //  Simple create/destroy test
     {
         printf ("      Simple create/destroy test ... \n");
@@ -1126,6 +2346,706 @@ rule_test (bool verbose)
         printf ("      OK\n");
     }
 
+    //  Merge and references
+    {
+        printf ("      Merge test - old rule keeps its actions ... \n");
+        rule_t *old_rule = rule_new ();
+        assert (rule_parse (old_rule, "{\"name\":\"m\",\"results\":{\"high_critical\":{\"action\":[\"EMAIL\"]}}}") == 0);
+        rule_t *new_rule = rule_new ();
+        assert (rule_parse (new_rule, "{\"name\":\"m\"}") == 0);
+        rule_t *shared = rule_ref (old_rule);
+        rule_merge (old_rule, new_rule);
+        rule_destroy (&old_rule);
+        assert (old_rule == NULL);
+        //  shared reference is still valid
+        zlist_t *actions = rule_result_actions (shared, 2);
+        assert (actions && zlist_size (actions) == 1);
+        actions = rule_result_actions (new_rule, 2);
+        assert (actions && zlist_size (actions) == 1);
+        assert (streq ((char *) zlist_first (actions), "EMAIL"));
+        rule_destroy (&shared);
+        rule_destroy (&new_rule);
+        printf ("      OK\n");
+    }
+
+    //  Shared compiled code
+    {
+        printf ("      Shared code test - rules with the same evaluation ... \n");
+        size_t chunks = rule_chunk_count ();
+        rule_t *first = rule_new ();
+        rule_t *second = rule_new ();
+        assert (rule_load (first, SELFTEST_DIR_RULES "/threshold.rule") == 0);
+        assert (rule_load (second, SELFTEST_DIR_RULES "/threshold.rule") == 0);
+        zhashx_update (second->variables, "high_warning", (void *) "55");
+        //  force lua, threshold engine would take them
+        rule_threshold_destroy (&first->threshold);
+        rule_threshold_destroy (&second->threshold);
+
+        zlist_t *params = zlist_new ();
+        zlist_append (params, (void *) "50");
+        int result;
+        char *message = NULL;
+        rule_evaluate (first, params, NULL, "rack-1", NULL, &result, &message);
+        assert (result == 1);
+        zstr_free (&message);
+        rule_evaluate (second, params, NULL, "rack-1", NULL, &result, &message);
+        assert (result == 0);
+        zstr_free (&message);
+        assert (first->chunk && first->chunk == second->chunk);
+        assert (rule_chunk_environments (first->chunk) == 2);
+        assert (rule_chunk_count () == chunks + 1);
+
+        //  chunk is freed with the last rule
+        rule_destroy (&first);
+        rule_evaluate (second, params, NULL, "rack-1", NULL, &result, &message);
+        assert (result == 0);
+        zstr_free (&message);
+        assert (rule_chunk_count () == chunks + 1);
+        rule_destroy (&second);
+        assert (rule_chunk_count () == chunks);
+        zlist_destroy (&params);
+        printf ("      OK\n");
+    }
+
+    //  Lua limits
+    {
+        printf ("      Lua limits test - runaway rule is aborted ... \n");
+        rule_t *rule = rule_new ();
+        assert (rule_parse (rule, "{\"name\":\"runaway\",\"evaluation\":"
+            "\"function main (x) while x do end return OK, 'never' end\"}") == 0);
+        zlist_t *params = zlist_new ();
+        zlist_append (params, (void *) "1");
+        int result;
+        char *message = NULL;
+        uint64_t aborted = rule_chunk_aborted (RULE_CHUNK_INSTRUCTIONS_EXCEEDED);
+        rule_evaluate (rule, params, NULL, "rack-1", NULL, &result, &message);
+        assert (result == RULE_ABORTED);
+        assert (message == NULL);
+        assert (rule_chunk_aborted (RULE_CHUNK_INSTRUCTIONS_EXCEEDED) == aborted + 1);
+        zlist_destroy (&params);
+        rule_destroy (&rule);
+        printf ("      OK\n");
+    }
+
+    //  Quarantine
+    {
+        printf ("      Quarantine test - failing rules are not evaluated ... \n");
+        rule_set_quarantine (QUARANTINE_FAILURES);
+        rule_t *rule = rule_new ();
+        assert (rule_parse (rule, "{\"name\":\"failing\",\"evaluation\":"
+            "\"function main (x) if x == 'bad' then error ('bad input') end return OK, x end\"}") == 0);
+        zlist_t *params = zlist_new ();
+        zlist_append (params, (void *) "bad");
+        int result;
+        char *message = NULL;
+        assert (streq (rule_health (rule, NULL, NULL), "OK"));
+        for (int i = 1; i < QUARANTINE_FAILURES; i++) {
+            rule_evaluate (rule, params, NULL, "rack-1", NULL, &result, &message);
+            assert (result == RULE_ERROR);
+        }
+        int failures;
+        int64_t remaining;
+        assert (streq (rule_health (rule, &failures, &remaining), "FAILING"));
+        assert (failures == QUARANTINE_FAILURES - 1 && remaining == 0);
+        //  success resets failures
+        zlist_purge (params);
+        zlist_append (params, (void *) "good");
+        rule_evaluate (rule, params, NULL, "rack-1", NULL, &result, &message);
+        assert (result == 0 && streq (message, "good"));
+        zstr_free (&message);
+        assert (streq (rule_health (rule, NULL, NULL), "OK"));
+        zlist_purge (params);
+        zlist_append (params, (void *) "bad");
+        for (int i = 0; i < QUARANTINE_FAILURES; i++) {
+            rule_evaluate (rule, params, NULL, "rack-1", NULL, &result, &message);
+            assert (result == RULE_ERROR);
+        }
+        assert (rule_quarantined (rule));
+        assert (streq (rule_health (rule, &failures, &remaining), "QUARANTINED"));
+        assert (failures == QUARANTINE_FAILURES);
+        assert (remaining > 0 && remaining <= QUARANTINE_MIN);
+        //  lua is not called, even for good input
+        zlist_purge (params);
+        zlist_append (params, (void *) "good");
+        rule_evaluate (rule, params, NULL, "rack-1", NULL, &result, &message);
+        assert (result == RULE_QUARANTINED && message == NULL);
+        //  failed probe after quarantine doubles it
+        rule->quarantine_until = zclock_mono () - 1;
+        assert (streq (rule_health (rule, NULL, NULL), "FAILING"));
+        zlist_purge (params);
+        zlist_append (params, (void *) "bad");
+        rule_evaluate (rule, params, NULL, "rack-1", NULL, &result, &message);
+        assert (result == RULE_ERROR);
+        assert (rule->quarantine == 2 * QUARANTINE_MIN);
+        assert (streq (rule_health (rule, NULL, NULL), "QUARANTINED"));
+        //  successful probe ends it
+        rule->quarantine_until = zclock_mono () - 1;
+        zlist_purge (params);
+        zlist_append (params, (void *) "good");
+        rule_evaluate (rule, params, NULL, "rack-1", NULL, &result, &message);
+        assert (result == 0);
+        zstr_free (&message);
+        assert (streq (rule_health (rule, &failures, &remaining), "OK"));
+        assert (failures == 0 && remaining == 0 && rule->quarantine == 0);
+        rule_destroy (&rule);
+
+        //  compilation is not retried
+        rule = rule_new ();
+        assert (rule_parse (rule, "{\"name\":\"broken\",\"evaluation\":"
+            "\"function main (x) return OK, x\"}") == 0);
+        rule_evaluate (rule, params, NULL, "rack-1", NULL, &result, &message);
+        assert (result == RULE_ERROR);
+        assert (streq (rule_health (rule, NULL, NULL), "BROKEN"));
+        rule_evaluate (rule, params, NULL, "rack-1", NULL, &result, &message);
+        assert (result == RULE_QUARANTINED);
+        assert (rule->chunk == NULL);
+        rule_destroy (&rule);
+        zlist_destroy (&params);
+        rule_set_quarantine (0);
+        printf ("      OK\n");
+    }
+    {
+        printf ("      Memo test - unchanged inputs are not evaluated again ... \n");
+        rule_t *rule = rule_new ();
+        //  counter of calls makes code impure, rule declares it pure
+        assert (rule_parse (rule, "{\"name\":\"status\",\"pure\":true,\"evaluation\":"
+            "\"calls = (calls or 0) + 1 function main (x) calls = calls + 1 return OK, NAME .. ' ' .. x .. ' ' .. calls end\"}") == 0);
+        assert (rule->pure);
+        char *json = rule_json (rule);
+        assert (strstr (json, "\"pure\":true"));
+        zstr_free (&json);
+        zlist_t *params = zlist_new ();
+        zlist_append (params, (void *) "online");
+        uint64_t hits, misses, hits0, misses0;
+        rule_memo_stats (&hits0, &misses0);
+        int result;
+        char *message = NULL;
+        rule_evaluate (rule, params, NULL, "ups-1", "UPS 1", &result, &message);
+        assert (result == 0 && streq (message, "UPS 1 online 2"));
+        zstr_free (&message);
+        //  the same inputs, lua is not called
+        rule_evaluate (rule, params, NULL, "ups-1", "UPS 1", &result, &message);
+        assert (result == 0 && streq (message, "UPS 1 online 2"));
+        zstr_free (&message);
+        rule_memo_stats (&hits, &misses);
+        assert (hits == hits0 + 1 && misses == misses0 + 1);
+        //  other asset, friendly name or value is evaluated
+        rule_evaluate (rule, params, NULL, "ups-2", "UPS 1", &result, &message);
+        assert (streq (message, "UPS 1 online 3"));
+        zstr_free (&message);
+        rule_evaluate (rule, params, NULL, "ups-1", "UPS One", &result, &message);
+        assert (streq (message, "UPS One online 4"));
+        zstr_free (&message);
+        zlist_purge (params);
+        zlist_append (params, (void *) "onbattery");
+        rule_evaluate (rule, params, NULL, "ups-1", "UPS One", &result, &message);
+        assert (streq (message, "UPS One onbattery 5"));
+        zstr_free (&message);
+        rule_memo_stats (&hits, &misses);
+        assert (hits == hits0 + 1 && misses == misses0 + 4);
+        rule_destroy (&rule);
+
+        //  impure rules are always evaluated
+        const char *impure [] = {
+            "{\"name\":\"clock\",\"evaluation\":\"function main (x) return OK, x .. os.time () end\"}",
+            "{\"name\":\"dice\",\"evaluation\":\"function main (x) return math.random (0, 1), x end\"}",
+            "{\"name\":\"declared\",\"pure\":false,\"evaluation\":\"function main (x) return OK, x end\"}",
+            "{\"name\":\"global\",\"evaluation\":\"calls = 0 function main (x) calls = calls + 1 return OK, x .. calls end\"}",
+            "{\"name\":\"upvalue\",\"evaluation\":\"local last = '' function main (x) local previous = last last = x return OK, previous end\"}",
+            NULL
+        };
+        for (int i = 0; impure [i]; i++) {
+            rule = rule_new ();
+            assert (rule_parse (rule, impure [i]) == 0);
+            assert (!rule->pure || rule->impure);
+            rule_evaluate (rule, params, NULL, "ups-1", NULL, &result, &message);
+            zstr_free (&message);
+            rule_evaluate (rule, params, NULL, "ups-1", NULL, &result, &message);
+            zstr_free (&message);
+            if (rule->impure) {
+                char *json = rule_json (rule);
+                assert (strstr (json, "\"pure\":false"));
+                zstr_free (&json);
+            }
+            rule_destroy (&rule);
+        }
+        rule_memo_stats (&hits, &misses);
+        assert (hits == hits0 + 1 && misses == misses0 + 4);
+        //  names merely containing os. are not impure, neither are writes of
+        //  locals, their tables, or of the chunk which runs once
+        const char *pure_code [] = {
+            "function main (x) return OK, bios.x end",
+            "function main (x) local t = {} t.v = x t [1] = x for i = 1, 2 do local z = i z = z + 1 end return OK, t.v end",
+            "function main (x) local r = { a = x, [1] = 2, f = function (q) q = 1 return q end } return OK, r.a end",
+            "count = 0 local limit = 5 function main (x) if x > limit then x = limit else local w w = 3 end return OK, x end",
+            "local function helper (v) v = v + 1 return v end function main (x) local a, b = 1, 2 a, b = b, a return OK, helper (x) end",
+            "function main (x) while x > 0 do x = x - 1 end repeat x = x + 1 until x > 3 return OK, x end",
+            NULL
+        };
+        for (int i = 0; pure_code [i]; i++)
+            assert (!s_impure_code (pure_code [i]));
+        const char *impure_code [] = {
+            "function main (x) return OK, os.date () end",
+            "local cache = {} function main (x) cache [x] = true return OK, x end",
+            "function main (x) local function f () x = 1 end f () return OK, x end",
+            "function main (x) function helper () end return OK, x end",
+            "function main (x) local a a, b = 1, 2 return OK, x end",
+            "function main (x) if x then state.total = (state.total or 0) + 1 end return OK, x end",
+            "function main (x) table.insert (list, x) return OK, x end",
+            "function main (x) local s = [[end]] count = 1 return OK, x end",
+            NULL
+        };
+        for (int i = 0; impure_code [i]; i++)
+            assert (s_impure_code (impure_code [i]));
+        zlist_destroy (&params);
+        printf ("      OK\n");
+    }
+    {
+        printf ("      Minimal interval test ... \n");
+        rule_t *rule = rule_new ();
+        assert (rule_parse (rule, "{\"name\":\"fast\",\"evaluation\":\"function main (x) return OK, x end\"}") == 0);
+        assert (rule_min_interval (rule) == -1);
+        char *json = rule_json (rule);
+        assert (!strstr (json, "min_interval"));
+        zstr_free (&json);
+        rule_destroy (&rule);
+        rule = rule_new ();
+        assert (rule_parse (rule, "{\"name\":\"fast\",\"min_interval\":5000,"
+            "\"evaluation\":\"function main (x) return OK, x end\"}") == 0);
+        assert (rule_min_interval (rule) == 5000);
+        json = rule_json (rule);
+        rule_destroy (&rule);
+        rule = rule_new ();
+        assert (rule_parse (rule, json) == 0);
+        assert (rule_min_interval (rule) == 5000);
+        zstr_free (&json);
+        rule_destroy (&rule);
+        printf ("      OK\n");
+    }
+
+    //  Threshold engine
+    {
+        printf ("      Threshold engine test - same results as lua ... \n");
+        rule_t *native = NULL;
+        rule_t *lua = NULL;
+        zlist_t *params = zlist_new ();
+        //  typed and string values
+        for (int typed = 1; typed >= 0; typed--) {
+            rule_destroy (&native);
+            rule_destroy (&lua);
+            native = rule_new ();
+            lua = rule_new ();
+            assert (rule_load (native, SELFTEST_DIR_RULES "/threshold.rule") == 0);
+            assert (rule_load (lua, SELFTEST_DIR_RULES "/threshold.rule") == 0);
+            assert (native->typed && lua->typed);
+            if (!typed) {
+                native->typed = lua->typed = false;
+                rule_threshold_destroy (&native->threshold);
+                native->threshold = rule_threshold_new (native->evaluation, false);
+            }
+            assert (native->threshold);
+            rule_threshold_destroy (&lua->threshold);
+
+            const char *values [] = { "", "abc", "-1", "4.50", "1e3", NULL };
+            for (int i = -5; i < 120 + 5; i++) {
+                char value [16];
+                const char *param = value;
+                if (i < 0)
+                    param = values [i + 5];
+                else
+                    snprintf (value, sizeof (value), "%d", i);
+                if (!param)
+                    continue;
+                zlist_purge (params);
+                zlist_append (params, (void *) param);
+                int result1, result2;
+                char *message1 = NULL, *message2 = NULL;
+                //  native engine gets value converted when metric came
+                double number;
+                if (!rule_threshold_number (param, &number))
+                    number = NAN;
+                rule_evaluate (native, params, &number, "rack-1", "Rack 1", &result1, &message1);
+                rule_evaluate (lua, params, NULL, "rack-1", "Rack 1", &result2, &message2);
+                assert (result1 == result2);
+                //  typed rule compares strings with numbers, lua fails
+                assert (!message1 == !message2);
+                assert (!message1 || streq (message1, message2));
+                assert (message1 || (typed && i < -3));
+                zstr_free (&message1);
+                zstr_free (&message2);
+            }
+        }
+
+        //  per evaluation latency, of lua and not of memo
+        const int count = 10000;
+        lua->impure = true;
+        zlist_purge (params);
+        zlist_append (params, (void *) "42");
+        int64_t times [2];
+        rule_t *engines [2] = { native, lua };
+        for (int e = 0; e < 2; e++) {
+            int64_t start = zclock_usecs ();
+            for (int i = 0; i < count; i++) {
+                int result;
+                char *message = NULL;
+                rule_evaluate (engines [e], params, NULL, "rack-1", "Rack 1", &result, &message);
+                zstr_free (&message);
+            }
+            times [e] = zclock_usecs () - start;
+        }
+        if (verbose)
+            log_info ("threshold evaluation: native %.3f us, lua %.3f us",
+                (double) times [0] / count, (double) times [1] / count);
+        rule_destroy (&native);
+        rule_destroy (&lua);
+
+        //  numeric comparisons, also classified in batch
+        const char *numeric = "{\"name\":\"load\",\"metrics\":[\"load.input\"],\"variables\":{\"high\":\"80\"},"
+            "\"evaluation\":\"function main (load) if tonumber (load) > tonumber (high) then return CRITICAL, 'high' end "
+            "if 10 >= tonumber (load) then return LOW_WARNING, 'low' end return OK, 'ok' end\"}";
+        native = rule_new ();
+        lua = rule_new ();
+        assert (rule_parse (native, numeric) == 0 && rule_parse (lua, numeric) == 0);
+        assert (native->threshold);
+        rule_threshold_destroy (&lua->threshold);
+        const char *loads [] = { "5", "10", "10.5", "79.9", "80", "80.1", "100", "1e3", " 0x20 ", NULL };
+        double numbers [10];
+        int results [10];
+        size_t loads_count = 0;
+        for (; loads [loads_count]; loads_count++) {
+            zlist_purge (params);
+            zlist_append (params, (void *) loads [loads_count]);
+            int result1, result2;
+            char *message1 = NULL, *message2 = NULL;
+            rule_evaluate (native, params, NULL, "ups-1", NULL, &result1, &message1);
+            rule_evaluate (lua, params, NULL, "ups-1", NULL, &result2, &message2);
+            assert (result1 == result2);
+            assert (message1 && message2 && streq (message1, message2));
+            zstr_free (&message1);
+            zstr_free (&message2);
+            assert (rule_threshold_number (loads [loads_count], &numbers [loads_count]));
+            results [loads_count] = result1;
+        }
+        int classified [10];
+        assert (rule_classify (native, numbers, loads_count, classified) == 0);
+        assert (memcmp (results, classified, loads_count * sizeof (int)) == 0);
+        assert (rule_classify (lua, numbers, loads_count, classified) == -1);
+        zlist_destroy (&params);
+        rule_destroy (&native);
+        rule_destroy (&lua);
+
+        //  explicit engine
+        rule_t *rule = rule_new ();
+        assert (rule_parse (rule, "{\"name\":\"t\",\"engine\":\"lua\","
+            "\"evaluation\":\"function main (x) return OK, 'ok' end\"}") == 0);
+        assert (rule->threshold == NULL);
+        char *json = rule_json (rule);
+        assert (strstr (json, "\"engine\":\"lua\""));
+        zstr_free (&json);
+        rule_destroy (&rule);
+        rule = rule_new ();
+        assert (rule_parse (rule, "{\"name\":\"t\",\"engine\":\"threshold\","
+            "\"evaluation\":\"function main (x) return OK, 'ok' end\"}") == 0);
+        assert (rule->threshold);
+        rule_destroy (&rule);
+        rule = rule_new ();
+        assert (rule_parse (rule, "{\"name\":\"t\",\"engine\":\"threshold\","
+            "\"evaluation\":\"function main (x) return OK, x + 1 end\"}") != 0);
+        rule_destroy (&rule);
+        rule = rule_new ();
+        assert (rule_parse (rule, "{\"name\":\"t\",\"engine\":\"jit\","
+            "\"evaluation\":\"function main (x) return OK, 'ok' end\"}") != 0);
+        rule_destroy (&rule);
+        printf ("      OK\n");
+    }
+
+    //  Expression engine
+#if defined (RULE_EXPRESSION_ENGINE)
+    {
+        printf ("      Expression engine test - same results as lua for shipped templates ... \n");
+        const char *templates [] = {
+            "door-contact.state-change@__device_sensorgpio__",
+            "fire-detector-extinguisher.state-change@__device_sensorgpio__",
+            "fire-detector.state-change@__device_sensorgpio__",
+            "licensing.expire@__device_rackcontroller__",
+            "pir-motion-detector.state-change@__device_sensorgpio__",
+            "single-point-of-failure@__device_ups__",
+            "smoke-detector.state-change@__device_sensorgpio__",
+            "sts-frequency@__device_sts__",
+            "sts-preferred-source@__device_sts__",
+            "sts-voltage@__device_sts__",
+            "vibration-sensor.state-change@__device_sensorgpio__",
+            "water-leak-detector.state-change@__device_sensorgpio__",
+            NULL
+        };
+        const char *inputs [] = {
+            "opened", "closed", "good", "bad", "0", "1", "2", "7", "15", "40", "60", "-3", "abc", "",
+            "2.5", "-0.5", "0.1", "1e3", "7.0", NULL
+        };
+        zhashx_t *substitutions = zhashx_new ();
+        zhashx_insert (substitutions, "__name__", (void *) "sensor-1");
+        zhashx_insert (substitutions, "__ename__", (void *) "Sensor 1");
+        zhashx_insert (substitutions, "__port__", (void *) "GPI1");
+        zhashx_insert (substitutions, "__normalstate__", (void *) "closed");
+        zhashx_insert (substitutions, "__severity__", (void *) "CRITICAL");
+        zhashx_insert (substitutions, "__rule_result__", (void *) "critical");
+        zhashx_insert (substitutions, "__logicalasset__", (void *) "Room 1");
+        zhashx_insert (substitutions, "__logicalasset_iname__", (void *) "room-1");
+        zlist_t *params = zlist_new ();
+        int64_t native_time = 0, lua_time = 0;
+        size_t evaluations = 0;
+        for (int t = 0; templates [t]; t++) {
+            char *path = zsys_sprintf ("%s/templates/%s.rule", SELFTEST_DIR_RULES, templates [t]);
+            char *text = s_test_read_file (path);
+            assert (text);
+            char *expanded_text = s_substitute (text, substitutions);
+            rule_t *lua = rule_new ();
+            assert (rule_parse (lua, expanded_text) == 0);
+            rule_threshold_destroy (&lua->threshold);
+            rule_expression_t *expression = rule_expression_new (lua->evaluation, lua->variables, lua->typed);
+            assert (expression);
+            size_t metrics = zlist_size (lua->metrics);
+            assert (metrics == 1 || metrics == 2);
+
+            size_t native = 0;
+            for (int i = 0; inputs [i]; i++) {
+                for (int j = 0; j == 0 || (metrics == 2 && inputs [j]); j++) {
+                    zlist_purge (params);
+                    zlist_append (params, (void *) inputs [i]);
+                    if (metrics == 2)
+                        zlist_append (params, (void *) inputs [j]);
+                    if (s_test_same_as_lua (expression, lua, params, templates [t], &native_time, &lua_time))
+                        native++;
+                    evaluations++;
+                }
+            }
+            //  licensing compares string with number, lua fails for most inputs
+            assert (native > 0);
+            rule_expression_destroy (&expression);
+            rule_destroy (&lua);
+            zstr_free (&expanded_text);
+            zstr_free (&text);
+            zstr_free (&path);
+        }
+        if (verbose)
+            log_info ("%zu evaluations of templates: expression engine %.3f us, lua %.3f us", evaluations,
+                (double) native_time / evaluations, (double) lua_time / evaluations);
+
+        //  fractions and division, numbers formatted by tostring
+        const char *evaluations_others [] = {
+            "function main (x) return OK, 'half ' .. x / 2 end",
+            "function main (x) return OK, 'number ' .. tonumber (x) end",
+            "function main (x) return OK, 'scaled ' .. (x * 1.5 - 0.25) end",
+            "function main (x) return OK, 'third ' .. tostring (x / 3) end",
+            "function main (x) return OK, 'power ' .. 2 ^ (x / 10) end",
+            "function main (x) if x / 2 > 1.25 then return WARNING, string.format ('%.2f high', x / 2) end "
+                "return OK, 'modulo ' .. x % 0.75 end",
+            NULL
+        };
+        for (int e = 0; evaluations_others [e]; e++) {
+            for (int typed = 0; typed < 2; typed++) {
+                rule_t *lua = rule_new ();
+                char *json = zsys_sprintf ("{\"name\":\"fractions\",\"engine\":\"lua\",\"values\":\"%s\",\"evaluation\":\"%s\"}",
+                    typed ? "number" : "string", evaluations_others [e]);
+                assert (rule_parse (lua, json) == 0);
+                zstr_free (&json);
+                rule_expression_t *expression = rule_expression_new (lua->evaluation, lua->variables, lua->typed);
+                assert (expression);
+                size_t native = 0;
+                for (int i = 0; inputs [i]; i++) {
+                    zlist_purge (params);
+                    zlist_append (params, (void *) inputs [i]);
+                    if (s_test_same_as_lua (expression, lua, params, evaluations_others [e], &native_time, &lua_time))
+                        native++;
+                }
+                assert (native > 0);
+                rule_expression_destroy (&expression);
+                rule_destroy (&lua);
+            }
+        }
+
+        //  template instance with expression engine
+        rule_t *tmpl = rule_new ();
+        assert (rule_load (tmpl, SELFTEST_DIR_RULES "/templates/sts-preferred-source@__device_sts__.rule") == 0);
+        tmpl->engine = strdup ("expression");
+        assert (s_rule_engine (tmpl) == 0);
+        rule_t *instance = rule_new ();
+        assert (rule_parse (instance, "{\"name\":\"sts-preferred-source@sts-1\","
+            "\"template\":\"sts-preferred-source@__device_sts__\","
+            "\"substitutions\":{\"__name__\":\"sts-1\",\"__ename__\":\"STS 1\"}}") == 0);
+        assert (rule_instantiate (instance, tmpl) == 0);
+        assert (instance->expression);
+        zlist_purge (params);
+        zlist_append (params, (void *) "1");
+        zlist_append (params, (void *) "2");
+        int result;
+        char *message = NULL;
+        rule_evaluate (instance, params, NULL, "sts-1", "STS 1", &result, &message);
+        assert (result == 1);
+        assert (message && strstr (message, "\"value\" : \"STS 1\""));
+        zstr_free (&message);
+        rule_destroy (&instance);
+        char *json = rule_json (tmpl);
+        assert (strstr (json, "\"engine\":\"expression\""));
+        zstr_free (&json);
+        rule_destroy (&tmpl);
+
+        //  explicit engine must compile
+        rule_t *rule = rule_new ();
+        assert (rule_parse (rule, "{\"name\":\"e\",\"engine\":\"expression\","
+            "\"evaluation\":\"function main (x) for i = 1, 2 do end return OK, 'ok' end\"}") != 0);
+        rule_destroy (&rule);
+
+        zlist_destroy (&params);
+        zhashx_destroy (&substitutions);
+        printf ("      OK\n");
+    }
+#endif
+
+    //  Template instances
+    {
+        printf ("      Template test - instance evaluates like expanded rule ... \n");
+        const char *path = SELFTEST_DIR_RULES "/templates/smoke-detector.state-change@__device_sensorgpio__.rule";
+        zhashx_t *substitutions = zhashx_new ();
+        zhashx_set_duplicator (substitutions, (zhashx_duplicator_fn *) strdup);
+        zhashx_set_destructor (substitutions, (zhashx_destructor_fn *) zstr_free);
+        zhashx_insert (substitutions, "__name__", (void *) "sensor-1");
+        zhashx_insert (substitutions, "__port__", (void *) "GPI1");
+        zhashx_insert (substitutions, "__normalstate__", (void *) "closed");
+        zhashx_insert (substitutions, "__severity__", (void *) "CRITICAL");
+        zhashx_insert (substitutions, "__rule_result__", (void *) "critical");
+        zhashx_insert (substitutions, "__logicalasset__", (void *) "Room 1");
+        zhashx_insert (substitutions, "__logicalasset_iname__", (void *) "room-1");
+
+        //  what fty-autoconfig does
+        char *text = s_test_read_file (path);
+        char *expanded_text = s_substitute (text, substitutions);
+        rule_t *expanded = rule_new ();
+        assert (rule_parse (expanded, expanded_text) == 0);
+
+        rule_t *tmpl = rule_new ();
+        assert (rule_load (tmpl, path) == 0);
+        const char *json = "{\"name\":\"smoke-detector.state-change@sensor-1\","
+            "\"template\":\"smoke-detector.state-change@__device_sensorgpio__\","
+            "\"substitutions\":{\"__name__\":\"sensor-1\",\"__port__\":\"GPI1\",\"__normalstate__\":\"closed\","
+            "\"__severity__\":\"CRITICAL\",\"__rule_result__\":\"critical\",\"__logicalasset__\":\"Room 1\","
+            "\"__logicalasset_iname__\":\"room-1\"}}";
+        rule_t *instance = rule_new ();
+        assert (rule_parse (instance, json) == 0);
+        assert (streq (rule_template (instance), "smoke-detector.state-change@__device_sensorgpio__"));
+        assert (rule_instantiate (instance, tmpl) == 0);
+        assert (instance->evaluation == NULL);
+        assert (rule_metric_exists (instance, "status.GPI1"));
+        assert (rule_asset_exists (instance, "sensor-1"));
+        assert (streq (rule_logical_asset (instance), "room-1"));
+        assert (rule_result_actions (instance, 2));
+
+        s_test_same_result (expanded, instance, "closed", 0);
+        s_test_same_result (expanded, instance, "opened", 2);
+
+        //  full json of instance is the same as of expanded rule
+        char *json1 = rule_json (expanded);
+        char *json2 = rule_json_expanded (instance);
+        assert (streq (json1, json2));
+        zstr_free (&json1);
+        zstr_free (&json2);
+
+        //  short form survives round trip
+        json1 = rule_json (instance);
+        assert (strstr (json1, "\"template\""));
+        assert (!strstr (json1, "\"evaluation\""));
+        rule_t *copy = rule_new ();
+        assert (rule_parse (copy, json1) == 0);
+        assert (rule_instantiate (copy, tmpl) == 0);
+        json2 = rule_json (copy);
+        assert (streq (json1, json2));
+        s_test_same_result (expanded, copy, "opened", 2);
+        zstr_free (&json1);
+        zstr_free (&json2);
+        rule_destroy (&copy);
+
+        //  second instance shares compiled template
+        rule_t *other = rule_new ();
+        assert (rule_parse (other, "{\"name\":\"smoke-detector.state-change@sensor-2\","
+            "\"template\":\"smoke-detector.state-change@__device_sensorgpio__\","
+            "\"substitutions\":{\"__name__\":\"sensor-2\",\"__normalstate__\":\"opened\","
+            "\"__severity__\":\"WARNING\"}}") == 0);
+        assert (rule_instantiate (other, tmpl) == 0);
+        zlist_t *params = zlist_new ();
+        zlist_append (params, (void *) "closed");
+        int result;
+        char *message = NULL;
+        rule_evaluate (other, params, NULL, "sensor-2", NULL, &result, &message);
+        assert (result == 1);
+        zstr_free (&message);
+        zlist_destroy (&params);
+        assert (tmpl->chunk && !instance->chunk && !other->chunk);
+        s_test_same_result (expanded, instance, "opened", 2);
+        rule_destroy (&other);
+
+        rule_destroy (&instance);
+        rule_destroy (&expanded);
+        rule_destroy (&tmpl);
+        zstr_free (&expanded_text);
+
+        //  1000 instances against 1000 expanded rules
+        const int count = 1000;
+        rule_t **rules = (rule_t **) zmalloc (count * sizeof (rule_t *));
+        int64_t start = zclock_mono ();
+        size_t expanded_memory = 0;
+        for (int i = 0; i < count; i++) {
+            //  different rooms, so expanded rules don't share compiled code
+            char *name = zsys_sprintf ("sensor-%d", i);
+            char *room = zsys_sprintf ("Room %d", i);
+            zhashx_update (substitutions, "__name__", name);
+            zhashx_update (substitutions, "__logicalasset__", room);
+            expanded_text = s_substitute (text, substitutions);
+            rules [i] = rule_new ();
+            assert (rule_parse (rules [i], expanded_text) == 0);
+            assert (rule_compile (rules [i]) == 1);
+            expanded_memory += strlen (rules [i]->evaluation) + s_test_lua_memory (rules [i]);
+            zstr_free (&expanded_text);
+            zstr_free (&name);
+            zstr_free (&room);
+        }
+        int64_t expanded_time = zclock_mono () - start;
+        for (int i = 0; i < count; i++)
+            rule_destroy (&rules [i]);
+
+        start = zclock_mono ();
+        tmpl = rule_new ();
+        assert (rule_load (tmpl, path) == 0);
+        for (int i = 0; i < count; i++) {
+            char *instance_json = zsys_sprintf ("{\"name\":\"smoke-detector.state-change@sensor-%d\","
+                "\"template\":\"smoke-detector.state-change@__device_sensorgpio__\","
+                "\"substitutions\":{\"__name__\":\"sensor-%d\",\"__port__\":\"GPI1\",\"__normalstate__\":\"closed\","
+                "\"__severity__\":\"CRITICAL\",\"__rule_result__\":\"critical\",\"__logicalasset__\":\"Room %d\","
+                "\"__logicalasset_iname__\":\"room-1\"}}", i, i, i);
+            rules [i] = rule_new ();
+            assert (rule_parse (rules [i], instance_json) == 0);
+            assert (rule_instantiate (rules [i], tmpl) == 0);
+            zstr_free (&instance_json);
+        }
+        assert (rule_compile (tmpl) == 1);
+        size_t instance_memory = strlen (tmpl->evaluation) + strlen (tmpl->template_source)
+            + s_test_lua_memory (tmpl);
+        int64_t instance_time = zclock_mono () - start;
+        for (int i = 0; i < count; i++)
+            rule_destroy (&rules [i]);
+        rule_destroy (&tmpl);
+        free (rules);
+        assert (instance_memory < expanded_memory);
+        if (verbose)
+            log_info ("%d rules: expanded files %d ms, %zu bytes of code and lua state; "
+                "template instances %d ms, %zu bytes", count, (int) expanded_time, expanded_memory,
+                (int) instance_time, instance_memory);
+
+        zstr_free (&text);
+        zhashx_destroy (&substitutions);
+        printf ("      OK\n");
+    }
+
+    rule_set_quarantine (QUARANTINE_FAILURES);
     //  @end
     printf ("OK\n");
 }
@@ -27,6 +27,8 @@ extern "C" {
 #endif
 
 #define RULE_ERROR 255
+#define RULE_ABORTED 254        //  evaluation exceeded lua limits
+#define RULE_QUARANTINED 253    //  rule is broken or in quarantine, not evaluated
 
 //  Opaque class structures to allow forward references
 #ifndef RULE_T_DEFINED
@@ -39,10 +41,14 @@ typedef struct _rule_t rule_t;
 FTY_ALERT_FLEXIBLE_PRIVATE rule_t *
     rule_new (void);
 
-//  Destroy the rule
+//  Destroy the rule. Rule is freed when the last reference is dropped.
 FTY_ALERT_FLEXIBLE_PRIVATE void
     rule_destroy (rule_t **self_p);
 
+//  Add reference to rule, returns the rule
+FTY_ALERT_FLEXIBLE_PRIVATE rule_t *
+    rule_ref (rule_t *self);
+
 //  Self test of this class
 FTY_ALERT_FLEXIBLE_PRIVATE void
     rule_test (bool verbose);
@@ -55,6 +61,11 @@ FTY_ALERT_FLEXIBLE_PRIVATE void
 FTY_ALERT_FLEXIBLE_PRIVATE int
     rule_parse (rule_t *self, const char *json);
 
+//  Rule loading callback of vsjson_parse, data is the rule. Unlike
+//  rule_parse, evaluation is not prepared; parser benchmark uses it.
+FTY_ALERT_FLEXIBLE_PRIVATE int
+    rule_json_callback (const char *locator, const char *value, void *data);
+
 //  Get rule name
 FTY_ALERT_FLEXIBLE_PRIVATE const char *
     rule_name (rule_t *self);
@@ -104,7 +115,7 @@ FTY_ALERT_FLEXIBLE_PRIVATE zhashx_t *
 FTY_ALERT_FLEXIBLE_PRIVATE int
     rule_load (rule_t *self, const char *path);
 
-// Update new_rule with configured actions of old_rule
+// Update new_rule with configured actions of old_rule (old_rule is not changed)
 FTY_ALERT_FLEXIBLE_PRIVATE void
     rule_merge (rule_t *old_rule, rule_t *new_rule);
 
@@ -117,9 +128,62 @@ FTY_ALERT_FLEXIBLE_PRIVATE int
 FTY_ALERT_FLEXIBLE_PRIVATE char *
     rule_json (rule_t *self);
 
-//  Evaluate rule
+//  Convert rule to json, template instance is expanded to full rule
+//  Caller is responsible for destroying the return value
+FTY_ALERT_FLEXIBLE_PRIVATE char *
+    rule_json_expanded (rule_t *self);
+
+//  Get name of template, NULL if rule is not template instance
+FTY_ALERT_FLEXIBLE_PRIVATE const char *
+    rule_template (rule_t *self);
+
+//  Make rule an instance of template rule. Attributes which instance does
+//  not specify are taken from template with placeholders substituted,
+//  evaluation is shared with template. Returns 0 on success.
+FTY_ALERT_FLEXIBLE_PRIVATE int
+    rule_instantiate (rule_t *self, rule_t *tmpl);
+
+//  Evaluate rule. Numbers are params converted by rule_threshold_number
+//  when metrics came (NAN if not a number), NULL to convert them here.
+FTY_ALERT_FLEXIBLE_PRIVATE void
+rule_evaluate (rule_t *self, zlist_t *params, const double *numbers, const char *iname, const char *ename, int *result, char **message);
+
+//  Set number of consecutive failed evaluations which put rule to quarantine,
+//  zero disables quarantine. Rules failing to compile are never retried.
+FTY_ALERT_FLEXIBLE_PRIVATE void
+    rule_set_quarantine (int failures);
+
+//  Return true if rule is broken or in quarantine, evaluation would return
+//  RULE_QUARANTINED.
+FTY_ALERT_FLEXIBLE_PRIVATE bool
+    rule_quarantined (rule_t *self);
+
+//  State of rule evaluation: "OK", "BROKEN" (evaluation doesn't compile),
+//  "FAILING" (last evaluations failed) or "QUARANTINED" (not evaluated for
+//  quarantine_ms). Failures and quarantine_ms can be NULL.
+FTY_ALERT_FLEXIBLE_PRIVATE const char *
+    rule_health (rule_t *self, int *failures, int64_t *quarantine_ms);
+
+//  Get minimal time between evaluations of rule for one asset in ms, -1 if
+//  rule doesn't set it. Template instance inherits it from template.
+FTY_ALERT_FLEXIBLE_PRIVATE int
+    rule_min_interval (rule_t *self);
+
+//  Get number of lua evaluations answered from memo (hits) and evaluated
+//  (misses). Rules with impure code are not counted.
 FTY_ALERT_FLEXIBLE_PRIVATE void
-rule_evaluate (rule_t *self, zlist_t *params, const char *iname, const char *ename, int *result, char **message);
+    rule_memo_stats (uint64_t *hits, uint64_t *misses);
+
+//  Bytes in use by lua state of rule (shared by rules with the same
+//  evaluation), 0 if rule has no lua state
+FTY_ALERT_FLEXIBLE_PRIVATE size_t
+    rule_lua_memory (rule_t *self);
+
+//  Classify numeric metric values of many assets by single metric rule at
+//  once, results are the same rule_evaluate would give. Returns 0 on
+//  success, -1 if rule can't be classified this way.
+FTY_ALERT_FLEXIBLE_PRIVATE int
+    rule_classify (rule_t *self, const double *values, size_t count, int *results);
 
 //  @end
 
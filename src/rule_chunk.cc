@@ -0,0 +1,800 @@
+/*  =========================================================================
+    rule_chunk - Compiled lua code shared by rules
+
+    Copyright (C) 2016 - 2017 Tomas Halman
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+/*
+@header
+    rule_chunk - Compiled lua code shared by rules
+@discuss
+    Many rules differ only in their variables and assets, their evaluation
+    code is the same. Chunks are interned by hash of the source, so such
+    rules share one lua state and one compiled function prototype.
+
+    Every rule gets its own environment: a table with the rule's variables
+    that falls back to the chunk globals (OK, WARNING, ...). The chunk is
+    run once in that environment, which defines main() as closure of the
+    shared prototype. With Lua 5.2 and newer, where function environments
+    can't be switched, the source is compiled with "local _ENV = ..." in
+    front of it on its first line, and the environment is passed to the
+    chunk as argument, so it is still compiled only once.
+
+    Chunk is freed with the last reference, which rule_destroy drops.
+
+    Code runs with limits, so a rule with endless loop or runaway string
+    building can't block the agent: count hook aborts it after configured
+    number of instructions and the allocator of the state refuses to grow
+    memory over the configured amount during one call.
+
+    Lua states allocate from the agent's lua_pool unless the system
+    allocator is configured, the bytes each state uses are tracked.
+
+    Garbage is collected when the agent is idle: rule_chunk_gc_idle steps
+    the collector of every state within a time budget. Automatic collection
+    waits until memory grows tenfold (generational mode with Lua 5.4), and
+    an evaluation makes one step itself only when its state has doubled since
+    the last finished cycle, so collection rarely adds to evaluation latency.
+    Time of both kinds of steps is measured. When the idle collection is
+    finished, slabs of lua_pool without live blocks are released.
+@end
+*/
+
+#include "fty_alert_flexible_classes.h"
+
+#include <lua.h>
+#include <lauxlib.h>
+#include <lualib.h>
+#include <pthread.h>
+#include <inttypes.h>
+
+//  Structure of our class
+
+struct _rule_chunk_t {
+    int refs;                   //  guarded by s_chunks_mutex
+    uint64_t hash;
+    char *key;                  //  key in s_chunks, NULL if not interned
+    char *source;
+    lua_State *lua;
+    int prototype;              //  registry reference of compiled chunk
+    size_t environments;
+    pthread_mutex_t mutex;      //  serializes use of lua state
+    lua_pool_t *pool;           //  NULL for system allocator
+    size_t memory;              //  bytes allocated by lua state
+    size_t memory_ceiling;      //  during call, 0 for no limit
+    int aborted;                //  why the call was aborted, 0 if it wasn't
+    size_t memory_live;         //  bytes after last finished gc cycle
+    rule_chunk_t *prev;         //  list of all chunks, guarded by s_chunks_mutex
+    rule_chunk_t *next;
+};
+
+#define CHUNK_ENV_PREFIX "local _ENV = ... "
+
+#define GC_PAUSE        1000    //  automatic collection at tenfold memory [%]
+#define GC_HOT_GROWTH   2       //  evaluation steps gc when state doubled
+
+static zhashx_t *s_chunks = NULL;   //  hash of source -> rule_chunk_t
+static pthread_mutex_t s_chunks_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static int s_instructions_limit = RULE_CHUNK_INSTRUCTIONS_LIMIT;
+static size_t s_memory_limit = RULE_CHUNK_MEMORY_LIMIT;
+static uint64_t s_aborted_instructions = 0;
+static uint64_t s_aborted_memory = 0;
+static bool s_use_pool = true;
+static rule_chunk_t *s_all = NULL;      //  every chunk, guarded by s_chunks_mutex
+static rule_chunk_t *s_gc_cursor = NULL;    //  where next idle collection starts
+static int s_gc_budget = RULE_CHUNK_GC_BUDGET;
+static uint64_t s_gc_hot_usecs = 0;
+static uint64_t s_gc_idle_usecs = 0;
+
+//  --------------------------------------------------------------------------
+//  Let idle collection do the work, or restore default lua collector
+
+static void
+s_gc_mode (lua_State *lua, bool idle)
+{
+#if LUA_VERSION_NUM >= 504
+    if (idle)
+        lua_gc (lua, LUA_GCGEN, 0, 0);
+    else
+        lua_gc (lua, LUA_GCINC, 0, 0, 0);
+#else
+    lua_gc (lua, LUA_GCSETPAUSE, idle ? GC_PAUSE : 200);
+#endif
+}
+
+//  --------------------------------------------------------------------------
+//  Allocator of lua states, keeps memory of call under the ceiling
+
+static void *
+s_alloc (void *ud, void *ptr, size_t osize, size_t nsize)
+{
+    rule_chunk_t *self = (rule_chunk_t *) ud;
+    size_t old = ptr ? osize : 0;   //  newer lua passes object type in osize
+    if (nsize == 0) {
+        if (self->pool)
+            lua_pool_realloc (self->pool, ptr, old, 0);
+        else
+            free (ptr);
+        self->memory -= old;
+        return NULL;
+    }
+    if (nsize > old && self->memory_ceiling && self->memory + (nsize - old) > self->memory_ceiling) {
+        self->aborted = RULE_CHUNK_MEMORY_EXCEEDED;
+        return NULL;
+    }
+    void *block;
+    if (self->pool)
+        block = lua_pool_realloc (self->pool, ptr, old, nsize);
+    else
+        block = realloc (ptr, nsize);
+    if (block)
+        self->memory = self->memory - old + nsize;
+    return block;
+}
+
+static int
+s_panic (lua_State *lua)
+{
+    log_fatal ("unprotected error in lua: %s", lua_tostring (lua, -1));
+    return 0;
+}
+
+//  Count hook, called when call runs out of instructions
+static void
+s_instructions_hook (lua_State *lua, lua_Debug *ar)
+{
+    void *ud = NULL;
+    lua_getallocf (lua, &ud);
+    ((rule_chunk_t *) ud)->aborted = RULE_CHUNK_INSTRUCTIONS_EXCEEDED;
+    luaL_error (lua, "instruction limit exceeded");
+}
+
+//  --------------------------------------------------------------------------
+//  FNV-1a hash of source
+
+static uint64_t
+s_hash (const char *source)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    for (const unsigned char *p = (const unsigned char *) source; *p; p++) {
+        hash ^= *p;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+//  --------------------------------------------------------------------------
+//  Create and compile new chunk, NULL on error
+
+static rule_chunk_t *
+s_chunk_new (const char *source, uint64_t hash)
+{
+    rule_chunk_t *self = (rule_chunk_t *) zmalloc (sizeof (rule_chunk_t));
+    assert (self);
+    self->refs = 1;
+    self->hash = hash;
+    self->source = strdup (source);
+    self->prototype = LUA_NOREF;
+    pthread_mutex_init (&self->mutex, NULL);
+    if (__atomic_load_n (&s_use_pool, __ATOMIC_RELAXED))
+        self->pool = lua_pool_shared ();
+    pthread_mutex_lock (&s_chunks_mutex);
+    self->next = s_all;
+    if (s_all)
+        s_all->prev = self;
+    s_all = self;
+    pthread_mutex_unlock (&s_chunks_mutex);
+    self->lua = lua_newstate (s_alloc, self);
+    if (!self->lua) {
+        rule_chunk_destroy (&self);
+        return NULL;
+    }
+    s_gc_mode (self->lua, __atomic_load_n (&s_gc_budget, __ATOMIC_RELAXED) > 0);
+    lua_atpanic (self->lua, s_panic);
+    luaL_openlibs (self->lua);
+#if LUA_VERSION_NUM > 501
+    //  environment is argument of chunk, messages keep name and lines of source
+    char *code = zsys_sprintf ("%s%s", CHUNK_ENV_PREFIX, source);
+    int rc = luaL_loadbuffer (self->lua, code, strlen (code), source);
+    zstr_free (&code);
+#else
+    int rc = luaL_loadstring (self->lua, source);
+#endif
+    if (rc != 0) {
+        log_error ("lua code can't be compiled: %s", lua_tostring (self->lua, -1));
+        rule_chunk_destroy (&self);
+        return NULL;
+    }
+    self->prototype = luaL_ref (self->lua, LUA_REGISTRYINDEX);
+
+    static const struct { const char *name; int value; } constants [] = {
+        { "OK", 0 }, { "WARNING", 1 }, { "HIGH_WARNING", 1 }, { "CRITICAL", 2 },
+        { "HIGH_CRITICAL", 2 }, { "LOW_WARNING", -1 }, { "LOW_CRITICAL", -2 }
+    };
+    for (size_t i = 0; i < sizeof (constants) / sizeof (constants [0]); i++) {
+        lua_pushnumber (self->lua, constants [i].value);
+        lua_setglobal (self->lua, constants [i].name);
+    }
+    self->memory_live = self->memory;
+    return self;
+}
+
+//  --------------------------------------------------------------------------
+//  Get compiled chunk for lua source. Rules with the same source share one
+//  chunk. Returns NULL if source can't be compiled.
+
+rule_chunk_t *
+rule_chunk_intern (const char *source)
+{
+    assert (source);
+    uint64_t hash = s_hash (source);
+    char key [17];
+    snprintf (key, sizeof (key), "%016" PRIx64, hash);
+
+    pthread_mutex_lock (&s_chunks_mutex);
+    if (!s_chunks)
+        s_chunks = zhashx_new ();
+    rule_chunk_t *self = (rule_chunk_t *) zhashx_lookup (s_chunks, key);
+    if (self && streq (self->source, source)) {
+        self->refs++;
+        pthread_mutex_unlock (&s_chunks_mutex);
+        return self;
+    }
+    bool collision = self != NULL;
+    pthread_mutex_unlock (&s_chunks_mutex);
+
+    //  compile outside of the lock, it can take a while
+    self = s_chunk_new (source, hash);
+    if (!self || collision)
+        return self;            //  different source with the same hash is not shared
+
+    pthread_mutex_lock (&s_chunks_mutex);
+    rule_chunk_t *other = (rule_chunk_t *) zhashx_lookup (s_chunks, key);
+    if (other && streq (other->source, source)) {
+        //  interned by another thread meanwhile
+        other->refs++;
+        pthread_mutex_unlock (&s_chunks_mutex);
+        rule_chunk_destroy (&self);
+        return other;
+    }
+    if (!other) {
+        self->key = strdup (key);
+        zhashx_insert (s_chunks, key, self);
+    }
+    pthread_mutex_unlock (&s_chunks_mutex);
+    return self;
+}
+
+//  --------------------------------------------------------------------------
+//  Destroy the rule_chunk. Chunk is freed when the last reference is dropped.
+
+void
+rule_chunk_destroy (rule_chunk_t **self_p)
+{
+    assert (self_p);
+    if (*self_p) {
+        rule_chunk_t *self = *self_p;
+        *self_p = NULL;
+        pthread_mutex_lock (&s_chunks_mutex);
+        if (--self->refs > 0) {
+            pthread_mutex_unlock (&s_chunks_mutex);
+            return;
+        }
+        if (self->key) {
+            zhashx_delete (s_chunks, self->key);
+            if (zhashx_size (s_chunks) == 0)
+                zhashx_destroy (&s_chunks);
+        }
+        if (s_gc_cursor == self)
+            s_gc_cursor = self->next;
+        if (self->prev)
+            self->prev->next = self->next;
+        else
+            s_all = self->next;
+        if (self->next)
+            self->next->prev = self->prev;
+        pthread_mutex_unlock (&s_chunks_mutex);
+        //  Free class properties here
+        if (self->lua)
+            lua_close (self->lua);
+        lua_pool_destroy (&self->pool);
+        zstr_free (&self->key);
+        zstr_free (&self->source);
+        pthread_mutex_destroy (&self->mutex);
+        //  Free object itself
+        free (self);
+    }
+}
+
+//  --------------------------------------------------------------------------
+//  Run chunk in new environment. Returns lua registry reference of the
+//  environment (table with function main), LUA_NOREF on error.
+
+int
+rule_chunk_environment_new (rule_chunk_t *self)
+{
+    assert (self);
+    lua_State *lua = rule_chunk_lock (self);
+
+    //  environment falls back to chunk globals
+    lua_newtable (lua);
+    lua_newtable (lua);
+#if LUA_VERSION_NUM > 501
+    lua_pushglobaltable (lua);
+#else
+    lua_pushvalue (lua, LUA_GLOBALSINDEX);
+#endif
+    lua_setfield (lua, -2, "__index");
+    lua_setmetatable (lua, -2);
+
+    lua_rawgeti (lua, LUA_REGISTRYINDEX, self->prototype);
+    lua_pushvalue (lua, -2);
+#if LUA_VERSION_NUM > 501
+    int nargs = 1;
+#else
+    lua_setfenv (lua, -2);
+    int nargs = 0;
+#endif
+    int environment = LUA_NOREF;
+    if (rule_chunk_pcall (self, nargs, 0) != 0) {
+        log_error ("lua code failed: %s", lua_tostring (lua, -1));
+        lua_pop (lua, 2);
+    }
+    else {
+        lua_getfield (lua, -1, "main");
+        bool has_main = lua_isfunction (lua, -1);
+        lua_pop (lua, 1);
+        if (has_main) {
+            environment = luaL_ref (lua, LUA_REGISTRYINDEX);
+            self->environments++;
+        }
+        else {
+            log_error ("main function not found in lua code");
+            lua_pop (lua, 1);
+        }
+    }
+    rule_chunk_unlock (self);
+    return environment;
+}
+
+//  --------------------------------------------------------------------------
+//  Free environment created by rule_chunk_environment_new
+
+void
+rule_chunk_environment_destroy (rule_chunk_t *self, int *environment_p)
+{
+    assert (self);
+    assert (environment_p);
+    if (*environment_p == LUA_NOREF)
+        return;
+    lua_State *lua = rule_chunk_lock (self);
+    luaL_unref (lua, LUA_REGISTRYINDEX, *environment_p);
+    self->environments--;
+    rule_chunk_unlock (self);
+    *environment_p = LUA_NOREF;
+}
+
+//  --------------------------------------------------------------------------
+//  Lock lua state of chunk. Lua state is used by one thread at a time.
+
+lua_State *
+rule_chunk_lock (rule_chunk_t *self)
+{
+    assert (self);
+    pthread_mutex_lock (&self->mutex);
+    return self->lua;
+}
+
+//  --------------------------------------------------------------------------
+//  Unlock lua state of chunk
+
+void
+rule_chunk_unlock (rule_chunk_t *self)
+{
+    assert (self);
+    pthread_mutex_unlock (&self->mutex);
+}
+
+//  --------------------------------------------------------------------------
+//  Call function on the stack of locked chunk like lua_pcall, within the
+//  instruction and memory limits. Returns RULE_CHUNK_INSTRUCTIONS_EXCEEDED
+//  or RULE_CHUNK_MEMORY_EXCEEDED if call was aborted for exceeding them.
+
+int
+rule_chunk_pcall (rule_chunk_t *self, int nargs, int nresults)
+{
+    assert (self);
+    int instructions = __atomic_load_n (&s_instructions_limit, __ATOMIC_RELAXED);
+    size_t memory = __atomic_load_n (&s_memory_limit, __ATOMIC_RELAXED);
+    self->aborted = 0;
+    self->memory_ceiling = memory ? self->memory + memory : 0;
+    if (instructions)
+        lua_sethook (self->lua, s_instructions_hook, LUA_MASKCOUNT, instructions);
+    int rc = lua_pcall (self->lua, nargs, nresults, 0);
+    if (instructions)
+        lua_sethook (self->lua, NULL, 0, 0);
+    self->memory_ceiling = 0;
+    if (rc != 0 && self->aborted) {
+        rc = self->aborted;
+        __atomic_add_fetch (rc == RULE_CHUNK_INSTRUCTIONS_EXCEEDED ? &s_aborted_instructions : &s_aborted_memory,
+            1, __ATOMIC_RELAXED);
+    }
+    self->aborted = 0;
+    //  idle collection doesn't keep up, do one step here
+    if (self->memory > GC_HOT_GROWTH * self->memory_live && __atomic_load_n (&s_gc_budget, __ATOMIC_RELAXED)) {
+        int64_t start = zclock_usecs ();
+        if (lua_gc (self->lua, LUA_GCSTEP, 0))
+            self->memory_live = self->memory;
+        __atomic_add_fetch (&s_gc_hot_usecs, zclock_usecs () - start, __ATOMIC_RELAXED);
+    }
+    return rc;
+}
+
+//  --------------------------------------------------------------------------
+//  Set limits of every lua call: number of instructions and bytes of memory
+//  it can allocate. Zero means no limit.
+
+void
+rule_chunk_set_limits (int instructions, size_t memory)
+{
+    __atomic_store_n (&s_instructions_limit, instructions > 0 ? instructions : 0, __ATOMIC_RELAXED);
+    __atomic_store_n (&s_memory_limit, memory, __ATOMIC_RELAXED);
+}
+
+//  --------------------------------------------------------------------------
+//  Use agent's lua_pool (default) or system allocator for lua states
+//  created from now on
+
+void
+rule_chunk_set_pool (bool pool)
+{
+    __atomic_store_n (&s_use_pool, pool, __ATOMIC_RELAXED);
+}
+
+//  --------------------------------------------------------------------------
+//  Set time budget of one rule_chunk_gc_idle call in microseconds. With
+//  zero budget, states collect garbage automatically as lua does by default.
+
+void
+rule_chunk_set_gc_budget (int usecs)
+{
+    if (usecs < 0)
+        usecs = 0;
+    __atomic_store_n (&s_gc_budget, usecs, __ATOMIC_RELAXED);
+    pthread_mutex_lock (&s_chunks_mutex);
+    for (rule_chunk_t *self = s_all; self; self = self->next) {
+        pthread_mutex_lock (&self->mutex);
+        if (self->lua)
+            s_gc_mode (self->lua, usecs > 0);
+        pthread_mutex_unlock (&self->mutex);
+    }
+    pthread_mutex_unlock (&s_chunks_mutex);
+}
+
+//  --------------------------------------------------------------------------
+//  Collect garbage of lua states within the time budget, call it when the
+//  agent is idle. Returns true if there is garbage left to collect.
+
+bool
+rule_chunk_gc_idle (void)
+{
+    int budget = __atomic_load_n (&s_gc_budget, __ATOMIC_RELAXED);
+    if (budget == 0)
+        return false;
+
+    int64_t start = zclock_usecs ();
+    int64_t now = start;
+    bool pending = false;
+    pthread_mutex_lock (&s_chunks_mutex);
+    rule_chunk_t *self = s_gc_cursor ? s_gc_cursor : s_all;
+    rule_chunk_t *first = self;
+    //  round robin, so every state gets its share of short budgets
+    while (self) {
+        if (now - start >= budget) {
+            pending = true;
+            break;
+        }
+        //  state used by evaluation is not waited for
+        if (pthread_mutex_trylock (&self->mutex) == 0) {
+            while (self->lua && self->memory > self->memory_live && now - start < budget) {
+                if (lua_gc (self->lua, LUA_GCSTEP, 0))
+                    self->memory_live = self->memory;
+                now = zclock_usecs ();
+            }
+            if (self->lua && self->memory > self->memory_live)
+                pending = true;
+            pthread_mutex_unlock (&self->mutex);
+        }
+        else
+            pending = true;
+        self = self->next ? self->next : s_all;
+        if (self == first)
+            break;
+    }
+    s_gc_cursor = self;
+    //  collection finished, empty slabs of agent's pool go back to system
+    for (self = pending ? NULL : s_all; self; self = self->next) {
+        if (self->pool) {
+            lua_pool_trim (self->pool);
+            break;
+        }
+    }
+    pthread_mutex_unlock (&s_chunks_mutex);
+    __atomic_add_fetch (&s_gc_idle_usecs, now - start, __ATOMIC_RELAXED);
+    return pending;
+}
+
+//  --------------------------------------------------------------------------
+//  Time spent collecting garbage in microseconds: during evaluations (hot)
+//  and in rule_chunk_gc_idle (idle). Either pointer can be NULL.
+
+void
+rule_chunk_gc_time (uint64_t *hot_usecs, uint64_t *idle_usecs)
+{
+    if (hot_usecs)
+        *hot_usecs = __atomic_load_n (&s_gc_hot_usecs, __ATOMIC_RELAXED);
+    if (idle_usecs)
+        *idle_usecs = __atomic_load_n (&s_gc_idle_usecs, __ATOMIC_RELAXED);
+}
+
+//  --------------------------------------------------------------------------
+//  Bytes in use by lua state of chunk
+
+size_t
+rule_chunk_memory (rule_chunk_t *self)
+{
+    assert (self);
+    pthread_mutex_lock (&self->mutex);
+    size_t memory = self->memory;
+    pthread_mutex_unlock (&self->mutex);
+    return memory;
+}
+
+//  --------------------------------------------------------------------------
+//  Number of calls aborted for given reason (RULE_CHUNK_INSTRUCTIONS_EXCEEDED
+//  or RULE_CHUNK_MEMORY_EXCEEDED)
+
+uint64_t
+rule_chunk_aborted (int reason)
+{
+    return __atomic_load_n (reason == RULE_CHUNK_INSTRUCTIONS_EXCEEDED ? &s_aborted_instructions : &s_aborted_memory,
+        __ATOMIC_RELAXED);
+}
+
+//  --------------------------------------------------------------------------
+//  Number of environments (rules) using the chunk
+
+size_t
+rule_chunk_environments (rule_chunk_t *self)
+{
+    assert (self);
+    return self->environments;
+}
+
+//  --------------------------------------------------------------------------
+//  Number of interned chunks
+
+size_t
+rule_chunk_count (void)
+{
+    pthread_mutex_lock (&s_chunks_mutex);
+    size_t count = s_chunks ? zhashx_size (s_chunks) : 0;
+    pthread_mutex_unlock (&s_chunks_mutex);
+    return count;
+}
+
+//  --------------------------------------------------------------------------
+//  Self test of this class
+
+//  Call main (x) in environment with variable limit set
+static int
+s_test_call (rule_chunk_t *chunk, int environment, double x)
+{
+    lua_State *lua = rule_chunk_lock (chunk);
+    lua_rawgeti (lua, LUA_REGISTRYINDEX, environment);
+    lua_getfield (lua, -1, "main");
+    lua_pushnumber (lua, x);
+    assert (lua_pcall (lua, 1, 1, 0) == 0);
+    int result = (int) lua_tointeger (lua, -1);
+    lua_pop (lua, 2);
+    rule_chunk_unlock (chunk);
+    return result;
+}
+
+static void
+s_test_set_limit (rule_chunk_t *chunk, int environment, const char *limit)
+{
+    lua_State *lua = rule_chunk_lock (chunk);
+    lua_rawgeti (lua, LUA_REGISTRYINDEX, environment);
+    lua_pushstring (lua, limit);
+    lua_setfield (lua, -2, "limit");
+    lua_pop (lua, 1);
+    rule_chunk_unlock (chunk);
+}
+
+void
+rule_chunk_test (bool verbose)
+{
+    printf (" * rule_chunk: ");
+
+    //  @selftest
+    size_t count = rule_chunk_count ();
+    const char *source = "function main (x) if x > tonumber (limit) then return CRITICAL end return OK end";
+    rule_chunk_t *a = rule_chunk_intern (source);
+    assert (a);
+    rule_chunk_t *b = rule_chunk_intern (source);
+    assert (a == b);
+    assert (rule_chunk_count () == count + 1);
+    rule_chunk_t *c = rule_chunk_intern ("function main (x) return WARNING end");
+    assert (c && c != a);
+    assert (rule_chunk_count () == count + 2);
+    assert (rule_chunk_intern ("function main (x) return") == NULL);
+    assert (rule_chunk_count () == count + 2);
+
+    //  shared code, own variables
+    int env_a = rule_chunk_environment_new (a);
+    int env_b = rule_chunk_environment_new (b);
+    assert (env_a != LUA_NOREF && env_b != LUA_NOREF && env_a != env_b);
+    assert (rule_chunk_environments (a) == 2);
+    s_test_set_limit (a, env_a, "10");
+    s_test_set_limit (b, env_b, "100");
+    assert (s_test_call (a, env_a, 50) == 2);
+    assert (s_test_call (b, env_b, 50) == 0);
+    assert (s_test_call (a, env_a, 5) == 0);
+
+    //  globals of chunk go to environment, errors name lines of source
+    rule_chunk_t *f = rule_chunk_intern ("count = 0\nfunction main (x)\n    count = count + 1\n    error ('boom')\nend");
+    assert (f);
+    int env_f = rule_chunk_environment_new (f);
+    assert (env_f != LUA_NOREF);
+    {
+        lua_State *lua = rule_chunk_lock (f);
+        lua_rawgeti (lua, LUA_REGISTRYINDEX, env_f);
+        lua_getfield (lua, -1, "main");
+        lua_pushnumber (lua, 1);
+        assert (rule_chunk_pcall (f, 1, 0) != 0);
+        assert (strstr (lua_tostring (lua, -1), ":4: boom"));
+        lua_pop (lua, 1);
+        lua_getfield (lua, -1, "count");
+        assert (lua_tonumber (lua, -1) == 1);
+        lua_pop (lua, 2);
+        lua_getglobal (lua, "count");
+        assert (lua_isnil (lua, -1));
+        lua_pop (lua, 1);
+        rule_chunk_unlock (f);
+    }
+    rule_chunk_environment_destroy (f, &env_f);
+    rule_chunk_destroy (&f);
+
+    //  chunk without main
+    rule_chunk_t *d = rule_chunk_intern ("x = 1");
+    assert (d);
+    int env_d = rule_chunk_environment_new (d);
+    assert (env_d == LUA_NOREF);
+    rule_chunk_destroy (&d);
+
+    rule_chunk_environment_destroy (a, &env_a);
+    assert (env_a == LUA_NOREF);
+    rule_chunk_destroy (&a);
+    assert (a == NULL);
+    //  still used by b
+    assert (rule_chunk_count () == count + 2);
+    assert (s_test_call (b, env_b, 500) == 2);
+    rule_chunk_environment_destroy (b, &env_b);
+    rule_chunk_destroy (&b);
+    assert (rule_chunk_count () == count + 1);
+    rule_chunk_destroy (&c);
+    assert (rule_chunk_count () == count);
+
+    //  runaway code is aborted, state stays usable
+    rule_chunk_t *e = rule_chunk_intern (
+        "function main (x)\n"
+        "    if x == 1 then while true do end end\n"
+        "    if x == 2 then local s = 'x' while true do s = s .. s end end\n"
+        "    if x == 3 then return string.rep ('x', 100000000) end\n"
+        "    return OK\n"
+        "end\n");
+    assert (e);
+    int env_e = rule_chunk_environment_new (e);
+    assert (env_e != LUA_NOREF);
+    rule_chunk_set_limits (100000, 1024 * 1024);
+    uint64_t instructions = rule_chunk_aborted (RULE_CHUNK_INSTRUCTIONS_EXCEEDED);
+    uint64_t memory = rule_chunk_aborted (RULE_CHUNK_MEMORY_EXCEEDED);
+    int expected [] = { RULE_CHUNK_INSTRUCTIONS_EXCEEDED, RULE_CHUNK_MEMORY_EXCEEDED, RULE_CHUNK_MEMORY_EXCEEDED };
+    for (int x = 1; x <= 3; x++) {
+        lua_State *lua = rule_chunk_lock (e);
+        lua_rawgeti (lua, LUA_REGISTRYINDEX, env_e);
+        lua_getfield (lua, -1, "main");
+        lua_pushnumber (lua, x);
+        int64_t start = zclock_mono ();
+        int rc = rule_chunk_pcall (e, 1, 1);
+        if (verbose)
+            log_info ("runaway main (%d) aborted in %d ms", x, (int) (zclock_mono () - start));
+        assert (rc == expected [x - 1]);
+        lua_settop (lua, 0);
+        rule_chunk_unlock (e);
+        assert (s_test_call (e, env_e, 0) == 0);
+    }
+    assert (rule_chunk_aborted (RULE_CHUNK_INSTRUCTIONS_EXCEEDED) == instructions + 1);
+    assert (rule_chunk_aborted (RULE_CHUNK_MEMORY_EXCEEDED) == memory + 2);
+    rule_chunk_set_limits (RULE_CHUNK_INSTRUCTIONS_LIMIT, RULE_CHUNK_MEMORY_LIMIT);
+    rule_chunk_environment_destroy (e, &env_e);
+    rule_chunk_destroy (&e);
+
+    //  memory of state is tracked with both allocators
+    for (int pool = 1; pool >= 0; pool--) {
+        rule_chunk_set_pool (pool);
+        rule_chunk_t *f = rule_chunk_intern ("function main (x) return OK, 'memory' end");
+        assert (f && (f->pool != NULL) == (pool == 1));
+        size_t memory = rule_chunk_memory (f);
+        assert (memory > 0);
+        int env_f = rule_chunk_environment_new (f);
+        assert (rule_chunk_memory (f) > memory);
+        for (int i = 0; i < 1000; i++)
+            s_test_call (f, env_f, i);
+        rule_chunk_environment_destroy (f, &env_f);
+        lua_State *lua = rule_chunk_lock (f);
+        lua_gc (lua, LUA_GCCOLLECT, 0);
+        rule_chunk_unlock (f);
+        if (verbose)
+            log_info ("%s allocator: %zu bytes of state", pool ? "pool" : "system", rule_chunk_memory (f));
+        rule_chunk_destroy (&f);
+    }
+    rule_chunk_set_pool (true);
+
+    //  garbage of evaluations is collected when idle
+    {
+        rule_chunk_t *g = rule_chunk_intern ("function main (x) local s = {} "
+            "for i = 1, 100 do s [i] = 'garbage ' .. i .. x end return OK, s [1] end");
+        assert (g);
+        int env_g = rule_chunk_environment_new (g);
+        lua_State *lua = rule_chunk_lock (g);
+        lua_gc (lua, LUA_GCCOLLECT, 0);
+        g->memory_live = g->memory;
+        rule_chunk_unlock (g);
+        for (int i = 0; i < 10; i++)
+            s_test_call (g, env_g, i);
+        size_t memory = rule_chunk_memory (g);
+        assert (memory > g->memory_live);
+        uint64_t idle1, idle2;
+        rule_chunk_gc_time (NULL, &idle1);
+        int64_t start = zclock_mono ();
+        while (rule_chunk_gc_idle ())
+            assert (zclock_mono () - start < 5000);
+        rule_chunk_gc_time (NULL, &idle2);
+        assert (idle2 >= idle1);
+        assert (rule_chunk_memory (g) < memory);
+        assert (g->memory_live == g->memory);
+        //  finished idle collection has released empty slabs
+        assert (g->pool && lua_pool_trim (g->pool) == 0);
+        if (verbose)
+            log_info ("idle gc: %zu -> %zu bytes in %" PRIu64 " us", memory, rule_chunk_memory (g), idle2 - idle1);
+
+        //  without budget nothing is collected when idle
+        rule_chunk_set_gc_budget (0);
+        for (int i = 0; i < 10; i++)
+            s_test_call (g, env_g, i);
+        assert (!rule_chunk_gc_idle ());
+        rule_chunk_set_gc_budget (RULE_CHUNK_GC_BUDGET);
+        rule_chunk_environment_destroy (g, &env_g);
+        rule_chunk_destroy (&g);
+    }
+    //  @end
+    printf ("OK\n");
+}
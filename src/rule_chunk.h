@@ -0,0 +1,132 @@
+/*  =========================================================================
+    rule_chunk - Compiled lua code shared by rules
+
+    Copyright (C) 2016 - 2017 Tomas Halman
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+#ifndef RULE_CHUNK_H_INCLUDED
+#define RULE_CHUNK_H_INCLUDED
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//  Opaque class structures to allow forward references
+#ifndef RULE_CHUNK_T_DEFINED
+typedef struct _rule_chunk_t rule_chunk_t;
+#define RULE_CHUNK_T_DEFINED
+#endif
+struct lua_State;
+
+//  Default limits of one lua call
+#define RULE_CHUNK_INSTRUCTIONS_LIMIT   1000000
+#define RULE_CHUNK_MEMORY_LIMIT         (4 * 1024 * 1024)
+
+//  Default time budget of idle garbage collection [us]
+#define RULE_CHUNK_GC_BUDGET            1000
+
+//  Results of rule_chunk_pcall for aborted calls
+#define RULE_CHUNK_INSTRUCTIONS_EXCEEDED    -1
+#define RULE_CHUNK_MEMORY_EXCEEDED          -2
+
+//  @interface
+//  Get compiled chunk for lua source. Rules with the same source share one
+//  chunk. Returns NULL if source can't be compiled.
+FTY_ALERT_FLEXIBLE_PRIVATE rule_chunk_t *
+    rule_chunk_intern (const char *source);
+
+//  Destroy the rule_chunk. Chunk is freed when the last reference is dropped.
+FTY_ALERT_FLEXIBLE_PRIVATE void
+    rule_chunk_destroy (rule_chunk_t **self_p);
+
+//  Run chunk in new environment. Returns lua registry reference of the
+//  environment (table with function main), LUA_NOREF on error.
+FTY_ALERT_FLEXIBLE_PRIVATE int
+    rule_chunk_environment_new (rule_chunk_t *self);
+
+//  Free environment created by rule_chunk_environment_new
+FTY_ALERT_FLEXIBLE_PRIVATE void
+    rule_chunk_environment_destroy (rule_chunk_t *self, int *environment_p);
+
+//  Lock lua state of chunk. Lua state is used by one thread at a time.
+FTY_ALERT_FLEXIBLE_PRIVATE struct lua_State *
+    rule_chunk_lock (rule_chunk_t *self);
+
+//  Unlock lua state of chunk
+FTY_ALERT_FLEXIBLE_PRIVATE void
+    rule_chunk_unlock (rule_chunk_t *self);
+
+//  Call function on the stack of locked chunk like lua_pcall, within the
+//  instruction and memory limits. Returns RULE_CHUNK_INSTRUCTIONS_EXCEEDED
+//  or RULE_CHUNK_MEMORY_EXCEEDED if call was aborted for exceeding them.
+FTY_ALERT_FLEXIBLE_PRIVATE int
+    rule_chunk_pcall (rule_chunk_t *self, int nargs, int nresults);
+
+//  Set limits of every lua call: number of instructions and bytes of memory
+//  it can allocate. Zero means no limit.
+FTY_ALERT_FLEXIBLE_PRIVATE void
+    rule_chunk_set_limits (int instructions, size_t memory);
+
+//  Use agent's lua_pool (default) or system allocator for lua states
+//  created from now on
+FTY_ALERT_FLEXIBLE_PRIVATE void
+    rule_chunk_set_pool (bool pool);
+
+//  Set time budget of one rule_chunk_gc_idle call in microseconds. With
+//  zero budget, states collect garbage automatically as lua does by default.
+FTY_ALERT_FLEXIBLE_PRIVATE void
+    rule_chunk_set_gc_budget (int usecs);
+
+//  Collect garbage of lua states within the time budget, call it when the
+//  agent is idle. Returns true if there is garbage left to collect.
+FTY_ALERT_FLEXIBLE_PRIVATE bool
+    rule_chunk_gc_idle (void);
+
+//  Time spent collecting garbage in microseconds: during evaluations (hot)
+//  and in rule_chunk_gc_idle (idle). Either pointer can be NULL.
+FTY_ALERT_FLEXIBLE_PRIVATE void
+    rule_chunk_gc_time (uint64_t *hot_usecs, uint64_t *idle_usecs);
+
+//  Bytes in use by lua state of chunk
+FTY_ALERT_FLEXIBLE_PRIVATE size_t
+    rule_chunk_memory (rule_chunk_t *self);
+
+//  Number of calls aborted for given reason (RULE_CHUNK_INSTRUCTIONS_EXCEEDED
+//  or RULE_CHUNK_MEMORY_EXCEEDED)
+FTY_ALERT_FLEXIBLE_PRIVATE uint64_t
+    rule_chunk_aborted (int reason);
+
+//  Number of environments (rules) using the chunk
+FTY_ALERT_FLEXIBLE_PRIVATE size_t
+    rule_chunk_environments (rule_chunk_t *self);
+
+//  Number of interned chunks
+FTY_ALERT_FLEXIBLE_PRIVATE size_t
+    rule_chunk_count (void);
+
+//  Self test of this class
+FTY_ALERT_FLEXIBLE_PRIVATE void
+    rule_chunk_test (bool verbose);
+
+//  @end
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,1333 @@
+/*  =========================================================================
+    rule_expression - Bytecode compiler and interpreter of simple rules
+
+    Copyright (C) 2016 - 2017 Tomas Halman
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+/*
+@header
+    rule_expression - Bytecode compiler and interpreter of simple rules
+@discuss
+    Rules selecting "engine":"expression" have their evaluation compiled to
+    a small register based bytecode instead of lua. Supported is a subset
+    of lua enough for state change and comparison rules:
+
+        function main (<params>)
+            if <expr> then return <expr>, <expr>
+            elseif <expr> then ... else ... end
+            return <expr>, <expr>
+        end
+
+    Expressions know literals, parameters, NAME, INAME, rule variables,
+    severity constants, comparisons, arithmetic, .., and, or, not,
+    string.format, tonumber and tostring.
+
+    Values are typed like in lua (nil, boolean, number, string) and follow
+    lua rules, so results are the same as from lua: parameters and variables
+    are strings (or numbers, if they are numbers and the rule is typed),
+    comparison of strings is strcoll, arithmetic converts strings to
+    numbers. Variables are known at compile time and become
+    constants; operations on constants are folded. Whenever lua would raise
+    an error, evaluation returns -1 and the rule is left to lua.
+@end
+*/
+
+#include "fty_alert_flexible_classes.h"
+
+#include <math.h>
+#include <limits.h>
+
+//  Values, typed like in lua
+typedef enum {
+    VALUE_NIL,
+    VALUE_BOOLEAN,
+    VALUE_NUMBER,
+    VALUE_STRING
+} value_type_t;
+
+typedef struct {
+    value_type_t type;
+    bool boolean;
+    double number;
+    const char *string;
+} value_t;
+
+//  Instructions. A is register, B and C are registers or constants (RK),
+//  jump target is in B.
+typedef enum {
+    OP_MOVE,                    //  R(A) = RK(B)
+    OP_NAME,                    //  R(A) = NAME
+    OP_INAME,                   //  R(A) = INAME
+    OP_EQ,                      //  R(A) = RK(B) op RK(C)
+    OP_NE,
+    OP_LT,
+    OP_LE,
+    OP_ADD,
+    OP_SUB,
+    OP_MUL,
+    OP_DIV,
+    OP_MOD,
+    OP_POW,
+    OP_CONCAT,
+    OP_NEG,                     //  R(A) = op RK(B)
+    OP_NOT,
+    OP_TONUMBER,
+    OP_TOSTRING,
+    OP_FORMAT,                  //  R(A) = string.format (R(B) ... R(B+C-1))
+    OP_JMP,                     //  pc = B
+    OP_JMPF,                    //  if not R(A) then pc = B
+    OP_JMPT,                    //  if R(A) then pc = B
+    OP_RETURN                   //  return A values: RK(B), RK(C)
+} opcode_t;
+
+typedef struct {
+    uint8_t op;
+    uint8_t a;
+    uint16_t b;
+    uint16_t c;
+} instruction_t;
+
+#define RK_CONSTANT     0x8000
+#define MAX_REGISTERS   250
+#define MAX_CONSTANTS   0x7fff
+#define MAX_CODE        0xffff
+
+//  Structure of our class
+
+struct _rule_expression_t {
+    instruction_t *code;
+    size_t code_size;
+    value_t *constants;         //  strings are owned
+    size_t constants_count;
+    size_t params;              //  parameters are in first registers
+    bool typed;                 //  numeric parameters are numbers
+};
+
+//  --------------------------------------------------------------------------
+//  Strings created during evaluation, freed at once
+
+typedef struct _arena_block_t {
+    struct _arena_block_t *next;
+} arena_block_t;
+
+typedef struct {
+    char buffer [1024];
+    size_t used;
+    arena_block_t *blocks;
+} arena_t;
+
+static void
+s_arena_init (arena_t *arena)
+{
+    arena->used = 0;
+    arena->blocks = NULL;
+}
+
+static char *
+s_arena_alloc (arena_t *arena, size_t size)
+{
+    if (arena->used + size <= sizeof (arena->buffer)) {
+        char *p = arena->buffer + arena->used;
+        arena->used += size;
+        return p;
+    }
+    arena_block_t *block = (arena_block_t *) malloc (sizeof (arena_block_t) + size);
+    assert (block);
+    block->next = arena->blocks;
+    arena->blocks = block;
+    return (char *) (block + 1);
+}
+
+static void
+s_arena_free (arena_t *arena)
+{
+    while (arena->blocks) {
+        arena_block_t *next = arena->blocks->next;
+        free (arena->blocks);
+        arena->blocks = next;
+    }
+    arena->used = 0;
+}
+
+//  --------------------------------------------------------------------------
+//  Operations with lua semantics, shared by constant folding and interpreter.
+//  Return -1 where lua raises an error.
+
+static bool
+s_truthy (const value_t *value)
+{
+    return !(value->type == VALUE_NIL || (value->type == VALUE_BOOLEAN && !value->boolean));
+}
+
+//  String to number like lua (luaO_str2d)
+static bool
+s_str2number (const char *string, double *number)
+{
+    char *end;
+    *number = strtod (string, &end);
+    if (end == string)
+        return false;
+    while (isspace ((unsigned char) *end))
+        end++;
+    return *end == 0;
+}
+
+static bool
+s_tonumber (const value_t *value, double *number)
+{
+    if (value->type == VALUE_NUMBER) {
+        *number = value->number;
+        return true;
+    }
+    if (value->type == VALUE_STRING)
+        return s_str2number (value->string, number);
+    return false;
+}
+
+//  String of string or number, NULL for other types
+static const char *
+s_tostring (const value_t *value, arena_t *arena)
+{
+    if (value->type == VALUE_STRING)
+        return value->string;
+    if (value->type != VALUE_NUMBER)
+        return NULL;
+    char *string = s_arena_alloc (arena, 32);
+    snprintf (string, 32, "%.14g", value->number);
+    return string;
+}
+
+static void
+s_set_boolean (value_t *value, bool boolean)
+{
+    value->type = VALUE_BOOLEAN;
+    value->boolean = boolean;
+}
+
+static void
+s_set_number (value_t *value, double number)
+{
+    value->type = VALUE_NUMBER;
+    value->number = number;
+}
+
+static void
+s_set_string (value_t *value, const char *string)
+{
+    value->type = VALUE_STRING;
+    value->string = string;
+}
+
+static int
+s_binary (int op, const value_t *b, const value_t *c, value_t *a, arena_t *arena)
+{
+    switch (op) {
+        case OP_EQ:
+        case OP_NE: {
+            bool equal = b->type == c->type;
+            if (equal) {
+                if (b->type == VALUE_BOOLEAN)
+                    equal = b->boolean == c->boolean;
+                else
+                if (b->type == VALUE_NUMBER)
+                    equal = b->number == c->number;
+                else
+                if (b->type == VALUE_STRING)
+                    equal = streq (b->string, c->string);
+            }
+            s_set_boolean (a, equal == (op == OP_EQ));
+            return 0;
+        }
+        case OP_LT:
+        case OP_LE: {
+            int cmp;
+            if (b->type == VALUE_NUMBER && c->type == VALUE_NUMBER)
+                cmp = b->number < c->number ? -1 : (b->number == c->number ? 0 : 1);
+            else
+            if (b->type == VALUE_STRING && c->type == VALUE_STRING)
+                cmp = strcoll (b->string, c->string);
+            else
+                return -1;
+            //  NaN is neither less nor equal
+            if (b->type == VALUE_NUMBER && (isnan (b->number) || isnan (c->number)))
+                s_set_boolean (a, false);
+            else
+                s_set_boolean (a, op == OP_LT ? cmp < 0 : cmp <= 0);
+            return 0;
+        }
+        case OP_CONCAT: {
+            const char *left = s_tostring (b, arena);
+            const char *right = s_tostring (c, arena);
+            if (!left || !right)
+                return -1;
+            size_t left_size = strlen (left);
+            size_t right_size = strlen (right);
+            char *string = s_arena_alloc (arena, left_size + right_size + 1);
+            memcpy (string, left, left_size);
+            memcpy (string + left_size, right, right_size + 1);
+            s_set_string (a, string);
+            return 0;
+        }
+        default: {
+            double x, y;
+            if (!s_tonumber (b, &x) || !s_tonumber (c, &y))
+                return -1;
+            switch (op) {
+                case OP_ADD: s_set_number (a, x + y); break;
+                case OP_SUB: s_set_number (a, x - y); break;
+                case OP_MUL: s_set_number (a, x * y); break;
+                case OP_DIV: s_set_number (a, x / y); break;
+                case OP_MOD: s_set_number (a, x - floor (x / y) * y); break;
+                case OP_POW: s_set_number (a, pow (x, y)); break;
+                default: return -1;
+            }
+            return 0;
+        }
+    }
+}
+
+static int
+s_unary (int op, const value_t *b, value_t *a, arena_t *arena)
+{
+    double number;
+    switch (op) {
+        case OP_MOVE:
+            *a = *b;
+            return 0;
+        case OP_NEG:
+            if (!s_tonumber (b, &number))
+                return -1;
+            s_set_number (a, -number);
+            return 0;
+        case OP_NOT:
+            s_set_boolean (a, !s_truthy (b));
+            return 0;
+        case OP_TONUMBER:
+            if (s_tonumber (b, &number))
+                s_set_number (a, number);
+            else
+                a->type = VALUE_NIL;
+            return 0;
+        case OP_TOSTRING:
+            if (b->type == VALUE_NIL)
+                s_set_string (a, "nil");
+            else
+            if (b->type == VALUE_BOOLEAN)
+                s_set_string (a, b->boolean ? "true" : "false");
+            else
+                s_set_string (a, s_tostring (b, arena));
+            return 0;
+        default:
+            return -1;
+    }
+}
+
+//  string.format of lua 5.1
+static int
+s_format (const value_t *args, size_t count, value_t *a, arena_t *arena)
+{
+    const char *format = count ? s_tostring (&args [0], arena) : NULL;
+    if (!format)
+        return -1;
+    char *buffer = NULL;
+    size_t size = 0;
+    size_t arg = 1;
+    int rc = 0;
+    const char *p = format;
+    while (*p && rc == 0) {
+        const char *start = p;
+        char piece [512];
+        char spec [32];
+        int length;
+        if (*p != '%' || p [1] == '%') {
+            piece [0] = *p;
+            length = 1;
+            p += *p == '%' ? 2 : 1;
+        }
+        else {
+            p++;
+            const char *flags = p;
+            while (*p && strchr ("-+ #0", *p))
+                p++;
+            if (p - flags > 5) { rc = -1; break; }
+            if (isdigit ((unsigned char) *p)) p++;
+            if (isdigit ((unsigned char) *p)) p++;
+            if (*p == '.') {
+                p++;
+                if (isdigit ((unsigned char) *p)) p++;
+                if (isdigit ((unsigned char) *p)) p++;
+            }
+            if (isdigit ((unsigned char) *p) || arg >= count) { rc = -1; break; }
+            char conversion = *p++;
+            size_t spec_size = p - start - 1;
+            memcpy (spec, start, spec_size);
+            const value_t *value = &args [arg++];
+            double number;
+            switch (conversion) {
+                case 'c':
+                case 'd':
+                case 'i':
+                case 'o':
+                case 'u':
+                case 'x':
+                case 'X':
+                case 'e':
+                case 'E':
+                case 'f':
+                case 'g':
+                case 'G':
+                    if (!s_tonumber (value, &number)) { rc = -1; break; }
+                    if (conversion == 'c') {
+                        snprintf (spec + spec_size, sizeof (spec) - spec_size, "c");
+                        length = snprintf (piece, sizeof (piece), spec, (int) number);
+                    }
+                    else
+                    if (conversion == 'd' || conversion == 'i') {
+                        snprintf (spec + spec_size, sizeof (spec) - spec_size, "l%c", conversion);
+                        length = snprintf (piece, sizeof (piece), spec, (long) number);
+                    }
+                    else
+                    if (strchr ("ouxX", conversion)) {
+                        snprintf (spec + spec_size, sizeof (spec) - spec_size, "l%c", conversion);
+                        length = snprintf (piece, sizeof (piece), spec, (unsigned long) number);
+                    }
+                    else {
+                        snprintf (spec + spec_size, sizeof (spec) - spec_size, "%c", conversion);
+                        length = snprintf (piece, sizeof (piece), spec, number);
+                    }
+                    break;
+                case 's': {
+                    const char *string = s_tostring (value, arena);
+                    if (!string) { rc = -1; break; }
+                    if (!memchr (spec, '.', spec_size) && strlen (string) >= 100) {
+                        //  long string is taken as is, like lua does
+                        buffer = (char *) realloc (buffer, size + strlen (string) + 1);
+                        assert (buffer);
+                        memcpy (buffer + size, string, strlen (string));
+                        size += strlen (string);
+                        length = 0;
+                        break;
+                    }
+                    snprintf (spec + spec_size, sizeof (spec) - spec_size, "s");
+                    length = snprintf (piece, sizeof (piece), spec, string);
+                    break;
+                }
+                default:
+                    rc = -1;
+            }
+            if (rc != 0)
+                break;
+        }
+        if (length < 0 || length >= (int) sizeof (piece)) {
+            rc = -1;
+            break;
+        }
+        buffer = (char *) realloc (buffer, size + length + 1);
+        assert (buffer);
+        memcpy (buffer + size, piece, length);
+        size += length;
+    }
+    if (rc == 0) {
+        char *string = s_arena_alloc (arena, size + 1);
+        if (size)
+            memcpy (string, buffer, size);
+        string [size] = 0;
+        s_set_string (a, string);
+    }
+    free (buffer);
+    return rc;
+}
+
+//  --------------------------------------------------------------------------
+//  Compiler
+
+typedef struct {
+    rule_lexer_t *lexer;
+    rule_expression_t *program;
+    zhashx_t *variables;
+    bool typed;                 //  numeric variables are number constants
+    char *params [MAX_REGISTERS];
+    size_t top;                 //  first free register
+    bool error;
+    arena_t arena;              //  strings of folded constants
+} compiler_t;
+
+//  Compiled (sub)expression, either constant or in register
+typedef struct {
+    bool constant;
+    value_t value;
+    int reg;
+} exp_t;
+
+//  Lua globals which are not nil, can't be used in expressions
+static const char *s_lua_globals [] = {
+    "_G", "_VERSION", "assert", "collectgarbage", "coroutine", "debug", "dofile",
+    "error", "gcinfo", "getfenv", "getmetatable", "io", "ipairs", "load", "loadfile",
+    "loadstring", "math", "module", "newproxy", "next", "os", "package", "pairs",
+    "pcall", "print", "rawequal", "rawget", "rawset", "require", "select",
+    "setfenv", "setmetatable", "string", "table", "tonumber", "tostring", "type",
+    "unpack", "xpcall", NULL
+};
+
+static void
+s_next (compiler_t *self)
+{
+    rule_lexer_next (self->lexer);
+    if (rule_lexer_type (self->lexer) == RULE_LEXER_ERROR)
+        self->error = true;
+}
+
+static bool
+s_accept (compiler_t *self, const char *text)
+{
+    if (self->error || !rule_lexer_is (self->lexer, text))
+        return false;
+    s_next (self);
+    return true;
+}
+
+static void
+s_expect (compiler_t *self, const char *text)
+{
+    if (!s_accept (self, text))
+        self->error = true;
+}
+
+static bool
+s_is_block_end (compiler_t *self)
+{
+    return rule_lexer_type (self->lexer) == RULE_LEXER_END || rule_lexer_is (self->lexer, "end")
+        || rule_lexer_is (self->lexer, "else") || rule_lexer_is (self->lexer, "elseif");
+}
+
+static size_t
+s_emit (compiler_t *self, int op, int a, int b, int c)
+{
+    rule_expression_t *program = self->program;
+    if (program->code_size >= MAX_CODE) {
+        self->error = true;
+        return 0;
+    }
+    program->code = (instruction_t *) realloc (program->code, (program->code_size + 1) * sizeof (instruction_t));
+    assert (program->code);
+    instruction_t *instruction = &program->code [program->code_size];
+    instruction->op = (uint8_t) op;
+    instruction->a = (uint8_t) a;
+    instruction->b = (uint16_t) b;
+    instruction->c = (uint16_t) c;
+    return program->code_size++;
+}
+
+static int
+s_register (compiler_t *self)
+{
+    if (self->top >= MAX_REGISTERS) {
+        self->error = true;
+        return 0;
+    }
+    return (int) self->top++;
+}
+
+//  Register or constant operand of expression
+static int
+s_rk (compiler_t *self, exp_t *exp)
+{
+    if (!exp->constant)
+        return exp->reg;
+    rule_expression_t *program = self->program;
+    if (program->constants_count >= MAX_CONSTANTS) {
+        self->error = true;
+        return 0;
+    }
+    program->constants = (value_t *) realloc (program->constants, (program->constants_count + 1) * sizeof (value_t));
+    assert (program->constants);
+    value_t *constant = &program->constants [program->constants_count];
+    *constant = exp->value;
+    if (constant->type == VALUE_STRING)
+        constant->string = strdup (constant->string);
+    return (int) (program->constants_count++ | RK_CONSTANT);
+}
+
+static int
+s_to_register (compiler_t *self, exp_t *exp)
+{
+    if (!exp->constant)
+        return exp->reg;
+    int reg = s_register (self);
+    s_emit (self, OP_MOVE, reg, s_rk (self, exp), 0);
+    exp->constant = false;
+    exp->reg = reg;
+    return reg;
+}
+
+static exp_t
+s_constant_string (compiler_t *self, const char *string)
+{
+    exp_t exp;
+    memset (&exp, 0, sizeof (exp));
+    exp.constant = true;
+    char *copy = s_arena_alloc (&self->arena, strlen (string) + 1);
+    strcpy (copy, string);
+    s_set_string (&exp.value, copy);
+    return exp;
+}
+
+static exp_t
+s_binary_exp (compiler_t *self, int op, exp_t left, exp_t right)
+{
+    exp_t exp;
+    memset (&exp, 0, sizeof (exp));
+    if (left.constant && right.constant
+    &&  s_binary (op, &left.value, &right.value, &exp.value, &self->arena) == 0) {
+        exp.constant = true;
+        return exp;
+    }
+    //  not folded, errors are raised at run time like in lua
+    int b = s_rk (self, &left);
+    int c = s_rk (self, &right);
+    exp.reg = s_register (self);
+    s_emit (self, op, exp.reg, b, c);
+    return exp;
+}
+
+static exp_t
+s_unary_exp (compiler_t *self, int op, exp_t operand)
+{
+    exp_t exp;
+    memset (&exp, 0, sizeof (exp));
+    if (operand.constant && s_unary (op, &operand.value, &exp.value, &self->arena) == 0) {
+        exp.constant = true;
+        return exp;
+    }
+    int b = s_rk (self, &operand);
+    exp.reg = s_register (self);
+    s_emit (self, op, exp.reg, b, 0);
+    return exp;
+}
+
+static exp_t s_expression (compiler_t *self);
+
+//  Arguments of function call
+static size_t
+s_arguments (compiler_t *self, exp_t *args, size_t max)
+{
+    size_t count = 0;
+    s_expect (self, "(");
+    if (!s_accept (self, ")")) {
+        do {
+            if (count == max) {
+                self->error = true;
+                return 0;
+            }
+            args [count++] = s_expression (self);
+        } while (s_accept (self, ","));
+        s_expect (self, ")");
+    }
+    return count;
+}
+
+static exp_t
+s_name (compiler_t *self, const char *name)
+{
+    exp_t exp;
+    memset (&exp, 0, sizeof (exp));
+    for (size_t i = 0; self->params [i]; i++)
+        if (streq (self->params [i], name)) {
+            exp.reg = (int) i;
+            return exp;
+        }
+    if (streq (name, "NAME") || streq (name, "INAME")) {
+        exp.reg = s_register (self);
+        s_emit (self, streq (name, "NAME") ? OP_NAME : OP_INAME, exp.reg, 0, 0);
+        return exp;
+    }
+    const char *variable = self->variables ? (const char *) zhashx_lookup (self->variables, name) : NULL;
+    double number;
+    if (variable && self->typed && rule_threshold_number (variable, &number)) {
+        exp.constant = true;
+        s_set_number (&exp.value, number);
+        return exp;
+    }
+    if (variable)
+        return s_constant_string (self, variable);
+    exp.constant = true;
+    int severity;
+    if (rule_lexer_severity (name, strlen (name), &severity)) {
+        s_set_number (&exp.value, severity);
+        return exp;
+    }
+    for (int i = 0; s_lua_globals [i]; i++)
+        if (streq (s_lua_globals [i], name))
+            self->error = true;
+    //  undefined global
+    exp.value.type = VALUE_NIL;
+    return exp;
+}
+
+static exp_t
+s_primary (compiler_t *self)
+{
+    exp_t exp;
+    memset (&exp, 0, sizeof (exp));
+    exp.constant = true;
+    rule_lexer_t *lexer = self->lexer;
+    if (self->error)
+        return exp;
+    if (rule_lexer_type (lexer) == RULE_LEXER_NUMBER) {
+        s_set_number (&exp.value, rule_lexer_number (lexer));
+        s_next (self);
+    }
+    else
+    if (rule_lexer_type (lexer) == RULE_LEXER_STRING) {
+        exp = s_constant_string (self, rule_lexer_string (lexer));
+        s_next (self);
+    }
+    else
+    if (s_accept (self, "nil"))
+        exp.value.type = VALUE_NIL;
+    else
+    if (s_accept (self, "true"))
+        s_set_boolean (&exp.value, true);
+    else
+    if (s_accept (self, "false"))
+        s_set_boolean (&exp.value, false);
+    else
+    if (s_accept (self, "(")) {
+        exp = s_expression (self);
+        s_expect (self, ")");
+    }
+    else
+    if (s_accept (self, "string")) {
+        s_expect (self, ".");
+        s_expect (self, "format");
+        exp_t args [MAX_REGISTERS / 2];
+        size_t count = s_arguments (self, args, sizeof (args) / sizeof (args [0]));
+        bool constant = true;
+        for (size_t i = 0; i < count; i++)
+            constant = constant && args [i].constant;
+        if (constant) {
+            value_t values [MAX_REGISTERS / 2];
+            for (size_t i = 0; i < count; i++)
+                values [i] = args [i].value;
+            if (s_format (values, count, &exp.value, &self->arena) == 0)
+                return exp;
+        }
+        //  arguments must be in consecutive registers
+        int base = (int) self->top;
+        for (size_t i = 0; i < count; i++) {
+            int reg = s_register (self);
+            s_emit (self, OP_MOVE, reg, s_rk (self, &args [i]), 0);
+        }
+        exp.constant = false;
+        exp.reg = s_register (self);
+        s_emit (self, OP_FORMAT, exp.reg, base, (int) count);
+    }
+    else
+    if (rule_lexer_is (lexer, "tonumber") || rule_lexer_is (lexer, "tostring")) {
+        int op = rule_lexer_is (lexer, "tonumber") ? OP_TONUMBER : OP_TOSTRING;
+        s_next (self);
+        exp_t args [1];
+        if (s_arguments (self, args, 1) != 1) {
+            self->error = true;
+            return exp;
+        }
+        exp = s_unary_exp (self, op, args [0]);
+    }
+    else
+    if (rule_lexer_type (lexer) == RULE_LEXER_NAME) {
+        size_t size;
+        const char *start = rule_lexer_text (lexer, &size);
+        if (rule_lexer_keyword (start, size)) {
+            self->error = true;
+            return exp;
+        }
+        char *name = strndup (start, size);
+        s_next (self);
+        exp = s_name (self, name);
+        zstr_free (&name);
+    }
+    else
+        self->error = true;
+    return exp;
+}
+
+//  Right associative power binds stronger than unary operators
+static exp_t s_unary_expression (compiler_t *self);
+
+static exp_t
+s_power (compiler_t *self)
+{
+    exp_t base = s_primary (self);
+    if (s_accept (self, "^"))
+        return s_binary_exp (self, OP_POW, base, s_unary_expression (self));
+    return base;
+}
+
+static exp_t
+s_unary_expression (compiler_t *self)
+{
+    if (s_accept (self, "not"))
+        return s_unary_exp (self, OP_NOT, s_unary_expression (self));
+    if (s_accept (self, "-"))
+        return s_unary_exp (self, OP_NEG, s_unary_expression (self));
+    return s_power (self);
+}
+
+static exp_t
+s_multiplication (compiler_t *self)
+{
+    exp_t left = s_unary_expression (self);
+    while (!self->error) {
+        int op;
+        if (s_accept (self, "*")) op = OP_MUL;
+        else if (s_accept (self, "/")) op = OP_DIV;
+        else if (s_accept (self, "%")) op = OP_MOD;
+        else break;
+        left = s_binary_exp (self, op, left, s_unary_expression (self));
+    }
+    return left;
+}
+
+static exp_t
+s_addition (compiler_t *self)
+{
+    exp_t left = s_multiplication (self);
+    while (!self->error) {
+        int op;
+        if (s_accept (self, "+")) op = OP_ADD;
+        else if (s_accept (self, "-")) op = OP_SUB;
+        else break;
+        left = s_binary_exp (self, op, left, s_multiplication (self));
+    }
+    return left;
+}
+
+static exp_t
+s_concatenation (compiler_t *self)
+{
+    exp_t left = s_addition (self);
+    if (s_accept (self, ".."))
+        return s_binary_exp (self, OP_CONCAT, left, s_concatenation (self));
+    return left;
+}
+
+static exp_t
+s_comparison (compiler_t *self)
+{
+    exp_t left = s_concatenation (self);
+    while (!self->error) {
+        //  a > b is b < a, like in lua
+        if (s_accept (self, "==")) left = s_binary_exp (self, OP_EQ, left, s_concatenation (self));
+        else if (s_accept (self, "~=")) left = s_binary_exp (self, OP_NE, left, s_concatenation (self));
+        else if (s_accept (self, "<")) left = s_binary_exp (self, OP_LT, left, s_concatenation (self));
+        else if (s_accept (self, "<=")) left = s_binary_exp (self, OP_LE, left, s_concatenation (self));
+        else if (s_accept (self, ">")) left = s_binary_exp (self, OP_LT, s_concatenation (self), left);
+        else if (s_accept (self, ">=")) left = s_binary_exp (self, OP_LE, s_concatenation (self), left);
+        else break;
+    }
+    return left;
+}
+
+//  Short circuit and/or. Right side is dropped when constant left side
+//  decides.
+static exp_t
+s_logical (compiler_t *self, bool is_and)
+{
+    exp_t left = is_and ? s_comparison (self) : s_logical (self, true);
+    while (s_accept (self, is_and ? "and" : "or")) {
+        if (left.constant) {
+            size_t code_size = self->program->code_size;
+            exp_t right = is_and ? s_comparison (self) : s_logical (self, true);
+            if (s_truthy (&left.value) == is_and)
+                left = right;
+            else
+                self->program->code_size = code_size;
+            continue;
+        }
+        int reg = s_register (self);
+        s_emit (self, OP_MOVE, reg, left.reg, 0);
+        size_t jump = s_emit (self, is_and ? OP_JMPF : OP_JMPT, reg, 0, 0);
+        exp_t right = is_and ? s_comparison (self) : s_logical (self, true);
+        s_emit (self, OP_MOVE, reg, s_rk (self, &right), 0);
+        self->program->code [jump].b = (uint16_t) self->program->code_size;
+        left.reg = reg;
+    }
+    return left;
+}
+
+static exp_t
+s_expression (compiler_t *self)
+{
+    return s_logical (self, false);
+}
+
+static void s_block (compiler_t *self);
+
+static void
+s_if (compiler_t *self)
+{
+    size_t exits [64];
+    size_t exits_count = 0;
+    do {
+        exp_t condition = s_expression (self);
+        s_expect (self, "then");
+        int reg = s_to_register (self, &condition);
+        size_t skip = s_emit (self, OP_JMPF, reg, 0, 0);
+        s_block (self);
+        if (rule_lexer_is (self->lexer, "elseif") || rule_lexer_is (self->lexer, "else")) {
+            if (exits_count == sizeof (exits) / sizeof (exits [0])) {
+                self->error = true;
+                return;
+            }
+            exits [exits_count++] = s_emit (self, OP_JMP, 0, 0, 0);
+        }
+        if (self->error)
+            return;
+        self->program->code [skip].b = (uint16_t) self->program->code_size;
+    } while (s_accept (self, "elseif"));
+    if (s_accept (self, "else"))
+        s_block (self);
+    s_expect (self, "end");
+    if (self->error)
+        return;
+    for (size_t i = 0; i < exits_count; i++)
+        self->program->code [exits [i]].b = (uint16_t) self->program->code_size;
+}
+
+static void
+s_return (compiler_t *self)
+{
+    exp_t values [2];
+    size_t count = 0;
+    if (!s_is_block_end (self) && !rule_lexer_is (self->lexer, ";")) {
+        do {
+            exp_t value = s_expression (self);
+            //  lua takes two results, others are evaluated only
+            if (count < 2)
+                values [count++] = value;
+        } while (s_accept (self, ","));
+    }
+    int b = count > 0 ? s_rk (self, &values [0]) : 0;
+    int c = count > 1 ? s_rk (self, &values [1]) : 0;
+    s_emit (self, OP_RETURN, (int) count, b, c);
+    s_accept (self, ";");
+    if (!s_is_block_end (self))
+        self->error = true;
+}
+
+static void
+s_block (compiler_t *self)
+{
+    size_t params = self->top;
+    while (!self->error && !s_is_block_end (self)) {
+        if (s_accept (self, "if"))
+            s_if (self);
+        else
+        if (s_accept (self, "return"))
+            s_return (self);
+        else
+        if (!s_accept (self, ";"))
+            self->error = true;
+        //  temporaries are not used across statements
+        self->top = params;
+    }
+}
+
+//  --------------------------------------------------------------------------
+//  Compile lua evaluation of rule with given variables to bytecode. Typed
+//  rule gets parameters and variables which are numbers as numbers. Returns
+//  NULL if evaluation uses lua features outside of supported subset.
+
+rule_expression_t *
+rule_expression_new (const char *evaluation, zhashx_t *variables, bool typed)
+{
+    if (!evaluation)
+        return NULL;
+    rule_expression_t *self = (rule_expression_t *) zmalloc (sizeof (rule_expression_t));
+    assert (self);
+
+    compiler_t compiler;
+    memset (&compiler, 0, sizeof (compiler));
+    compiler.program = self;
+    compiler.variables = variables;
+    compiler.typed = typed;
+    compiler.lexer = rule_lexer_new (evaluation);
+    s_arena_init (&compiler.arena);
+    if (rule_lexer_type (compiler.lexer) == RULE_LEXER_ERROR)
+        compiler.error = true;
+
+    s_expect (&compiler, "function");
+    s_expect (&compiler, "main");
+    s_expect (&compiler, "(");
+    if (!s_accept (&compiler, ")")) {
+        do {
+            if (rule_lexer_type (compiler.lexer) != RULE_LEXER_NAME || compiler.top >= MAX_REGISTERS - 1) {
+                compiler.error = true;
+                break;
+            }
+            size_t size;
+            const char *start = rule_lexer_text (compiler.lexer, &size);
+            char *param = strndup (start, size);
+            for (size_t i = 0; i < compiler.top; i++)
+                if (streq (compiler.params [i], param))
+                    compiler.error = true;
+            if (rule_lexer_keyword (start, size))
+                compiler.error = true;
+            compiler.params [compiler.top++] = param;
+            s_next (&compiler);
+        } while (s_accept (&compiler, ","));
+        s_expect (&compiler, ")");
+    }
+    self->params = compiler.top;
+    self->typed = typed;
+    s_block (&compiler);
+    s_expect (&compiler, "end");
+    if (rule_lexer_type (compiler.lexer) != RULE_LEXER_END)
+        compiler.error = true;
+    //  main without return
+    s_emit (&compiler, OP_RETURN, 0, 0, 0);
+
+    for (size_t i = 0; compiler.params [i]; i++)
+        zstr_free (&compiler.params [i]);
+    rule_lexer_destroy (&compiler.lexer);
+    s_arena_free (&compiler.arena);
+    if (compiler.error)
+        rule_expression_destroy (&self);
+    return self;
+}
+
+//  --------------------------------------------------------------------------
+//  Destroy the rule_expression
+
+void
+rule_expression_destroy (rule_expression_t **self_p)
+{
+    assert (self_p);
+    if (*self_p) {
+        rule_expression_t *self = *self_p;
+        //  Free class properties here
+        for (size_t i = 0; i < self->constants_count; i++)
+            if (self->constants [i].type == VALUE_STRING)
+                free ((char *) self->constants [i].string);
+        free (self->constants);
+        free (self->code);
+        //  Free object itself
+        free (self);
+        *self_p = NULL;
+    }
+}
+
+//  --------------------------------------------------------------------------
+//  Take results of main like rule_evaluate takes them from lua stack
+
+static int
+s_results (size_t count, const value_t *first, const value_t *second, int *result, char **message, arena_t *arena)
+{
+    value_t nil;
+    nil.type = VALUE_NIL;
+    if (count < 1)
+        first = &nil;
+    if (count < 2)
+        second = &nil;
+    double number;
+    const value_t *text;
+    if (s_tonumber (second, &number))
+        text = first;
+    else
+    if (s_tonumber (first, &number))
+        text = second;
+    else
+        return -1;
+    //  lua converts other numbers by rules of its version and platform
+    if (!isfinite (number) || number != floor (number) || number < INT_MIN || number > INT_MAX)
+        return -1;
+    *result = (int) number;
+    const char *string = s_tostring (text, arena);
+    *message = string ? strdup (string) : NULL;
+    return 0;
+}
+
+//  --------------------------------------------------------------------------
+//  Evaluate compiled rule with the same result and message as lua would
+//  give. Returns 0 on success, -1 if rule must be evaluated by lua (lua
+//  would raise an error).
+
+int
+rule_expression_evaluate (rule_expression_t *self, zlist_t *params, const double *numbers,
+    const char *iname, const char *ename, int *result, char **message)
+{
+    assert (self);
+    if (!params || !iname || !result || !message)
+        return -1;
+
+    value_t registers [MAX_REGISTERS];
+    const char *param = (const char *) zlist_first (params);
+    for (size_t i = 0; i < self->params; i++) {
+        double number = numbers && param ? numbers [i] : NAN;
+        if (param && self->typed && !numbers && !rule_threshold_number (param, &number))
+            number = NAN;
+        if (param && self->typed && !isnan (number)) {
+            s_set_number (&registers [i], number);
+            param = (const char *) zlist_next (params);
+        }
+        else
+        if (param) {
+            s_set_string (&registers [i], param);
+            param = (const char *) zlist_next (params);
+        }
+        else
+            registers [i].type = VALUE_NIL;
+    }
+    arena_t arena;
+    s_arena_init (&arena);
+
+#define RK(x) ((x) & RK_CONSTANT ? &self->constants [(x) & ~RK_CONSTANT] : &registers [x])
+    int rc = -1;
+    size_t pc = 0;
+    while (pc < self->code_size) {
+        const instruction_t *instruction = &self->code [pc++];
+        value_t *a = &registers [instruction->a];
+        switch (instruction->op) {
+            case OP_NAME:
+                s_set_string (a, ename ? ename : iname);
+                break;
+            case OP_INAME:
+                s_set_string (a, iname);
+                break;
+            case OP_MOVE:
+                *a = *RK (instruction->b);
+                break;
+            case OP_JMP:
+                pc = instruction->b;
+                break;
+            case OP_JMPF:
+                if (!s_truthy (a))
+                    pc = instruction->b;
+                break;
+            case OP_JMPT:
+                if (s_truthy (a))
+                    pc = instruction->b;
+                break;
+            case OP_FORMAT:
+                if (s_format (&registers [instruction->b], instruction->c, a, &arena) != 0)
+                    goto done;
+                break;
+            case OP_RETURN:
+                rc = s_results (instruction->a, RK (instruction->b), RK (instruction->c), result, message, &arena);
+                goto done;
+            case OP_NEG:
+            case OP_NOT:
+            case OP_TONUMBER:
+            case OP_TOSTRING:
+                if (s_unary (instruction->op, RK (instruction->b), a, &arena) != 0)
+                    goto done;
+                break;
+            default: {
+                value_t value;
+                if (s_binary (instruction->op, RK (instruction->b), RK (instruction->c), &value, &arena) != 0)
+                    goto done;
+                *a = value;
+            }
+        }
+    }
+#undef RK
+done:
+    s_arena_free (&arena);
+    return rc;
+}
+
+//  --------------------------------------------------------------------------
+//  Number of bytecode instructions
+
+size_t
+rule_expression_size (rule_expression_t *self)
+{
+    assert (self);
+    return self->code_size;
+}
+
+//  --------------------------------------------------------------------------
+//  Self test of this class
+
+//  Evaluate with up to two parameters, returns rc
+static int
+s_test_evaluate (rule_expression_t *self, const char *x, const char *y, int *result, char **message)
+{
+    zlist_t *params = zlist_new ();
+    if (x) zlist_append (params, (void *) x);
+    if (y) zlist_append (params, (void *) y);
+    *result = 99;
+    *message = NULL;
+    int rc = rule_expression_evaluate (self, params, NULL, "rack-1", "Rack 1", result, message);
+    //  values converted when metrics came give the same result
+    double numbers [2];
+    const char *values [2] = { x, y };
+    for (int i = 0; i < 2; i++)
+        if (!values [i] || !rule_threshold_number (values [i], &numbers [i]))
+            numbers [i] = NAN;
+    int cached_result = 99;
+    char *cached_message = NULL;
+    assert (rule_expression_evaluate (self, params, numbers, "rack-1", "Rack 1", &cached_result, &cached_message) == rc);
+    assert (cached_result == *result);
+    assert (!cached_message == !*message && (!cached_message || streq (cached_message, *message)));
+    zstr_free (&cached_message);
+    zlist_destroy (&params);
+    return rc;
+}
+
+static void
+s_test_result (rule_expression_t *self, const char *x, const char *y, int expected, const char *expected_message)
+{
+    int result;
+    char *message;
+    assert (s_test_evaluate (self, x, y, &result, &message) == 0);
+    if (result != expected || !message || !streq (message, expected_message)) {
+        fprintf (stderr, "Expected %d '%s', got %d '%s'\n", expected, expected_message, result, message);
+        assert (false);
+    }
+    zstr_free (&message);
+}
+
+void
+rule_expression_test (bool verbose)
+{
+    printf (" * rule_expression: ");
+
+    //  @selftest
+    //  constant folding
+    rule_expression_t *self = rule_expression_new ("function main (x) return OK, 'a' .. 'b' .. 1 + 2 * 3 end", NULL, false);
+    assert (self);
+    //  folded return and implicit return at end of main
+    assert (rule_expression_size (self) == 2);
+    s_test_result (self, "x", NULL, 0, "ab7");
+    rule_expression_destroy (&self);
+    assert (self == NULL);
+
+    //  variables are constants
+    zhashx_t *variables = zhashx_new ();
+    zhashx_insert (variables, "limit", (void *) "10");
+    self = rule_expression_new ("function main (x) -- comment\n"
+        "  if x < limit then return LOW_WARNING, NAME .. ' is below ' .. limit end\n"
+        "  return OK, INAME;\n"
+        "end", variables, false);
+    assert (self);
+    s_test_result (self, "05", NULL, -1, "Rack 1 is below 10");
+    //  strings are compared as strings
+    s_test_result (self, "5", NULL, 0, "rack-1");
+    rule_expression_destroy (&self);
+
+    int result;
+    char *message;
+
+    //  typed rule compares numbers, lua formats them
+    self = rule_expression_new ("function main (x) -- comment\n"
+        "  if x < limit then return LOW_WARNING, NAME .. ' is below ' .. limit .. ': ' .. x end\n"
+        "  return OK, INAME;\n"
+        "end", variables, true);
+    assert (self);
+    s_test_result (self, "5.50", NULL, -1, "Rack 1 is below 10: 5.5");
+    s_test_result (self, "10", NULL, 0, "rack-1");
+    //  string compared with number
+    assert (s_test_evaluate (self, "abc", NULL, &result, &message) == -1);
+    rule_expression_destroy (&self);
+    self = rule_expression_new ("function main (x) if x == '1' then return OK, 'string' end return WARNING, x end", NULL, true);
+    assert (self);
+    s_test_result (self, "abc", NULL, 1, "abc");
+    s_test_result (self, "1", NULL, 1, "1");
+    rule_expression_destroy (&self);
+    zhashx_destroy (&variables);
+
+    //  elseif/else, string.format, tonumber
+    self = rule_expression_new (
+        "function main (x, y)\n"
+        "  if x == y then\n"
+        "    return OK, 'same'\n"
+        "  elseif tonumber (x) > tonumber (y) then\n"
+        "    return WARNING, x .. ' > ' .. y\n"
+        "  else\n"
+        "    return CRITICAL, string.format (\"%s < %5.1f (%d%%)\", x, y, 42)\n"
+        "  end\n"
+        "end", NULL, false);
+    assert (self);
+    s_test_result (self, "1", "1", 0, "same");
+    s_test_result (self, "5", "3", 1, "5 > 3");
+    s_test_result (self, "2", "30", 2, "2 <  30.0 (42%)");
+    //  comparison of nil with number
+    assert (s_test_evaluate (self, "abc", "3", &result, &message) == -1);
+    rule_expression_destroy (&self);
+
+    //  and/or, not, escapes
+    self = rule_expression_new ("function main (x) return x == 'a' and OK or not (x == 'b') and CRITICAL or WARNING, 'it\\'s \\65' end", NULL, false);
+    assert (self);
+    s_test_result (self, "a", NULL, 0, "it's A");
+    s_test_result (self, "b", NULL, 1, "it's A");
+    s_test_result (self, "c", NULL, 2, "it's A");
+    rule_expression_destroy (&self);
+
+    //  lua takes numeric message for result
+    self = rule_expression_new ("function main (x) return OK, x + 1 end", NULL, false);
+    assert (self);
+    s_test_result (self, "2", NULL, 3, "0");
+    //  arithmetic on string
+    assert (s_test_evaluate (self, "abc", NULL, &result, &message) == -1);
+    rule_expression_destroy (&self);
+    //  result which is not int is left to lua
+    self = rule_expression_new ("function main (x, y) return x / y, 'x' end", NULL, false);
+    assert (self);
+    s_test_result (self, "4", "2", 2, "x");
+    s_test_result (self, "-4", "2", -2, "x");
+    const char *invalid [][2] = { { "3", "2" }, { "0", "0" }, { "1", "0" }, { "-1e300", "1" }, { "1e10", "1" } };
+    for (size_t i = 0; i < sizeof (invalid) / sizeof (invalid [0]); i++)
+        assert (s_test_evaluate (self, invalid [i][0], invalid [i][1], &result, &message) == -1);
+    rule_expression_destroy (&self);
+
+    //  main without return
+    self = rule_expression_new ("function main (x) if x == 'a' then return OK, 'a' end end", NULL, false);
+    assert (self);
+    s_test_result (self, "a", NULL, 0, "a");
+    assert (s_test_evaluate (self, "b", NULL, &result, &message) == -1);
+    rule_expression_destroy (&self);
+
+    //  not supported
+    const char *others [] = {
+        "local x = 1 function main (x) return OK, 'x' end",
+        "function main (x) return OK, #x end",
+        "function main (x) for i = 1, 2 do end return OK, 'x' end",
+        "function main (x) return OK, print (x) end",
+        "function main (x) return OK, string.upper (x) end",
+        "function main (x) return OK, x:upper () end",
+        "function main (x) return OK, [[x]] end",
+        "function main (x) return OK, 'x' end function other () end",
+        "function main (x) return OK, 'x' return end",
+        "function main (x, x) return OK, 'x' end",
+        "function main (...) return OK, 'x' end",
+        "function main (x) return OK, 'x\n' end",
+        "function main (x) return OK, 'x'",
+        "",
+        NULL
+    };
+    for (int i = 0; others [i]; i++) {
+        self = rule_expression_new (others [i], NULL, false);
+        if (self) {
+            fprintf (stderr, "Expression compiler accepts\n%s\n", others [i]);
+            assert (0);
+        }
+    }
+    //  @end
+    printf ("OK\n");
+}
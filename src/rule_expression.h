@@ -0,0 +1,68 @@
+/*  =========================================================================
+    rule_expression - Bytecode compiler and interpreter of simple rules
+
+    Copyright (C) 2016 - 2017 Tomas Halman
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+#ifndef RULE_EXPRESSION_H_INCLUDED
+#define RULE_EXPRESSION_H_INCLUDED
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//  Opaque class structures to allow forward references
+#ifndef RULE_EXPRESSION_T_DEFINED
+typedef struct _rule_expression_t rule_expression_t;
+#define RULE_EXPRESSION_T_DEFINED
+#endif
+
+//  @interface
+//  Compile lua evaluation of rule with given variables to bytecode. Typed
+//  rule gets parameters and variables which are numbers as numbers. Returns
+//  NULL if evaluation uses lua features outside of supported subset.
+FTY_ALERT_FLEXIBLE_PRIVATE rule_expression_t *
+    rule_expression_new (const char *evaluation, zhashx_t *variables, bool typed);
+
+//  Destroy the rule_expression
+FTY_ALERT_FLEXIBLE_PRIVATE void
+    rule_expression_destroy (rule_expression_t **self_p);
+
+//  Evaluate compiled rule with the same result and message as lua would
+//  give. Numbers are params converted by rule_threshold_number when metrics
+//  came (NAN if not a number), NULL to convert them here. Returns 0 on
+//  success, -1 if rule must be evaluated by lua (lua would raise an error).
+FTY_ALERT_FLEXIBLE_PRIVATE int
+    rule_expression_evaluate (rule_expression_t *self, zlist_t *params, const double *numbers,
+        const char *iname, const char *ename, int *result, char **message);
+
+//  Number of bytecode instructions
+FTY_ALERT_FLEXIBLE_PRIVATE size_t
+    rule_expression_size (rule_expression_t *self);
+
+//  Self test of this class
+FTY_ALERT_FLEXIBLE_PRIVATE void
+    rule_expression_test (bool verbose);
+
+//  @end
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
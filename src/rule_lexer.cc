@@ -0,0 +1,417 @@
+/*  =========================================================================
+    rule_lexer - Lexer of lua subset understood by native engines
+
+    Copyright (C) 2016 - 2017 Tomas Halman
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+/*
+@header
+    rule_lexer - Lexer of lua subset understood by native engines
+@discuss
+    Tokens of lua code for rule_threshold and rule_expression: names,
+    numbers, string literals (decoded like lua does), and symbols. Comments
+    are skipped. Anything else is an error, so the rule is left to lua.
+    Lua keywords and severity constants of rules are known here too.
+@end
+*/
+
+#include "fty_alert_flexible_classes.h"
+
+//  Structure of our class
+
+struct _rule_lexer_t {
+    const char *p;              //  next character
+    int type;
+    const char *start;          //  source text of current token
+    size_t size;
+    char *string;               //  decoded string literal
+    double number;
+};
+
+static const char *s_keywords [] = {
+    "and", "break", "do", "else", "elseif", "end", "false", "for", "function",
+    "goto", "if", "in", "local", "nil", "not", "or", "repeat", "return", "then",
+    "true", "until", "while", NULL
+};
+
+static const struct {
+    const char *name;
+    int value;
+} s_severities [] = {
+    { "OK", 0 }, { "WARNING", 1 }, { "HIGH_WARNING", 1 }, { "CRITICAL", 2 },
+    { "HIGH_CRITICAL", 2 }, { "LOW_WARNING", -1 }, { "LOW_CRITICAL", -2 },
+    { NULL, 0 }
+};
+
+//  --------------------------------------------------------------------------
+//  Create a new rule_lexer of lua code, positioned on its first token
+
+rule_lexer_t *
+rule_lexer_new (const char *code)
+{
+    assert (code);
+    rule_lexer_t *self = (rule_lexer_t *) zmalloc (sizeof (rule_lexer_t));
+    assert (self);
+    self->p = code;
+    rule_lexer_next (self);
+    return self;
+}
+
+//  --------------------------------------------------------------------------
+//  Destroy the rule_lexer
+
+void
+rule_lexer_destroy (rule_lexer_t **self_p)
+{
+    assert (self_p);
+    if (*self_p) {
+        rule_lexer_t *self = *self_p;
+        zstr_free (&self->string);
+        free (self);
+        *self_p = NULL;
+    }
+}
+
+//  Skip long bracket [[...]] or [==[...]==] starting at p, NULL on error
+static const char *
+s_skip_long_bracket (const char *p)
+{
+    const char *q = p + 1;
+    size_t level = 0;
+    while (*q == '=') {
+        level++;
+        q++;
+    }
+    if (*q != '[')
+        return NULL;
+    for (q++; *q; q++) {
+        if (*q != ']')
+            continue;
+        size_t i = 0;
+        while (i < level && q [1 + i] == '=')
+            i++;
+        if (i == level && q [1 + level] == ']')
+            return q + level + 2;
+    }
+    return NULL;
+}
+
+//  Decode string literal starting at p
+static bool
+s_string (rule_lexer_t *self, const char *p)
+{
+    char quote = *p++;
+    size_t capacity = 64, size = 0;
+    char *string = (char *) malloc (capacity);
+    assert (string);
+    while (*p != quote) {
+        if (*p == 0 || *p == '\n') {
+            free (string);
+            return false;
+        }
+        char c = *p++;
+        if (c == '\\') {
+            c = *p++;
+            switch (c) {
+                case 'a': c = '\a'; break;
+                case 'b': c = '\b'; break;
+                case 'f': c = '\f'; break;
+                case 'n': c = '\n'; break;
+                case 'r': c = '\r'; break;
+                case 't': c = '\t'; break;
+                case 'v': c = '\v'; break;
+                case 0:
+                    free (string);
+                    return false;
+                default:
+                    if (isdigit ((unsigned char) c)) {
+                        int code = c - '0';
+                        for (int i = 0; i < 2 && isdigit ((unsigned char) *p); i++)
+                            code = code * 10 + (*p++ - '0');
+                        if (code > 255 || code == 0) {
+                            free (string);
+                            return false;
+                        }
+                        c = (char) code;
+                    }
+                    //  \\, \", \', \<newline> stand for themselves
+            }
+        }
+        if (size + 2 > capacity) {
+            capacity *= 2;
+            string = (char *) realloc (string, capacity);
+            assert (string);
+        }
+        string [size++] = c;
+    }
+    string [size] = 0;
+    self->string = string;
+    self->p = p + 1;
+    return true;
+}
+
+//  --------------------------------------------------------------------------
+//  Move to next token. Anything unexpected is RULE_LEXER_ERROR.
+
+void
+rule_lexer_next (rule_lexer_t *self)
+{
+    assert (self);
+    zstr_free (&self->string);
+    const char *p = self->p;
+    self->type = RULE_LEXER_ERROR;
+    while (true) {
+        while (isspace ((unsigned char) *p))
+            p++;
+        if (p [0] != '-' || p [1] != '-')
+            break;
+        p += 2;
+        if (*p == '[' && (p [1] == '[' || p [1] == '=')) {
+            p = s_skip_long_bracket (p);
+            if (!p)
+                return;
+        }
+        else
+            while (*p && *p != '\n')
+                p++;
+    }
+    self->start = p;
+    self->size = 0;
+    if (*p == 0) {
+        self->type = RULE_LEXER_END;
+        return;
+    }
+    if (isalpha ((unsigned char) *p) || *p == '_') {
+        while (isalnum ((unsigned char) *p) || *p == '_')
+            p++;
+        self->type = RULE_LEXER_NAME;
+    }
+    else
+    if (isdigit ((unsigned char) *p) || (*p == '.' && isdigit ((unsigned char) p [1]))) {
+        while (isdigit ((unsigned char) *p) || *p == '.')
+            p++;
+        if (*p == 'e' || *p == 'E') {
+            p++;
+            if (*p == '+' || *p == '-')
+                p++;
+        }
+        while (isalnum ((unsigned char) *p) || *p == '_')
+            p++;
+        //  whole literal must be number, like lua reads it
+        char *text = strndup (self->start, p - self->start);
+        char *end;
+        self->number = strtod (text, &end);
+        bool valid = end != text && *end == 0;
+        zstr_free (&text);
+        if (!valid)
+            return;
+        self->type = RULE_LEXER_NUMBER;
+    }
+    else
+    if (*p == '\'' || *p == '"') {
+        if (!s_string (self, p))
+            return;
+        self->type = RULE_LEXER_STRING;
+        self->size = self->p - self->start;
+        return;
+    }
+    else {
+        static const char *symbols [] = {
+            "...", "..", "==", "~=", "<=", ">=",
+            "+", "-", "*", "/", "%", "^", "#", "<", ">", "=",
+            "(", ")", "{", "}", "[", "]", ";", ":", ",", ".", NULL
+        };
+        int i;
+        for (i = 0; symbols [i]; i++)
+            if (strncmp (p, symbols [i], strlen (symbols [i])) == 0)
+                break;
+        if (!symbols [i])
+            return;
+        p += strlen (symbols [i]);
+        self->type = RULE_LEXER_SYMBOL;
+    }
+    self->size = p - self->start;
+    self->p = p;
+}
+
+//  --------------------------------------------------------------------------
+//  Return type of current token
+
+int
+rule_lexer_type (rule_lexer_t *self)
+{
+    assert (self);
+    return self->type;
+}
+
+//  --------------------------------------------------------------------------
+//  Return source text of current token, string literals with quotes. Text
+//  is not terminated, its size is stored to size.
+
+const char *
+rule_lexer_text (rule_lexer_t *self, size_t *size)
+{
+    assert (self);
+    assert (size);
+    *size = self->size;
+    return self->start;
+}
+
+//  --------------------------------------------------------------------------
+//  Return decoded string literal, NULL if current token is not a string
+
+const char *
+rule_lexer_string (rule_lexer_t *self)
+{
+    assert (self);
+    return self->string;
+}
+
+//  --------------------------------------------------------------------------
+//  Return value of number literal
+
+double
+rule_lexer_number (rule_lexer_t *self)
+{
+    assert (self);
+    return self->number;
+}
+
+//  --------------------------------------------------------------------------
+//  Is current token given name or symbol?
+
+bool
+rule_lexer_is (rule_lexer_t *self, const char *text)
+{
+    assert (self);
+    return (self->type == RULE_LEXER_NAME || self->type == RULE_LEXER_SYMBOL)
+        && self->size == strlen (text)
+        && strncmp (self->start, text, self->size) == 0;
+}
+
+//  --------------------------------------------------------------------------
+//  Move to next token if current one is given name or symbol
+
+bool
+rule_lexer_accept (rule_lexer_t *self, const char *text)
+{
+    if (!rule_lexer_is (self, text))
+        return false;
+    rule_lexer_next (self);
+    return true;
+}
+
+//  --------------------------------------------------------------------------
+//  Is name a lua keyword (of any lua version)?
+
+bool
+rule_lexer_keyword (const char *name, size_t size)
+{
+    for (int i = 0; s_keywords [i]; i++)
+        if (size == strlen (s_keywords [i]) && strncmp (name, s_keywords [i], size) == 0)
+            return true;
+    return false;
+}
+
+//  --------------------------------------------------------------------------
+//  Return severity constant (OK, WARNING, ...) of name and store its value,
+//  NULL if name is not severity.
+
+const char *
+rule_lexer_severity (const char *name, size_t size, int *value)
+{
+    for (int i = 0; s_severities [i].name; i++)
+        if (size == strlen (s_severities [i].name) && strncmp (name, s_severities [i].name, size) == 0) {
+            if (value)
+                *value = s_severities [i].value;
+            return s_severities [i].name;
+        }
+    return NULL;
+}
+
+//  --------------------------------------------------------------------------
+//  Self test of this class
+
+void
+rule_lexer_test (bool verbose)
+{
+    printf (" * rule_lexer: ");
+
+    //  @selftest
+    rule_lexer_t *self = rule_lexer_new (
+        "function main (x) -- comment\n"
+        "    --[==[ long ]] comment ]==]\n"
+        "    if x >= 1.5e1 then return HIGH_WARNING, 'it\\'s \\104igh' .. \"\" end\n"
+        "end");
+    assert (self);
+    const char *names [] = { "function", "main", "(", "x", ")", "if", "x", ">=", NULL };
+    for (int i = 0; names [i]; i++) {
+        assert (rule_lexer_is (self, names [i]));
+        assert (rule_lexer_string (self) == NULL);
+        rule_lexer_next (self);
+    }
+    assert (rule_lexer_type (self) == RULE_LEXER_NUMBER);
+    assert (rule_lexer_number (self) == 15);
+    size_t size;
+    const char *text = rule_lexer_text (self, &size);
+    assert (size == 5 && strncmp (text, "1.5e1", size) == 0);
+    rule_lexer_next (self);
+    assert (rule_lexer_accept (self, "then"));
+    assert (rule_lexer_accept (self, "return"));
+    assert (rule_lexer_type (self) == RULE_LEXER_NAME);
+    text = rule_lexer_text (self, &size);
+    int value = 0;
+    assert (streq (rule_lexer_severity (text, size, &value), "HIGH_WARNING"));
+    assert (value == 1);
+    assert (!rule_lexer_keyword (text, size));
+    rule_lexer_next (self);
+    assert (rule_lexer_accept (self, ","));
+    assert (rule_lexer_type (self) == RULE_LEXER_STRING);
+    assert (streq (rule_lexer_string (self), "it's high"));
+    text = rule_lexer_text (self, &size);
+    assert (size == 15 && text [0] == '\'');
+    rule_lexer_next (self);
+    assert (rule_lexer_accept (self, ".."));
+    assert (streq (rule_lexer_string (self), ""));
+    rule_lexer_next (self);
+    assert (!rule_lexer_accept (self, "else"));
+    assert (rule_lexer_accept (self, "end"));
+    assert (rule_lexer_accept (self, "end"));
+    assert (rule_lexer_type (self) == RULE_LEXER_END);
+    rule_lexer_destroy (&self);
+    rule_lexer_destroy (&self);
+
+    //  errors
+    const char *errors [] = { "1.5x", "'open", "'a\\0b'", "--[[ open", "@", "1..2", NULL };
+    for (int i = 0; errors [i]; i++) {
+        self = rule_lexer_new (errors [i]);
+        assert (rule_lexer_type (self) == RULE_LEXER_ERROR);
+        rule_lexer_destroy (&self);
+    }
+
+    //  keywords and severities
+    assert (rule_lexer_keyword ("goto", 4));
+    assert (rule_lexer_keyword ("end", 3));
+    assert (!rule_lexer_keyword ("ends", 3 + 1));
+    assert (!rule_lexer_keyword ("NAME", 4));
+    assert (rule_lexer_severity ("OK", 2, NULL));
+    assert (rule_lexer_severity ("LOW_CRITICAL", 12, &value) && value == -2);
+    assert (!rule_lexer_severity ("CRITICALS", 9, &value));
+    //  @end
+    printf ("OK\n");
+}
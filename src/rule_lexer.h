@@ -0,0 +1,100 @@
+/*  =========================================================================
+    rule_lexer - Lexer of lua subset understood by native engines
+
+    Copyright (C) 2016 - 2017 Tomas Halman
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+#ifndef RULE_LEXER_H_INCLUDED
+#define RULE_LEXER_H_INCLUDED
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//  Token types
+#define RULE_LEXER_END      0
+#define RULE_LEXER_NAME     1
+#define RULE_LEXER_NUMBER   2
+#define RULE_LEXER_STRING   3
+#define RULE_LEXER_SYMBOL   4
+#define RULE_LEXER_ERROR    5
+
+//  Opaque class structures to allow forward references
+#ifndef RULE_LEXER_T_DEFINED
+typedef struct _rule_lexer_t rule_lexer_t;
+#define RULE_LEXER_T_DEFINED
+#endif
+
+//  @interface
+//  Create a new rule_lexer of lua code, positioned on its first token
+FTY_ALERT_FLEXIBLE_PRIVATE rule_lexer_t *
+    rule_lexer_new (const char *code);
+
+//  Destroy the rule_lexer
+FTY_ALERT_FLEXIBLE_PRIVATE void
+    rule_lexer_destroy (rule_lexer_t **self_p);
+
+//  Move to next token. Anything unexpected is RULE_LEXER_ERROR.
+FTY_ALERT_FLEXIBLE_PRIVATE void
+    rule_lexer_next (rule_lexer_t *self);
+
+//  Return type of current token
+FTY_ALERT_FLEXIBLE_PRIVATE int
+    rule_lexer_type (rule_lexer_t *self);
+
+//  Return source text of current token, string literals with quotes. Text
+//  is not terminated, its size is stored to size.
+FTY_ALERT_FLEXIBLE_PRIVATE const char *
+    rule_lexer_text (rule_lexer_t *self, size_t *size);
+
+//  Return decoded string literal, NULL if current token is not a string
+FTY_ALERT_FLEXIBLE_PRIVATE const char *
+    rule_lexer_string (rule_lexer_t *self);
+
+//  Return value of number literal
+FTY_ALERT_FLEXIBLE_PRIVATE double
+    rule_lexer_number (rule_lexer_t *self);
+
+//  Is current token given name or symbol?
+FTY_ALERT_FLEXIBLE_PRIVATE bool
+    rule_lexer_is (rule_lexer_t *self, const char *text);
+
+//  Move to next token if current one is given name or symbol
+FTY_ALERT_FLEXIBLE_PRIVATE bool
+    rule_lexer_accept (rule_lexer_t *self, const char *text);
+
+//  Is name a lua keyword (of any lua version)?
+FTY_ALERT_FLEXIBLE_PRIVATE bool
+    rule_lexer_keyword (const char *name, size_t size);
+
+//  Return severity constant (OK, WARNING, ...) of name and store its value,
+//  NULL if name is not severity.
+FTY_ALERT_FLEXIBLE_PRIVATE const char *
+    rule_lexer_severity (const char *name, size_t size, int *value);
+
+//  Self test of this class
+FTY_ALERT_FLEXIBLE_PRIVATE void
+    rule_lexer_test (bool verbose);
+
+//  @end
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
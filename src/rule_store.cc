@@ -0,0 +1,790 @@
+/*  =========================================================================
+    rule_store - Append-only journal of rules
+
+    Copyright (C) 2016 - 2017 Tomas Halman
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+/*
+@header
+    rule_store - Append-only journal of rules
+@discuss
+    Alternative to one <name>.rule file per rule. All rules live in one
+    journal file, every change appends one record:
+
+        header      "FTYRULE1"
+        record      magic, operation, name size, json size, crc32
+                    name (zero terminated), json (zero terminated),
+                    padding to 8 bytes
+
+    Journal is memory mapped for reading, json returned by lookup points
+    directly to the mapping. Every put/delete is committed by fdatasync.
+    Record with wrong size or checksum at the end of journal comes from
+    interrupted write and is cut off when journal is opened.
+
+    When there are more bytes of overwritten records than of live ones,
+    journal is compacted: live records are written to <path>.tmp, which
+    is synced and renamed over the journal.
+@end
+*/
+
+#include "fty_alert_flexible_classes.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <libgen.h>
+#include <inttypes.h>
+
+#define RULE_STORE_HEADER       "FTYRULE1"
+#define RULE_STORE_HEADER_SIZE  8
+#define RULE_STORE_MAGIC        0x52554c45      //  "RULE"
+#define RULE_STORE_OP_PUT       1
+#define RULE_STORE_OP_DELETE    2
+#define RULE_STORE_COMPACT_MIN  (1024 * 1024)   //  don't compact small journals
+
+typedef struct {
+    uint32_t magic;
+    uint32_t op;
+    uint32_t name_size;         //  including terminating zero
+    uint32_t json_size;         //  including terminating zero, 0 for delete
+    uint32_t crc;               //  crc32 of name and json
+    uint32_t reserved;
+} record_t;
+
+typedef struct {
+    uint64_t offset;            //  offset of json in journal
+    uint64_t size;              //  size of whole record
+} entry_t;
+
+//  Structure of our class
+
+struct _rule_store_t {
+    char *path;
+    int fd;
+    char *map;                  //  read only mapping of journal
+    size_t map_size;
+    uint64_t end;               //  end of last valid record
+    uint64_t live;              //  bytes of records in index
+    uint64_t written;           //  bytes written since open
+    zhash_t *index;             //  rule name -> entry_t
+};
+
+//  --------------------------------------------------------------------------
+//  crc32 (IEEE 802.3)
+
+static uint32_t
+s_crc32 (uint32_t crc, const void *data, size_t size)
+{
+    static uint32_t table [256];
+    static bool ready = false;
+    if (!ready) {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++)
+                c = (c & 1) ? 0xedb88320 ^ (c >> 1) : c >> 1;
+            table [i] = c;
+        }
+        ready = true;
+    }
+    const unsigned char *p = (const unsigned char *) data;
+    crc = ~crc;
+    while (size--)
+        crc = table [(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+static size_t
+s_record_size (size_t name_size, size_t json_size)
+{
+    return (sizeof (record_t) + name_size + json_size + 7) & ~((size_t) 7);
+}
+
+//  --------------------------------------------------------------------------
+//  Write whole buffer at offset. Returns 0 on success.
+
+static int
+s_pwrite (int fd, const char *buffer, size_t size, uint64_t offset)
+{
+    while (size) {
+        ssize_t r = pwrite (fd, buffer, size, (off_t) offset);
+        if (r < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        buffer += r;
+        size -= r;
+        offset += r;
+    }
+    return 0;
+}
+
+//  --------------------------------------------------------------------------
+//  Write one record at offset. Returns record size or -1 on error.
+
+static ssize_t
+s_write_record (int fd, uint64_t offset, uint32_t op, const char *name, const char *json)
+{
+    record_t record;
+    memset (&record, 0, sizeof (record));
+    record.magic = RULE_STORE_MAGIC;
+    record.op = op;
+    record.name_size = strlen (name) + 1;
+    record.json_size = json ? strlen (json) + 1 : 0;
+    record.crc = s_crc32 (s_crc32 (0, name, record.name_size), json, record.json_size);
+
+    size_t size = s_record_size (record.name_size, record.json_size);
+    char *buffer = (char *) zmalloc (size);
+    assert (buffer);
+    memcpy (buffer, &record, sizeof (record));
+    memcpy (buffer + sizeof (record), name, record.name_size);
+    if (json)
+        memcpy (buffer + sizeof (record) + record.name_size, json, record.json_size);
+    int r = s_pwrite (fd, buffer, size, offset);
+    free (buffer);
+    return r == 0 ? (ssize_t) size : -1;
+}
+
+//  --------------------------------------------------------------------------
+//  Map journal up to its end. Returns 0 on success.
+
+static int
+s_remap (rule_store_t *self)
+{
+    if (self->map && self->map_size >= self->end)
+        return 0;
+    if (self->map)
+        munmap (self->map, self->map_size);
+    self->map = (char *) mmap (NULL, self->end, PROT_READ, MAP_SHARED, self->fd, 0);
+    if (self->map == MAP_FAILED) {
+        log_error ("can't map rule journal %s (%s)", self->path, strerror (errno));
+        self->map = NULL;
+        self->map_size = 0;
+        return -1;
+    }
+    self->map_size = self->end;
+    return 0;
+}
+
+//  --------------------------------------------------------------------------
+//  Apply record to index
+
+static void
+s_index (rule_store_t *self, uint32_t op, const char *name, uint64_t json_offset, uint64_t size)
+{
+    entry_t *entry = (entry_t *) zhash_lookup (self->index, name);
+    if (entry) {
+        self->live -= entry->size;
+        zhash_delete (self->index, name);
+    }
+    if (op == RULE_STORE_OP_PUT) {
+        entry = (entry_t *) zmalloc (sizeof (entry_t));
+        assert (entry);
+        entry->offset = json_offset;
+        entry->size = size;
+        zhash_insert (self->index, name, entry);
+        zhash_freefn (self->index, name, free);
+        self->live += size;
+    }
+}
+
+//  --------------------------------------------------------------------------
+//  Read journal and build index. Returns 0 on success.
+
+static int
+s_load (rule_store_t *self)
+{
+    struct stat st;
+    if (fstat (self->fd, &st) != 0)
+        return -1;
+    if (st.st_size == 0) {
+        if (s_pwrite (self->fd, RULE_STORE_HEADER, RULE_STORE_HEADER_SIZE, 0) != 0
+        ||  fdatasync (self->fd) != 0)
+            return -1;
+        self->end = RULE_STORE_HEADER_SIZE;
+        return s_remap (self);
+    }
+    self->end = st.st_size;
+    if (self->end < RULE_STORE_HEADER_SIZE || s_remap (self) != 0
+    ||  memcmp (self->map, RULE_STORE_HEADER, RULE_STORE_HEADER_SIZE) != 0) {
+        log_error ("%s is not rule journal", self->path);
+        return -1;
+    }
+
+    uint64_t offset = RULE_STORE_HEADER_SIZE;
+    while (offset + sizeof (record_t) <= self->end) {
+        record_t record;
+        memcpy (&record, self->map + offset, sizeof (record));
+        const char *name = self->map + offset + sizeof (record);
+        const char *json = name + record.name_size;
+        uint64_t size = s_record_size (record.name_size, record.json_size);
+        if (record.magic != RULE_STORE_MAGIC
+        ||  (record.op != RULE_STORE_OP_PUT && record.op != RULE_STORE_OP_DELETE)
+        ||  record.name_size == 0
+        ||  (record.op == RULE_STORE_OP_PUT) != (record.json_size > 0)
+        ||  size > self->end - offset
+        ||  name [record.name_size - 1] != 0
+        ||  (record.json_size && json [record.json_size - 1] != 0)
+        ||  record.crc != s_crc32 (s_crc32 (0, name, record.name_size), json, record.json_size))
+            break;
+        s_index (self, record.op, name, offset + sizeof (record) + record.name_size, size);
+        offset += size;
+    }
+    if (offset != self->end) {
+        log_warning ("rule journal %s: discarding %" PRIu64 " bytes of incomplete record at offset %" PRIu64,
+            self->path, self->end - offset, offset);
+        if (ftruncate (self->fd, (off_t) offset) != 0 || fdatasync (self->fd) != 0)
+            return -1;
+        self->end = offset;
+    }
+    return 0;
+}
+
+//  --------------------------------------------------------------------------
+//  Open rule journal, file is created if it does not exist. Incomplete
+//  record at the end of the journal (interrupted write) is discarded.
+//  Returns NULL on error.
+
+rule_store_t *
+rule_store_new (const char *path)
+{
+    assert (path);
+    rule_store_t *self = (rule_store_t *) zmalloc (sizeof (rule_store_t));
+    assert (self);
+    //  Initialize class properties here
+    self->path = strdup (path);
+    self->index = zhash_new ();
+    self->fd = open (path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (self->fd == -1) {
+        log_error ("can't open rule journal %s (%s)", path, strerror (errno));
+        rule_store_destroy (&self);
+        return NULL;
+    }
+    if (s_load (self) != 0) {
+        log_error ("can't read rule journal %s", path);
+        rule_store_destroy (&self);
+        return NULL;
+    }
+    log_debug ("rule journal %s: %zu rules, %" PRIu64 " bytes",
+        path, zhash_size (self->index), self->end);
+    return self;
+}
+
+//  --------------------------------------------------------------------------
+//  Destroy the rule_store
+
+void
+rule_store_destroy (rule_store_t **self_p)
+{
+    assert (self_p);
+    if (*self_p) {
+        rule_store_t *self = *self_p;
+        //  Free class properties here
+        if (self->map)
+            munmap (self->map, self->map_size);
+        if (self->fd != -1)
+            close (self->fd);
+        zhash_destroy (&self->index);
+        zstr_free (&self->path);
+        //  Free object itself
+        free (self);
+        *self_p = NULL;
+    }
+}
+
+//  --------------------------------------------------------------------------
+//  Append record, optionally commit it. Returns 0 on success.
+
+static int
+s_append (rule_store_t *self, uint32_t op, const char *name, const char *json, bool sync)
+{
+    ssize_t size = s_write_record (self->fd, self->end, op, name, json);
+    if (size < 0 || (sync && fdatasync (self->fd) != 0)) {
+        log_error ("can't write to rule journal %s (%s)", self->path, strerror (errno));
+        //  drop partial record so next append doesn't follow garbage
+        if (ftruncate (self->fd, (off_t) self->end) != 0)
+            log_error ("can't truncate rule journal %s (%s)", self->path, strerror (errno));
+        return -1;
+    }
+    s_index (self, op, name, self->end + sizeof (record_t) + strlen (name) + 1, size);
+    self->end += size;
+    self->written += size;
+
+    uint64_t dead = self->end - RULE_STORE_HEADER_SIZE - self->live;
+    if (sync && dead > self->live && dead > RULE_STORE_COMPACT_MIN)
+        rule_store_compact (self);
+    return 0;
+}
+
+//  --------------------------------------------------------------------------
+//  Store json of rule. Record is on disk when function returns.
+//  Returns 0 on success, else -1.
+
+int
+rule_store_put (rule_store_t *self, const char *name, const char *json)
+{
+    assert (self);
+    assert (name);
+    assert (json);
+    return s_append (self, RULE_STORE_OP_PUT, name, json, true);
+}
+
+//  --------------------------------------------------------------------------
+//  Delete rule. Returns 0 on success, -1 if rule does not exist or
+//  record can't be written.
+
+int
+rule_store_delete (rule_store_t *self, const char *name)
+{
+    assert (self);
+    assert (name);
+    if (!zhash_lookup (self->index, name))
+        return -1;
+    return s_append (self, RULE_STORE_OP_DELETE, name, NULL, true);
+}
+
+//  --------------------------------------------------------------------------
+//  Return json for index entry
+
+static const char *
+s_json (rule_store_t *self, entry_t *entry)
+{
+    if (!entry || s_remap (self) != 0)
+        return NULL;
+    return self->map + entry->offset;
+}
+
+//  --------------------------------------------------------------------------
+//  Get json of rule, NULL if there is no such rule. Returned string is
+//  valid until next change of the store.
+
+const char *
+rule_store_lookup (rule_store_t *self, const char *name)
+{
+    assert (self);
+    assert (name);
+    return s_json (self, (entry_t *) zhash_lookup (self->index, name));
+}
+
+//  --------------------------------------------------------------------------
+//  Return json of the first rule, NULL if store is empty.
+
+const char *
+rule_store_first (rule_store_t *self)
+{
+    assert (self);
+    return s_json (self, (entry_t *) zhash_first (self->index));
+}
+
+//  --------------------------------------------------------------------------
+//  Return json of the next rule, NULL if there are no more rules.
+
+const char *
+rule_store_next (rule_store_t *self)
+{
+    assert (self);
+    return s_json (self, (entry_t *) zhash_next (self->index));
+}
+
+//  --------------------------------------------------------------------------
+//  Get name of rule returned by rule_store_first or rule_store_next
+
+const char *
+rule_store_cursor (rule_store_t *self)
+{
+    assert (self);
+    return zhash_cursor (self->index);
+}
+
+//  --------------------------------------------------------------------------
+//  Number of rules in store
+
+size_t
+rule_store_size (rule_store_t *self)
+{
+    assert (self);
+    return zhash_size (self->index);
+}
+
+//  --------------------------------------------------------------------------
+//  Rewrite journal with current rules only. Returns 0 on success.
+
+int
+rule_store_compact (rule_store_t *self)
+{
+    assert (self);
+    if (s_remap (self) != 0)
+        return -1;
+
+    int64_t start = zclock_mono ();
+    char *tmp = zsys_sprintf ("%s.tmp", self->path);
+    int fd = open (tmp, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1) {
+        log_error ("can't create %s (%s)", tmp, strerror (errno));
+        zstr_free (&tmp);
+        return -1;
+    }
+
+    zhash_t *index = zhash_new ();
+    uint64_t end = RULE_STORE_HEADER_SIZE;
+    int r = s_pwrite (fd, RULE_STORE_HEADER, RULE_STORE_HEADER_SIZE, 0);
+    entry_t *entry = (entry_t *) zhash_first (self->index);
+    while (entry && r == 0) {
+        const char *name = zhash_cursor (self->index);
+        ssize_t size = s_write_record (fd, end, RULE_STORE_OP_PUT, name, self->map + entry->offset);
+        if (size < 0) {
+            r = -1;
+            break;
+        }
+        entry_t *copy = (entry_t *) zmalloc (sizeof (entry_t));
+        assert (copy);
+        copy->offset = end + sizeof (record_t) + strlen (name) + 1;
+        copy->size = size;
+        zhash_insert (index, name, copy);
+        zhash_freefn (index, name, free);
+        end += size;
+        entry = (entry_t *) zhash_next (self->index);
+    }
+    if (r == 0)
+        r = fsync (fd);
+    if (r == 0)
+        r = rename (tmp, self->path);
+    if (r != 0) {
+        log_error ("compaction of rule journal %s failed (%s)", self->path, strerror (errno));
+        close (fd);
+        unlink (tmp);
+        zhash_destroy (&index);
+        zstr_free (&tmp);
+        return -1;
+    }
+
+    //  make rename durable
+    char *dir = strdup (self->path);
+    int dirfd = open (dirname (dir), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dirfd != -1) {
+        fsync (dirfd);
+        close (dirfd);
+    }
+    zstr_free (&dir);
+
+    log_info ("rule journal %s compacted from %" PRIu64 " to %" PRIu64 " bytes in %d ms",
+        self->path, self->end, end, (int) (zclock_mono () - start));
+    munmap (self->map, self->map_size);
+    self->map = NULL;
+    self->map_size = 0;
+    close (self->fd);
+    self->fd = fd;
+    zhash_destroy (&self->index);
+    self->index = index;
+    self->end = end;
+    self->live = end - RULE_STORE_HEADER_SIZE;
+    self->written += end;
+    zstr_free (&tmp);
+    return s_remap (self);
+}
+
+//  --------------------------------------------------------------------------
+//  Import all .rule files from directory. Returns number of imported
+//  rules or -1 if directory can't be read.
+
+int
+rule_store_import (rule_store_t *self, const char *dir)
+{
+    assert (self);
+    assert (dir);
+
+    DIR *d = opendir (dir);
+    if (!d) {
+        log_error ("cannot open dir '%s' (%s)", dir, strerror (errno));
+        return -1;
+    }
+    int count = 0;
+    struct dirent *entry;
+    while ((entry = readdir (d)) != NULL) {
+        size_t l = strlen (entry->d_name);
+        if (l <= 5 || !streq (&entry->d_name [l - 5], ".rule"))
+            continue;
+        char *fullpath = zsys_sprintf ("%s/%s", dir, entry->d_name);
+        rule_t *rule = rule_new ();
+        if (rule_load (rule, fullpath) == 0 && rule_name (rule)) {
+            char *json = rule_json (rule);
+            //  one commit for whole import
+            if (json && s_append (self, RULE_STORE_OP_PUT, rule_name (rule), json, false) == 0)
+                count++;
+            zstr_free (&json);
+        }
+        else
+            log_error ("failed to import rule '%s'", fullpath);
+        rule_destroy (&rule);
+        zstr_free (&fullpath);
+    }
+    closedir (d);
+    if (fdatasync (self->fd) != 0) {
+        log_error ("can't write to rule journal %s (%s)", self->path, strerror (errno));
+        return -1;
+    }
+    log_info ("%d rules imported from '%s' to %s", count, dir, self->path);
+    return count;
+}
+
+//  --------------------------------------------------------------------------
+//  Export all rules to directory as <name>.rule files. Returns number
+//  of exported rules or -1 on error.
+
+int
+rule_store_export (rule_store_t *self, const char *dir)
+{
+    assert (self);
+    assert (dir);
+
+    int count = 0;
+    const char *json = rule_store_first (self);
+    while (json) {
+        char *fullpath = zsys_sprintf ("%s/%s.rule", dir, rule_store_cursor (self));
+        FILE *f = fopen (fullpath, "w");
+        bool ok = f && fputs (json, f) >= 0;
+        if (f && fclose (f) != 0)
+            ok = false;
+        if (!ok) {
+            log_error ("can't export rule to '%s' (%s)", fullpath, strerror (errno));
+            zstr_free (&fullpath);
+            return -1;
+        }
+        zstr_free (&fullpath);
+        count++;
+        json = rule_store_next (self);
+    }
+    return count;
+}
+
+//  --------------------------------------------------------------------------
+//  Number of bytes written to journal since it was opened
+
+uint64_t
+rule_store_written (rule_store_t *self)
+{
+    assert (self);
+    return self->written;
+}
+
+//  --------------------------------------------------------------------------
+//  Self test of this class
+
+#define SELFTEST_DIR_RW "src/selftest-rw"
+
+//  Remove .rule files from directory
+
+static void
+s_clean_dir (const char *path)
+{
+    DIR *dir = opendir (path);
+    if (!dir)
+        return;
+    struct dirent *entry;
+    while ((entry = readdir (dir)) != NULL) {
+        if (entry->d_name [0] == '.')
+            continue;
+        char *file = zsys_sprintf ("%s/%s", path, entry->d_name);
+        unlink (file);
+        zstr_free (&file);
+    }
+    closedir (dir);
+    rmdir (path);
+}
+
+void
+rule_store_test (bool verbose)
+{
+    printf (" * rule_store: ");
+
+    //  @selftest
+    const char *journal = SELFTEST_DIR_RW "/rules.journal";
+    const char *exportdir = SELFTEST_DIR_RW "/rule_store";
+    unlink (journal);
+    s_clean_dir (exportdir);
+    {
+        rule_store_t *self = rule_store_new (journal);
+        assert (self);
+        assert (rule_store_size (self) == 0);
+        assert (rule_store_first (self) == NULL);
+        assert (rule_store_put (self, "a", "{\"name\":\"a\"}") == 0);
+        assert (rule_store_put (self, "b", "{\"name\":\"b\"}") == 0);
+        assert (rule_store_put (self, "a", "{\"name\":\"a\",\"x\":1}") == 0);
+        assert (rule_store_delete (self, "b") == 0);
+        assert (rule_store_delete (self, "b") == -1);
+        assert (rule_store_size (self) == 1);
+        assert (streq (rule_store_lookup (self, "a"), "{\"name\":\"a\",\"x\":1}"));
+        assert (rule_store_lookup (self, "b") == NULL);
+        rule_store_destroy (&self);
+        assert (self == NULL);
+    }
+    {
+        //  reopen, then simulate write interrupted in the middle of record
+        rule_store_t *self = rule_store_new (journal);
+        assert (self);
+        assert (rule_store_size (self) == 1);
+        assert (streq (rule_store_lookup (self, "a"), "{\"name\":\"a\",\"x\":1}"));
+        rule_store_destroy (&self);
+
+        struct stat st;
+        assert (stat (journal, &st) == 0);
+        int fd = open (journal, O_WRONLY | O_APPEND);
+        assert (fd != -1);
+        record_t record = { RULE_STORE_MAGIC, RULE_STORE_OP_PUT, 2, 100, 0, 0 };
+        assert (write (fd, &record, sizeof (record)) == sizeof (record));
+        assert (write (fd, "c\0{\"na", 6) == 6);
+        close (fd);
+
+        self = rule_store_new (journal);
+        assert (self);
+        assert (rule_store_size (self) == 1);
+        assert (rule_store_lookup (self, "c") == NULL);
+        struct stat st2;
+        assert (stat (journal, &st2) == 0);
+        assert (st2.st_size == st.st_size);
+        assert (rule_store_put (self, "c", "{\"name\":\"c\"}") == 0);
+
+        //  compaction keeps only live records
+        assert (stat (journal, &st) == 0);
+        assert (rule_store_compact (self) == 0);
+        assert (stat (journal, &st2) == 0);
+        assert (st2.st_size < st.st_size);
+        assert (rule_store_size (self) == 2);
+        assert (streq (rule_store_lookup (self, "a"), "{\"name\":\"a\",\"x\":1}"));
+        assert (rule_store_put (self, "d", "{\"name\":\"d\"}") == 0);
+        rule_store_destroy (&self);
+
+        self = rule_store_new (journal);
+        assert (rule_store_size (self) == 3);
+        assert (streq (rule_store_lookup (self, "c"), "{\"name\":\"c\"}"));
+        assert (streq (rule_store_lookup (self, "d"), "{\"name\":\"d\"}"));
+        rule_store_destroy (&self);
+    }
+    {
+        //  not a journal
+        const char *bogus = SELFTEST_DIR_RW "/bogus.journal";
+        FILE *f = fopen (bogus, "w");
+        assert (f);
+        fputs ("{\"name\":\"x\"}", f);
+        fclose (f);
+        assert (rule_store_new (bogus) == NULL);
+        unlink (bogus);
+    }
+    unlink (journal);
+    {
+        //  import/export and comparison with directory of rule files
+        const int count = 1000;
+        mkdir (exportdir, 0755);
+        rule_t *rule = rule_new ();
+        assert (rule_load (rule, "src/selftest-ro/rules/threshold.rule") == 0);
+        char *json = rule_json (rule);
+        rule_destroy (&rule);
+        assert (json);
+        const char *suffix = strchr (json, ',');
+        assert (suffix);
+
+        uint64_t dir_written = 0;
+        int64_t start = zclock_mono ();
+        for (int i = 0; i < count; i++) {
+            char *path = zsys_sprintf ("%s/rule-%d.rule", exportdir, i);
+            char *content = zsys_sprintf ("{\"name\":\"rule-%d\"%s", i, suffix);
+            FILE *f = fopen (path, "w");
+            assert (f);
+            fputs (content, f);
+            fflush (f);
+            fdatasync (fileno (f));
+            fclose (f);
+            //  data rounded up to filesystem block plus directory entry
+            dir_written += (strlen (content) + 4095) / 4096 * 4096 + strlen (path);
+            zstr_free (&content);
+            zstr_free (&path);
+        }
+        int64_t dir_save = zclock_mono () - start;
+
+        rule_store_t *self = rule_store_new (journal);
+        start = zclock_mono ();
+        for (int i = 0; i < count; i++) {
+            char *name = zsys_sprintf ("rule-%d", i);
+            char *content = zsys_sprintf ("{\"name\":\"rule-%d\"%s", i, suffix);
+            assert (rule_store_put (self, name, content) == 0);
+            zstr_free (&content);
+            zstr_free (&name);
+        }
+        int64_t journal_save = zclock_mono () - start;
+        uint64_t journal_written = rule_store_written (self);
+        rule_store_destroy (&self);
+
+        start = zclock_mono ();
+        int loaded = 0;
+        DIR *dir = opendir (exportdir);
+        struct dirent *entry;
+        while ((entry = readdir (dir)) != NULL) {
+            if (entry->d_name [0] == '.')
+                continue;
+            char *path = zsys_sprintf ("%s/%s", exportdir, entry->d_name);
+            rule = rule_new ();
+            if (rule_load (rule, path) == 0)
+                loaded++;
+            rule_destroy (&rule);
+            zstr_free (&path);
+        }
+        closedir (dir);
+        int64_t dir_load = zclock_mono () - start;
+        assert (loaded == count);
+
+        start = zclock_mono ();
+        loaded = 0;
+        self = rule_store_new (journal);
+        const char *stored = rule_store_first (self);
+        while (stored) {
+            rule = rule_new ();
+            if (rule_parse (rule, stored) == 0)
+                loaded++;
+            rule_destroy (&rule);
+            stored = rule_store_next (self);
+        }
+        int64_t journal_load = zclock_mono () - start;
+        assert (loaded == count);
+
+        if (verbose)
+            log_info ("%d rules: directory save %d ms, load %d ms, ~%" PRIu64 " bytes; "
+                "journal save %d ms, load %d ms, %" PRIu64 " bytes",
+                count, (int) dir_save, (int) dir_load, dir_written,
+                (int) journal_save, (int) journal_load, journal_written);
+
+        //  export and import back
+        s_clean_dir (exportdir);
+        mkdir (exportdir, 0755);
+        assert (rule_store_export (self, exportdir) == count);
+        rule_store_destroy (&self);
+        unlink (journal);
+        self = rule_store_new (journal);
+        assert (rule_store_import (self, exportdir) == count);
+        assert (rule_store_size (self) == (size_t) count);
+        rule = rule_new ();
+        assert (rule_parse (rule, rule_store_lookup (self, "rule-42")) == 0);
+        assert (streq (rule_name (rule), "rule-42"));
+        rule_destroy (&rule);
+        rule_store_destroy (&self);
+        zstr_free (&json);
+    }
+    unlink (journal);
+    s_clean_dir (exportdir);
+    //  @end
+    printf ("OK\n");
+}
@@ -0,0 +1,105 @@
+/*  =========================================================================
+    rule_store - Append-only journal of rules
+
+    Copyright (C) 2016 - 2017 Tomas Halman
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+#ifndef RULE_STORE_H_INCLUDED
+#define RULE_STORE_H_INCLUDED
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//  Opaque class structures to allow forward references
+#ifndef RULE_STORE_T_DEFINED
+typedef struct _rule_store_t rule_store_t;
+#define RULE_STORE_T_DEFINED
+#endif
+
+//  @interface
+//  Open rule journal, file is created if it does not exist. Incomplete
+//  record at the end of the journal (interrupted write) is discarded.
+//  Returns NULL on error.
+FTY_ALERT_FLEXIBLE_PRIVATE rule_store_t *
+    rule_store_new (const char *path);
+
+//  Destroy the rule_store
+FTY_ALERT_FLEXIBLE_PRIVATE void
+    rule_store_destroy (rule_store_t **self_p);
+
+//  Store json of rule. Record is on disk when function returns.
+//  Returns 0 on success, else -1.
+FTY_ALERT_FLEXIBLE_PRIVATE int
+    rule_store_put (rule_store_t *self, const char *name, const char *json);
+
+//  Delete rule. Returns 0 on success, -1 if rule does not exist or
+//  record can't be written.
+FTY_ALERT_FLEXIBLE_PRIVATE int
+    rule_store_delete (rule_store_t *self, const char *name);
+
+//  Get json of rule, NULL if there is no such rule. Returned string is
+//  valid until next change of the store.
+FTY_ALERT_FLEXIBLE_PRIVATE const char *
+    rule_store_lookup (rule_store_t *self, const char *name);
+
+//  Return json of the first rule, NULL if store is empty.
+FTY_ALERT_FLEXIBLE_PRIVATE const char *
+    rule_store_first (rule_store_t *self);
+
+//  Return json of the next rule, NULL if there are no more rules.
+FTY_ALERT_FLEXIBLE_PRIVATE const char *
+    rule_store_next (rule_store_t *self);
+
+//  Get name of rule returned by rule_store_first or rule_store_next
+FTY_ALERT_FLEXIBLE_PRIVATE const char *
+    rule_store_cursor (rule_store_t *self);
+
+//  Number of rules in store
+FTY_ALERT_FLEXIBLE_PRIVATE size_t
+    rule_store_size (rule_store_t *self);
+
+//  Rewrite journal with current rules only. Returns 0 on success.
+FTY_ALERT_FLEXIBLE_PRIVATE int
+    rule_store_compact (rule_store_t *self);
+
+//  Import all .rule files from directory. Returns number of imported
+//  rules or -1 if directory can't be read.
+FTY_ALERT_FLEXIBLE_PRIVATE int
+    rule_store_import (rule_store_t *self, const char *dir);
+
+//  Export all rules to directory as <name>.rule files. Returns number
+//  of exported rules or -1 on error.
+FTY_ALERT_FLEXIBLE_PRIVATE int
+    rule_store_export (rule_store_t *self, const char *dir);
+
+//  Number of bytes written to journal since it was opened
+FTY_ALERT_FLEXIBLE_PRIVATE uint64_t
+    rule_store_written (rule_store_t *self);
+
+//  Self test of this class
+FTY_ALERT_FLEXIBLE_PRIVATE void
+    rule_store_test (bool verbose);
+
+//  @end
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
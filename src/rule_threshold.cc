@@ -0,0 +1,864 @@
+/*  =========================================================================
+    rule_threshold - Native evaluator of threshold rules
+
+    Copyright (C) 2016 - 2017 Tomas Halman
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+/*
+@header
+    rule_threshold - Native evaluator of threshold rules
+@discuss
+    Most rules compare their metric against variables and return a severity
+    with a message built from string literals, NAME, INAME, the metric and
+    variables (see threshold.rule). Such evaluation is recognized by a
+    conservative parser and evaluated without lua. Everything else (loops,
+    numbers, function calls, elseif, ...) is left to lua.
+
+    Results and messages are the same as lua gives. Typed rules get values
+    and variables which are numbers as lua numbers, so they are compared
+    as numbers and formatted by lua in messages. Otherwise they are lua
+    strings and comparisons are string comparisons (strcoll), as in lua.
+@end
+*/
+
+#include "fty_alert_flexible_classes.h"
+
+#include <math.h>
+
+//  Message part
+typedef enum {
+    TERM_LITERAL,
+    TERM_VALUE,                 //  metric value (parameter of main)
+    TERM_NAME,
+    TERM_INAME,
+    TERM_VARIABLE
+} term_kind_t;
+
+typedef struct {
+    term_kind_t kind;
+    char *text;                 //  literal or name of variable
+} term_t;
+
+//  Comparison operand
+typedef struct {
+    term_kind_t kind;           //  TERM_VALUE, TERM_LITERAL or TERM_VARIABLE
+    char *text;
+    bool numeric;               //  number literal or tonumber (<term>)
+} operand_t;
+
+//  if <left> <op> <right> then return <severity>, <message> end
+typedef struct {
+    bool conditional;           //  false for final return
+    char op [3];
+    operand_t left;
+    operand_t right;
+    int severity;
+    const char *severity_name;
+    term_t *terms;
+    size_t terms_count;
+} branch_t;
+
+//  Structure of our class
+
+struct _rule_threshold_t {
+    branch_t *branches;
+    size_t count;
+    bool numeric;               //  all comparisons are numeric, messages never are
+    bool typed;                 //  numeric values and variables are lua numbers
+};
+
+//  --------------------------------------------------------------------------
+//  Parser
+
+//  Parse name or string used in comparison or message. Returns false if
+//  token is something else than metric value, variable, literal or (when
+//  names are allowed) NAME and INAME.
+static bool
+s_parse_term (rule_lexer_t *lexer, const char *value, bool names, term_kind_t *kind, char **text)
+{
+    size_t size;
+    const char *start = rule_lexer_text (lexer, &size);
+    if (rule_lexer_type (lexer) == RULE_LEXER_STRING) {
+        //  escapes are left to lua
+        if (memchr (start, '\\', size))
+            return false;
+        *kind = TERM_LITERAL;
+        *text = strdup (rule_lexer_string (lexer));
+        rule_lexer_next (lexer);
+        return true;
+    }
+    if (rule_lexer_type (lexer) != RULE_LEXER_NAME || rule_lexer_keyword (start, size)
+    ||  rule_lexer_severity (start, size, NULL))
+        return false;
+    if (size == strlen (value) && strncmp (start, value, size) == 0)
+        *kind = TERM_VALUE;
+    else
+    if (rule_lexer_is (lexer, "NAME") || rule_lexer_is (lexer, "INAME")) {
+        if (!names)
+            return false;
+        *kind = rule_lexer_is (lexer, "NAME") ? TERM_NAME : TERM_INAME;
+    }
+    else
+        *kind = TERM_VARIABLE;
+    *text = strndup (start, size);
+    rule_lexer_next (lexer);
+    return true;
+}
+
+//  Parse return <severity>, <message> [;]
+static bool
+s_parse_return (rule_lexer_t *lexer, const char *value, branch_t *branch)
+{
+    if (!rule_lexer_accept (lexer, "return") || rule_lexer_type (lexer) != RULE_LEXER_NAME)
+        return false;
+    size_t size;
+    const char *start = rule_lexer_text (lexer, &size);
+    branch->severity_name = rule_lexer_severity (start, size, &branch->severity);
+    if (!branch->severity_name)
+        return false;
+    rule_lexer_next (lexer);
+    if (!rule_lexer_accept (lexer, ","))
+        return false;
+    do {
+        term_t term;
+        if (!s_parse_term (lexer, value, true, &term.kind, &term.text))
+            return false;
+        branch->terms = (term_t *) realloc (branch->terms, (branch->terms_count + 1) * sizeof (term_t));
+        assert (branch->terms);
+        branch->terms [branch->terms_count++] = term;
+    } while (rule_lexer_accept (lexer, ".."));
+    rule_lexer_accept (lexer, ";");
+    return true;
+}
+
+//  Parse comparison operand: metric value, variable or literal, optionally
+//  converted by tonumber (), or number
+static bool
+s_parse_operand (rule_lexer_t *lexer, const char *value, operand_t *operand)
+{
+    if (rule_lexer_type (lexer) == RULE_LEXER_NUMBER) {
+        size_t size;
+        const char *start = rule_lexer_text (lexer, &size);
+        operand->kind = TERM_LITERAL;
+        operand->text = strndup (start, size);
+        operand->numeric = true;
+        rule_lexer_next (lexer);
+        return true;
+    }
+    if (rule_lexer_accept (lexer, "tonumber")) {
+        operand->numeric = true;
+        return rule_lexer_accept (lexer, "(")
+            && s_parse_term (lexer, value, false, &operand->kind, &operand->text)
+            && rule_lexer_accept (lexer, ")");
+    }
+    return s_parse_term (lexer, value, false, &operand->kind, &operand->text);
+}
+
+//  Parse if [(] <operand> <op> <operand> [)] then
+static bool
+s_parse_condition (rule_lexer_t *lexer, const char *value, branch_t *branch)
+{
+    bool parenthesis = rule_lexer_accept (lexer, "(");
+    if (!s_parse_operand (lexer, value, &branch->left))
+        return false;
+    static const char *operators [] = { "<", ">", "<=", ">=", "==", "~=", NULL };
+    int i;
+    for (i = 0; operators [i]; i++)
+        if (rule_lexer_is (lexer, operators [i]))
+            break;
+    if (!operators [i])
+        return false;
+    strcpy (branch->op, operators [i]);
+    rule_lexer_next (lexer);
+    if (!s_parse_operand (lexer, value, &branch->right))
+        return false;
+    //  exactly one side is the metric value
+    if ((branch->left.kind == TERM_VALUE) == (branch->right.kind == TERM_VALUE))
+        return false;
+    if (parenthesis && !rule_lexer_accept (lexer, ")"))
+        return false;
+    return rule_lexer_accept (lexer, "then");
+}
+
+//  Can lua never take the message for a number? True if the message starts
+//  with literal which can't start a number or contains a character strtod
+//  never accepts.
+static bool
+s_message_textual (branch_t *branch)
+{
+    for (size_t t = 0; t < branch->terms_count; t++) {
+        if (branch->terms [t].kind != TERM_LITERAL)
+            continue;
+        const char *text = branch->terms [t].text;
+        if (t == 0) {
+            while (isspace ((unsigned char) *text))
+                text++;
+            if (*text && !strchr ("+-.0123456789iInN", *text))
+                return true;
+        }
+        for (const char *p = text; *p; p++)
+            if (!isalnum ((unsigned char) *p) && !isspace ((unsigned char) *p) && !strchr ("_.+-()", *p))
+                return true;
+    }
+    return false;
+}
+
+static void
+s_branch_free (branch_t *branch)
+{
+    zstr_free (&branch->left.text);
+    zstr_free (&branch->right.text);
+    for (size_t i = 0; i < branch->terms_count; i++)
+        zstr_free (&branch->terms [i].text);
+    free (branch->terms);
+}
+
+//  --------------------------------------------------------------------------
+//  Create a new rule_threshold from lua evaluation of rule. Typed rule gets
+//  values and variables which are numbers as lua numbers. Returns NULL if
+//  evaluation is not a plain threshold rule.
+
+rule_threshold_t *
+rule_threshold_new (const char *evaluation, bool typed)
+{
+    if (!evaluation)
+        return NULL;
+    rule_lexer_t *lexer = rule_lexer_new (evaluation);
+    size_t size = 0;
+    const char *start = NULL;
+    if (rule_lexer_accept (lexer, "function") && rule_lexer_accept (lexer, "main")
+    &&  rule_lexer_accept (lexer, "(") && rule_lexer_type (lexer) == RULE_LEXER_NAME)
+        start = rule_lexer_text (lexer, &size);
+    if (!start || rule_lexer_keyword (start, size)) {
+        rule_lexer_destroy (&lexer);
+        return NULL;
+    }
+    char *value = strndup (start, size);
+    rule_lexer_next (lexer);
+
+    rule_threshold_t *self = (rule_threshold_t *) zmalloc (sizeof (rule_threshold_t));
+    assert (self);
+    bool valid = rule_lexer_accept (lexer, ")");
+    bool done = false;
+    while (valid && !done) {
+        self->branches = (branch_t *) realloc (self->branches, (self->count + 1) * sizeof (branch_t));
+        assert (self->branches);
+        branch_t *branch = &self->branches [self->count++];
+        memset (branch, 0, sizeof (branch_t));
+        if (rule_lexer_accept (lexer, "if")) {
+            branch->conditional = true;
+            valid = s_parse_condition (lexer, value, branch)
+                && s_parse_return (lexer, value, branch)
+                && rule_lexer_accept (lexer, "end");
+        }
+        else {
+            //  final return closes main
+            valid = s_parse_return (lexer, value, branch)
+                && rule_lexer_accept (lexer, "end")
+                && rule_lexer_type (lexer) == RULE_LEXER_END;
+            done = true;
+        }
+    }
+    rule_lexer_destroy (&lexer);
+    zstr_free (&value);
+    if (!valid) {
+        rule_threshold_destroy (&self);
+        return NULL;
+    }
+    self->typed = typed;
+    self->numeric = true;
+    for (size_t i = 0; i < self->count; i++) {
+        branch_t *branch = &self->branches [i];
+        //  typed values and variables are numbers, if they can be
+        bool left = branch->left.numeric || (typed && branch->left.kind != TERM_LITERAL);
+        bool right = branch->right.numeric || (typed && branch->right.kind != TERM_LITERAL);
+        if ((branch->conditional && !(left && right))
+        ||  !s_message_textual (branch))
+            self->numeric = false;
+    }
+    return self;
+}
+
+//  --------------------------------------------------------------------------
+//  Destroy the rule_threshold
+
+void
+rule_threshold_destroy (rule_threshold_t **self_p)
+{
+    assert (self_p);
+    if (*self_p) {
+        rule_threshold_t *self = *self_p;
+        //  Free class properties here
+        for (size_t i = 0; i < self->count; i++)
+            s_branch_free (&self->branches [i]);
+        free (self->branches);
+        //  Free object itself
+        free (self);
+        *self_p = NULL;
+    }
+}
+
+//  --------------------------------------------------------------------------
+//  Format number like lua tostring () does
+
+static const char *
+s_format_number (double number, char *buffer, size_t size)
+{
+    snprintf (buffer, size, "%.14g", number);
+    return buffer;
+}
+
+//  --------------------------------------------------------------------------
+//  Value of operand or message term, NULL if variable is not set
+
+static const char *
+s_term_value (term_kind_t kind, const char *text, const char *value, zhashx_t *variables, const char *iname, const char *ename)
+{
+    switch (kind) {
+        case TERM_LITERAL:
+            return text;
+        case TERM_VALUE:
+            return value;
+        case TERM_NAME:
+            return ename ? ename : iname;
+        case TERM_INAME:
+            return iname;
+        case TERM_VARIABLE:
+            return variables ? (const char *) zhashx_lookup (variables, text) : NULL;
+    }
+    return NULL;
+}
+
+//  Does lua take the string as a number?
+static bool
+s_is_number (const char *string)
+{
+    char *end;
+    strtod (string, &end);
+    if (end == string)
+        return false;
+    while (isspace ((unsigned char) *end))
+        end++;
+    return *end == 0;
+}
+
+//  --------------------------------------------------------------------------
+//  Convert metric value to number like lua tonumber () does. Returns false
+//  if value is not a number, or lua versions don't agree on it (inf, nan).
+
+bool
+rule_threshold_number (const char *value, double *number)
+{
+    if (!value || !number || !s_is_number (value) || strpbrk (value, "nN"))
+        return false;
+    //  + 0.0 turns -0 to 0, lua 5.3 pushes it as integer
+    *number = strtod (value, NULL) + 0.0;
+    return true;
+}
+
+//  Convert term text to number like rule_threshold_number. Value term uses
+//  number converted when metric came, if given (NAN if not a number).
+static bool
+s_term_number (term_kind_t kind, const char *text, const double *cached, double *number)
+{
+    if (kind == TERM_VALUE && cached) {
+        *number = *cached;
+        return !isnan (*cached);
+    }
+    return rule_threshold_number (text, number);
+}
+
+//  Value of message term as lua concatenates it, NULL if variable is not set
+static const char *
+s_term_text (rule_threshold_t *self, term_t *term, const char *value, const double *number_p,
+    zhashx_t *variables, const char *iname, const char *ename, char *buffer, size_t size)
+{
+    const char *text = s_term_value (term->kind, term->text, value, variables, iname, ename);
+    double number;
+    if (self->typed && (term->kind == TERM_VALUE || term->kind == TERM_VARIABLE)
+    &&  s_term_number (term->kind, text, number_p, &number))
+        return s_format_number (number, buffer, size);
+    return text;
+}
+
+//  Value of comparison operand as lua sees it
+typedef struct {
+    enum { VALUE_NIL, VALUE_NUMBER, VALUE_STRING } type;
+    double number;
+    const char *string;
+} operand_value_t;
+
+//  Returns -1 if lua versions differ in conversion of operand
+static int
+s_operand_value (operand_t *operand, bool typed, const char *value, const double *number,
+    zhashx_t *variables, operand_value_t *result)
+{
+    const char *text = s_term_value (operand->kind, operand->text, value, variables, NULL, NULL);
+    result->type = operand_value_t::VALUE_NIL;
+    if (!text)
+        return 0;
+    if (typed && operand->kind != TERM_LITERAL && s_term_number (operand->kind, text, number, &result->number)) {
+        result->type = operand_value_t::VALUE_NUMBER;
+        return 0;
+    }
+    if (!operand->numeric) {
+        result->type = operand_value_t::VALUE_STRING;
+        result->string = text;
+        return 0;
+    }
+    if (s_term_number (operand->kind, text, number, &result->number))
+        result->type = operand_value_t::VALUE_NUMBER;
+    else
+    if (s_is_number (text))
+        return -1;
+    return 0;
+}
+
+//  Compare operands like lua. Returns -1 where lua raises an error.
+static int
+s_compare (const char *op, operand_value_t *left, operand_value_t *right, bool *match)
+{
+    if (op [0] == '=' || op [0] == '~') {
+        bool equal = left->type == right->type;
+        if (equal && left->type == operand_value_t::VALUE_NUMBER)
+            equal = left->number == right->number;
+        else
+        if (equal && left->type == operand_value_t::VALUE_STRING)
+            equal = strcmp (left->string, right->string) == 0;
+        *match = equal == (op [0] == '=');
+        return 0;
+    }
+    if (left->type == operand_value_t::VALUE_NUMBER && right->type == operand_value_t::VALUE_NUMBER) {
+        double a = left->number, b = right->number;
+        if (op [0] == '<')
+            *match = op [1] ? a <= b : a < b;
+        else
+            *match = op [1] ? a >= b : a > b;
+        return 0;
+    }
+    if (left->type == operand_value_t::VALUE_STRING && right->type == operand_value_t::VALUE_STRING) {
+        int cmp = strcoll (left->string, right->string);
+        if (op [0] == '<')
+            *match = op [1] ? cmp <= 0 : cmp < 0;
+        else
+            *match = op [1] ? cmp >= 0 : cmp > 0;
+        return 0;
+    }
+    return -1;
+}
+
+//  --------------------------------------------------------------------------
+//  Evaluate threshold with the same result and message as lua would give.
+//  Returns 0 on success, -1 if rule must be evaluated by lua (e.g. variable
+//  is missing).
+
+int
+rule_threshold_evaluate (rule_threshold_t *self, zlist_t *params, const double *numbers,
+    zhashx_t *variables, const char *iname, const char *ename, int *result, char **message)
+{
+    assert (self);
+    if (!params || zlist_size (params) != 1 || !iname || !result || !message)
+        return -1;
+    const char *value = (const char *) zlist_first (params);
+    if (variables && zhashx_lookup (variables, "tonumber"))
+        return -1;
+
+    for (size_t i = 0; i < self->count; i++) {
+        branch_t *branch = &self->branches [i];
+        if (branch->conditional) {
+            operand_value_t left, right;
+            bool match;
+            if (s_operand_value (&branch->left, self->typed, value, numbers, variables, &left) != 0
+            ||  s_operand_value (&branch->right, self->typed, value, numbers, variables, &right) != 0
+            ||  s_compare (branch->op, &left, &right, &match) != 0)
+                return -1;      //  lua raises an error or versions differ
+            if (!match)
+                continue;
+        }
+        if (variables && zhashx_lookup (variables, branch->severity_name))
+            return -1;          //  variable hides the constant
+        //  build message
+        char buffer [32];
+        size_t size = 1;
+        for (size_t t = 0; t < branch->terms_count; t++) {
+            const char *text = s_term_text (self, &branch->terms [t], value, numbers, variables, iname, ename, buffer, sizeof (buffer));
+            if (!text)
+                return -1;
+            size += strlen (text);
+        }
+        char *msg = (char *) zmalloc (size);
+        assert (msg);
+        char *p = msg;
+        for (size_t t = 0; t < branch->terms_count; t++) {
+            const char *text = s_term_text (self, &branch->terms [t], value, numbers, variables, iname, ename, buffer, sizeof (buffer));
+            size_t length = strlen (text);
+            memcpy (p, text, length);
+            p += length;
+        }
+        if (s_is_number (msg)) {
+            //  lua code takes numeric message as result
+            zstr_free (&msg);
+            return -1;
+        }
+        *result = branch->severity;
+        *message = msg;
+        return 0;
+    }
+    return -1;
+}
+
+//  --------------------------------------------------------------------------
+//  Vector kernel: set severity of values matching comparison with limit
+
+typedef double v4df_t __attribute__ ((vector_size (4 * sizeof (double))));
+typedef int64_t v4di_t __attribute__ ((vector_size (4 * sizeof (int64_t))));
+
+#define S_CLASSIFY_LOOP(cmp) \
+    for (; i + 4 <= count; i += 4) { \
+        v4df_t a, b; \
+        v4di_t r; \
+        memcpy (&a, values + i, sizeof (a)); \
+        memcpy (&r, severities + i, sizeof (r)); \
+        b = limits; \
+        if (!value_left) { v4df_t t = a; a = b; b = t; } \
+        v4di_t mask = (v4di_t) (a cmp b); \
+        r = (mask & branch) | (~mask & r); \
+        memcpy (severities + i, &r, sizeof (r)); \
+    } \
+    for (; i < count; i++) { \
+        double a = value_left ? values [i] : limit; \
+        double b = value_left ? limit : values [i]; \
+        if (a cmp b) \
+            severities [i] = severity; \
+    }
+
+static void
+s_classify_branch (const double *values, int64_t *severities, size_t count,
+    const char *op, bool value_left, double limit, int64_t severity)
+{
+    v4df_t limits = { limit, limit, limit, limit };
+    v4di_t branch = { severity, severity, severity, severity };
+    size_t i = 0;
+    if (streq (op, "<"))
+        { S_CLASSIFY_LOOP (<) }
+    else
+    if (streq (op, "<="))
+        { S_CLASSIFY_LOOP (<=) }
+    else
+    if (streq (op, ">"))
+        { S_CLASSIFY_LOOP (>) }
+    else
+    if (streq (op, ">="))
+        { S_CLASSIFY_LOOP (>=) }
+    else
+    if (streq (op, "=="))
+        { S_CLASSIFY_LOOP (==) }
+    else
+        { S_CLASSIFY_LOOP (!=) }
+}
+
+//  --------------------------------------------------------------------------
+//  Classify metric values (converted by rule_threshold_number) of many
+//  assets at once. Stores the severity rule_threshold_evaluate would give
+//  for every value, messages are not built. Returns 0 on success, -1 if
+//  rule or its variables don't allow numeric classification.
+
+int
+rule_threshold_classify (rule_threshold_t *self, const double *values, size_t count,
+    zhashx_t *variables, int *results)
+{
+    assert (self);
+    if (!self->numeric || (count && (!values || !results))
+    ||  (variables && zhashx_lookup (variables, "tonumber")))
+        return -1;
+    //  limits of all branches first, we can't fall back in the middle
+    double *limits = (double *) zmalloc ((self->count + 1) * sizeof (double));
+    assert (limits);
+    int rc = 0;
+    for (size_t i = 0; i < self->count && rc == 0; i++) {
+        branch_t *branch = &self->branches [i];
+        if (variables && zhashx_lookup (variables, branch->severity_name))
+            rc = -1;            //  variable hides the constant
+        for (size_t t = 0; t < branch->terms_count; t++)
+            if (branch->terms [t].kind == TERM_VARIABLE
+            &&  !(variables && zhashx_lookup (variables, branch->terms [t].text)))
+                rc = -1;        //  lua fails to build the message
+        if (rc == 0 && branch->conditional) {
+            operand_t *limit = branch->left.kind == TERM_VALUE ? &branch->right : &branch->left;
+            const char *text = s_term_value (limit->kind, limit->text, NULL, variables, NULL, NULL);
+            if (!rule_threshold_number (text, &limits [i]))
+                rc = -1;        //  tonumber () gives nil, lua fails on ordering
+        }
+    }
+    if (rc == 0 && count) {
+        int64_t *severities = (int64_t *) zmalloc (count * sizeof (int64_t));
+        assert (severities);
+        //  last branch first, so the first matching one wins
+        for (size_t i = self->count; i-- > 0;) {
+            branch_t *branch = &self->branches [i];
+            if (!branch->conditional) {
+                for (size_t v = 0; v < count; v++)
+                    severities [v] = branch->severity;
+            }
+            else
+                s_classify_branch (values, severities, count, branch->op,
+                    branch->left.kind == TERM_VALUE, limits [i], branch->severity);
+        }
+        for (size_t v = 0; v < count; v++)
+            results [v] = (int) severities [v];
+        free (severities);
+    }
+    free (limits);
+    return rc;
+}
+
+//  --------------------------------------------------------------------------
+//  Self test of this class
+
+static void
+s_test_result (rule_threshold_t *self, zhashx_t *variables, const char *value, int expected, const char *expected_message)
+{
+    zlist_t *params = zlist_new ();
+    zlist_append (params, (void *) value);
+    //  value converted here and when metric came
+    double number;
+    if (!rule_threshold_number (value, &number))
+        number = NAN;
+    for (int i = 0; i < 2; i++) {
+        int result = 99;
+        char *message = NULL;
+        assert (rule_threshold_evaluate (self, params, i ? &number : NULL, variables,
+            "rack-1", "Rack 1", &result, &message) == 0);
+        assert (result == expected);
+        assert (message && streq (message, expected_message));
+        zstr_free (&message);
+    }
+    zlist_destroy (&params);
+}
+
+void
+rule_threshold_test (bool verbose)
+{
+    printf (" * rule_threshold: ");
+
+    //  @selftest
+    const char *threshold =
+        "function main (humidity)\n"
+        "    if (humidity < low_critical) then\n"
+        "        return LOW_CRITICAL, 'Humidity in '..NAME..' is critically low ('..humidity..'%)'\n"
+        "    end\n"
+        "    -- comment\n"
+        "    if high_warning < humidity then\n"
+        "        return HIGH_WARNING, \"Humidity in \" .. INAME .. ' is over ' .. high_warning;\n"
+        "    end\n"
+        "    if humidity == 'nan' then return WARNING, 'no value' end\n"
+        "    return OK, 'Humidity is within normal limits.'\n"
+        "end\n";
+    rule_threshold_t *self = rule_threshold_new (threshold, false);
+    assert (self);
+
+    zhashx_t *variables = zhashx_new ();
+    zhashx_insert (variables, "low_critical", (void *) "20");
+    zhashx_insert (variables, "high_warning", (void *) "60");
+    s_test_result (self, variables, "10", -2, "Humidity in Rack 1 is critically low (10%)");
+    s_test_result (self, variables, "70", 1, "Humidity in rack-1 is over 60");
+    s_test_result (self, variables, "nan", 1, "Humidity in rack-1 is over 60");
+    s_test_result (self, variables, "40", 0, "Humidity is within normal limits.");
+    //  lua compares strings
+    s_test_result (self, variables, "100", -2, "Humidity in Rack 1 is critically low (100%)");
+
+    //  missing variable, lua raises an error
+    zhashx_delete (variables, "high_warning");
+    zlist_t *params = zlist_new ();
+    zlist_append (params, (void *) "40");
+    int result;
+    char *message = NULL;
+    assert (rule_threshold_evaluate (self, params, NULL, variables, "rack-1", NULL, &result, &message) == -1);
+    assert (message == NULL);
+    //  variable named like severity
+    zhashx_insert (variables, "high_warning", (void *) "60");
+    zhashx_insert (variables, "OK", (void *) "5");
+    assert (rule_threshold_evaluate (self, params, NULL, variables, "rack-1", NULL, &result, &message) == -1);
+    zlist_destroy (&params);
+    zhashx_destroy (&variables);
+    rule_threshold_destroy (&self);
+    assert (self == NULL);
+
+    //  numeric message is taken as result by lua
+    self = rule_threshold_new ("function main (x) return OK, x end", false);
+    assert (self);
+    params = zlist_new ();
+    zlist_append (params, (void *) "42");
+    assert (rule_threshold_evaluate (self, params, NULL, NULL, "rack-1", NULL, &result, &message) == -1);
+    zlist_destroy (&params);
+    rule_threshold_destroy (&self);
+
+    //  string compared with number, lua raises an error
+    self = rule_threshold_new ("function main (load) if load > 90 then return CRITICAL, 'high' end return OK, 'ok' end", false);
+    assert (self);
+    params = zlist_new ();
+    zlist_append (params, (void *) "95");
+    assert (rule_threshold_evaluate (self, params, NULL, NULL, "ups-1", NULL, &result, &message) == -1);
+    zlist_destroy (&params);
+    rule_threshold_destroy (&self);
+    self = rule_threshold_new ("function main (load) if load == 90 then return CRITICAL, 'high' end return OK, 'ok' end", false);
+    assert (self);
+    s_test_result (self, NULL, "90", 0, "ok");
+    rule_threshold_destroy (&self);
+
+    //  typed rule gets numbers, which lua compares as numbers
+    self = rule_threshold_new (threshold, true);
+    assert (self);
+    variables = zhashx_new ();
+    zhashx_insert (variables, "low_critical", (void *) "20");
+    zhashx_insert (variables, "high_warning", (void *) "60");
+    s_test_result (self, variables, "100", 1, "Humidity in rack-1 is over 60");
+    s_test_result (self, variables, "10.50", -2, "Humidity in Rack 1 is critically low (10.5%)");
+    s_test_result (self, variables, "1e1", -2, "Humidity in Rack 1 is critically low (10%)");
+    s_test_result (self, variables, "-0", -2, "Humidity in Rack 1 is critically low (0%)");
+    s_test_result (self, variables, "40", 0, "Humidity is within normal limits.");
+    //  string is still compared with number
+    params = zlist_new ();
+    zlist_append (params, (void *) "nan");
+    assert (rule_threshold_evaluate (self, params, NULL, variables, "rack-1", NULL, &result, &message) == -1);
+    zlist_destroy (&params);
+    zhashx_destroy (&variables);
+    rule_threshold_destroy (&self);
+    self = rule_threshold_new ("function main (load) if load > 90 then return CRITICAL, 'high' end return OK, 'ok' end", true);
+    assert (self);
+    s_test_result (self, NULL, "95", 2, "high");
+    s_test_result (self, NULL, "90.0", 0, "ok");
+    rule_threshold_destroy (&self);
+
+    //  numeric comparisons
+    const char *numeric =
+        "function main (load)\n"
+        "    if tonumber (load) < tonumber (low) then return LOW_WARNING, 'Load of '..NAME..' is low' end\n"
+        "    if 90 <= tonumber (load) then return CRITICAL, 'Load is '..load..'%' end\n"
+        "    if tonumber (load) == 50 then return WARNING, 'Load is exactly half' end\n"
+        "    return OK, 'Load is normal'\n"
+        "end\n";
+    self = rule_threshold_new (numeric, false);
+    assert (self);
+    variables = zhashx_new ();
+    zhashx_insert (variables, "low", (void *) "10");
+    s_test_result (self, variables, "100", 2, "Load is 100%");
+    s_test_result (self, variables, "90", 2, "Load is 90%");
+    s_test_result (self, variables, "9.5", -1, "Load of Rack 1 is low");
+    s_test_result (self, variables, " 0x10 ", 0, "Load is normal");
+    s_test_result (self, variables, "50.0", 1, "Load is exactly half");
+    params = zlist_new ();
+    zlist_append (params, (void *) "unknown");
+    assert (rule_threshold_evaluate (self, params, NULL, variables, "ups-1", NULL, &result, &message) == -1);
+    zlist_destroy (&params);
+    params = zlist_new ();
+    zlist_append (params, (void *) "nan");
+    assert (rule_threshold_evaluate (self, params, NULL, variables, "ups-1", NULL, &result, &message) == -1);
+    zlist_destroy (&params);
+
+    //  batch classification gives the same severities
+    const size_t count = verbose ? 10000 : 1000;
+    double *values = (double *) zmalloc (count * sizeof (double));
+    int *results = (int *) zmalloc (count * sizeof (int));
+    char **texts = (char **) zmalloc (count * sizeof (char *));
+    for (size_t i = 0; i < count; i++) {
+        texts [i] = zsys_sprintf ("%zu.%zu", i % 120, i % 10);
+        assert (rule_threshold_number (texts [i], &values [i]));
+    }
+    assert (!rule_threshold_number ("inf", &values [0]) && !rule_threshold_number ("10 %", &values [0]));
+    int64_t start = zclock_usecs ();
+    assert (rule_threshold_classify (self, values, count, variables, results) == 0);
+    int64_t batch_time = zclock_usecs () - start;
+    int64_t single_time = 0;
+    for (size_t i = 0; i < count; i++) {
+        params = zlist_new ();
+        zlist_append (params, texts [i]);
+        start = zclock_usecs ();
+        //  number converted when metric came gives the same result
+        assert (rule_threshold_evaluate (self, params, i % 2 ? &values [i] : NULL, variables,
+            "ups-1", NULL, &result, &message) == 0);
+        single_time += zclock_usecs () - start;
+        assert (result == results [i]);
+        zstr_free (&message);
+        zlist_destroy (&params);
+        zstr_free (&texts [i]);
+    }
+    if (verbose)
+        log_info ("%zu assets: batch classification %.3f ms, evaluation one by one %.3f ms",
+            count, batch_time / 1000.0, single_time / 1000.0);
+    free (texts);
+    //  limit is not a number
+    zhashx_update (variables, "low", (void *) "low");
+    assert (rule_threshold_classify (self, values, count, variables, results) == -1);
+    zhashx_delete (variables, "low");
+    assert (rule_threshold_classify (self, values, count, variables, results) == -1);
+    zhashx_destroy (&variables);
+    rule_threshold_destroy (&self);
+    //  string comparisons or numeric message can't be classified
+    self = rule_threshold_new (threshold, false);
+    assert (rule_threshold_classify (self, values, count, NULL, results) == -1);
+    rule_threshold_destroy (&self);
+    self = rule_threshold_new ("function main (x) if tonumber (x) > 1 then return WARNING, x..'' end return OK, 'ok' end", false);
+    assert (self);
+    assert (rule_threshold_classify (self, values, count, NULL, results) == -1);
+    rule_threshold_destroy (&self);
+    //  typed variables are numbers without tonumber
+    const char *typed = "function main (x) if x > high then return WARNING, 'high' end return OK, 'ok' end";
+    self = rule_threshold_new (typed, false);
+    assert (rule_threshold_classify (self, values, count, NULL, results) == -1);
+    rule_threshold_destroy (&self);
+    self = rule_threshold_new (typed, true);
+    variables = zhashx_new ();
+    zhashx_insert (variables, "high", (void *) "100");
+    assert (rule_threshold_classify (self, values, count, variables, results) == 0);
+    for (size_t i = 0; i < count; i++)
+        assert (results [i] == (values [i] > 100 ? 1 : 0));
+    zhashx_destroy (&variables);
+    rule_threshold_destroy (&self);
+    free (values);
+    free (results);
+
+    //  left to lua
+    const char *others [] = {
+        "function main (x) if x < a then return CRITICAL, 'low' elseif x > b then return WARNING, 'high' end return OK, 'ok' end",
+        "function main (x) if x < a then return CRITICAL, string.format ('%s', x) end return OK, 'ok' end",
+        "function main (x, y) if x < y then return CRITICAL, 'low' end return OK, 'ok' end",
+        "function main (x) if a < b then return CRITICAL, 'low' end return OK, 'ok' end",
+        "function main (x) if x < a then return CRITICAL, 'it\\'s low' end return OK, 'ok' end",
+        "function main (x) if x < a then return CRITICAL, 'low' end end",
+        "function main (x) return OK, 'ok' end function other () end",
+        "function main (x) return __severity__, 'ok' end",
+        "",
+        NULL
+    };
+    for (int i = 0; others [i]; i++) {
+        self = rule_threshold_new (others [i], false);
+        if (self) {
+            fprintf (stderr, "Threshold evaluator accepts\n%s\n", others [i]);
+            assert (0);
+        }
+    }
+    assert (rule_threshold_new (NULL, false) == NULL);
+
+    //  comments are skipped like lua does
+    self = rule_threshold_new ("--[[ comment ]] function main (x) -- value\n return OK, 'ok' end", false);
+    assert (self);
+    rule_threshold_destroy (&self);
+    //  @end
+    printf ("OK\n");
+}
@@ -0,0 +1,77 @@
+/*  =========================================================================
+    rule_threshold - Native evaluator of threshold rules
+
+    Copyright (C) 2016 - 2017 Tomas Halman
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+#ifndef RULE_THRESHOLD_H_INCLUDED
+#define RULE_THRESHOLD_H_INCLUDED
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//  Opaque class structures to allow forward references
+#ifndef RULE_THRESHOLD_T_DEFINED
+typedef struct _rule_threshold_t rule_threshold_t;
+#define RULE_THRESHOLD_T_DEFINED
+#endif
+
+//  @interface
+//  Create a new rule_threshold from lua evaluation of rule. Typed rule gets
+//  values and variables which are numbers as lua numbers. Returns NULL if
+//  evaluation is not a plain threshold rule.
+FTY_ALERT_FLEXIBLE_PRIVATE rule_threshold_t *
+    rule_threshold_new (const char *evaluation, bool typed);
+
+//  Destroy the rule_threshold
+FTY_ALERT_FLEXIBLE_PRIVATE void
+    rule_threshold_destroy (rule_threshold_t **self_p);
+
+//  Evaluate threshold with the same result and message as lua would give.
+//  Numbers are params converted by rule_threshold_number when metrics came
+//  (NAN if not a number), NULL to convert them here. Returns 0 on success,
+//  -1 if rule must be evaluated by lua (e.g. variable is missing).
+FTY_ALERT_FLEXIBLE_PRIVATE int
+    rule_threshold_evaluate (rule_threshold_t *self, zlist_t *params, const double *numbers,
+        zhashx_t *variables, const char *iname, const char *ename, int *result, char **message);
+
+//  Convert metric value to number like lua tonumber () does. Returns false
+//  if value is not a number, or lua versions don't agree on it (inf, nan).
+FTY_ALERT_FLEXIBLE_PRIVATE bool
+    rule_threshold_number (const char *value, double *number);
+
+//  Classify metric values (converted by rule_threshold_number) of many
+//  assets at once. Stores the severity rule_threshold_evaluate would give
+//  for every value, messages are not built. Returns 0 on success, -1 if
+//  rule or its variables don't allow numeric classification.
+FTY_ALERT_FLEXIBLE_PRIVATE int
+    rule_threshold_classify (rule_threshold_t *self, const double *values, size_t count,
+        zhashx_t *variables, int *results);
+
+//  Self test of this class
+FTY_ALERT_FLEXIBLE_PRIVATE void
+    rule_threshold_test (bool verbose);
+
+//  @end
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
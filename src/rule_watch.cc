@@ -0,0 +1,345 @@
+/*  =========================================================================
+    rule_watch - Watch rule directory for changed rule files
+
+    Copyright (C) 2016 - 2017 Tomas Halman
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+/*
+@header
+    rule_watch - Watch rule directory for changed rule files
+@discuss
+    Provisioning tools drop .rule files directly to the rule directory.
+    rule_watch uses inotify to find out which files were created, modified
+    or deleted, so only those are parsed again. Bursts of changes are
+    debounced and reported together.
+@end
+*/
+
+#include "fty_alert_flexible_classes.h"
+
+#include <sys/inotify.h>
+
+#define RULE_WATCH_MASK (IN_CREATE | IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE)
+#define RULE_WATCH_DEBOUNCE 500
+
+//  Structure of our class
+
+struct _rule_watch_t {
+    char *dir;
+    int fd;                     //  inotify instance
+    int wd;                     //  watch descriptor of dir
+    int debounce;               //  quiet period before changes are reported
+    zhash_t *changes;           //  changed file names
+    int64_t first_change;
+    int64_t last_change;
+};
+
+//  --------------------------------------------------------------------------
+//  Does the name look like a rule file?
+
+static bool
+s_is_rule_file (const char *name)
+{
+    size_t l = strlen (name);
+    return l > 5 && streq (&name [l - 5], ".rule");
+}
+
+//  --------------------------------------------------------------------------
+//  Create a new rule_watch for directory. Changes are reported once there
+//  was no other change for debounce milliseconds. Returns NULL if the
+//  directory can't be watched.
+
+rule_watch_t *
+rule_watch_new (const char *dir, int debounce)
+{
+    assert (dir);
+
+    int fd = inotify_init1 (IN_NONBLOCK | IN_CLOEXEC);
+    if (fd == -1) {
+        log_error ("inotify_init1 failed (%s)", strerror (errno));
+        return NULL;
+    }
+    int wd = inotify_add_watch (fd, dir, RULE_WATCH_MASK);
+    if (wd == -1) {
+        log_error ("can't watch dir '%s' (%s)", dir, strerror (errno));
+        close (fd);
+        return NULL;
+    }
+
+    rule_watch_t *self = (rule_watch_t *) zmalloc (sizeof (rule_watch_t));
+    assert (self);
+    //  Initialize class properties here
+    self->dir = strdup (dir);
+    self->fd = fd;
+    self->wd = wd;
+    self->debounce = debounce;
+    self->changes = zhash_new ();
+    return self;
+}
+
+//  --------------------------------------------------------------------------
+//  Destroy the rule_watch
+
+void
+rule_watch_destroy (rule_watch_t **self_p)
+{
+    assert (self_p);
+    if (*self_p) {
+        rule_watch_t *self = *self_p;
+        //  Free class properties here
+        inotify_rm_watch (self->fd, self->wd);
+        close (self->fd);
+        zstr_free (&self->dir);
+        zhash_destroy (&self->changes);
+        //  Free object itself
+        free (self);
+        *self_p = NULL;
+    }
+}
+
+//  --------------------------------------------------------------------------
+//  Get inotify file descriptor, readable when there are new events
+
+int
+rule_watch_fd (rule_watch_t *self)
+{
+    assert (self);
+    return self->fd;
+}
+
+//  --------------------------------------------------------------------------
+//  Record change of rule file name
+
+void
+rule_watch_touch (rule_watch_t *self, const char *name, int64_t now)
+{
+    assert (self);
+    assert (name);
+
+    if (zhash_size (self->changes) == 0)
+        self->first_change = now;
+    self->last_change = now;
+    zhash_update (self->changes, name, (void *) "");
+}
+
+//  --------------------------------------------------------------------------
+//  Events were lost, consider all rule files changed
+
+static void
+s_touch_all (rule_watch_t *self, int64_t now)
+{
+    DIR *dir = opendir (self->dir);
+    if (!dir) return;
+    struct dirent *entry;
+    while ((entry = readdir (dir)) != NULL) {
+        if (s_is_rule_file (entry->d_name))
+            rule_watch_touch (self, entry->d_name, now);
+    }
+    closedir (dir);
+}
+
+//  --------------------------------------------------------------------------
+//  Read all pending events without blocking. Returns number of events
+//  about .rule files.
+
+int
+rule_watch_read (rule_watch_t *self, int64_t now)
+{
+    assert (self);
+
+    char buffer [4096] __attribute__ ((aligned (__alignof__ (struct inotify_event))));
+    int count = 0;
+    while (true) {
+        ssize_t len = read (self->fd, buffer, sizeof (buffer));
+        if (len <= 0)
+            break;      //  EAGAIN, nothing more to read
+
+        for (char *p = buffer; p < buffer + len; ) {
+            const struct inotify_event *event = (const struct inotify_event *) p;
+            if (event->mask & IN_Q_OVERFLOW) {
+                log_warning ("inotify queue overflow, rescanning '%s'", self->dir);
+                s_touch_all (self, now);
+            }
+            else
+            if (event->len && s_is_rule_file (event->name)) {
+                log_trace ("rule file %s changed (mask 0x%x)", event->name, event->mask);
+                rule_watch_touch (self, event->name, now);
+                count++;
+            }
+            p += sizeof (struct inotify_event) + event->len;
+        }
+    }
+    return count;
+}
+
+//  --------------------------------------------------------------------------
+//  Return milliseconds until recorded changes are due, -1 if there are none
+
+int64_t
+rule_watch_timeout (rule_watch_t *self, int64_t now)
+{
+    assert (self);
+
+    if (zhash_size (self->changes) == 0)
+        return -1;
+    //  continuous churn must not postpone reload forever
+    int64_t due = self->last_change + self->debounce;
+    int64_t latest = self->first_change + 10 * self->debounce;
+    if (latest < due)
+        due = latest;
+    return due > now ? due - now : 0;
+}
+
+//  --------------------------------------------------------------------------
+//  Return list of changed file names if they are due, else NULL.
+//  Caller is responsible for destroying the return value
+
+zlist_t *
+rule_watch_changes (rule_watch_t *self, int64_t now)
+{
+    assert (self);
+
+    if (rule_watch_timeout (self, now) != 0)
+        return NULL;
+
+    zlist_t *changes = zhash_keys (self->changes);
+    zhash_destroy (&self->changes);
+    self->changes = zhash_new ();
+    return changes;
+}
+
+//  --------------------------------------------------------------------------
+//  Actor watching directory passed as args. It sends CHANGED/name1/.../nameN
+//  message to the pipe after rule files were created, modified or deleted.
+
+void
+rule_watch_actor (zsock_t *pipe, void *args)
+{
+    rule_watch_t *self = rule_watch_new ((const char *) args, RULE_WATCH_DEBOUNCE);
+    zsock_signal (pipe, 0);
+
+    zmq_pollitem_t items [] = {
+        { zsock_resolve (pipe), 0, ZMQ_POLLIN, 0 },
+        { NULL, self ? rule_watch_fd (self) : -1, ZMQ_POLLIN, 0 }
+    };
+    int nitems = self ? 2 : 1;
+
+    while (!zsys_interrupted) {
+        long timeout = self ? (long) rule_watch_timeout (self, zclock_mono ()) : -1;
+        if (zmq_poll (items, nitems, timeout) == -1)
+            break;      //  interrupted
+
+        if (items [0].revents & ZMQ_POLLIN) {
+            zmsg_t *msg = zmsg_recv (pipe);
+            char *cmd = zmsg_popstr (msg);
+            bool terminate = !cmd || streq (cmd, "$TERM");
+            zstr_free (&cmd);
+            zmsg_destroy (&msg);
+            if (terminate)
+                break;
+        }
+        if (!self)
+            continue;
+        if (items [1].revents & ZMQ_POLLIN)
+            rule_watch_read (self, zclock_mono ());
+
+        zlist_t *changes = rule_watch_changes (self, zclock_mono ());
+        if (changes) {
+            zmsg_t *msg = zmsg_new ();
+            zmsg_addstr (msg, "CHANGED");
+            const char *name = (const char *) zlist_first (changes);
+            while (name) {
+                zmsg_addstr (msg, name);
+                name = (const char *) zlist_next (changes);
+            }
+            zmsg_send (&msg, pipe);
+            zlist_destroy (&changes);
+        }
+    }
+    rule_watch_destroy (&self);
+}
+
+//  --------------------------------------------------------------------------
+//  Self test of this class
+
+void
+rule_watch_test (bool verbose)
+{
+    printf (" * rule_watch: ");
+
+    //  @selftest
+    const char *SELFTEST_DIR_RW = "src/selftest-rw";
+    char *dir = zsys_sprintf ("%s/rule_watch", SELFTEST_DIR_RW);
+    assert (dir);
+    mkdir (dir, 0755);
+
+    assert (rule_watch_new ("/nonexistent/rules", 100) == NULL);
+
+    rule_watch_t *self = rule_watch_new (dir, 100);
+    assert (self);
+    assert (rule_watch_timeout (self, 0) == -1);
+
+    //  create rule and other file
+    char *path = zsys_sprintf ("%s/test.rule", dir);
+    char *other = zsys_sprintf ("%s/test.txt", dir);
+    FILE *f = fopen (path, "w");
+    assert (f);
+    fputs ("{}", f);
+    fclose (f);
+    f = fopen (other, "w");
+    assert (f);
+    fclose (f);
+
+    assert (rule_watch_read (self, 1000) > 0);
+    assert (rule_watch_timeout (self, 1000) == 100);
+    assert (rule_watch_changes (self, 1050) == NULL);
+
+    //  another change postpones report
+    rule_watch_touch (self, "test.rule", 1050);
+    assert (rule_watch_changes (self, 1100) == NULL);
+    zlist_t *changes = rule_watch_changes (self, 1150);
+    assert (changes);
+    assert (zlist_size (changes) == 1);
+    assert (streq ((char *) zlist_first (changes), "test.rule"));
+    zlist_destroy (&changes);
+    assert (rule_watch_timeout (self, 1150) == -1);
+
+    //  churn is reported after 10 * debounce at the latest
+    for (int64_t now = 2000; now < 3000; now += 50)
+        rule_watch_touch (self, "churn.rule", now);
+    changes = rule_watch_changes (self, 3000);
+    assert (changes);
+    zlist_destroy (&changes);
+
+    //  deleted file
+    unlink (path);
+    unlink (other);
+    assert (rule_watch_read (self, 4000) == 1);
+    changes = rule_watch_changes (self, 4100);
+    assert (changes && streq ((char *) zlist_first (changes), "test.rule"));
+    zlist_destroy (&changes);
+
+    rule_watch_destroy (&self);
+    assert (self == NULL);
+    zstr_free (&path);
+    zstr_free (&other);
+    rmdir (dir);
+    zstr_free (&dir);
+    //  @end
+    printf ("OK\n");
+}
@@ -0,0 +1,83 @@
+/*  =========================================================================
+    rule_watch - Watch rule directory for changed rule files
+
+    Copyright (C) 2016 - 2017 Tomas Halman
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+#ifndef RULE_WATCH_H_INCLUDED
+#define RULE_WATCH_H_INCLUDED
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//  Opaque class structures to allow forward references
+#ifndef RULE_WATCH_T_DEFINED
+typedef struct _rule_watch_t rule_watch_t;
+#define RULE_WATCH_T_DEFINED
+#endif
+
+//  @interface
+//  Create a new rule_watch for directory. Changes are reported once there
+//  was no other change for debounce milliseconds. Returns NULL if the
+//  directory can't be watched.
+FTY_ALERT_FLEXIBLE_PRIVATE rule_watch_t *
+    rule_watch_new (const char *dir, int debounce);
+
+//  Destroy the rule_watch
+FTY_ALERT_FLEXIBLE_PRIVATE void
+    rule_watch_destroy (rule_watch_t **self_p);
+
+//  Get inotify file descriptor, readable when there are new events
+FTY_ALERT_FLEXIBLE_PRIVATE int
+    rule_watch_fd (rule_watch_t *self);
+
+//  Read all pending events without blocking. Returns number of events
+//  about .rule files.
+FTY_ALERT_FLEXIBLE_PRIVATE int
+    rule_watch_read (rule_watch_t *self, int64_t now);
+
+//  Record change of rule file name
+FTY_ALERT_FLEXIBLE_PRIVATE void
+    rule_watch_touch (rule_watch_t *self, const char *name, int64_t now);
+
+//  Return milliseconds until recorded changes are due, -1 if there are none
+FTY_ALERT_FLEXIBLE_PRIVATE int64_t
+    rule_watch_timeout (rule_watch_t *self, int64_t now);
+
+//  Return list of changed file names if they are due, else NULL.
+//  Caller is responsible for destroying the return value
+FTY_ALERT_FLEXIBLE_PRIVATE zlist_t *
+    rule_watch_changes (rule_watch_t *self, int64_t now);
+
+//  Actor watching directory passed as args. It sends CHANGED/name1/.../nameN
+//  message to the pipe after rule files were created, modified or deleted.
+FTY_ALERT_FLEXIBLE_PRIVATE void
+    rule_watch_actor (zsock_t *pipe, void *args);
+
+//  Self test of this class
+FTY_ALERT_FLEXIBLE_PRIVATE void
+    rule_watch_test (bool verbose);
+
+//  @end
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
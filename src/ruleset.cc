@@ -0,0 +1,300 @@
+/*  =========================================================================
+    ruleset - Immutable snapshot of all rules
+
+    Copyright (C) 2016 - 2017 Tomas Halman
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+/*
+@header
+    ruleset - Immutable snapshot of all rules
+@discuss
+    The agent never changes published ruleset. Every change makes a copy
+    (ruleset_dup), modifies it and publishes it instead of the old one, so
+    threads evaluating metrics can keep using the snapshot they hold
+    without any locking. Rules are reference counted and shared between
+    snapshots; ruleset and its rules are freed with the last reference.
+
+    Rules are kept in array sorted by name. Lookup and iteration only read
+    the array, which makes them safe for concurrent readers.
+@end
+*/
+
+#include "fty_alert_flexible_classes.h"
+
+//  Structure of our class
+
+struct _ruleset_t {
+    int refs;
+    uint64_t version;
+    rule_t **rules;             //  sorted by name
+    size_t size;
+    size_t capacity;
+};
+
+//  --------------------------------------------------------------------------
+//  Create a new empty ruleset
+
+ruleset_t *
+ruleset_new (void)
+{
+    ruleset_t *self = (ruleset_t *) zmalloc (sizeof (ruleset_t));
+    assert (self);
+    //  Initialize class properties here
+    self->refs = 1;
+    return self;
+}
+
+//  --------------------------------------------------------------------------
+//  Create a modifiable copy of ruleset with next version. Rules are
+//  shared with the original.
+
+ruleset_t *
+ruleset_dup (ruleset_t *self)
+{
+    assert (self);
+    ruleset_t *copy = ruleset_new ();
+    copy->version = self->version + 1;
+    copy->capacity = self->size;
+    if (copy->capacity) {
+        copy->rules = (rule_t **) malloc (copy->capacity * sizeof (rule_t *));
+        assert (copy->rules);
+    }
+    for (size_t i = 0; i < self->size; i++)
+        copy->rules [i] = rule_ref (self->rules [i]);
+    copy->size = self->size;
+    return copy;
+}
+
+//  --------------------------------------------------------------------------
+//  Destroy the ruleset. Ruleset is freed when the last reference is dropped.
+
+void
+ruleset_destroy (ruleset_t **self_p)
+{
+    assert (self_p);
+    if (*self_p) {
+        ruleset_t *self = *self_p;
+        *self_p = NULL;
+        if (__atomic_sub_fetch (&self->refs, 1, __ATOMIC_ACQ_REL) > 0)
+            return;
+        //  Free class properties here
+        for (size_t i = 0; i < self->size; i++)
+            rule_destroy (&self->rules [i]);
+        free (self->rules);
+        //  Free object itself
+        free (self);
+    }
+}
+
+//  --------------------------------------------------------------------------
+//  Add reference to ruleset, returns the ruleset
+
+ruleset_t *
+ruleset_ref (ruleset_t *self)
+{
+    assert (self);
+    __atomic_add_fetch (&self->refs, 1, __ATOMIC_RELAXED);
+    return self;
+}
+
+//  --------------------------------------------------------------------------
+//  Find position of rule, or position where it would be inserted
+
+static size_t
+s_position (ruleset_t *self, const char *name, bool *found)
+{
+    size_t low = 0, high = self->size;
+    *found = false;
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        int cmp = strcmp (rule_name (self->rules [middle]), name);
+        if (cmp == 0) {
+            *found = true;
+            return middle;
+        }
+        if (cmp < 0)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+    return low;
+}
+
+//  --------------------------------------------------------------------------
+//  Insert rule, ruleset takes over the caller's reference. Rule with the
+//  same name is replaced. Ruleset must not be published yet.
+
+void
+ruleset_insert (ruleset_t *self, rule_t *rule)
+{
+    assert (self);
+    assert (rule && rule_name (rule));
+    bool found;
+    size_t index = s_position (self, rule_name (rule), &found);
+    if (found) {
+        rule_destroy (&self->rules [index]);
+        self->rules [index] = rule;
+        return;
+    }
+    if (self->size == self->capacity) {
+        self->capacity = self->capacity ? self->capacity * 2 : 16;
+        self->rules = (rule_t **) realloc (self->rules, self->capacity * sizeof (rule_t *));
+        assert (self->rules);
+    }
+    memmove (&self->rules [index + 1], &self->rules [index], (self->size - index) * sizeof (rule_t *));
+    self->rules [index] = rule;
+    self->size++;
+}
+
+//  --------------------------------------------------------------------------
+//  Remove rule. Returns 0 on success, -1 if there is no such rule.
+//  Ruleset must not be published yet.
+
+int
+ruleset_remove (ruleset_t *self, const char *name)
+{
+    assert (self);
+    assert (name);
+    bool found;
+    size_t index = s_position (self, name, &found);
+    if (!found)
+        return -1;
+    rule_destroy (&self->rules [index]);
+    memmove (&self->rules [index], &self->rules [index + 1], (self->size - index - 1) * sizeof (rule_t *));
+    self->size--;
+    return 0;
+}
+
+//  --------------------------------------------------------------------------
+//  Find rule by name, NULL if there is no such rule
+
+rule_t *
+ruleset_lookup (ruleset_t *self, const char *name)
+{
+    assert (self);
+    if (!name)
+        return NULL;
+    bool found;
+    size_t index = s_position (self, name, &found);
+    return found ? self->rules [index] : NULL;
+}
+
+//  --------------------------------------------------------------------------
+//  Number of rules
+
+size_t
+ruleset_size (ruleset_t *self)
+{
+    assert (self);
+    return self->size;
+}
+
+//  --------------------------------------------------------------------------
+//  Get rule at index (rules are sorted by name), NULL if index is out
+//  of range. Unlike zhash cursors, this does not modify the ruleset.
+
+rule_t *
+ruleset_at (ruleset_t *self, size_t index)
+{
+    assert (self);
+    return index < self->size ? self->rules [index] : NULL;
+}
+
+//  --------------------------------------------------------------------------
+//  Version of ruleset, each copy has version of its origin plus one
+
+uint64_t
+ruleset_version (ruleset_t *self)
+{
+    assert (self);
+    return self->version;
+}
+
+//  --------------------------------------------------------------------------
+//  Self test of this class
+
+static rule_t *
+s_test_rule (const char *name, const char *description)
+{
+    rule_t *rule = rule_new ();
+    char *json = zsys_sprintf ("{\"name\":\"%s\",\"description\":\"%s\"}", name, description);
+    assert (rule_parse (rule, json) == 0);
+    zstr_free (&json);
+    return rule;
+}
+
+void
+ruleset_test (bool verbose)
+{
+    printf (" * ruleset: ");
+
+    //  @selftest
+    ruleset_t *self = ruleset_new ();
+    assert (self);
+    assert (ruleset_size (self) == 0);
+    assert (ruleset_version (self) == 0);
+    assert (ruleset_lookup (self, "a") == NULL);
+    ruleset_insert (self, s_test_rule ("c", "1"));
+    ruleset_insert (self, s_test_rule ("a", "1"));
+    ruleset_insert (self, s_test_rule ("b", "1"));
+    assert (ruleset_size (self) == 3);
+    assert (streq (rule_name (ruleset_at (self, 0)), "a"));
+    assert (streq (rule_name (ruleset_at (self, 2)), "c"));
+    assert (ruleset_at (self, 3) == NULL);
+
+    //  reader keeps old snapshot while new one is published
+    ruleset_t *reader = ruleset_ref (self);
+    rule_t *old_b = ruleset_lookup (self, "b");
+    ruleset_t *next = ruleset_dup (self);
+    assert (ruleset_version (next) == 1);
+    ruleset_insert (next, s_test_rule ("b", "2"));
+    assert (ruleset_remove (next, "a") == 0);
+    assert (ruleset_remove (next, "a") == -1);
+    ruleset_destroy (&self);
+    self = next;
+
+    assert (ruleset_size (reader) == 3);
+    assert (ruleset_lookup (reader, "b") == old_b);
+    assert (ruleset_lookup (reader, "a"));
+    assert (ruleset_size (self) == 2);
+    assert (ruleset_lookup (self, "a") == NULL);
+    assert (ruleset_lookup (self, "b") != old_b);
+    //  unchanged rule is shared
+    assert (ruleset_lookup (self, "c") == ruleset_lookup (reader, "c"));
+    ruleset_destroy (&reader);
+    assert (reader == NULL);
+    assert (ruleset_lookup (self, "c"));
+
+    //  many rules keep sorted order
+    next = ruleset_dup (self);
+    for (int i = 999; i >= 0; i--) {
+        char *name = zsys_sprintf ("r%04d", i);
+        ruleset_insert (next, s_test_rule (name, "x"));
+        zstr_free (&name);
+    }
+    ruleset_destroy (&self);
+    self = next;
+    assert (ruleset_size (self) == 1002);
+    for (size_t i = 1; i < ruleset_size (self); i++)
+        assert (strcmp (rule_name (ruleset_at (self, i - 1)), rule_name (ruleset_at (self, i))) < 0);
+    assert (ruleset_lookup (self, "r0500"));
+    ruleset_destroy (&self);
+    assert (self == NULL);
+    //  @end
+    printf ("OK\n");
+}
@@ -0,0 +1,90 @@
+/*  =========================================================================
+    ruleset - Immutable snapshot of all rules
+
+    Copyright (C) 2016 - 2017 Tomas Halman
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+#ifndef RULESET_H_INCLUDED
+#define RULESET_H_INCLUDED
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//  Opaque class structures to allow forward references
+#ifndef RULESET_T_DEFINED
+typedef struct _ruleset_t ruleset_t;
+#define RULESET_T_DEFINED
+#endif
+
+//  @interface
+//  Create a new empty ruleset
+FTY_ALERT_FLEXIBLE_PRIVATE ruleset_t *
+    ruleset_new (void);
+
+//  Create a modifiable copy of ruleset with next version. Rules are
+//  shared with the original.
+FTY_ALERT_FLEXIBLE_PRIVATE ruleset_t *
+    ruleset_dup (ruleset_t *self);
+
+//  Destroy the ruleset. Ruleset is freed when the last reference is dropped.
+FTY_ALERT_FLEXIBLE_PRIVATE void
+    ruleset_destroy (ruleset_t **self_p);
+
+//  Add reference to ruleset, returns the ruleset
+FTY_ALERT_FLEXIBLE_PRIVATE ruleset_t *
+    ruleset_ref (ruleset_t *self);
+
+//  Insert rule, ruleset takes over the caller's reference. Rule with the
+//  same name is replaced. Ruleset must not be published yet.
+FTY_ALERT_FLEXIBLE_PRIVATE void
+    ruleset_insert (ruleset_t *self, rule_t *rule);
+
+//  Remove rule. Returns 0 on success, -1 if there is no such rule.
+//  Ruleset must not be published yet.
+FTY_ALERT_FLEXIBLE_PRIVATE int
+    ruleset_remove (ruleset_t *self, const char *name);
+
+//  Find rule by name, NULL if there is no such rule
+FTY_ALERT_FLEXIBLE_PRIVATE rule_t *
+    ruleset_lookup (ruleset_t *self, const char *name);
+
+//  Number of rules
+FTY_ALERT_FLEXIBLE_PRIVATE size_t
+    ruleset_size (ruleset_t *self);
+
+//  Get rule at index (rules are sorted by name), NULL if index is out
+//  of range. Unlike zhash cursors, this does not modify the ruleset.
+FTY_ALERT_FLEXIBLE_PRIVATE rule_t *
+    ruleset_at (ruleset_t *self, size_t index);
+
+//  Version of ruleset, each copy has version of its origin plus one
+FTY_ALERT_FLEXIBLE_PRIVATE uint64_t
+    ruleset_version (ruleset_t *self);
+
+//  Self test of this class
+FTY_ALERT_FLEXIBLE_PRIVATE void
+    ruleset_test (bool verbose);
+
+//  @end
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
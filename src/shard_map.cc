@@ -0,0 +1,246 @@
+/*  =========================================================================
+    shard_map - Consistent share of assets owned by one agent instance
+
+    Copyright (C) 2016 - 2017 Tomas Halman
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+/*
+@header
+    shard_map - Consistent share of assets owned by one agent instance
+@discuss
+    On big sites several agent instances can run side by side, each one
+    evaluating rules for its share of assets. Asset names are hashed with
+    FNV-1a and mapped to shards by jump consistent hash, so every instance
+    computes the same owner without talking to others, and changing number
+    of shards from N to N+1 moves only 1/(N+1) of assets.
+    Shard 0 uses the configured mailbox name, shard i uses "<name>-<i>".
+@end
+*/
+
+#include "fty_alert_flexible_classes.h"
+
+//  Structure of our class
+
+struct _shard_map_t {
+    size_t index;               //  shard of this instance
+    size_t count;               //  number of shards
+    char **peers;               //  mailbox names of all shards
+};
+
+//  --------------------------------------------------------------------------
+//  Jump consistent hash, maps key to bucket in [0, buckets)
+
+static size_t
+s_jump_hash (uint64_t key, size_t buckets)
+{
+    int64_t b = -1, j = 0;
+    while (j < (int64_t) buckets) {
+        b = j;
+        key = key * 2862933555777941757ULL + 1;
+        j = (int64_t) ((b + 1) * ((double) (1LL << 31) / (double) ((key >> 33) + 1)));
+    }
+    return (size_t) b;
+}
+
+//  --------------------------------------------------------------------------
+//  Create a new shard_map for instance index of count instances, name is
+//  mailbox name of shard 0. Returns NULL if index is not valid.
+
+shard_map_t *
+shard_map_new (const char *name, size_t index, size_t count)
+{
+    assert (name);
+    if (count == 0 || index >= count)
+        return NULL;
+
+    shard_map_t *self = (shard_map_t *) zmalloc (sizeof (shard_map_t));
+    assert (self);
+    //  Initialize class properties here
+    self->index = index;
+    self->count = count;
+    self->peers = (char **) zmalloc (count * sizeof (char *));
+    assert (self->peers);
+    self->peers [0] = strdup (name);
+    for (size_t i = 1; i < count; i++)
+        self->peers [i] = zsys_sprintf ("%s-%zu", name, i);
+    return self;
+}
+
+//  --------------------------------------------------------------------------
+//  Destroy the shard_map
+
+void
+shard_map_destroy (shard_map_t **self_p)
+{
+    assert (self_p);
+    if (*self_p) {
+        shard_map_t *self = *self_p;
+        //  Free class properties here
+        for (size_t i = 0; i < self->count; i++)
+            zstr_free (&self->peers [i]);
+        free (self->peers);
+        //  Free object itself
+        free (self);
+        *self_p = NULL;
+    }
+}
+
+//  --------------------------------------------------------------------------
+//  Return shard owning asset
+
+size_t
+shard_map_owner (shard_map_t *self, const char *asset)
+{
+    assert (self);
+    assert (asset);
+    uint64_t hash = 14695981039346656037ULL;
+    for (const char *p = asset; *p; p++) {
+        hash ^= (unsigned char) *p;
+        hash *= 1099511628211ULL;
+    }
+    return s_jump_hash (hash, self->count);
+}
+
+//  --------------------------------------------------------------------------
+//  Is asset owned by this instance?
+
+bool
+shard_map_owns (shard_map_t *self, const char *asset)
+{
+    assert (self);
+    return self->count == 1 || shard_map_owner (self, asset) == self->index;
+}
+
+//  --------------------------------------------------------------------------
+//  Get shard of this instance
+
+size_t
+shard_map_index (shard_map_t *self)
+{
+    assert (self);
+    return self->index;
+}
+
+//  --------------------------------------------------------------------------
+//  Get number of shards
+
+size_t
+shard_map_count (shard_map_t *self)
+{
+    assert (self);
+    return self->count;
+}
+
+//  --------------------------------------------------------------------------
+//  Get mailbox name of shard
+
+const char *
+shard_map_peer (shard_map_t *self, size_t index)
+{
+    assert (self);
+    assert (index < self->count);
+    return self->peers [index];
+}
+
+//  --------------------------------------------------------------------------
+//  Is name mailbox of other shard?
+
+bool
+shard_map_is_peer (shard_map_t *self, const char *name)
+{
+    assert (self);
+    if (!name)
+        return false;
+    for (size_t i = 0; i < self->count; i++) {
+        if (i != self->index && streq (self->peers [i], name))
+            return true;
+    }
+    return false;
+}
+
+//  --------------------------------------------------------------------------
+//  Self test of this class
+
+void
+shard_map_test (bool verbose)
+{
+    printf (" * shard_map: ");
+
+    //  @selftest
+    assert (shard_map_new ("agent", 2, 2) == NULL);
+    assert (shard_map_new ("agent", 0, 0) == NULL);
+
+    shard_map_t *self = shard_map_new ("agent", 1, 3);
+    assert (self);
+    assert (shard_map_index (self) == 1);
+    assert (shard_map_count (self) == 3);
+    assert (streq (shard_map_peer (self, 0), "agent"));
+    assert (streq (shard_map_peer (self, 2), "agent-2"));
+    assert (shard_map_is_peer (self, "agent"));
+    assert (shard_map_is_peer (self, "agent-2"));
+    assert (!shard_map_is_peer (self, "agent-1"));
+    assert (!shard_map_is_peer (self, "fty-autoconfig"));
+    assert (!shard_map_is_peer (self, NULL));
+
+    //  every asset has exactly one owner, shares are balanced
+    shard_map_t *shards [3];
+    for (size_t i = 0; i < 3; i++)
+        shards [i] = shard_map_new ("agent", i, 3);
+    shard_map_t *grown = shard_map_new ("agent", 0, 4);
+    const size_t assets = 30000;
+    size_t share [3] = { 0, 0, 0 };
+    size_t moved = 0;
+    for (size_t i = 0; i < assets; i++) {
+        char *name = zsys_sprintf ("ups-%zu", i);
+        size_t owner = shard_map_owner (self, name);
+        assert (owner < 3);
+        share [owner]++;
+        size_t owners = 0;
+        for (size_t j = 0; j < 3; j++)
+            if (shard_map_owns (shards [j], name))
+                owners++;
+        assert (owners == 1);
+        //  new shard takes assets only from others
+        size_t now = shard_map_owner (grown, name);
+        if (now != owner) {
+            assert (now == 3);
+            moved++;
+        }
+        zstr_free (&name);
+    }
+    for (size_t j = 0; j < 3; j++)
+        assert (share [j] > assets / 3 * 9 / 10 && share [j] < assets / 3 * 11 / 10);
+    assert (moved > assets / 4 * 9 / 10 && moved < assets / 4 * 11 / 10);
+    if (verbose)
+        log_info ("shares %zu/%zu/%zu, %zu of %zu assets moved to 4th shard",
+            share [0], share [1], share [2], moved, assets);
+
+    //  single instance owns everything
+    shard_map_t *single = shard_map_new ("agent", 0, 1);
+    assert (shard_map_owns (single, "ups-1"));
+    assert (!shard_map_is_peer (single, "agent"));
+    shard_map_destroy (&single);
+
+    for (size_t i = 0; i < 3; i++)
+        shard_map_destroy (&shards [i]);
+    shard_map_destroy (&grown);
+    shard_map_destroy (&self);
+    assert (self == NULL);
+    //  @end
+    printf ("OK\n");
+}
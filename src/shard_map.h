@@ -0,0 +1,79 @@
+/*  =========================================================================
+    shard_map - Consistent share of assets owned by one agent instance
+
+    Copyright (C) 2016 - 2017 Tomas Halman
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+#ifndef SHARD_MAP_H_INCLUDED
+#define SHARD_MAP_H_INCLUDED
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//  Opaque class structures to allow forward references
+#ifndef SHARD_MAP_T_DEFINED
+typedef struct _shard_map_t shard_map_t;
+#define SHARD_MAP_T_DEFINED
+#endif
+
+//  @interface
+//  Create a new shard_map for instance index of count instances, name is
+//  mailbox name of shard 0. Returns NULL if index is not valid.
+FTY_ALERT_FLEXIBLE_PRIVATE shard_map_t *
+    shard_map_new (const char *name, size_t index, size_t count);
+
+//  Destroy the shard_map
+FTY_ALERT_FLEXIBLE_PRIVATE void
+    shard_map_destroy (shard_map_t **self_p);
+
+//  Return shard owning asset
+FTY_ALERT_FLEXIBLE_PRIVATE size_t
+    shard_map_owner (shard_map_t *self, const char *asset);
+
+//  Is asset owned by this instance?
+FTY_ALERT_FLEXIBLE_PRIVATE bool
+    shard_map_owns (shard_map_t *self, const char *asset);
+
+//  Get shard of this instance
+FTY_ALERT_FLEXIBLE_PRIVATE size_t
+    shard_map_index (shard_map_t *self);
+
+//  Get number of shards
+FTY_ALERT_FLEXIBLE_PRIVATE size_t
+    shard_map_count (shard_map_t *self);
+
+//  Get mailbox name of shard
+FTY_ALERT_FLEXIBLE_PRIVATE const char *
+    shard_map_peer (shard_map_t *self, size_t index);
+
+//  Is name mailbox of other shard?
+FTY_ALERT_FLEXIBLE_PRIVATE bool
+    shard_map_is_peer (shard_map_t *self, const char *name);
+
+//  Self test of this class
+FTY_ALERT_FLEXIBLE_PRIVATE void
+    shard_map_test (bool verbose);
+
+//  @end
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
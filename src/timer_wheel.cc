@@ -0,0 +1,279 @@
+/*  =========================================================================
+    timer_wheel - Deferred evaluations of rules driven by actor loop
+
+    Copyright (C) 2016 - 2017 Tomas Halman
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+/*
+@header
+    timer_wheel - Deferred evaluations of rules driven by actor loop
+@discuss
+    Hashed timing wheel: every key is kept in the slot of the tick it is
+    due in, so scheduling is constant time and each expiration visits only
+    the slots of elapsed ticks. Keys due more ticks than there are slots
+    ahead stay in their slot for more rounds. A key is scheduled at most
+    once; the owner decides what expiration means, e.g. one trailing
+    evaluation of rule on the latest metric values.
+@end
+*/
+
+#include "fty_alert_flexible_classes.h"
+
+//  Structure of our class
+
+struct _timer_wheel_t {
+    zlist_t **slots;            //  wheel_timer_t of keys due in each slot
+    size_t slot_count;
+    int tick;                   //  length of one slot [ms]
+    int64_t current;            //  first tick not expired yet
+    zhash_t *timers;            //  key -> wheel_timer_t
+};
+
+typedef struct {
+    int64_t due;
+    char *key;
+    size_t slot;
+} wheel_timer_t;
+
+//  --------------------------------------------------------------------------
+//  Create a new timer_wheel with slots of tick milliseconds. Time now is the
+//  start of the first slot.
+
+timer_wheel_t *
+timer_wheel_new (int tick, size_t slots, int64_t now)
+{
+    assert (tick > 0 && slots > 0);
+    timer_wheel_t *self = (timer_wheel_t *) zmalloc (sizeof (timer_wheel_t));
+    assert (self);
+    //  Initialize class properties here
+    self->slots = (zlist_t **) zmalloc (slots * sizeof (zlist_t *));
+    assert (self->slots);
+    for (size_t i = 0; i < slots; i++)
+        self->slots [i] = zlist_new ();
+    self->slot_count = slots;
+    self->tick = tick;
+    self->current = now / tick;
+    self->timers = zhash_new ();
+    return self;
+}
+
+//  --------------------------------------------------------------------------
+//  Destroy the timer_wheel
+
+void
+timer_wheel_destroy (timer_wheel_t **self_p)
+{
+    assert (self_p);
+    if (*self_p) {
+        timer_wheel_t *self = *self_p;
+        //  Free class properties here
+        for (size_t i = 0; i < self->slot_count; i++) {
+            wheel_timer_t *timer = (wheel_timer_t *) zlist_pop (self->slots [i]);
+            while (timer) {
+                zstr_free (&timer->key);
+                free (timer);
+                timer = (wheel_timer_t *) zlist_pop (self->slots [i]);
+            }
+            zlist_destroy (&self->slots [i]);
+        }
+        free (self->slots);
+        zhash_destroy (&self->timers);
+        //  Free object itself
+        free (self);
+        *self_p = NULL;
+    }
+}
+
+//  --------------------------------------------------------------------------
+//  Schedule key to expire at time due. Returns false if the key is already
+//  scheduled, the earlier time is kept.
+
+bool
+timer_wheel_add (timer_wheel_t *self, const char *key, int64_t due)
+{
+    assert (self);
+    assert (key);
+
+    if (zhash_lookup (self->timers, key))
+        return false;
+    wheel_timer_t *timer = (wheel_timer_t *) zmalloc (sizeof (wheel_timer_t));
+    assert (timer);
+    timer->due = due;
+    timer->key = strdup (key);
+    int64_t tick = due / self->tick;
+    if (tick < self->current)
+        tick = self->current;
+    timer->slot = tick % self->slot_count;
+    zlist_append (self->slots [timer->slot], timer);
+    zhash_insert (self->timers, key, timer);
+    return true;
+}
+
+//  --------------------------------------------------------------------------
+//  Cancel scheduled key. Returns false if the key is not scheduled.
+
+bool
+timer_wheel_remove (timer_wheel_t *self, const char *key)
+{
+    assert (self);
+    assert (key);
+
+    wheel_timer_t *timer = (wheel_timer_t *) zhash_lookup (self->timers, key);
+    if (!timer)
+        return false;
+    zlist_remove (self->slots [timer->slot], timer);
+    zhash_delete (self->timers, key);
+    zstr_free (&timer->key);
+    free (timer);
+    return true;
+}
+
+//  --------------------------------------------------------------------------
+//  Return list of keys expired till now, slot by slot, or NULL if no key
+//  expired. Caller is responsible for destroying the return value.
+
+zlist_t *
+timer_wheel_expire (timer_wheel_t *self, int64_t now)
+{
+    assert (self);
+
+    int64_t last = now / self->tick;
+    if (last < self->current)
+        return NULL;
+    zlist_t *expired = NULL;
+    //  after long sleep every slot is visited once
+    int64_t first = last - self->current >= (int64_t) self->slot_count ?
+        last - (int64_t) self->slot_count + 1 : self->current;
+    for (int64_t tick = first; tick <= last && zhash_size (self->timers); tick++) {
+        zlist_t *slot = self->slots [tick % self->slot_count];
+        size_t size = zlist_size (slot);
+        for (size_t i = 0; i < size; i++) {
+            wheel_timer_t *timer = (wheel_timer_t *) zlist_pop (slot);
+            if (timer->due > now) {
+                //  later round or later in current tick
+                zlist_append (slot, timer);
+                continue;
+            }
+            if (!expired) {
+                expired = zlist_new ();
+                zlist_autofree (expired);
+            }
+            zlist_append (expired, timer->key);
+            zhash_delete (self->timers, timer->key);
+            zstr_free (&timer->key);
+            free (timer);
+        }
+    }
+    //  current tick is not over, its slot is visited again
+    self->current = last;
+    return expired;
+}
+
+//  --------------------------------------------------------------------------
+//  Milliseconds till next tick with scheduled keys, -1 if nothing is
+//  scheduled
+
+int
+timer_wheel_timeout (timer_wheel_t *self, int64_t now)
+{
+    assert (self);
+    if (zhash_size (self->timers) == 0)
+        return -1;
+    //  keys due in current tick were checked on its start
+    return (int) ((now / self->tick + 1) * self->tick - now);
+}
+
+//  --------------------------------------------------------------------------
+//  Number of scheduled keys
+
+size_t
+timer_wheel_size (timer_wheel_t *self)
+{
+    assert (self);
+    return zhash_size (self->timers);
+}
+
+//  --------------------------------------------------------------------------
+//  Self test of this class
+
+void
+timer_wheel_test (bool verbose)
+{
+    printf (" * timer_wheel: ");
+
+    //  @selftest
+    timer_wheel_t *self = timer_wheel_new (100, 8, 1000);
+    assert (self);
+    assert (timer_wheel_timeout (self, 1000) == -1);
+    assert (timer_wheel_expire (self, 1000) == NULL);
+
+    //  key is scheduled once, the earlier time is kept
+    assert (timer_wheel_add (self, "load@ups-1", 1250));
+    assert (!timer_wheel_add (self, "load@ups-1", 1100));
+    assert (timer_wheel_add (self, "load@ups-2", 1210));
+    assert (timer_wheel_size (self) == 2);
+    assert (timer_wheel_timeout (self, 1000) == 100);
+    assert (timer_wheel_timeout (self, 1150) == 50);
+
+    assert (timer_wheel_expire (self, 1200) == NULL);
+    zlist_t *expired = timer_wheel_expire (self, 1220);
+    assert (expired && zlist_size (expired) == 1);
+    assert (streq ((char *) zlist_first (expired), "load@ups-2"));
+    zlist_destroy (&expired);
+    expired = timer_wheel_expire (self, 1260);
+    assert (expired && zlist_size (expired) == 1);
+    assert (streq ((char *) zlist_first (expired), "load@ups-1"));
+    zlist_destroy (&expired);
+    assert (timer_wheel_size (self) == 0);
+    assert (timer_wheel_timeout (self, 1260) == -1);
+
+    //  removed key doesn't expire
+    assert (timer_wheel_add (self, "load@ups-3", 1280));
+    assert (timer_wheel_remove (self, "load@ups-3"));
+    assert (!timer_wheel_remove (self, "load@ups-3"));
+    assert (timer_wheel_size (self) == 0);
+    assert (timer_wheel_expire (self, 1290) == NULL);
+
+    //  expired key can be scheduled again, past time expires on next call
+    assert (timer_wheel_add (self, "load@ups-1", 900));
+    expired = timer_wheel_expire (self, 1270);
+    assert (expired && zlist_size (expired) == 1);
+    zlist_destroy (&expired);
+
+    //  keys more rounds ahead wait for their round
+    assert (timer_wheel_add (self, "far", 1300 + 8 * 100 * 2));
+    assert (timer_wheel_add (self, "near", 1300));
+    expired = timer_wheel_expire (self, 1350);
+    assert (expired && zlist_size (expired) == 1);
+    assert (streq ((char *) zlist_first (expired), "near"));
+    zlist_destroy (&expired);
+    for (int64_t now = 1400; now < 2900; now += 100)
+        assert (timer_wheel_expire (self, now) == NULL);
+    //  long sleep
+    expired = timer_wheel_expire (self, 10000);
+    assert (expired && zlist_size (expired) == 1);
+    assert (streq ((char *) zlist_first (expired), "far"));
+    zlist_destroy (&expired);
+
+    //  scheduled keys are freed with the wheel
+    timer_wheel_add (self, "left", 20000);
+    timer_wheel_destroy (&self);
+    assert (self == NULL);
+    //  @end
+    printf ("OK\n");
+}
@@ -0,0 +1,78 @@
+/*  =========================================================================
+    timer_wheel - Deferred evaluations of rules driven by actor loop
+
+    Copyright (C) 2016 - 2017 Tomas Halman
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+#ifndef TIMER_WHEEL_H_INCLUDED
+#define TIMER_WHEEL_H_INCLUDED
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//  Opaque class structures to allow forward references
+#ifndef TIMER_WHEEL_T_DEFINED
+typedef struct _timer_wheel_t timer_wheel_t;
+#define TIMER_WHEEL_T_DEFINED
+#endif
+
+//  @interface
+//  Create a new timer_wheel with slots of tick milliseconds. Time now is the
+//  start of the first slot.
+FTY_ALERT_FLEXIBLE_PRIVATE timer_wheel_t *
+    timer_wheel_new (int tick, size_t slots, int64_t now);
+
+//  Destroy the timer_wheel
+FTY_ALERT_FLEXIBLE_PRIVATE void
+    timer_wheel_destroy (timer_wheel_t **self_p);
+
+//  Schedule key to expire at time due. Returns false if the key is already
+//  scheduled, the earlier time is kept.
+FTY_ALERT_FLEXIBLE_PRIVATE bool
+    timer_wheel_add (timer_wheel_t *self, const char *key, int64_t due);
+
+//  Cancel scheduled key. Returns false if the key is not scheduled.
+FTY_ALERT_FLEXIBLE_PRIVATE bool
+    timer_wheel_remove (timer_wheel_t *self, const char *key);
+
+//  Return list of keys expired till now, in order of expiration, or NULL if
+//  no key expired. Caller is responsible for destroying the return value.
+FTY_ALERT_FLEXIBLE_PRIVATE zlist_t *
+    timer_wheel_expire (timer_wheel_t *self, int64_t now);
+
+//  Milliseconds till next tick with scheduled keys, -1 if nothing is
+//  scheduled
+FTY_ALERT_FLEXIBLE_PRIVATE int
+    timer_wheel_timeout (timer_wheel_t *self, int64_t now);
+
+//  Number of scheduled keys
+FTY_ALERT_FLEXIBLE_PRIVATE size_t
+    timer_wheel_size (timer_wheel_t *self);
+
+//  Self test of this class
+FTY_ALERT_FLEXIBLE_PRIVATE void
+    timer_wheel_test (bool verbose);
+
+//  @end
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif